@@ -0,0 +1,70 @@
+//
+//  async_log_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of how long logging blocks the caller, ex: a power-management callback:
+//  printf() into the stdout, against ASYNC_LOG
+//
+//  INFO: Build it with the Makefile in this folder: make async_log_bench
+//
+
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "types.h"
+#include "time_stamp.h"
+#include "async_log.h"
+
+
+
+
+int main()
+{
+    const int nCnt = 1000;
+    const char* pstrEvent = "SystemHasPoweredOn";
+
+    auto tmStart = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        char buff[TIME_STAMP_BUFF_SIZE];
+        TimeStamp::formatNow(buff, SIZEOF(buff));
+
+        printf("%s > Received notification: %s #%d\n", buff, pstrEvent, i);
+    }
+
+    auto tmPrintf = std::chrono::steady_clock::now();
+
+    //INFO: Fewer records than the size of the ring, so that none are dropped
+    for(int i = 0; i < nCnt; i++)
+    {
+        ASYNC_LOG("Received notification: %s #%d\n", pstrEvent, i);
+    }
+
+    auto tmAsync = std::chrono::steady_clock::now();
+
+    AsyncLogger::get().flush();
+
+    auto fnNs = [nCnt](std::chrono::steady_clock::duration dur)
+    {
+        return std::chrono::duration<double, std::nano>(dur).count() / nCnt;
+    };
+
+    ASYNC_LOG("Log call (ns per call): printf=%.1f, ASYNC_LOG=%.1f, dropped=%zu\n",
+              fnNs(tmPrintf - tmStart),
+              fnNs(tmAsync - tmPrintf),
+              AsyncLogger::get().getDroppedCount());
+
+    AsyncLogger::get().flush();
+
+    return 0;
+}
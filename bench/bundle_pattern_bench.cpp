@@ -0,0 +1,117 @@
+//
+//  bundle_pattern_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of matching bundle IDs with a compiled BundlePattern, against creating a CFString
+//  for each of them and comparing it with CFStringCompareWithOptions()
+//
+//  INFO: Build it with the Makefile in this folder: make bundle_pattern_bench
+//
+
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "bundle_pattern.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+
+
+
+
+int main()
+{
+    const int nCntIDs = 5000;
+    const int nCntPasses = 100;
+
+    //Half of them match "com.ourco.agent.*"
+    std::vector<std::string> arrIDs;
+    arrIDs.reserve(nCntIDs);
+
+    for(int i = 0; i < nCntIDs; i++)
+    {
+        char buff[64];
+        snprintf(buff, sizeof(buff), (i & 1) ? "com.OurCo.Agent.task%04d" : "com.other.app%04d", i);
+        arrIDs.push_back(buff);
+    }
+
+    const char* pstrPrefix = "com.ourco.agent.";
+
+    size_t szcMatchedCF = 0;
+    size_t szcMatchedPattern = 0;
+
+    auto tmStart = std::chrono::steady_clock::now();
+
+    //The old way: create a CFString for each entry and compare it
+    CFStringRef refPrefix = CFStringCreateWithCString(kCFAllocatorDefault, pstrPrefix, kCFStringEncodingUTF8);
+    if(refPrefix)
+    {
+        CFIndex nPrefixLen = CFStringGetLength(refPrefix);
+
+        for(int p = 0; p < nCntPasses; p++)
+        {
+            for(const std::string& strID : arrIDs)
+            {
+                CFStringRef refID = CFStringCreateWithCString(kCFAllocatorDefault, strID.c_str(), kCFStringEncodingUTF8);
+                if(refID)
+                {
+                    if(CFStringGetLength(refID) >= nPrefixLen &&
+                       CFStringCompareWithOptions(refID,
+                                                  refPrefix,
+                                                  CFRangeMake(0, nPrefixLen),
+                                                  kCFCompareCaseInsensitive) == kCFCompareEqualTo)
+                    {
+                        szcMatchedCF++;
+                    }
+
+                    CFRelease(refID);
+                }
+            }
+        }
+
+        CFRelease(refPrefix);
+    }
+
+    auto tmCF = std::chrono::steady_clock::now();
+
+    //Compiled pattern
+    for(int p = 0; p < nCntPasses; p++)
+    {
+        BundlePattern pattern("com.ourco.agent.*");
+
+        for(const std::string& strID : arrIDs)
+        {
+            if(pattern.isMatch(strID))
+            {
+                szcMatchedPattern++;
+            }
+        }
+    }
+
+    auto tmPattern = std::chrono::steady_clock::now();
+
+    auto fnNs = [](std::chrono::steady_clock::duration dur)
+    {
+        return std::chrono::duration<double, std::nano>(dur).count() / (nCntIDs * nCntPasses);
+    };
+
+    assert(szcMatchedCF == szcMatchedPattern);
+
+    printf("Bundle ID matching (ns per entry): CFStringCompare=%.1f, BundlePattern=%.1f (matched %zu)\n",
+           fnNs(tmCF - tmStart),
+           fnNs(tmPattern - tmCF),
+           szcMatchedPattern);
+
+    return szcMatchedCF == szcMatchedPattern ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+//
+//  cfstring_conv_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of conversions from CFString to UTF-8: GetString_From_CFStringRef() that makes a new
+//  std::string each time, against AssignString_From_CFStringRef() and GetStringView_From_CFStringRef()
+//
+//  INFO: Build it with the Makefile in this folder: make cfstring_conv_bench
+//
+
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <string>
+#include <string_view>
+#include <chrono>
+
+#include "types.h"
+#include "CFString_conv.h"
+
+
+
+
+int main()
+{
+    const int nCnt = 1000000;
+
+    //INFO: The first one may keep its chars in UTF-8, while the second one will be kept in UTF-16
+    CFStringRef arrRefs[] = {
+        CFStringCreateWithCString(kCFAllocatorDefault, "com.dennisbabkin.wake01", kCFStringEncodingUTF8),
+        CFStringCreateWithCString(kCFAllocatorDefault, "com.dennisbabkin.\xD0\xBF\xD1\x80\xD0\xBE\xD0\xB1\xD1\x83\xD0\xB6\xD0\xB4\xD0\xB5\xD0\xBD\xD0\xB8\xD0\xB5", kCFStringEncodingUTF8),
+    };
+
+    for(int r = 0; r < SIZEOF(arrRefs); r++)
+    {
+        CFStringRef ref = arrRefs[r];
+        if(!ref)
+        {
+            //Failed
+            assert(false);
+            continue;
+        }
+
+        size_t szcTotal = 0;
+        std::string str;
+
+        auto tmStart = std::chrono::steady_clock::now();
+
+        for(int i = 0; i < nCnt; i++)
+        {
+            GetString_From_CFStringRef(ref, str);
+            szcTotal += str.size();
+        }
+
+        auto tmOld = std::chrono::steady_clock::now();
+
+        for(int i = 0; i < nCnt; i++)
+        {
+            AssignString_From_CFStringRef(ref, str);
+            szcTotal += str.size();
+        }
+
+        auto tmAssign = std::chrono::steady_clock::now();
+
+        for(int i = 0; i < nCnt; i++)
+        {
+            char buff[256];
+            std::string_view sv;
+            GetStringView_From_CFStringRef(ref, buff, sizeof(buff), sv);
+            szcTotal += sv.size();
+        }
+
+        auto tmView = std::chrono::steady_clock::now();
+
+        auto fnNs = [nCnt](std::chrono::steady_clock::duration dur)
+        {
+            return std::chrono::duration<double, std::nano>(dur).count() / nCnt;
+        };
+
+        printf("CFString #%d (ns per call): GetString=%.1f, AssignString=%.1f, GetStringView=%.1f (%zu bytes)\n",
+               r,
+               fnNs(tmOld - tmStart),
+               fnNs(tmAssign - tmOld),
+               fnNs(tmView - tmAssign),
+               szcTotal);
+
+        CFRelease(ref);
+    }
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+//
+//  date_format_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of date/time formatting: a new CFDateFormatter for each call, against
+//  FormatDateTimeAsStr() with a cached one, and the ISO-8601 fast path
+//
+//  INFO: Build it with the Makefile in this folder: make date_format_bench
+//
+
+
+#include <stdio.h>
+
+#include <string>
+#include <chrono>
+
+#include "types.h"
+#include "CFString_conv.h"
+
+
+
+
+int main()
+{
+    const int nCnt = 100000;
+
+    CFAbsoluteTime dtmNow = CFAbsoluteTimeGetCurrent();
+    size_t szcTotal = 0;
+    std::string str;
+
+    auto tmStart = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        //The old way: create a formatter for each call
+        CFDateFormatterRef refDtFmtr = CFDateFormatterCreate(kCFAllocatorDefault, nullptr, kCFDateFormatterShortStyle, kCFDateFormatterLongStyle);
+        if(refDtFmtr)
+        {
+            CFStringRef refStr = CFDateFormatterCreateStringWithAbsoluteTime(kCFAllocatorDefault, refDtFmtr, dtmNow + i);
+            if(refStr)
+            {
+                GetString_From_CFStringRef(refStr, str);
+                szcTotal += str.size();
+
+                CFRelease(refStr);
+            }
+
+            CFRelease(refDtFmtr);
+        }
+    }
+
+    auto tmCreate = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        FormatDateTimeAsStr(dtmNow + i, &str);
+        szcTotal += str.size();
+    }
+
+    auto tmCached = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        FormatDateTimeAsIso8601(dtmNow + i, &str);
+        szcTotal += str.size();
+    }
+
+    auto tmIso = std::chrono::steady_clock::now();
+
+    auto fnNs = [nCnt](std::chrono::steady_clock::duration dur)
+    {
+        return std::chrono::duration<double, std::nano>(dur).count() / nCnt;
+    };
+
+    printf("Date formatting (ns per call): new formatter=%.1f, cached formatter=%.1f, ISO-8601=%.1f (%zu bytes)\n",
+           fnNs(tmCreate - tmStart),
+           fnNs(tmCached - tmCreate),
+           fnNs(tmIso - tmCached),
+           szcTotal);
+
+    printf("Now: %s\n", FormatDateTimeAsIso8601(dtmNow, &str) ? str.c_str() : "?");
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+//
+//  iso8601_batch_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of bulk formatting of time stamps, ex: for an export of the journal of power events:
+//  Iso8601::formatLocal() for each one, against Iso8601::formatBatch() for all of them
+//
+//  INFO: Build it with the Makefile in this folder: make iso8601_batch_bench
+//
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <vector>
+#include <chrono>
+
+#include "types.h"
+#include "CFString_conv.h"
+
+
+
+
+int main()
+{
+    const int nCnt = 1000000;
+
+    //Sorted times, about 0.25 sec apart
+    std::vector<int64_t> arrTimesUs(nCnt);
+
+    int64_t nTimeUs = (int64_t)time(nullptr) * 1000000;
+    for(int i = 0; i < nCnt; i++)
+    {
+        nTimeUs += 250000 + ((int64_t)i * 7919) % 1000;
+        arrTimesUs[i] = nTimeUs;
+    }
+
+    LocalTimeConv* pConv = DateFormatterCache::getLocalTimeConv();
+
+    std::vector<char> arrOut(nCnt * Iso8601::getBatchWidth(6, false));
+    size_t szcTotal = 0;
+
+    auto tmStart = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        szcTotal += Iso8601::formatLocal(*pConv,
+                                         arrTimesUs[i] / 1000000,
+                                         arrTimesUs[i] % 1000000,
+                                         6,
+                                         arrOut.data() + i * Iso8601::getBatchWidth(6, false),
+                                         ISO8601_BUFF_SIZE);
+    }
+
+    auto tmSingle = std::chrono::steady_clock::now();
+
+    szcTotal += Iso8601::formatBatch(pConv, arrTimesUs.data(), nCnt, 6, '\n', arrOut.data(), arrOut.size());
+
+    auto tmBatch = std::chrono::steady_clock::now();
+
+    auto fnNs = [nCnt](std::chrono::steady_clock::duration dur)
+    {
+        return std::chrono::duration<double, std::nano>(dur).count() / nCnt;
+    };
+
+    printf("ISO-8601 (ns per time stamp): formatLocal=%.1f, formatBatch=%.1f (%zu chars)\n",
+           fnNs(tmSingle - tmStart),
+           fnNs(tmBatch - tmSingle),
+           szcTotal);
+
+    printf("Last: %.*s",
+           (int)Iso8601::getBatchWidth(6, false),
+           arrOut.data() + arrOut.size() - Iso8601::getBatchWidth(6, false));
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+//
+//  local_time_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of the conversion of local date & time to CFAbsoluteTime without mktime(),
+//  one at a time and all at once, against mktime()
+//
+//  INFO: Build it with the Makefile in this folder: make local_time_bench
+//
+
+
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+
+#include <vector>
+#include <chrono>
+
+#include "types.h"
+#include "wake_timer.h"
+
+
+
+
+int main()
+{
+    //Every 15 minutes for the next 3 years - that includes several DST changes
+    std::vector<CIVIL_TIME> arrDates;
+
+    time_t tNow = time(nullptr);
+    struct tm tmNow = {};
+    localtime_r(&tNow, &tmNow);
+
+    for(int nDay = 0; nDay < 3 * 365; nDay++)
+    {
+        for(int nMin = 0; nMin < 24 * 60; nMin += 15)
+        {
+            arrDates.push_back({tmNow.tm_year + 1900, 1, nDay + 1, nMin / 60, nMin % 60, 0, 0});
+        }
+    }
+
+    size_t szCnt = arrDates.size();
+    std::vector<CFAbsoluteTime> arrMkTime(szCnt), arrSingle(szCnt), arrBatch(szCnt);
+
+    //With mktime()
+    auto tmStart = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < szCnt; i++)
+    {
+        const CIVIL_TIME& c = arrDates[i];
+
+        struct tm t = {};
+        t.tm_year = c.nYear - 1900;
+        t.tm_mon = c.nMonth - 1;
+        t.tm_mday = c.nDay;
+        t.tm_hour = c.nHour;
+        t.tm_min = c.nMinute;
+        t.tm_sec = c.nSecond;
+        t.tm_isdst = -1;
+
+        arrMkTime[i] = (CFAbsoluteTime)mktime(&t) - DIFF_UNIX_EPOCH_AND_MAC_TIME_SEC;
+    }
+
+    auto tmMkTime = std::chrono::steady_clock::now();
+
+    //One at a time
+    for(size_t i = 0; i < szCnt; i++)
+    {
+        const CIVIL_TIME& c = arrDates[i];
+
+        WakeTimer::Set_CFAbsoluteTime(&arrSingle[i], c.nYear, c.nMonth, c.nDay, c.nHour, c.nMinute, c.nSecond, c.nMillisecond);
+    }
+
+    auto tmSingle = std::chrono::steady_clock::now();
+
+    //All at once
+    WakeTimer::Set_CFAbsoluteTimes(arrDates.data(), szCnt, arrBatch.data());
+
+    auto tmBatch = std::chrono::steady_clock::now();
+
+    //Results must be the same
+    //INFO: Local times that happen twice can still differ, since mktime() picks one of them depending on its previous calls.
+    size_t szcDiff = 0;
+    for(size_t i = 0; i < szCnt; i++)
+    {
+        if(arrSingle[i] != arrMkTime[i] ||
+           arrBatch[i] != arrMkTime[i])
+        {
+            szcDiff++;
+        }
+    }
+
+    printf("Converted %zu dates: mktime=%.3f ms, single=%.3f ms, batch=%.3f ms, different=%zu\n",
+           szCnt,
+           std::chrono::duration<double, std::milli>(tmMkTime - tmStart).count(),
+           std::chrono::duration<double, std::milli>(tmSingle - tmMkTime).count(),
+           std::chrono::duration<double, std::milli>(tmBatch - tmSingle).count(),
+           szcDiff);
+
+    return 0;
+}
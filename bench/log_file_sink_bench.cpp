@@ -0,0 +1,83 @@
+//
+//  log_file_sink_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of how many log records per second AsyncLogSink_File can write into a file, with rotation
+//
+//  INFO: Build it with the Makefile in this folder: make log_file_sink_bench
+//
+
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <chrono>
+
+#include "types.h"
+#include "async_log.h"
+#include "log_file_sink.h"
+
+
+
+
+int main()
+{
+    const int nCnt = 1000000;
+    const char* pstrPath = "/tmp/com.dennisbabkin.log_bench.log";
+
+    AsyncLogSink_File sinkFile;
+    if(sinkFile.open(pstrPath, 16 * 1024 * 1024, 2))
+    {
+        AsyncLogger::get().setSink(&sinkFile);
+
+        auto tmStart = std::chrono::steady_clock::now();
+
+        for(int i = 0; i < nCnt; i++)
+        {
+            ASYNC_LOG("Received notification: %s #%d\n", "SystemHasPoweredOn", i);
+
+            //Don't let the ring of this thread overflow
+            if((i % 512) == 511)
+            {
+                AsyncLogger::get().flush();
+            }
+        }
+
+        AsyncLogger::get().flush(true);
+
+        auto tmEnd = std::chrono::steady_clock::now();
+
+        AsyncLogger::get().setSink(nullptr);
+        sinkFile.close();
+
+        ASYNC_LOG_FILE_STATS stats;
+        sinkFile.getStats(&stats);
+
+        double fSec = std::chrono::duration<double>(tmEnd - tmStart).count();
+
+        ASYNC_LOG("Log file: %.0f records/sec, lines=%zu, bytes=%zu, writev=%zu, rotations=%zu, dropped=%zu\n",
+                  nCnt / fSec,
+                  stats.szcLines,
+                  stats.szcBytes,
+                  stats.szcWrites,
+                  stats.szcRotations,
+                  stats.szcDroppedBytes + AsyncLogger::get().getDroppedCount());
+
+        AsyncLogger::get().flush();
+    }
+    else
+    {
+        //Failed
+        assert(false);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+//
+//  pwr_evt_record_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of encoding a power notification: as a line of text with snprintf(), against
+//  PwrEvtRecordEncoder as a JSON line and as a binary record
+//
+//  INFO: Build it with the Makefile in this folder: make pwr_evt_record_bench
+//
+
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "types.h"
+#include "time_stamp.h"
+#include "pwr_evt_record.h"
+#include "pwr_msg_handlers.h"
+
+
+
+
+int main()
+{
+    const int nCnt = 1000000;
+
+    PWR_EVT_RECORD rec;
+    rec.stamp();
+    rec.source = PES_SleepWake;
+    rec.nMsgType = kIOMessageSystemWillSleep;
+    rec.pstrMsgName = "SystemWillSleep";
+    rec.nStateBefore = PSS_Awake;
+    rec.nStateAfter = PSS_GoingToSleep;
+
+    char buff[PWR_EVT_JSON_MAX_LEN + 1];
+    size_t szcTotal = 0;
+
+    auto tmStart = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        char buffTime[TIME_STAMP_BUFF_SIZE];
+        TimeStamp::formatNow(buffTime, sizeof(buffTime));
+
+        szcTotal += snprintf(buff, sizeof(buff), "%s > Received notification: %s\n", buffTime, rec.pstrMsgName);
+    }
+
+    auto tmText = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        rec.nSeqNum++;
+        szcTotal += PwrEvtRecordEncoder::toJsonLine(rec, buff, sizeof(buff));
+    }
+
+    auto tmJson = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        rec.nSeqNum++;
+        szcTotal += PwrEvtRecordEncoder::toBinary(rec, buff, sizeof(buff));
+    }
+
+    auto tmBin = std::chrono::steady_clock::now();
+
+    auto fnNs = [nCnt](std::chrono::steady_clock::duration dur)
+    {
+        return std::chrono::duration<double, std::nano>(dur).count() / nCnt;
+    };
+
+    printf("Encode (ns per record): text=%.1f, JSON=%.1f, binary=%.1f (%zu bytes)\n",
+           fnNs(tmText - tmStart),
+           fnNs(tmJson - tmText),
+           fnNs(tmBin - tmJson),
+           szcTotal);
+
+    return 0;
+}
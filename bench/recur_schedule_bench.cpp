@@ -0,0 +1,102 @@
+//
+//  recur_schedule_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Recurring wake timers of WakeScheduler that share their wakes, followed by a benchmark
+//  of finding the next firing of a schedule in the cron format
+//
+//  INFO: It doesn't touch the OS wake events - they are kept in memory with PwrEvtSource_Memory.
+//        Build it with the Makefile in this folder: make recur_schedule_bench
+//
+
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "types.h"
+#include "wake_scheduler.h"
+#include "CFString_conv.h"
+
+
+
+
+int main()
+{
+    //Don't touch the OS - use events in memory
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+    WakeTimer wkTmr("com.dennisbabkin.wake-bench", &idx);
+    WakeScheduler wkSched(wkTmr);
+
+    //Wake up every weekday at 3:00 AM, and every day at 3:05 AM - both can share the same wake
+    static const char* kSchedules[] = { "0 3 * * 1-5", "5 3 * * *" };
+
+    for(int i = 0; i < SIZEOF(kSchedules); i++)
+    {
+        if(!wkSched.addTimerRecurring(kSchedules[i],
+                                      nullptr,
+                                      nullptr,
+                                      nullptr,
+                                      5 * 60 * 1000))
+        {
+            //Failed
+            assert(false);
+            return 1;
+        }
+    }
+
+    std::vector<CFAbsoluteTime> arrWakes;
+    size_t szcSaved = wkSched.getWakePlan(&arrWakes);
+
+    CFAbsoluteTime dtWhen = 0;
+    wkSched.getNextWakeTime(&dtWhen);
+
+    std::string strWhen;
+    FormatDateTimeAsIso8601(dtWhen, &strWhen);
+
+    printf("Recurring timers: %zu in %zu wakes (%zu saved), OS wake event is set for: %s\n",
+           wkSched.getTimerCount(),
+           arrWakes.size(),
+           szcSaved,
+           strWhen.c_str());
+
+    //Measure how long it takes to find the next firing
+    RecurSchedule sched("*/5 8-18 * * 1-5");
+    assert(sched.isValid());
+
+    const int nQueries = 2000000;
+    CFAbsoluteTime dtStart = CFAbsoluteTimeGetCurrent();
+    CFAbsoluteTime dtSum = 0;
+
+    auto tmStart = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nQueries; i++)
+    {
+        CFAbsoluteTime dtNext;
+        if(WakeTimer::Get_NextRecurringTime(sched, dtStart + i * 97.0, &dtNext))
+        {
+            dtSum += dtNext - dtStart;
+        }
+    }
+
+    double fMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tmStart).count();
+
+    printf("Next-fire queries: %d in %.3f ms (%.1f ns each), checksum=%.0f\n",
+           nQueries,
+           fMs,
+           fMs * 1000000.0 / nQueries,
+           dtSum);
+
+    return 0;
+}
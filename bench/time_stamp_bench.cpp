@@ -0,0 +1,106 @@
+//
+//  time_stamp_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of time stamps for log lines: snprintf() with localtime_r() for each call,
+//  against TimeStamp that caches the formatted date & time
+//
+//  INFO: Build it with the Makefile in this folder: make time_stamp_bench
+//
+
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <string>
+#include <chrono>
+
+#include "types.h"
+#include "time_stamp.h"
+
+
+
+
+int main()
+{
+    const int nCnt = 1000000;
+
+    //How it used to be done
+    auto fnLegacy = []()
+    {
+        timeval tv = {};
+        gettimeofday(&tv, nullptr);
+
+        tm dtm = {};
+        localtime_r(&tv.tv_sec, &dtm);
+
+        char buff[128];
+        snprintf(buff, SIZEOF(buff),
+                 "%04u-%02u-%02u %02u:%02u:%02u.%06u",
+                 1900 + dtm.tm_year,
+                 1 + dtm.tm_mon,
+                 dtm.tm_mday,
+                 dtm.tm_hour,
+                 dtm.tm_min,
+                 dtm.tm_sec,
+                 (unsigned int)tv.tv_usec);
+
+        return std::string(buff);
+    };
+
+    //Cached, but returned as std::string
+    auto fnString = []()
+    {
+        char buff[TIME_STAMP_BUFF_SIZE];
+        TimeStamp::formatNow(buff, SIZEOF(buff));
+
+        return std::string(buff);
+    };
+
+    size_t szcTotal = 0;
+
+    auto tmStart = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        szcTotal += fnLegacy().size();
+    }
+
+    auto tmLegacy = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        szcTotal += fnString().size();
+    }
+
+    auto tmString = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < nCnt; i++)
+    {
+        char buff[TIME_STAMP_BUFF_SIZE];
+        szcTotal += TimeStamp::formatNow(buff, SIZEOF(buff));
+    }
+
+    auto tmBuff = std::chrono::steady_clock::now();
+
+    auto fnNs = [nCnt](std::chrono::steady_clock::duration dur)
+    {
+        return std::chrono::duration<double, std::nano>(dur).count() / nCnt;
+    };
+
+    printf("Time stamp (ns per call): snprintf=%.1f, cached as std::string=%.1f, cached into buffer=%.1f (%zu)\n",
+           fnNs(tmLegacy - tmStart),
+           fnNs(tmString - tmLegacy),
+           fnNs(tmBuff - tmString),
+           szcTotal);
+
+    return 0;
+}
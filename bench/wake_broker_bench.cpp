@@ -0,0 +1,183 @@
+//
+//  wake_broker_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Load test of WakeBrokerServer with simulated clients: how long it takes them to connect and register
+//  their wake windows, how many OS calls that makes, and how long it takes to notify all of them
+//
+//  INFO: It doesn't touch the OS wake events - they are kept in memory with PwrEvtSource_Memory.
+//        Build it with the Makefile in this folder: make wake_broker_bench
+//
+
+
+#include <stdio.h>
+#include <assert.h>
+#include <poll.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "types.h"
+#include "wake_broker.h"
+
+
+
+
+int main()
+{
+    const size_t szcClients = 4000;
+    const size_t szcTimersPerClient = 2;
+    std::string strSockPath;
+    WakeBrokerServer::getDefaultSocketPath(strSockPath, "broker-test.sock");
+    const char* pstrSockPath = strSockPath.c_str();
+
+    //Each client needs a socket on both ends (plus some spare)
+    rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+       rl.rlim_cur < szcClients * 2 + 64)
+    {
+        rl.rlim_cur = std::min((rlim_t)(szcClients * 2 + 64), rl.rlim_max);
+        if(setrlimit(RLIMIT_NOFILE, &rl) != 0)
+        {
+            //Failed
+            assert(false);
+        }
+    }
+
+    //Don't touch the OS - use events in memory
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+    WakeTimer wkTmr("com.dennisbabkin.wakebroker-test", &idx);
+    WakeScheduler wkSched(wkTmr);
+
+    WakeBrokerServer broker(wkSched);
+    if(!broker.start(pstrSockPath))
+    {
+        //Failed
+        assert(false);
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<WakeBrokerClient>> arrClients(szcClients);
+
+    auto tmStart = std::chrono::steady_clock::now();
+
+    for(auto& pClient : arrClients)
+    {
+        pClient.reset(new WakeBrokerClient());
+        if(!pClient->connect(pstrSockPath))
+        {
+            //Failed
+            assert(false);
+        }
+    }
+
+    auto tmConnected = std::chrono::steady_clock::now();
+
+    //Each client asks to wake up within 2-4 seconds, with a 5 second leeway
+    CFAbsoluteTime dtNow = CFAbsoluteTimeGetCurrent();
+
+    for(size_t c = 0; c < szcClients; c++)
+    {
+        for(size_t t = 0; t < szcTimersPerClient; t++)
+        {
+            CFAbsoluteTime dtEarliest = dtNow + 2.0 + (double)((c * 7 + t * 13) % 2000) / 1000.0;
+
+            arrClients[c]->setWakeWindow(t + 1, dtEarliest, dtEarliest + 5.0);
+        }
+    }
+
+    //Wait until the broker took all requests
+    size_t szcTimers = 0;
+    while(broker.getStats(nullptr, nullptr, &szcTimers) != szcClients ||
+          szcTimers != szcClients * szcTimersPerClient)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto tmRegistered = std::chrono::steady_clock::now();
+
+    size_t szcOSCancel = 0;
+    size_t szcOSSchedule = 0;
+    src.getCallCounts(&szcOSSchedule, &szcOSCancel);
+
+    std::vector<CFAbsoluteTime> arrWakes;
+    wkSched.getWakePlan(&arrWakes);
+
+    //Simulate a wake when all of them are due
+    std::this_thread::sleep_for(std::chrono::milliseconds(4500));
+
+    auto tmFire = std::chrono::steady_clock::now();
+
+    wkSched.fireDueTimers();
+
+    //Collect notifications from all clients on this thread
+    size_t szcNotified = 0;
+
+    std::vector<pollfd> arrPoll(szcClients);
+    for(size_t c = 0; c < szcClients; c++)
+    {
+        arrPoll[c] = {arrClients[c]->getSocket(), POLLIN, 0};
+    }
+
+    while(szcNotified < szcClients * szcTimersPerClient)
+    {
+        if(poll(arrPoll.data(), (nfds_t)arrPoll.size(), 5000) <= 0)
+        {
+            //Timed out
+            assert(false);
+            break;
+        }
+
+        for(size_t c = 0; c < szcClients; c++)
+        {
+            if(arrPoll[c].revents)
+            {
+                int nCnt = arrClients[c]->dispatch(nullptr);
+                if(nCnt > 0)
+                    szcNotified += nCnt;
+            }
+        }
+    }
+
+    auto tmNotified = std::chrono::steady_clock::now();
+
+    auto fnMs = [](std::chrono::steady_clock::duration dur)
+    {
+        return std::chrono::duration<double, std::milli>(dur).count();
+    };
+
+    size_t szcDropped = 0;
+    broker.getStats(nullptr, nullptr, nullptr, &szcDropped);
+
+    printf("Broker load test: %zu clients, %zu timers\n"
+           "  connect: %.1f ms, register: %.1f ms, fan-out: %.1f ms (%zu notified, %zu dropped)\n"
+           "  OS calls: %zu schedule, %zu cancel; physical wakes planned: %zu\n",
+           szcClients,
+           szcClients * szcTimersPerClient,
+           fnMs(tmConnected - tmStart),
+           fnMs(tmRegistered - tmConnected),
+           fnMs(tmNotified - tmFire),
+           szcNotified,
+           szcDropped,
+           szcOSSchedule,
+           szcOSCancel,
+           arrWakes.size());
+
+    arrClients.clear();
+    broker.stop();
+
+    return 0;
+}
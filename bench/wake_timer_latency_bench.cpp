@@ -0,0 +1,74 @@
+//
+//  wake_timer_latency_bench.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Benchmark of how long readers of WakeTimer wait, while another thread keeps rescheduling it in the OS
+//
+//  INFO: Build it with the Makefile in this folder: make wake_timer_latency_bench
+//        Run it as root, otherwise the OS refuses to set wake events and the writer doesn't hold any locks.
+//
+
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "types.h"
+#include "wake_timer.h"
+
+
+
+
+int main()
+{
+    WakeTimer wkTmr("com.dennisbabkin.wake-bench");
+
+    std::atomic<bool> bStop(false);
+
+    //Writer keeps rescheduling the wake event
+    std::thread thrWriter([&bStop, &wkTmr]()
+    {
+        for(UInt32 i = 0; !bStop; i++)
+        {
+            wkTmr.setWakeEventRelative(600 * 1000 + (i % 1000) * 1000);
+        }
+    });
+
+    //Measure how long readers wait
+    const int nReads = 100000;
+    double fMaxUs = 0, fTotalUs = 0;
+
+    for(int i = 0; i < nReads; i++)
+    {
+        auto tmStart = std::chrono::steady_clock::now();
+
+        wkTmr.getWakeEventInfo();
+
+        double fUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tmStart).count();
+
+        fTotalUs += fUs;
+        if(fUs > fMaxUs)
+            fMaxUs = fUs;
+    }
+
+    bStop = true;
+    thrWriter.join();
+
+    wkTmr.stopWakeEvent();
+
+    printf("Reader latency while writing: avg=%.3f us, max=%.3f us\n",
+           fTotalUs / nReads,
+           fMaxUs);
+
+    return 0;
+}
@@ -17,8 +17,19 @@
 #ifndef CFString_conv_h
 #define CFString_conv_h
 
+#include <math.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
 #include <CoreFoundation/CoreFoundation.h>
 
+#include "utf16_to_utf8.h"
+#include "iso8601.h"
+
 
 
 
@@ -96,6 +107,345 @@ bool GetString_From_CFStringRef(CFStringRef ref, std::string& strOut)
 
 
 
+///Convert 'ref' into std::string by reusing its memory
+///INFO: Unlike GetString_From_CFStringRef() it converts directly into 'strOut', so if 'strOut' is reused
+///      for several conversions, it doesn't allocate memory after it grows large enough.
+///'strOut' = receives converted string, or an empty string if conversion fails
+///RETURN:
+///     = true if converted successfully
+bool AssignString_From_CFStringRef(CFStringRef ref, std::string& strOut)
+{
+    bool bRes = false;
+    
+    if(ref)
+    {
+        const char* pStr = CFStringGetCStringPtr(ref, kCFStringEncodingUTF8);
+        if(pStr)
+        {
+            //No conversion needed
+            strOut.assign(pStr);
+            
+            bRes = true;
+        }
+        else if(const UniChar* pChars = CFStringGetCharactersPtr(ref))
+        {
+            //It keeps its chars in UTF-16, so convert them directly
+            CFIndex nchLen = CFStringGetLength(ref);
+            
+            strOut.resize(Utf16ToUtf8::getMaxSize(nchLen));
+            
+            size_t szcOut = 0;
+            if(Utf16ToUtf8::convert(pChars,
+                                    nchLen,
+                                    strOut.data(),
+                                    strOut.size(),
+                                    &szcOut) == UCR_OK)
+            {
+                strOut.resize(szcOut);
+                
+                bRes = true;
+            }
+        }
+        else
+        {
+            CFIndex nchLen = CFStringGetLength(ref);     //This is the size in UTF-16 characters
+            CFIndex ncbMax = CFStringGetMaximumSizeForEncoding(nchLen,
+                                                               kCFStringEncodingUTF8);
+            if(ncbMax != kCFNotFound)
+            {
+                //Convert into the string itself, and then trim it to the size that was used
+                strOut.resize(ncbMax);
+                
+                CFIndex ncbUsed = 0;
+                if(CFStringGetBytes(ref,
+                                    CFRangeMake(0, nchLen),
+                                    kCFStringEncodingUTF8,
+                                    0,
+                                    false,
+                                    (UInt8*)strOut.data(),
+                                    ncbMax,
+                                    &ncbUsed) == nchLen)
+                {
+                    strOut.resize(ncbUsed);
+                    
+                    bRes = true;
+                }
+                else
+                    assert(false);
+            }
+            else
+                assert(false);
+        }
+    }
+    
+    if(!bRes)
+    {
+        //Clear resulting string on error
+        strOut.clear();
+    }
+    
+    return bRes;
+}
+
+
+
+
+///Convert 'ref' into UTF-8 without allocating any memory
+///INFO: If 'ref' already keeps its characters in UTF-8, 'svOut' points into the storage of 'ref' itself,
+///      thus it is valid only while 'ref' is alive. Otherwise 'ref' is converted into 'pBuff'.
+///'pBuff' = buffer to convert into (it is not null-terminated), or 0 to check the size that is needed
+///'szcBuff' = size of 'pBuff' in bytes
+///'svOut' = receives converted string, or an empty string if conversion fails
+///'pszcNeeded' = if not 0, receives the size of the string in UTF-8, in bytes - even if 'pBuff' was too small
+///RETURN:
+///     = true if converted successfully
+///     = false if error, or if 'pBuff' was too small (check 'pszcNeeded' for the size that is needed)
+bool GetStringView_From_CFStringRef(CFStringRef ref,
+                                    char* pBuff,
+                                    size_t szcBuff,
+                                    std::string_view& svOut,
+                                    size_t* pszcNeeded = nullptr)
+{
+    bool bRes = false;
+    size_t szcNeeded = 0;
+    
+    svOut = std::string_view();
+    
+    if(ref)
+    {
+        const char* pStr = CFStringGetCStringPtr(ref, kCFStringEncodingUTF8);
+        if(pStr)
+        {
+            //No conversion needed
+            svOut = std::string_view(pStr);
+            szcNeeded = svOut.size();
+            
+            bRes = true;
+        }
+        else
+        {
+            CFIndex nchLen = CFStringGetLength(ref);     //This is the size in UTF-16 characters
+            CFRange rng = CFRangeMake(0, nchLen);
+            CFIndex ncbUsed = 0;
+            
+            const UniChar* pChars = CFStringGetCharactersPtr(ref);
+            size_t szcOut = 0;
+            
+            if(pChars &&
+               pBuff &&
+               Utf16ToUtf8::convert(pChars,
+                                    nchLen,
+                                    pBuff,
+                                    szcBuff,
+                                    &szcOut) == UCR_OK)
+            {
+                //It kept its chars in UTF-16, so they were converted directly
+                svOut = std::string_view(pBuff, szcOut);
+                szcNeeded = szcOut;
+                
+                bRes = true;
+            }
+            //INFO: It converts only full characters that fit into 'pBuff'
+            else if(pBuff &&
+                    CFStringGetBytes(ref,
+                                     rng,
+                                     kCFStringEncodingUTF8,
+                                     0,
+                                     false,
+                                     (UInt8*)pBuff,
+                                     (CFIndex)szcBuff,
+                                     &ncbUsed) == nchLen)
+            {
+                svOut = std::string_view(pBuff, ncbUsed);
+                szcNeeded = ncbUsed;
+                
+                bRes = true;
+            }
+            else
+            {
+                //Buffer is too small - only get the size
+                ncbUsed = 0;
+                if(CFStringGetBytes(ref,
+                                    rng,
+                                    kCFStringEncodingUTF8,
+                                    0,
+                                    false,
+                                    nullptr,
+                                    0,
+                                    &ncbUsed) == nchLen)
+                {
+                    szcNeeded = ncbUsed;
+                }
+                else
+                    assert(false);
+            }
+        }
+    }
+    
+    if(pszcNeeded)
+        *pszcNeeded = szcNeeded;
+    
+    return bRes;
+}
+
+
+
+
+///Date formatters that are cached for each thread
+///INFO: Creating a date formatter loads locale data, so it's expensive to do it for each call. A formatter
+///      can't be shared between threads, thus each thread keeps its own for each combination of styles.
+///      Cached formatters are re-created after the locale or the time zone change.
+struct DateFormatterCache
+{
+    ///Get date formatter for the calling thread
+    ///'dateStyle' = style for the date part
+    ///'timeStyle' = style for the time part
+    ///RETURN:
+    ///     = Formatter that is owned by the cache (don't release it!) - it's valid only in the calling thread,
+    ///       until the next call to this function, or
+    ///     = 0 if error
+    static CFDateFormatterRef get(CFDateFormatterStyle dateStyle,
+                                  CFDateFormatterStyle timeStyle)
+    {
+        std::atomic<uint32_t>& nGeneration = _getGeneration();
+        THREAD_CACHE& cache = _getThreadCache();
+        
+        uint32_t nGen = nGeneration.load(std::memory_order_acquire);
+        if(cache.nGeneration != nGen)
+        {
+            //Locale or time zone have changed since we created them
+            cache.clear();
+            cache.nGeneration = nGen;
+        }
+        
+        for(const ENTRY& entry : cache.arrEntries)
+        {
+            if(entry.dateStyle == dateStyle &&
+               entry.timeStyle == timeStyle)
+            {
+                return entry.ref;
+            }
+        }
+        
+        CFDateFormatterRef ref = CFDateFormatterCreate(kCFAllocatorDefault, nullptr, dateStyle, timeStyle);
+        if(ref)
+        {
+            cache.arrEntries.push_back({dateStyle, timeStyle, ref});
+        }
+        else
+            assert(false);
+        
+        return ref;
+    }
+    
+    
+    ///Discard cached formatters in all threads
+    ///INFO: It's called automatically when the locale or the time zone change.
+    static void invalidate()
+    {
+        CFTimeZoneResetSystem();
+        _getLocalTimeConv()->invalidate();
+        
+        _getGeneration().fetch_add(1, std::memory_order_release);
+    }
+    
+    
+    ///RETURN:
+    ///     = Converter between UTC and local time, that is shared by this process (it's invalidated along with the formatters)
+    static LocalTimeConv* getLocalTimeConv()
+    {
+        _getGeneration();
+        
+        return _getLocalTimeConv();
+    }
+    
+    
+    
+private:
+    
+    struct ENTRY
+    {
+        CFDateFormatterStyle dateStyle;
+        CFDateFormatterStyle timeStyle;
+        CFDateFormatterRef ref;
+    };
+    
+    struct THREAD_CACHE
+    {
+        uint32_t nGeneration = 0;               //Value of _getGeneration() when 'arrEntries' were created
+        std::vector<ENTRY> arrEntries;          //Formatters for this thread
+        
+        ~THREAD_CACHE()
+        {
+            clear();
+        }
+        
+        void clear()
+        {
+            for(ENTRY& entry : arrEntries)
+            {
+                CFRelease(entry.ref);
+            }
+            
+            arrEntries.clear();
+        }
+    };
+    
+    static LocalTimeConv* _getLocalTimeConv()
+    {
+        static LocalTimeConv s_conv;
+        
+        return &s_conv;
+    }
+    
+    static THREAD_CACHE& _getThreadCache()
+    {
+        static thread_local THREAD_CACHE s_cache;
+        
+        return s_cache;
+    }
+    
+    
+    ///RETURN:
+    ///     = Counter that is incremented each time all cached formatters must be discarded
+    static std::atomic<uint32_t>& _getGeneration()
+    {
+        static std::atomic<uint32_t> s_nGeneration{0};
+        static std::once_flag s_once;
+        
+        std::call_once(s_once, []()
+        {
+            //Cached formatters are no longer valid if the locale or the time zone change
+            CFNotificationName arrNames[] = {
+                kCFLocaleCurrentLocaleDidChangeNotification,
+                kCFTimeZoneSystemTimeZoneDidChangeNotification,
+            };
+            
+            for(CFNotificationName strName : arrNames)
+            {
+                CFNotificationCenterAddObserver(CFNotificationCenterGetLocalCenter(),
+                                                &s_nGeneration,
+                                                [](CFNotificationCenterRef center,
+                                                   void* observer,
+                                                   CFNotificationName name,
+                                                   const void* object,
+                                                   CFDictionaryRef userInfo)
+                                                {
+                                                    DateFormatterCache::invalidate();
+                                                },
+                                                strName,
+                                                nullptr,
+                                                CFNotificationSuspensionBehaviorDeliverImmediately);
+            }
+        });
+        
+        return s_nGeneration;
+    }
+};
+
+
+
+
 ///Format 'dtm' as local date/time
 ///'pstrOut' = if not 0, receives formatted string, if success. Otherwise ""
 ///RETURN:
@@ -105,42 +455,32 @@ bool FormatDateTimeAsStr(CFAbsoluteTime dtm,
 {
     bool bRes = false;
     
-    CFDateRef refDate = CFDateCreate(kCFAllocatorDefault, dtm);
-    if(refDate)
+    //INFO: The formatter is cached, so we don't load locale data each time
+    CFDateFormatterRef refDtFmtr = DateFormatterCache::get(kCFDateFormatterShortStyle, kCFDateFormatterLongStyle);
+    if(refDtFmtr)
     {
-        CFDateFormatterRef refDtFmtr = CFDateFormatterCreate(kCFAllocatorDefault, nullptr, kCFDateFormatterShortStyle, kCFDateFormatterLongStyle);
-     
-        if(refDtFmtr)
+        CFStringRef refStr = CFDateFormatterCreateStringWithAbsoluteTime(kCFAllocatorDefault, refDtFmtr, dtm);
+        if(refStr)
         {
-            CFStringRef refStr = CFDateFormatterCreateStringWithDate(kCFAllocatorDefault, refDtFmtr, refDate);
-            if(refStr)
+            if(pstrOut)
             {
-                if(pstrOut)
+                //Convert to string
+                if(AssignString_From_CFStringRef(refStr,
+                                                 *pstrOut))
                 {
-                    //Convert to string
-                    if(GetString_From_CFStringRef(refStr,
-                                                  *pstrOut))
-                    {
-                        //Done
-                        bRes = true;
-                    }
-                }
-                else
-                {
-                    //Assume success
+                    //Done
                     bRes = true;
                 }
-                
-                CFRelease(refStr);
-                refStr = nullptr;
+            }
+            else
+            {
+                //Assume success
+                bRes = true;
             }
             
-            CFRelease(refDtFmtr);
-            refDtFmtr = nullptr;
+            CFRelease(refStr);
+            refStr = nullptr;
         }
-        
-        CFRelease(refDate);
-        refDate = nullptr;
     }
     
     if(!bRes &&
@@ -155,4 +495,48 @@ bool FormatDateTimeAsStr(CFAbsoluteTime dtm,
 
 
 
+///Format 'dtm' as ISO-8601, ex: "2023-06-17T03:20:30.123-07:00"
+///INFO: It doesn't create any CoreFoundation objects, so it's much faster than FormatDateTimeAsStr().
+///'dtm' = UTC date/time
+///'pstrOut' = if not 0, receives formatted string, if success. Otherwise ""
+///'bUtc' = true to format it in UTC (with the "Z" suffix), false - in the local time zone
+///'nFracDigits' = number of digits for the fraction of a second: 0, 3 or 6
+///RETURN:
+///     - true if success
+bool FormatDateTimeAsIso8601(CFAbsoluteTime dtm,
+                             std::string* pstrOut,
+                             bool bUtc = false,
+                             int nFracDigits = 3)
+{
+    //Split into seconds & microseconds since 1970
+    double fSec = floor(dtm + kCFAbsoluteTimeIntervalSince1970);
+    int64_t nUtc = (int64_t)fSec;
+    uint32_t nUsec = (uint32_t)((dtm + kCFAbsoluteTimeIntervalSince1970 - fSec) * 1000000.0);
+    
+    char buff[ISO8601_BUFF_SIZE];
+    size_t szcLen;
+    
+    if(bUtc)
+    {
+        szcLen = Iso8601::formatUtc(nUtc, nUsec, nFracDigits, buff, sizeof(buff));
+    }
+    else
+    {
+        szcLen = Iso8601::formatLocal(*DateFormatterCache::getLocalTimeConv(), nUtc, nUsec, nFracDigits, buff, sizeof(buff));
+    }
+    
+    if(pstrOut)
+    {
+        if(szcLen)
+            pstrOut->assign(buff, szcLen);
+        else
+            pstrOut->clear();
+    }
+    
+    return szcLen != 0;
+}
+
+
+
+
 #endif /* CFString_conv_h */
@@ -0,0 +1,1013 @@
+//
+//  async_log.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of a low-latency logger for time-critical callbacks: the calling thread only copies
+//  the format string ID and raw arguments into its own lock-free ring, while a background thread
+//  does the formatting and output
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef async_log_h
+#define async_log_h
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <type_traits>
+
+#include "types.h"
+#include "time_stamp.h"
+
+
+
+
+#define ASYNC_LOG_RING_SIZE (64 * 1024)         //Size of the ring for each thread that logs, in bytes (must be a power of 2)
+#define ASYNC_LOG_MAX_ARGS 8                    //Max number of arguments for a single log record
+#define ASYNC_LOG_MAX_STR 256                   //Max number of chars that are copied from each string argument
+#define ASYNC_LOG_MAX_FORMATS 4096              //Max number of distinct format strings (or call sites)
+
+static_assert((ASYNC_LOG_RING_SIZE & (ASYNC_LOG_RING_SIZE - 1)) == 0, "ASYNC_LOG_RING_SIZE must be a power of 2!");
+
+
+
+///Log a message without blocking
+///INFO: It takes printf-style format, that is sent with raw arguments to the background thread.
+///      The output line is prefixed with the time stamp of this call, ex: "2023-06-17 10:20:30.123456 > "
+///IMPORTANT: 'fmt' must be a string literal!
+///IMPORTANT: Only integers, enums, floating point numbers, pointers, C-strings and std::string can be passed as arguments.
+#define ASYNC_LOG(fmt, ...)                                                             \
+    do                                                                                  \
+    {                                                                                   \
+        static const uint32_t s_nAsyncLogFmtID_ = AsyncLogger::registerFormat(fmt);     \
+        AsyncLogger::get().log(s_nAsyncLogFmtID_, ##__VA_ARGS__);                       \
+    }                                                                                   \
+    while(0)
+
+
+///Same as ASYNC_LOG(), but the output line is not prefixed with the time stamp
+///INFO: Use it for lines that are already structured, ex: JSON Lines.
+#define ASYNC_LOG_RAW(fmt, ...)                                                         \
+    do                                                                                  \
+    {                                                                                   \
+        static const uint32_t s_nAsyncLogFmtID_ = AsyncLogger::registerFormat(fmt, false);  \
+        AsyncLogger::get().log(s_nAsyncLogFmtID_, ##__VA_ARGS__);                       \
+    }                                                                                   \
+    while(0)
+
+
+
+
+///Where the formatted output of 'AsyncLogger' goes
+///INFO: All its functions are called from the background thread of the logger.
+struct AsyncLogSink
+{
+    virtual ~AsyncLogSink()
+    {
+    }
+
+    ///Write formatted lines
+    ///'pText' = one or more full lines of text
+    ///'szcLen' = number of chars in 'pText'
+    virtual void write(const char* pText, size_t szcLen) = 0;
+
+    ///Push what was written to its destination
+    ///'bDurable' = true to also make sure that it's on disk (if it applies)
+    virtual void flush(bool bDurable)
+    {
+        UNREFERENCED_PARAMETER(bDurable);
+    }
+};
+
+
+///Sink that writes into the stdout
+struct AsyncLogSink_Stdout : public AsyncLogSink
+{
+    virtual void write(const char* pText, size_t szcLen) override
+    {
+        fwrite(pText, 1, szcLen, stdout);
+    }
+
+    virtual void flush(bool bDurable) override
+    {
+        UNREFERENCED_PARAMETER(bDurable);
+
+        fflush(stdout);
+    }
+};
+
+
+
+
+///Process-wide asynchronous logger - use ASYNC_LOG() macro to log with it
+struct AsyncLogger
+{
+    ///RETURN:
+    ///     = The logger for this process (it's started on the first use)
+    ///INFO: It's never destroyed, as other threads may still log while the process exits.
+    ///      Instead, it's flushed when exit() is called.
+    static AsyncLogger& get()
+    {
+        static AsyncLogger* s_pLogger = []()
+        {
+            AsyncLogger* pLogger = new AsyncLogger();
+
+            atexit([]()
+            {
+                get().flush(true);
+            });
+
+            return pLogger;
+        }();
+
+        return *s_pLogger;
+    }
+
+
+    ///Register format string
+    ///INFO: It's called once for each call site of ASYNC_LOG()
+    ///'pstrFmt' = printf-style format - must remain valid for the lifetime of the process
+    ///'bTimeStamp' = true to prefix the output line with the time stamp
+    ///RETURN:
+    ///     = ID of the format
+    static uint32_t registerFormat(const char* pstrFmt,
+                                   bool bTimeStamp = true)
+    {
+        AsyncLogger& logger = get();
+
+        //INFO: It doesn't take a lock, as it may be called on the first log call from a time-critical callback.
+        //      The background thread sees the format along with the first record that uses it.
+        uint32_t nID = logger._nFormats.fetch_add(1, std::memory_order_relaxed);
+        if(nID >= ASYNC_LOG_MAX_FORMATS - 1)
+        {
+            //Too many - share the last one (it's set in the constructor)
+            assert(false);
+            return ASYNC_LOG_MAX_FORMATS - 1;
+        }
+
+        logger._arrFormats[nID] = pstrFmt;
+        logger._arrNoTimeStamp[nID] = !bTimeStamp;
+
+        return nID;
+    }
+
+
+    ///Copy a log record into the ring of the calling thread
+    ///INFO: It never blocks. If the ring is full, the record is dropped and counted.
+    ///'nFmtID' = format ID returned by registerFormat()
+    ///'args' = arguments for the format
+    template<typename... ARGS>
+    void log(uint32_t nFmtID,
+             const ARGS&... args)
+    {
+        static_assert(sizeof...(ARGS) <= ASYNC_LOG_MAX_ARGS, "Too many arguments for ASYNC_LOG()");
+
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        RING* pRing = _getThreadRing();
+        if(!pRing)
+        {
+            //Failed
+            return;
+        }
+
+        //Size of the record
+        size_t szcRec = sizeof(REC_HDR);
+        ((szcRec += _argSize(args)), ...);
+
+        szcRec = (szcRec + 7) & ~(size_t)7;
+
+        uint8_t* pRec = pRing->beginWrite(szcRec);
+        if(!pRec)
+        {
+            //Ring is full
+            pRing->szcDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        REC_HDR* pHdr = (REC_HDR*)pRec;
+        pHdr->nSize = (uint32_t)szcRec;
+        pHdr->nFmtID = nFmtID;
+        pHdr->nTimeSec = (int64_t)ts.tv_sec;
+        pHdr->nTimeUsec = (uint32_t)(ts.tv_nsec / 1000);
+        pHdr->nArgs = (uint8_t)sizeof...(ARGS);
+
+        uint8_t* pDest = pRec + sizeof(REC_HDR);
+        size_t i = 0;
+        ((pHdr->arrTypes[i++] = _argWrite(pDest, args)), ...);
+        UNREFERENCED_PARAMETER(i);
+
+        pRing->endWrite(szcRec);
+
+        //Wake up the background thread, if it's waiting
+        //INFO: The ring position was published with a sequentially-consistent store, so either we see
+        //      that it's idle, or it sees our record before it goes idle. Only one thread gets to wake it up.
+        if(_bIdle.load(std::memory_order_seq_cst) &&
+           _bIdle.exchange(false, std::memory_order_seq_cst))
+        {
+            _wakeUp();
+        }
+    }
+
+
+    ///Create the ring for the calling thread ahead of time
+    ///INFO: Call it at startup from a thread that will log from time-critical callbacks,
+    ///      so that its first log call doesn't allocate memory or take a lock.
+    ///RETURN:
+    ///     = true if success
+    bool prepareThread()
+    {
+        return _getThreadRing() != nullptr;
+    }
+
+
+    ///Replace the sink where the output goes
+    ///'pSink' = new sink, or 0 to use the stdout - it must remain valid until it's replaced, or until the process exits
+    void setSink(AsyncLogSink* pSink)
+    {
+        //What was logged so far goes to the old one
+        flush(false);
+
+        if(true)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            _pSink = pSink ? pSink : &_sinkStdout;
+        }
+
+        //Make sure that the background thread is done with the old one
+        flush(false);
+    }
+
+
+    ///Wait until everything that was logged before this call is written to the sink
+    ///'bDurable' = true to also make sure that the sink put it on disk
+    void flush(bool bDurable = false)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        uint64_t nReq = ++_nFlushRequested;
+        if(bDurable)
+            _nDurableRequested = nReq;
+
+        _wakeUp();
+
+        _cvFlushed.wait(lock, [this, nReq]()
+        {
+            return _nFlushCompleted >= nReq;
+        });
+    }
+
+
+    ///Ask the background thread to write everything that was logged before this call to the sink, without waiting for it
+    ///INFO: Use it instead of flush() on threads that can't wait for the disk, ex: in the run-loop callbacks.
+    ///'bDurable' = true to also make sure that the sink puts it on disk
+    void flushAsync(bool bDurable = false)
+    {
+        if(true)
+        {
+            //Act from within a lock
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            uint64_t nReq = ++_nFlushRequested;
+            if(bDurable)
+                _nDurableRequested = nReq;
+        }
+
+        _wakeUp();
+    }
+
+
+    ///RETURN:
+    ///     = Number of log records that were dropped because rings were full
+    size_t getDroppedCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        size_t szcDropped = 0;
+        for(const RING* pRing : _arrRings)
+        {
+            szcDropped += pRing->szcDropped.load(std::memory_order_relaxed);
+        }
+
+        return szcDropped + _szcDroppedOrphans;
+    }
+
+
+
+private:
+
+    AsyncLogger()
+    {
+        _pSink = &_sinkStdout;
+
+        //Shared by all formats that didn't fit
+        _arrFormats[ASYNC_LOG_MAX_FORMATS - 1] = "(too many log formats)\n";
+
+        //INFO: This thread runs for the lifetime of the process
+        std::thread(&AsyncLogger::_threadProc, this).detach();
+    }
+
+    enum ARG_TYPE : uint8_t
+    {
+        AT_INT,                 //int64_t
+        AT_UINT,                //uint64_t
+        AT_DOUBLE,              //double
+        AT_PTR,                 //Pointer, as uint64_t
+        AT_STR,                 //uint32_t length, followed by chars (no null)
+    };
+
+    struct REC_HDR
+    {
+        uint32_t nSize;                                 //Size of the whole record, in bytes (multiple of 8)
+        uint32_t nFmtID;                                //Format ID, or REC_PADDING
+        int64_t nTimeSec;                               //When it was logged: seconds since the Unix epoch
+        uint32_t nTimeUsec;                             //When it was logged: microseconds
+        uint8_t nArgs;                                  //Number of arguments that follow
+        uint8_t arrTypes[ASYNC_LOG_MAX_ARGS];           //Type of each argument (ARG_TYPE)
+        uint8_t nReserved[3];
+    };
+
+    static_assert(sizeof(REC_HDR) % 8 == 0, "REC_HDR must keep records aligned!");
+
+    static const uint32_t REC_PADDING = 0xFFFFFFFF;     //Format ID for the filler to the end of the ring
+
+
+    ///Single-producer / single-consumer ring of variable-size records
+    struct RING
+    {
+        alignas(64) std::atomic<uint64_t> nHead{0};     //Consumer position (bytes read since the start)
+        alignas(64) std::atomic<uint64_t> nTail{0};     //Producer position (bytes written since the start)
+        uint64_t nHeadCached = 0;                       //Producer's copy of 'nHead'
+        size_t szcPadPending = 0;                       //Producer: padding that was added by beginWrite()
+
+        std::atomic<size_t> szcDropped{0};              //Number of records that didn't fit
+        std::atomic<bool> bOrphan{false};               //true when the thread that owns this ring has exited
+
+        alignas(64) uint8_t arrBuff[ASYNC_LOG_RING_SIZE];
+
+
+        ///Producer: Reserve 'szcRec' contiguous bytes
+        ///RETURN:
+        ///     = Pointer to write the record to, or 0 if there's no space
+        uint8_t* beginWrite(size_t szcRec)
+        {
+            uint64_t nTail = this->nTail.load(std::memory_order_relaxed);
+            size_t nOffs = (size_t)(nTail & (ASYNC_LOG_RING_SIZE - 1));
+
+            //Records don't wrap around - fill the end with padding if needed
+            size_t szcPad = nOffs + szcRec > ASYNC_LOG_RING_SIZE ? ASYNC_LOG_RING_SIZE - nOffs : 0;
+
+            if(nTail + szcPad + szcRec - nHeadCached > ASYNC_LOG_RING_SIZE)
+            {
+                nHeadCached = nHead.load(std::memory_order_acquire);
+
+                if(nTail + szcPad + szcRec - nHeadCached > ASYNC_LOG_RING_SIZE)
+                {
+                    //No space
+                    return nullptr;
+                }
+            }
+
+            if(szcPad)
+            {
+                //INFO: It's published along with the record in endWrite()
+                REC_HDR* pPad = (REC_HDR*)(arrBuff + nOffs);
+                pPad->nSize = (uint32_t)szcPad;
+                pPad->nFmtID = REC_PADDING;
+
+                nOffs = 0;
+            }
+
+            szcPadPending = szcPad;
+
+            return arrBuff + nOffs;
+        }
+
+        ///Producer: Publish the record that was reserved by beginWrite()
+        void endWrite(size_t szcRec)
+        {
+            nTail.store(nTail.load(std::memory_order_relaxed) + szcPadPending + szcRec, std::memory_order_seq_cst);
+        }
+    };
+
+
+    ///Marks the ring of a thread as orphaned when that thread exits
+    struct RING_OWNER
+    {
+        RING* pRing = nullptr;
+
+        ~RING_OWNER()
+        {
+            if(pRing)
+            {
+                pRing->bOrphan.store(true, std::memory_order_release);
+            }
+        }
+    };
+
+
+    ///RETURN:
+    ///     = Ring for the calling thread (it's created on the first call, or by prepareThread())
+    RING* _getThreadRing()
+    {
+        static thread_local RING_OWNER s_owner;
+
+        if(!s_owner.pRing)
+        {
+            RING* pRing = new (std::nothrow) RING();
+            if(!pRing)
+            {
+                //Failed
+                assert(false);
+                return nullptr;
+            }
+
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            _arrRings.push_back(pRing);
+            s_owner.pRing = pRing;
+        }
+
+        return s_owner.pRing;
+    }
+
+
+    ///Wake up the background thread
+    ///INFO: It doesn't take a lock, as it's called from log().
+    void _wakeUp()
+    {
+        _nWakeUps.fetch_add(1, std::memory_order_seq_cst);
+        _nWakeUps.notify_one();
+    }
+
+
+    //Size, in bytes, that each argument takes in the record
+    template<typename T>
+    static size_t _argSize(const T& v)
+    {
+        UNREFERENCED_PARAMETER(v);
+        return 8;
+    }
+
+    static size_t _argSize(const char* p)
+    {
+        return 4 + (p ? strnlen(p, ASYNC_LOG_MAX_STR) : 6);
+    }
+
+    static size_t _argSize(char* p)
+    {
+        return _argSize((const char*)p);
+    }
+
+    template<size_t N>
+    static size_t _argSize(const char (&p)[N])
+    {
+        return _argSize((const char*)p);
+    }
+
+    static size_t _argSize(const std::string& str)
+    {
+        return 4 + std::min(str.size(), (size_t)ASYNC_LOG_MAX_STR);
+    }
+
+
+    //Copy each argument into the record and advance 'pDest'
+    //RETURN: its type
+    template<typename T>
+    static uint8_t _argWrite(uint8_t*& pDest,
+                             const T& v)
+    {
+        uint8_t type;
+        uint64_t nVal;
+
+        if constexpr(std::is_floating_point<T>::value)
+        {
+            double f = (double)v;
+            memcpy(&nVal, &f, sizeof(nVal));
+            type = AT_DOUBLE;
+        }
+        else if constexpr(std::is_pointer<T>::value || std::is_null_pointer<T>::value)
+        {
+            nVal = (uint64_t)(uintptr_t)v;
+            type = AT_PTR;
+        }
+        else if constexpr(std::is_enum<T>::value)
+        {
+            nVal = (uint64_t)(int64_t)v;
+            type = AT_INT;
+        }
+        else
+        {
+            static_assert(std::is_integral<T>::value, "Unsupported argument type for ASYNC_LOG()");
+
+            if constexpr(std::is_signed<T>::value)
+            {
+                nVal = (uint64_t)(int64_t)v;
+                type = AT_INT;
+            }
+            else
+            {
+                nVal = (uint64_t)v;
+                type = AT_UINT;
+            }
+        }
+
+        memcpy(pDest, &nVal, sizeof(nVal));
+        pDest += sizeof(nVal);
+
+        return type;
+    }
+
+    static uint8_t _argWrite(uint8_t*& pDest,
+                             const char* p)
+    {
+        if(!p)
+            p = "(null)";
+
+        uint32_t nLen = (uint32_t)strnlen(p, ASYNC_LOG_MAX_STR);
+
+        memcpy(pDest, &nLen, sizeof(nLen));
+        memcpy(pDest + sizeof(nLen), p, nLen);
+        pDest += sizeof(nLen) + nLen;
+
+        return AT_STR;
+    }
+
+    static uint8_t _argWrite(uint8_t*& pDest,
+                             char* p)
+    {
+        return _argWrite(pDest, (const char*)p);
+    }
+
+    template<size_t N>
+    static uint8_t _argWrite(uint8_t*& pDest,
+                             const char (&p)[N])
+    {
+        return _argWrite(pDest, (const char*)p);
+    }
+
+    static uint8_t _argWrite(uint8_t*& pDest,
+                             const std::string& str)
+    {
+        uint32_t nLen = (uint32_t)std::min(str.size(), (size_t)ASYNC_LOG_MAX_STR);
+
+        memcpy(pDest, &nLen, sizeof(nLen));
+        memcpy(pDest + sizeof(nLen), str.data(), nLen);
+        pDest += sizeof(nLen) + nLen;
+
+        return AT_STR;
+    }
+
+
+
+    struct ARG
+    {
+        uint8_t type;
+        uint64_t nVal;                  //For all types, except AT_STR
+        const char* pStr;               //For AT_STR
+        uint32_t nStrLen;               //For AT_STR
+    };
+
+
+    ///Format 'pstrFmt' with 'pArgs' and append it to 'strOut'
+    ///INFO: Each conversion is done by snprintf() on its own, with the length modifier adjusted to the stored type.
+    static void _formatArgs(const char* pstrFmt,
+                            const ARG* pArgs,
+                            size_t szcArgs,
+                            std::string& strOut)
+    {
+        char buffSpec[32];
+        char buff[512];
+        size_t a = 0;
+
+        const char* p = pstrFmt;
+        while(*p)
+        {
+            const char* pPct = strchr(p, '%');
+            if(!pPct)
+            {
+                strOut.append(p);
+                break;
+            }
+
+            strOut.append(p, pPct - p);
+            p = pPct + 1;
+
+            if(*p == '%')
+            {
+                strOut.push_back('%');
+                p++;
+                continue;
+            }
+
+            //Flags, width & precision
+            const char* pSpec = p;
+            while(*p && strchr("-+ #0'", *p))
+                p++;
+            while(*p >= '0' && *p <= '9')
+                p++;
+            if(*p == '.')
+            {
+                p++;
+                while(*p >= '0' && *p <= '9')
+                    p++;
+            }
+
+            size_t szcSpec = std::min((size_t)(p - pSpec), sizeof(buffSpec) - 8);
+
+            //Skip the length modifier - we use our own
+            while(*p && strchr("hljztLq", *p))
+                p++;
+
+            char chConv = *p;
+            if(!chConv)
+                break;
+            p++;
+
+            if(a >= szcArgs)
+            {
+                //Not enough arguments
+                continue;
+            }
+
+            const ARG& arg = pArgs[a++];
+
+            buffSpec[0] = '%';
+            memcpy(buffSpec + 1, pSpec, szcSpec);
+            char* pEnd = buffSpec + 1 + szcSpec;
+
+            int nLen = 0;
+
+            switch(chConv)
+            {
+                case 'd': case 'i':
+                case 'u': case 'x': case 'X': case 'o':
+                case 'c':
+                {
+                    if(arg.type == AT_STR)
+                        goto lbl_str;
+
+                    if(chConv != 'c')
+                    {
+                        *pEnd++ = 'l';
+                        *pEnd++ = 'l';
+                    }
+                    *pEnd++ = chConv;
+                    *pEnd = 0;
+
+                    long long nVal = arg.type == AT_DOUBLE ? (long long)_asDouble(arg.nVal) : (long long)arg.nVal;
+                    if(chConv == 'c')
+                        nLen = snprintf(buff, sizeof(buff), buffSpec, (int)nVal);
+                    else
+                        nLen = snprintf(buff, sizeof(buff), buffSpec, nVal);
+                }
+                break;
+
+                case 'f': case 'F': case 'e': case 'E':
+                case 'g': case 'G': case 'a': case 'A':
+                {
+                    if(arg.type == AT_STR)
+                        goto lbl_str;
+
+                    *pEnd++ = chConv;
+                    *pEnd = 0;
+
+                    double f = arg.type == AT_DOUBLE ? _asDouble(arg.nVal) :
+                               arg.type == AT_INT ? (double)(int64_t)arg.nVal : (double)arg.nVal;
+                    nLen = snprintf(buff, sizeof(buff), buffSpec, f);
+                }
+                break;
+
+                case 'p':
+                {
+                    *pEnd++ = 'p';
+                    *pEnd = 0;
+
+                    nLen = snprintf(buff, sizeof(buff), buffSpec, (void*)(uintptr_t)arg.nVal);
+                }
+                break;
+
+                case 's':
+                default:
+                lbl_str:
+                {
+                    if(arg.type == AT_STR)
+                    {
+                        //Keep the width & precision for the string
+                        *pEnd++ = '.';
+                        *pEnd++ = '*';
+                        *pEnd++ = 's';
+                        *pEnd = 0;
+
+                        //INFO: Our precision limits the length, since the string is not null-terminated
+                        if(memchr(pSpec, '.', szcSpec) == nullptr)
+                        {
+                            nLen = snprintf(buff, sizeof(buff), buffSpec, (int)arg.nStrLen, arg.pStr);
+                        }
+                        else
+                        {
+                            //Precision was specified - copy it into a null-terminated string first
+                            std::string str(arg.pStr, arg.nStrLen);
+                            buffSpec[1 + szcSpec] = 's';
+                            buffSpec[2 + szcSpec] = 0;
+                            nLen = snprintf(buff, sizeof(buff), buffSpec, str.c_str());
+                        }
+                    }
+                    else
+                    {
+                        nLen = snprintf(buff, sizeof(buff), "(?)");
+                    }
+                }
+                break;
+            }
+
+            if(nLen > 0)
+            {
+                strOut.append(buff, std::min((size_t)nLen, sizeof(buff) - 1));
+            }
+        }
+    }
+
+    static double _asDouble(uint64_t nVal)
+    {
+        double f;
+        memcpy(&f, &nVal, sizeof(f));
+        return f;
+    }
+
+
+    ///Format a single record from the ring and append it to 'strOut'
+    void _formatRecord(const REC_HDR* pHdr,
+                       std::string& strOut)
+    {
+        ARG arrArgs[ASYNC_LOG_MAX_ARGS];
+
+        const uint8_t* pSrc = (const uint8_t*)pHdr + sizeof(REC_HDR);
+
+        for(size_t i = 0; i < pHdr->nArgs; i++)
+        {
+            ARG& arg = arrArgs[i];
+            arg.type = pHdr->arrTypes[i];
+
+            if(arg.type == AT_STR)
+            {
+                memcpy(&arg.nStrLen, pSrc, sizeof(arg.nStrLen));
+                arg.pStr = (const char*)pSrc + sizeof(arg.nStrLen);
+                pSrc += sizeof(arg.nStrLen) + arg.nStrLen;
+            }
+            else
+            {
+                memcpy(&arg.nVal, pSrc, sizeof(arg.nVal));
+                pSrc += sizeof(arg.nVal);
+            }
+        }
+
+        //Time stamp prefix
+        if(!_arrNoTimeStamp[pHdr->nFmtID])
+        {
+            timeval tv = {};
+            tv.tv_sec = (time_t)pHdr->nTimeSec;
+            tv.tv_usec = (suseconds_t)pHdr->nTimeUsec;
+
+            char buffTime[TIME_STAMP_BUFF_SIZE];
+            size_t szcTime = TimeStamp::format(tv, buffTime, sizeof(buffTime));
+
+            strOut.append(buffTime, szcTime);
+            strOut.append(" > ");
+        }
+
+        _formatArgs(_arrFormats[pHdr->nFmtID], arrArgs, pHdr->nArgs, strOut);
+    }
+
+
+    struct PENDING
+    {
+        int64_t nTimeSec;
+        uint32_t nTimeUsec;
+        size_t nOffs;                   //Where its text begins in the batch
+        size_t szcLen;                  //Length of its text
+    };
+
+
+    ///IMPORTANT: Must be called from within '_mutex'!
+    ///Take all records from all rings, format them in the order they were logged, and write them to the sink
+    ///RETURN:
+    ///     = Number of records written
+    size_t _drain(std::unique_lock<std::mutex>& lock)
+    {
+        std::vector<RING*> arrRings = _arrRings;
+        AsyncLogSink* pSink = _pSink;
+
+        //Release orphaned rings that were already drained
+        for(auto it = _arrRings.begin(); it != _arrRings.end(); )
+        {
+            RING* pRing = *it;
+            if(pRing->bOrphan.load(std::memory_order_acquire) &&
+               pRing->nHead.load(std::memory_order_relaxed) == pRing->nTail.load(std::memory_order_acquire))
+            {
+                _szcDroppedOrphans += pRing->szcDropped.load(std::memory_order_relaxed);
+
+                arrRings.erase(std::find(arrRings.begin(), arrRings.end(), pRing));
+                it = _arrRings.erase(it);
+
+                delete pRing;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        //Formatting is done outside of the lock
+        lock.unlock();
+
+        _strBatch.clear();
+        _arrPending.clear();
+
+        size_t szcDropped = 0;
+
+        for(RING* pRing : arrRings)
+        {
+            szcDropped += pRing->szcDropped.load(std::memory_order_relaxed);
+
+            uint64_t nHead = pRing->nHead.load(std::memory_order_relaxed);
+            uint64_t nTail = pRing->nTail.load(std::memory_order_acquire);
+
+            while(nHead != nTail)
+            {
+                const REC_HDR* pHdr = (const REC_HDR*)(pRing->arrBuff + (nHead & (ASYNC_LOG_RING_SIZE - 1)));
+
+                if(pHdr->nFmtID != REC_PADDING)
+                {
+                    PENDING pnd;
+                    pnd.nTimeSec = pHdr->nTimeSec;
+                    pnd.nTimeUsec = pHdr->nTimeUsec;
+                    pnd.nOffs = _strBatch.size();
+
+                    _formatRecord(pHdr, _strBatch);
+
+                    pnd.szcLen = _strBatch.size() - pnd.nOffs;
+                    _arrPending.push_back(pnd);
+                }
+
+                nHead += pHdr->nSize;
+            }
+
+            //Let the producer reuse this space
+            pRing->nHead.store(nHead, std::memory_order_release);
+        }
+
+        szcDropped += _szcDroppedOrphans;
+
+        if(!_arrPending.empty())
+        {
+            //Records from different threads are merged by their time stamps
+            std::stable_sort(_arrPending.begin(), _arrPending.end(),
+                             [](const PENDING& p1, const PENDING& p2)
+                             {
+                                 return p1.nTimeSec != p2.nTimeSec ? p1.nTimeSec < p2.nTimeSec : p1.nTimeUsec < p2.nTimeUsec;
+                             });
+
+            _strOut.clear();
+            for(const PENDING& pnd : _arrPending)
+            {
+                _strOut.append(_strBatch, pnd.nOffs, pnd.szcLen);
+            }
+
+            pSink->write(_strOut.data(), _strOut.size());
+        }
+
+        if(szcDropped != _szcDroppedReported)
+        {
+            //Let it be known
+            char buff[128];
+            char buffTime[TIME_STAMP_BUFF_SIZE];
+            TimeStamp::formatNow(buffTime, sizeof(buffTime));
+
+            int nLen = snprintf(buff, sizeof(buff), "%s > (%zu log records were dropped)\n",
+                                buffTime,
+                                szcDropped - _szcDroppedReported);
+
+            pSink->write(buff, std::min((size_t)nLen, sizeof(buff) - 1));
+
+            _szcDroppedReported = szcDropped;
+        }
+
+        lock.lock();
+
+        return _arrPending.size();
+    }
+
+
+    void _threadProc()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        for(;;)
+        {
+            //This pass serves all wake-ups up to this point
+            uint32_t nWakeUps = _nWakeUps.load(std::memory_order_seq_cst);
+
+            uint64_t nFlushReq = _nFlushRequested;
+            bool bDurable = _nDurableRequested > _nFlushCompleted;
+
+            //Take everything there is (sequentially-consistent, to pair with the producers)
+            _bIdle.store(false, std::memory_order_seq_cst);
+            _drain(lock);
+
+            if(nFlushReq > _nFlushCompleted)
+            {
+                AsyncLogSink* pSink = _pSink;
+
+                lock.unlock();
+                pSink->flush(bDurable);
+                lock.lock();
+
+                _nFlushCompleted = nFlushReq;
+                _cvFlushed.notify_all();
+            }
+
+            //Announce that we're going idle, then check once more, as a producer may have
+            //missed the flag while we were draining
+            _bIdle.store(true, std::memory_order_seq_cst);
+
+            bool bMore = false;
+            for(RING* pRing : _arrRings)
+            {
+                if(pRing->nTail.load(std::memory_order_seq_cst) != pRing->nHead.load(std::memory_order_relaxed))
+                {
+                    bMore = true;
+                    break;
+                }
+            }
+
+            if(!bMore)
+            {
+                //Wait for a wake-up that came after we took 'nWakeUps'
+                lock.unlock();
+                _nWakeUps.wait(nWakeUps, std::memory_order_seq_cst);
+                lock.lock();
+            }
+        }
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    AsyncLogger(const AsyncLogger& s) = delete;
+    AsyncLogger& operator = (const AsyncLogger& s) = delete;
+
+private:
+
+    std::mutex _mutex;                                  //Lock for accessing this struct (never taken by log())
+    std::condition_variable _cvFlushed;                 //Signaled when a flush completes
+
+    std::atomic<bool> _bIdle{false};                    //true if the background thread is about to wait, or is waiting
+    std::atomic<uint32_t> _nWakeUps{0};                 //Incremented to wake up the background thread (it waits on it without '_mutex')
+
+    uint64_t _nFlushRequested = 0;                      //Number of flush() calls
+    uint64_t _nDurableRequested = 0;                    //Last flush() call that asked for a durable flush
+    uint64_t _nFlushCompleted = 0;                      //Last flush() call that was completed
+
+    const char* _arrFormats[ASYNC_LOG_MAX_FORMATS] = {};    //Registered format strings, by their IDs
+    bool _arrNoTimeStamp[ASYNC_LOG_MAX_FORMATS] = {};   //true for formats that are not prefixed with the time stamp, by their IDs
+    std::atomic<uint32_t> _nFormats{0};                 //Number of registered format strings
+
+    std::vector<RING*> _arrRings;                       //Rings of all threads that logged
+    size_t _szcDroppedOrphans = 0;                      //Dropped records in rings that were released
+    size_t _szcDroppedReported = 0;                     //Dropped records that were reported in the output
+
+    AsyncLogSink_Stdout _sinkStdout;                    //Default sink
+    AsyncLogSink* _pSink;                               //Where the output goes
+
+    std::string _strBatch;                              //Formatted records for a single pass (used by the background thread only)
+    std::vector<PENDING> _arrPending;                   //Records in '_strBatch' (used by the background thread only)
+    std::string _strOut;                                //Records in the order they were logged (used by the background thread only)
+};
+
+
+
+
+#endif /* async_log_h */
@@ -0,0 +1,343 @@
+//
+//  bundle_pattern.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of a case-insensitive wildcard matcher for bundle IDs, that is compiled once
+//  and then applied to many strings
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef bundle_pattern_h
+#define bundle_pattern_h
+
+#include <string.h>
+#include <assert.h>
+
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+
+
+///Case-insensitive (for ASCII) pattern for bundle IDs, that may contain wildcards:
+///     '*' = matches any number of characters, including none
+///     '?' = matches exactly one character
+///ex: "com.dennisbabkin.*", "com.*.wake??", or "com.dennisbabkin.wake01" for an exact match
+struct BundlePattern
+{
+    BundlePattern()
+    {
+    }
+
+    ///'pstrPattern' = pattern to compile, or 0 or "" to match everything
+    BundlePattern(const char* pstrPattern)
+    {
+        compile(pstrPattern);
+    }
+
+
+    ///Compile 'pstrPattern' so that it can be applied to many strings
+    ///'pstrPattern' = pattern to compile, or 0 or "" to match everything
+    void compile(const char* pstrPattern)
+    {
+        _arrSegs.clear();
+        _bAnchorStart = true;
+        _bAnchorEnd = true;
+        _bMatchAll = false;
+        _strPrefix.clear();
+
+        if(!pstrPattern ||
+           !pstrPattern[0])
+        {
+            _bMatchAll = true;
+            return;
+        }
+
+        //Split it into segments between '*'
+        std::string strSeg;
+
+        for(const char* p = pstrPattern; ; p++)
+        {
+            char c = *p;
+
+            if(c == '*' ||
+               c == 0)
+            {
+                if(!strSeg.empty())
+                {
+                    _arrSegs.push_back(strSeg);
+                    strSeg.clear();
+                }
+
+                if(c == '*')
+                {
+                    if(p == pstrPattern)
+                        _bAnchorStart = false;
+
+                    if(p[1] == 0)
+                        _bAnchorEnd = false;
+                }
+                else
+                {
+                    break;
+                }
+            }
+            else
+            {
+                strSeg += _toLower(c);
+            }
+        }
+
+        if(_arrSegs.empty())
+        {
+            //Pattern had only '*'
+            _bMatchAll = true;
+        }
+        else if(_bAnchorStart)
+        {
+            //Literal prefix (up to the first '?') that we can compare quickly
+            const std::string& strFirst = _arrSegs[0];
+            _strPrefix = strFirst.substr(0, strFirst.find('?'));
+        }
+    }
+
+
+    ///RETURN:
+    ///     = true if this pattern matches all strings
+    bool isMatchAll() const
+    {
+        return _bMatchAll;
+    }
+
+    ///RETURN:
+    ///     = true if this pattern has no wildcards
+    bool isExact() const
+    {
+        return !_bMatchAll &&
+               _bAnchorStart &&
+               _bAnchorEnd &&
+               _arrSegs.size() == 1 &&
+               _strPrefix.size() == _arrSegs[0].size();
+    }
+
+    ///RETURN:
+    ///     = Lower-case literal prefix that all matching strings must start with, or "" if none
+    const std::string& getPrefix() const
+    {
+        return _strPrefix;
+    }
+
+
+    ///Check if 'pStr' matches this pattern
+    ///'pStr' = string to check
+    ///'szcLen' = length of 'pStr' in bytes
+    ///RETURN:
+    ///     = true if it matches
+    bool isMatch(const char* pStr,
+                 size_t szcLen) const
+    {
+        if(_bMatchAll)
+            return true;
+
+        assert(!_arrSegs.empty());
+
+        //Quick rejection by the literal prefix
+        size_t szcPrefix = _strPrefix.size();
+        if(szcPrefix)
+        {
+            if(szcLen < szcPrefix ||
+               !_isPrefixMatch(pStr, szcPrefix))
+            {
+                return false;
+            }
+        }
+
+        size_t szcSegs = _arrSegs.size();
+        size_t nPos = 0;
+        size_t i = 0;
+
+        if(_bAnchorStart)
+        {
+            //First segment must be at the beginning
+            const std::string& strSeg = _arrSegs[0];
+
+            if(szcLen < strSeg.size() ||
+               !_isSegMatch(pStr, strSeg))
+            {
+                return false;
+            }
+
+            nPos = strSeg.size();
+            i = 1;
+
+            if(szcSegs == 1 &&
+               _bAnchorEnd)
+            {
+                //No '*' at all
+                return nPos == szcLen;
+            }
+        }
+
+        //Last segment must be at the end
+        size_t szcEnd = szcLen;
+        size_t szcMiddle = szcSegs;
+
+        if(_bAnchorEnd &&
+           i < szcSegs)
+        {
+            const std::string& strSeg = _arrSegs[szcSegs - 1];
+
+            if(szcLen < nPos + strSeg.size() ||
+               !_isSegMatch(pStr + szcLen - strSeg.size(), strSeg))
+            {
+                return false;
+            }
+
+            szcEnd = szcLen - strSeg.size();
+            szcMiddle = szcSegs - 1;
+        }
+
+        //Segments in the middle are found left-to-right (the leftmost match is always the best one)
+        for(; i < szcMiddle; i++)
+        {
+            const std::string& strSeg = _arrSegs[i];
+            size_t szcSeg = strSeg.size();
+
+            bool bFound = false;
+
+            for(; nPos + szcSeg <= szcEnd; nPos++)
+            {
+                if(_isSegMatch(pStr + nPos, strSeg))
+                {
+                    bFound = true;
+                    break;
+                }
+            }
+
+            if(!bFound)
+                return false;
+
+            nPos += szcSeg;
+        }
+
+        return nPos <= szcEnd;
+    }
+
+    bool isMatch(const std::string& str) const
+    {
+        return isMatch(str.c_str(), str.size());
+    }
+
+
+
+private:
+
+    static char _toLower(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? (char)(c + ('a' - 'A')) : c;
+    }
+
+
+    ///RETURN:
+    ///     = true if 'pStr' (that is at least as long as 'strSeg') matches 'strSeg' that may contain '?'
+    static bool _isSegMatch(const char* pStr,
+                            const std::string& strSeg)
+    {
+        size_t szcSeg = strSeg.size();
+        const char* pSeg = strSeg.c_str();
+
+        for(size_t i = 0; i < szcSeg; i++)
+        {
+            if(pSeg[i] != '?' &&
+               pSeg[i] != _toLower(pStr[i]))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    ///RETURN:
+    ///     = true if the first 'szcPrefix' bytes of 'pStr' match '_strPrefix' (case-insensitively)
+    bool _isPrefixMatch(const char* pStr,
+                        size_t szcPrefix) const
+    {
+        const char* pPrefix = _strPrefix.c_str();
+        size_t i = 0;
+
+#if defined(__SSE2__)
+        //16 bytes at a time
+        const __m128i vA = _mm_set1_epi8('A' - 1);
+        const __m128i vZ = _mm_set1_epi8('Z' + 1);
+        const __m128i vCase = _mm_set1_epi8('a' - 'A');
+
+        for(; i + 16 <= szcPrefix; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(pStr + i));
+            __m128i vUpper = _mm_and_si128(_mm_cmpgt_epi8(v, vA), _mm_cmplt_epi8(v, vZ));
+            v = _mm_add_epi8(v, _mm_and_si128(vUpper, vCase));
+
+            __m128i vPfx = _mm_loadu_si128((const __m128i*)(pPrefix + i));
+            if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, vPfx)) != 0xFFFF)
+                return false;
+        }
+#elif defined(__ARM_NEON)
+        //16 bytes at a time
+        const uint8x16_t vA = vdupq_n_u8('A');
+        const uint8x16_t vRange = vdupq_n_u8('Z' - 'A');
+        const uint8x16_t vCase = vdupq_n_u8('a' - 'A');
+
+        for(; i + 16 <= szcPrefix; i += 16)
+        {
+            uint8x16_t v = vld1q_u8((const uint8_t*)(pStr + i));
+            uint8x16_t vUpper = vcleq_u8(vsubq_u8(v, vA), vRange);
+            v = vaddq_u8(v, vandq_u8(vUpper, vCase));
+
+            uint8x16_t vEq = vceqq_u8(v, vld1q_u8((const uint8_t*)(pPrefix + i)));
+            if(vminvq_u8(vEq) != 0xFF)
+                return false;
+        }
+#endif
+
+        //The rest
+        for(; i < szcPrefix; i++)
+        {
+            if(_toLower(pStr[i]) != pPrefix[i])
+                return false;
+        }
+
+        return true;
+    }
+
+
+
+private:
+
+    std::vector<std::string> _arrSegs;      //Lower-case segments between '*', can contain '?'
+    bool _bAnchorStart = true;              //true if pattern doesn't start with '*'
+    bool _bAnchorEnd = true;                //true if pattern doesn't end with '*'
+    bool _bMatchAll = false;                //true if pattern matches everything
+    std::string _strPrefix;                 //Lower-case literal prefix, or "" if none
+};
+
+
+
+
+#endif /* bundle_pattern_h */
@@ -0,0 +1,611 @@
+//
+//  civil_time.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of how to convert local date & time to UTC without calling mktime() every time,
+//  using a cached table of UTC offsets for the local time zone
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef civil_time_h
+#define civil_time_h
+
+#include <time.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "rdr_wrtr.h"           //Reader/writer lock classes from "macOS tips - part 1"
+
+
+
+
+#define CIVIL_TIME_CACHE_YEARS_BACK 1           //Number of years before the current one, to cache UTC offsets for
+#define CIVIL_TIME_CACHE_YEARS_AHEAD 10         //Number of years after the current one, to cache UTC offsets for
+
+#define CIVIL_TIME_SCAN_STEP_SEC (24 * 60 * 60) //Step in seconds, to look for UTC offset changes with
+                                                //INFO: Time zones don't change their offset more than once per day.
+
+
+
+///Local date & time
+struct CIVIL_TIME
+{
+    int nYear;              //4-digit year
+    int nMonth;             //[1-12]
+    int nDay;               //[1-31]
+    int nHour;              //[0-23]
+    int nMinute;            //[0-59]
+    int nSecond;            //[0-59]
+    int nMillisecond;       //[0-999]
+};
+
+
+
+///Converts local date & time to UTC with the same results as mktime() with tm_isdst = -1
+///INFO: It keeps a table of UTC offset changes for the local time zone, so that most conversions
+///      don't need to call mktime() that takes the global time zone lock in libc.
+///      Local times that don't exist, or happen twice (at DST changes) are passed to mktime().
+struct LocalTimeConv
+{
+    LocalTimeConv()
+    {
+    }
+
+
+    ///Get number of days since Jan 1, 1970 for a date in the proleptic Gregorian calendar
+    ///'y' = year
+    ///'m' = month [1-12]
+    ///'d' = day of the month [1-31]
+    static constexpr int64_t daysFromCivil(int64_t y,
+                                           unsigned m,
+                                           unsigned d)
+    {
+        //Count years from March 1, so that Feb 29 is the last day of a year
+        y -= m <= 2;
+
+        const int64_t era = (y >= 0 ? y : y - 399) / 400;
+        const unsigned yoe = (unsigned)(y - era * 400);                         //[0, 399]
+        const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;   //[0, 365]
+        const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;             //[0, 146096]
+
+        return era * 146097 + (int64_t)doe - 719468;
+    }
+
+
+    ///Get date in the proleptic Gregorian calendar from the number of days since Jan 1, 1970
+    ///'nDays' = number of days since Jan 1, 1970
+    ///'pOutYear' = receives the year
+    ///'pOutMonth' = receives the month [1-12]
+    ///'pOutDay' = receives the day of the month [1-31]
+    static constexpr void civilFromDays(int64_t nDays,
+                                        int* pOutYear,
+                                        int* pOutMonth,
+                                        int* pOutDay)
+    {
+        nDays += 719468;
+
+        const int64_t era = (nDays >= 0 ? nDays : nDays - 146096) / 146097;
+        const unsigned doe = (unsigned)(nDays - era * 146097);                      //[0, 146096]
+        const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; //[0, 399]
+        const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);               //[0, 365]
+        const unsigned mp = (5 * doy + 2) / 153;                                    //[0, 11] from March
+        const unsigned d = doy - (153 * mp + 2) / 5 + 1;                            //[1, 31]
+        const unsigned m = mp < 10 ? mp + 3 : mp - 9;                               //[1, 12]
+
+        *pOutYear = (int)((int64_t)yoe + era * 400 + (m <= 2));
+        *pOutMonth = (int)m;
+        *pOutDay = (int)d;
+    }
+
+
+    ///RETURN:
+    ///     = Day of the week [0-6] (0 = Sunday) for the number of days since Jan 1, 1970
+    static constexpr int weekdayFromDays(int64_t nDays)
+    {
+        //Jan 1, 1970 was Thursday
+        return (int)(nDays >= -4 ? (nDays + 4) % 7 : (nDays + 5) % 7 + 6);
+    }
+
+
+    ///Get local time as the number of seconds since midnight of Jan 1, 1970 (as if it was in UTC)
+    ///INFO: Values out of range are normalized like mktime() does, ex: Jan 32 becomes Feb 1.
+    static constexpr int64_t localSecondsFromCivil(int nYear,
+                                                   int nMonth,
+                                                   int nDay,
+                                                   int nHour,
+                                                   int nMinute,
+                                                   int nSecond)
+    {
+        //Bring month into [0-11]
+        int64_t y = nYear;
+        int64_t m = nMonth - 1;
+
+        int64_t yAdj = m >= 0 ? m / 12 : (m - 11) / 12;
+        y += yAdj;
+        m -= yAdj * 12;
+
+        int64_t nDays = daysFromCivil(y, (unsigned)m + 1, 1) + (nDay - 1);
+
+        return nDays * 86400 + (int64_t)nHour * 3600 + (int64_t)nMinute * 60 + nSecond;
+    }
+
+
+    ///Convert local date & time to UTC
+    ///'pOutUtc' = if not 0, receives the number of seconds since midnight of Jan 1, 1970 in UTC, or -1 if error
+    ///RETURN:
+    ///     = true if success
+    bool toUtc(int nYear,
+               int nMonth,
+               int nDay,
+               int nHour,
+               int nMinute,
+               int nSecond,
+               int64_t* pOutUtc)
+    {
+        int64_t nLocal = localSecondsFromCivil(nYear, nMonth, nDay, nHour, nMinute, nSecond);
+
+        int64_t nUtc;
+        if(!_resolve(&nLocal, 1, &nUtc))
+        {
+            //Use the OS
+            nUtc = _mktime(nYear, nMonth, nDay, nHour, nMinute, nSecond);
+        }
+
+        if(pOutUtc)
+            *pOutUtc = nUtc;
+
+        return nUtc != -1;
+    }
+
+
+    ///Convert UTC time to local time
+    ///'nUtc' = number of seconds since midnight of Jan 1, 1970 in UTC
+    ///'pOutLocal' = if not 0, receives local time as the number of seconds since midnight of Jan 1, 1970
+    ///              (as if it was in UTC) - use civilFromDays() to get the date from it
+    ///RETURN:
+    ///     = true if success
+    bool toLocal(int64_t nUtc,
+                 int64_t* pOutLocal)
+    {
+        int32_t nOffset = 0;
+        bool bRes = getOffset(nUtc, &nOffset);
+
+        if(pOutLocal)
+            *pOutLocal = bRes ? nUtc + nOffset : 0;
+
+        return bRes;
+    }
+
+
+    ///Get UTC offset of the local time zone
+    ///'nUtc' = number of seconds since midnight of Jan 1, 1970 in UTC
+    ///'pOutOffset' = if not 0, receives UTC offset at 'nUtc', in seconds, or 0 if error
+    ///'pOutFrom' = if not 0, receives the first UTC time, when the offset is the same as at 'nUtc'
+    ///'pOutTo' = if not 0, receives the UTC time after the last one, when the offset is the same as at 'nUtc'
+    ///INFO: Callers that convert sorted times can skip calling it while times stay in ['pOutFrom', 'pOutTo').
+    ///      If 'nUtc' is not in the cached table, the range is up to CIVIL_TIME_SCAN_STEP_SEC long.
+    ///RETURN:
+    ///     = true if success
+    bool getOffset(int64_t nUtc,
+                   int32_t* pOutOffset,
+                   int64_t* pOutFrom = nullptr,
+                   int64_t* pOutTo = nullptr)
+    {
+        bool bRes = true;
+        int32_t nOffset = 0;
+        int64_t nFrom = nUtc;
+        int64_t nTo = nUtc + 1;
+
+        for(;;)
+        {
+            if(true)
+            {
+                //Act from within a lock
+                READER_LOCK rdl(_lock);
+
+                if(_bValid)
+                {
+                    if(nUtc >= _nFrom &&
+                       nUtc < _nTo)
+                    {
+                        //Find the last change at or before 'nUtc'
+                        auto it = std::upper_bound(_arrTrans.begin(), _arrTrans.end(), nUtc,
+                                                   [](int64_t n, const TRANSITION& t)
+                                                   {
+                                                       return n < t.nUtc;
+                                                   });
+
+                        nOffset = it != _arrTrans.begin() ? (it - 1)->nOffsetAfter : _nOffsetFirst;
+                        nFrom = it != _arrTrans.begin() ? (it - 1)->nUtc : _nFrom;
+                        nTo = it != _arrTrans.end() ? it->nUtc : _nTo;
+                    }
+                    else
+                    {
+                        //Not in the table - use the OS
+                        time_t tm = (time_t)nUtc;
+
+                        struct tm t = {};
+                        if(localtime_r(&tm, &t))
+                        {
+                            nOffset = (int32_t)t.tm_gmtoff;
+
+                            //Offset doesn't change more than once per step (same as in _build)
+                            if(pOutTo &&
+                               _getOffset(nUtc + CIVIL_TIME_SCAN_STEP_SEC) == nOffset)
+                            {
+                                nTo = nUtc + CIVIL_TIME_SCAN_STEP_SEC;
+                            }
+                        }
+                        else
+                        {
+                            //Error
+                            bRes = false;
+                        }
+                    }
+
+                    break;
+                }
+            }
+
+            //Build the table
+            WRITER_LOCK wrl(_lock);
+
+            if(!_bValid)
+            {
+                _build();
+            }
+        }
+
+        if(pOutOffset)
+            *pOutOffset = bRes ? nOffset : 0;
+        if(pOutFrom)
+            *pOutFrom = nFrom;
+        if(pOutTo)
+            *pOutTo = nTo;
+
+        return bRes;
+    }
+
+
+    ///Convert an array of local dates & times to UTC
+    ///INFO: Calendar math is done in one pass over the array, and then all UTC offsets
+    ///      are resolved with a single lock. It's fastest if 'pArr' is sorted.
+    ///'pArr' = local dates & times to convert
+    ///'szCnt' = number of elements in 'pArr'
+    ///'pOutUtc' = receives 'szCnt' elements with the number of seconds since midnight of Jan 1, 1970 in UTC,
+    ///            or -1 for elements that could not be converted
+    ///RETURN:
+    ///     = Number of elements that were converted successfully
+    size_t toUtcBatch(const CIVIL_TIME* pArr,
+                      size_t szCnt,
+                      int64_t* pOutUtc)
+    {
+        assert(pArr || !szCnt);
+        assert(pOutUtc || !szCnt);
+
+        //Calendar math
+        std::vector<int64_t> arrLocal(szCnt);
+
+        for(size_t i = 0; i < szCnt; i++)
+        {
+            const CIVIL_TIME& c = pArr[i];
+
+            arrLocal[i] = localSecondsFromCivil(c.nYear, c.nMonth, c.nDay, c.nHour, c.nMinute, c.nSecond);
+        }
+
+        //UTC offsets
+        _resolve(arrLocal.data(), szCnt, pOutUtc);
+
+        size_t szcOK = 0;
+
+        for(size_t i = 0; i < szCnt; i++)
+        {
+            if(pOutUtc[i] == RESOLVE_FAILED)
+            {
+                //Use the OS
+                const CIVIL_TIME& c = pArr[i];
+
+                pOutUtc[i] = _mktime(c.nYear, c.nMonth, c.nDay, c.nHour, c.nMinute, c.nSecond);
+            }
+
+            if(pOutUtc[i] != -1)
+            {
+                szcOK++;
+            }
+        }
+
+        return szcOK;
+    }
+
+
+    ///Discard the cached table of UTC offsets
+    ///IMPORTANT: Call it when the local time zone changes!
+    void invalidate()
+    {
+        WRITER_LOCK wrl(_lock);
+
+        _bValid = false;
+    }
+
+
+    ///Get info about the cached table of UTC offsets
+    ///'pOutFrom' = if not 0, receives the UTC time that the table starts from, or 0 if it's not built yet
+    ///'pOutTo' = if not 0, receives the UTC time that the table ends at, or 0 if it's not built yet
+    ///RETURN:
+    ///     = Number of UTC offset changes in the table
+    size_t getCacheInfo(int64_t* pOutFrom = nullptr,
+                        int64_t* pOutTo = nullptr)
+    {
+        READER_LOCK rdl(_lock);
+
+        if(pOutFrom)
+            *pOutFrom = _bValid ? _nFrom : 0;
+        if(pOutTo)
+            *pOutTo = _bValid ? _nTo : 0;
+
+        return _bValid ? _arrTrans.size() : 0;
+    }
+
+
+
+private:
+
+    static constexpr int64_t RESOLVE_FAILED = INT64_MIN;        //Value that _resolve() outputs for times it could not resolve
+
+    ///Change of the UTC offset
+    struct TRANSITION
+    {
+        int64_t nUtc;                   //UTC time when the offset changed
+        int32_t nOffsetBefore;          //UTC offset before 'nUtc', in seconds
+        int32_t nOffsetAfter;           //UTC offset from 'nUtc', in seconds
+
+        int64_t nLocalStart;            //First local time, that is either skipped or repeated by this change
+        int64_t nLocalEnd;              //First local time after the ones that are skipped or repeated by this change
+    };
+
+
+    ///Resolve local times to UTC with the cached table
+    ///'pLocal' = local times, as returned by localSecondsFromCivil()
+    ///'szCnt' = number of elements in 'pLocal'
+    ///'pOutUtc' = receives 'szCnt' UTC times, or RESOLVE_FAILED for the ones that must be passed to mktime()
+    ///RETURN:
+    ///     = true if all times were resolved
+    bool _resolve(const int64_t* pLocal,
+                  size_t szCnt,
+                  int64_t* pOutUtc)
+    {
+        for(;;)
+        {
+            if(true)
+            {
+                //Act from within a lock
+                READER_LOCK rdl(_lock);
+
+                if(_bValid)
+                {
+                    return _resolveLocked(pLocal, szCnt, pOutUtc);
+                }
+            }
+
+            //Build the table
+            WRITER_LOCK wrl(_lock);
+
+            if(!_bValid)
+            {
+                _build();
+            }
+        }
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    bool _resolveLocked(const int64_t* pLocal,
+                        size_t szCnt,
+                        int64_t* pOutUtc)
+    {
+        bool bAll = true;
+
+        //Local times in the current segment of the table have this offset
+        int64_t nSegStart = 1;
+        int64_t nSegEnd = 0;
+        int32_t nSegOffset = 0;
+
+        for(size_t i = 0; i < szCnt; i++)
+        {
+            int64_t nLocal = pLocal[i];
+
+            if(nLocal < nSegStart ||
+               nLocal >= nSegEnd)
+            {
+                //Find the first change that ends after 'nLocal'
+                auto it = std::upper_bound(_arrTrans.begin(), _arrTrans.end(), nLocal,
+                                           [](int64_t n, const TRANSITION& t)
+                                           {
+                                               return n < t.nLocalEnd;
+                                           });
+
+                if(it != _arrTrans.end() &&
+                   nLocal >= it->nLocalStart)
+                {
+                    //This local time is either skipped or repeated
+                    pOutUtc[i] = RESOLVE_FAILED;
+                    bAll = false;
+
+                    continue;
+                }
+
+                nSegStart = it != _arrTrans.begin() ? (it - 1)->nLocalEnd : INT64_MIN;
+                nSegEnd = it != _arrTrans.end() ? it->nLocalStart : INT64_MAX;
+                nSegOffset = it != _arrTrans.begin() ? (it - 1)->nOffsetAfter : _nOffsetFirst;
+            }
+
+            int64_t nUtc = nLocal - nSegOffset;
+
+            if(nUtc >= _nFrom &&
+               nUtc < _nTo)
+            {
+                pOutUtc[i] = nUtc;
+            }
+            else
+            {
+                //Not in the table
+                pOutUtc[i] = RESOLVE_FAILED;
+                bAll = false;
+            }
+        }
+
+        return bAll;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Build the table of UTC offset changes around the current year
+    void _build()
+    {
+        //Time zone may have changed
+        tzset();
+
+        _arrTrans.clear();
+
+        time_t tNow = time(nullptr);
+
+        struct tm t = {};
+        if(!gmtime_r(&tNow, &t))
+        {
+            //Error
+            assert(false);
+            t.tm_year = 2023 - 1900;
+        }
+
+        _nFrom = daysFromCivil(t.tm_year + 1900 - CIVIL_TIME_CACHE_YEARS_BACK, 1, 1) * 86400;
+        _nTo = daysFromCivil(t.tm_year + 1900 + CIVIL_TIME_CACHE_YEARS_AHEAD + 1, 1, 1) * 86400;
+
+        _nOffsetFirst = _getOffset(_nFrom);
+
+        int32_t nOffsetPrev = _nOffsetFirst;
+
+        for(int64_t n = _nFrom; n < _nTo; )
+        {
+            int64_t nNext = std::min(n + CIVIL_TIME_SCAN_STEP_SEC, _nTo);
+
+            int32_t nOffset = _getOffset(nNext);
+            if(nOffset != nOffsetPrev)
+            {
+                //Offset changed in (n, nNext] - find the exact second
+                int64_t nLo = n;
+                int64_t nHi = nNext;
+
+                while(nHi - nLo > 1)
+                {
+                    int64_t nMid = nLo + (nHi - nLo) / 2;
+
+                    if(_getOffset(nMid) == nOffsetPrev)
+                        nLo = nMid;
+                    else
+                        nHi = nMid;
+                }
+
+                TRANSITION tr;
+                tr.nUtc = nHi;
+                tr.nOffsetBefore = nOffsetPrev;
+                tr.nOffsetAfter = nOffset;
+                tr.nLocalStart = nHi + std::min(nOffsetPrev, nOffset);
+                tr.nLocalEnd = nHi + std::max(nOffsetPrev, nOffset);
+
+                _arrTrans.push_back(tr);
+
+                nOffsetPrev = nOffset;
+            }
+
+            n = nNext;
+        }
+
+        _bValid = true;
+    }
+
+
+    ///RETURN:
+    ///     = UTC offset of the local time zone at 'nUtc', in seconds
+    static int32_t _getOffset(int64_t nUtc)
+    {
+        time_t tm = (time_t)nUtc;
+
+        struct tm t = {};
+        if(!localtime_r(&tm, &t))
+        {
+            //Error
+            assert(false);
+            return 0;
+        }
+
+        return (int32_t)t.tm_gmtoff;
+    }
+
+
+    ///RETURN:
+    ///     = Result of mktime() for the local date & time, with tm_isdst = -1
+    static int64_t _mktime(int nYear,
+                           int nMonth,
+                           int nDay,
+                           int nHour,
+                           int nMinute,
+                           int nSecond)
+    {
+        struct tm t = {};
+        t.tm_year = nYear - 1900;       //years since 1900
+        t.tm_mon = nMonth - 1;          //months since January [0-11]
+        t.tm_mday = nDay;               //day of the month [1-31]
+        t.tm_hour = nHour;              //hours since midnight [0-23]
+        t.tm_min = nMinute;             //minutes after the hour [0-59]
+        t.tm_sec = nSecond;             //seconds after the minute [0-60]
+
+        t.tm_isdst = -1;
+
+        return mktime(&t);
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    LocalTimeConv(const LocalTimeConv& s) = delete;
+    LocalTimeConv& operator = (const LocalTimeConv& s) = delete;
+
+private:
+
+    RDR_WRTR _lock;                             //Lock for accessing this struct
+
+    bool _bValid = false;                       //true if the members below are valid
+    int64_t _nFrom = 0;                         //UTC time that the table starts from
+    int64_t _nTo = 0;                           //UTC time that the table ends at (exclusive)
+    int32_t _nOffsetFirst = 0;                  //UTC offset at '_nFrom', in seconds
+    std::vector<TRANSITION> _arrTrans;          //Changes of the UTC offset, sorted by time
+};
+
+
+
+static_assert(LocalTimeConv::daysFromCivil(1970, 1, 1) == 0, "Unix epoch");
+static_assert(LocalTimeConv::daysFromCivil(2001, 1, 1) * 86400 == 978307200, "Mac epoch");
+static_assert(LocalTimeConv::daysFromCivil(2000, 3, 1) == 11017, "Leap year");
+static_assert(LocalTimeConv::weekdayFromDays(0) == 4 &&
+              LocalTimeConv::weekdayFromDays(-5) == 6, "Weekday");
+static_assert(LocalTimeConv::localSecondsFromCivil(2023, 13, 1, 0, 0, 0) ==
+              LocalTimeConv::localSecondsFromCivil(2024, 1, 1, 0, 0, 0), "Month normalization");
+
+
+
+
+#endif /* civil_time_h */
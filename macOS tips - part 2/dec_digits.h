@@ -0,0 +1,60 @@
+//
+//  dec_digits.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Table of two-digit decimal numbers, that is shared by the formatters of dates and numbers
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef dec_digits_h
+#define dec_digits_h
+
+#include <string.h>
+#include <assert.h>
+
+
+
+
+///"00" to "99" one after another, so that two digits are written with a single copy instead of a division
+///INFO: It's inline, so there's only one copy of it in the whole program.
+inline constexpr char gkDecDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static_assert(sizeof(gkDecDigitPairs) == 100 * 2 + 1, "Must have all pairs from 00 to 99");
+
+
+
+struct DecDigits
+{
+    ///Write 'nVal' as 2 decimal digits (with a leading 0)
+    ///'nVal' = must be less than 100
+    static void put2(char* pDest,
+                     unsigned int nVal)
+    {
+        assert(nVal < 100);
+        memcpy(pDest, gkDecDigitPairs + nVal * 2, 2);
+    }
+};
+
+
+
+
+#endif /* dec_digits_h */
@@ -0,0 +1,370 @@
+//
+//  iso8601.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of how to format date & time as ISO-8601 with plain calendar math,
+//  instead of creating a date formatter
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef iso8601_h
+#define iso8601_h
+
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "civil_time.h"
+#include "dec_digits.h"
+
+
+
+
+#define ISO8601_MAX_LEN 32                      //Max number of chars in "YYYY-MM-DDTHH:MM:SS.uuuuuu+HH:MM"
+#define ISO8601_BUFF_SIZE (ISO8601_MAX_LEN + 1) //Min size of the buffer for Iso8601 functions, in chars (with the null)
+
+
+
+///Formats date & time as ISO-8601, ex: "2023-06-17T10:20:30.123Z" or "2023-06-17T03:20:30.123-07:00"
+///INFO: Years outside of [0, 9999] are clamped, as they can't be written with 4 digits.
+struct Iso8601
+{
+    ///Format UTC date & time with the "Z" suffix
+    ///'nUtc' = number of seconds since midnight of Jan 1, 1970 in UTC
+    ///'nUsec' = microseconds [0-999999]
+    ///'nFracDigits' = number of digits for the fraction of a second: 0, 3 or 6
+    ///'pBuff' = buffer to write into (it's null-terminated)
+    ///'szcBuff' = size of 'pBuff' in chars, must be at least ISO8601_BUFF_SIZE
+    ///RETURN:
+    ///     = Number of chars written, not counting the null, or 0 if error
+    static size_t formatUtc(int64_t nUtc,
+                            uint32_t nUsec,
+                            int nFracDigits,
+                            char* pBuff,
+                            size_t szcBuff)
+    {
+        return _format(nUtc, nUsec, nFracDigits, 0, true, pBuff, szcBuff);
+    }
+
+
+    ///Format local date & time with the UTC offset suffix
+    ///'conv' = converter for the local time zone (its cached table of UTC offsets is used)
+    ///'nUtc' = number of seconds since midnight of Jan 1, 1970 in UTC
+    ///'nUsec' = microseconds [0-999999]
+    ///'nFracDigits' = number of digits for the fraction of a second: 0, 3 or 6
+    ///'pBuff' = buffer to write into (it's null-terminated)
+    ///'szcBuff' = size of 'pBuff' in chars, must be at least ISO8601_BUFF_SIZE
+    ///RETURN:
+    ///     = Number of chars written, not counting the null, or 0 if error
+    static size_t formatLocal(LocalTimeConv& conv,
+                              int64_t nUtc,
+                              uint32_t nUsec,
+                              int nFracDigits,
+                              char* pBuff,
+                              size_t szcBuff)
+    {
+        int64_t nLocal;
+        if(!conv.toLocal(nUtc, &nLocal))
+        {
+            //Failed
+            return 0;
+        }
+
+        return _format(nLocal, nUsec, nFracDigits, (int32_t)(nLocal - nUtc), false, pBuff, szcBuff);
+    }
+
+
+    ///RETURN:
+    ///     = Width of each record written by formatBatch(), in chars (with the separator), or 0 if parameters are wrong
+    static constexpr size_t getBatchWidth(int nFracDigits,
+                                          bool bUtc)
+    {
+        return nFracDigits != 0 && nFracDigits != 3 && nFracDigits != 6 ? 0 :
+            19 + (nFracDigits ? nFracDigits + 1 : 0) + (bUtc ? 1 : 6) + 1;
+    }
+
+
+    ///Format an array of times into fixed-width records, ex: for export of a journal
+    ///INFO: Each record takes getBatchWidth() chars, and ends with 'chSep'. The output is not null-terminated.
+    ///INFO: It's fastest when 'pTimesUs' is sorted: the date, hours & minutes are reformatted only when
+    ///      they change, and the UTC offset is looked up only when a DST change is crossed.
+    ///'pConv' = converter for the local time zone, or 0 to format in UTC (with the "Z" suffix)
+    ///'pTimesUs' = UTC times, in microseconds since the Unix epoch
+    ///'szCnt' = number of elements in 'pTimesUs'
+    ///'nFracDigits' = number of digits for the fraction of a second: 0, 3 or 6
+    ///'chSep' = char to end each record with, ex: '\n'
+    ///'pOut' = buffer to write records into
+    ///'szcOut' = size of 'pOut' in chars, must be at least 'szCnt' * getBatchWidth()
+    ///RETURN:
+    ///     = Number of chars written, or 0 if error
+    static size_t formatBatch(LocalTimeConv* pConv,
+                              const int64_t* pTimesUs,
+                              size_t szCnt,
+                              int nFracDigits,
+                              char chSep,
+                              char* pOut,
+                              size_t szcOut)
+    {
+        bool bUtc = !pConv;
+        size_t szcWidth = getBatchWidth(nFracDigits, bUtc);
+
+        if(!szcWidth ||
+           (szCnt && (!pTimesUs || !pOut)) ||
+           szCnt > szcOut / szcWidth)
+        {
+            //Bad parameters
+            assert(false);
+            return 0;
+        }
+
+        //Range of local times that have 4-digit years
+        static constexpr int64_t kMinLocal = LocalTimeConv::daysFromCivil(0, 1, 1) * 86400;
+        static constexpr int64_t kMaxLocal = LocalTimeConv::daysFromCivil(10000, 1, 1) * 86400;
+
+        static constexpr uint32_t kPow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+        //Template of a record, where only the parts that changed are updated
+        char tmpl[ISO8601_BUFF_SIZE + 1];
+        memcpy(tmpl, "0000-00-00T00:00:00.000000+00:00", ISO8601_MAX_LEN);
+
+        char* pSuffix = tmpl + 19 + (nFracDigits ? nFracDigits + 1 : 0);
+        if(bUtc)
+            pSuffix[0] = 'Z';
+        else
+            pSuffix[3] = ':';
+        tmpl[szcWidth - 1] = chSep;
+
+        int64_t nDayStart = INT64_MIN;          //Local time when the date in 'tmpl' starts
+        int64_t nMinStart = INT64_MIN;          //Local time when the hours & minutes in 'tmpl' start
+        int64_t nOffsetFrom = 0;                //Range of UTC times where 'nOffset' is valid
+        int64_t nOffsetTo = 0;
+        int32_t nOffset = 0;                    //UTC offset in seconds
+
+        uint32_t nFracDiv = 1000000 / kPow10[nFracDigits];
+        uint32_t nSecMul = kPow10[nFracDigits];
+        size_t szcSecAt = 6 - nFracDigits;      //Position of seconds in the output of _digits8()
+
+        char* p = pOut;
+
+        for(size_t i = 0; i < szCnt; i++, p += szcWidth)
+        {
+            //Split into seconds (rounding towards negative infinity) & microseconds
+            int64_t nUtc = pTimesUs[i] / 1000000;
+            int32_t nUsec = (int32_t)(pTimesUs[i] % 1000000);
+            if(nUsec < 0)
+            {
+                nUsec += 1000000;
+                nUtc--;
+            }
+
+            if(!bUtc &&
+               (nUtc < nOffsetFrom || nUtc >= nOffsetTo))
+            {
+                if(!pConv->getOffset(nUtc, &nOffset, &nOffsetFrom, &nOffsetTo))
+                {
+                    //Failed - leave it in UTC
+                    assert(false);
+                }
+
+                uint32_t nAbs = nOffset >= 0 ? (uint32_t)nOffset : (uint32_t)-nOffset;
+
+                pSuffix[0] = nOffset >= 0 ? '+' : '-';
+                DecDigits::put2(pSuffix + 1, (nAbs / 3600) % 100);
+                DecDigits::put2(pSuffix + 4, (nAbs / 60) % 60);
+            }
+
+            int64_t nLocal = nUtc + nOffset;
+
+            if(nLocal < kMinLocal ||
+               nLocal >= kMaxLocal)
+            {
+                //Year is clamped - this is rare, so do it the slow way
+                char buff[ISO8601_BUFF_SIZE];
+                _format(nLocal, nUsec, nFracDigits, nOffset, bUtc, buff, sizeof(buff));
+
+                memcpy(p, buff, szcWidth - 1);
+                p[szcWidth - 1] = chSep;
+
+                continue;
+            }
+
+            if((uint64_t)nLocal - (uint64_t)nMinStart >= 60)
+            {
+                //Minute changed
+                if((uint64_t)nLocal - (uint64_t)nDayStart >= 86400)
+                {
+                    //Day changed
+                    int64_t nDays = nLocal >= 0 ? nLocal / 86400 : (nLocal - 86399) / 86400;
+                    nDayStart = nDays * 86400;
+
+                    int nYear, nMonth, nDay;
+                    LocalTimeConv::civilFromDays(nDays, &nYear, &nMonth, &nDay);
+
+                    DecDigits::put2(tmpl + 0, (unsigned int)nYear / 100);
+                    DecDigits::put2(tmpl + 2, (unsigned int)nYear % 100);
+                    DecDigits::put2(tmpl + 5, (unsigned int)nMonth);
+                    DecDigits::put2(tmpl + 8, (unsigned int)nDay);
+                }
+
+                uint32_t nMinOfDay = (uint32_t)(nLocal - nDayStart) / 60;
+                nMinStart = nDayStart + nMinOfDay * 60;
+
+                DecDigits::put2(tmpl + 11, nMinOfDay / 60);
+                DecDigits::put2(tmpl + 14, nMinOfDay % 60);
+            }
+
+            memcpy(p, tmpl, szcWidth);
+
+            //Seconds & fraction are converted together
+            char digits[8];
+            _digits8((uint32_t)(nLocal - nMinStart) * nSecMul + (uint32_t)nUsec / nFracDiv, digits);
+
+            memcpy(p + 17, digits + szcSecAt, 2);
+            memcpy(p + 20, digits + 8 - nFracDigits, nFracDigits);
+        }
+
+        return p - pOut;
+    }
+
+
+
+private:
+
+    ///'nSec' = seconds since midnight of Jan 1, 1970, in the time zone of 'nOffset'
+    ///'nOffset' = UTC offset in seconds, that is written if 'bUtc' is false
+    static size_t _format(int64_t nSec,
+                          uint32_t nUsec,
+                          int nFracDigits,
+                          int32_t nOffset,
+                          bool bUtc,
+                          char* pBuff,
+                          size_t szcBuff)
+    {
+        if(!pBuff ||
+           szcBuff < ISO8601_BUFF_SIZE ||
+           (nFracDigits != 0 && nFracDigits != 3 && nFracDigits != 6))
+        {
+            //Bad parameters
+            assert(false);
+            return 0;
+        }
+
+        if(nUsec > 999999)
+            nUsec = 999999;
+
+        //Split into days and seconds of the day (rounding towards negative infinity)
+        int64_t nDays = nSec >= 0 ? nSec / 86400 : (nSec - 86399) / 86400;
+        uint32_t nSecOfDay = (uint32_t)(nSec - nDays * 86400);
+
+        int nYear, nMonth, nDay;
+        LocalTimeConv::civilFromDays(nDays, &nYear, &nMonth, &nDay);
+
+        if(nYear < 0)
+        {
+            nYear = 0;
+            nMonth = 1;
+            nDay = 1;
+            nSecOfDay = 0;
+        }
+        else if(nYear > 9999)
+        {
+            nYear = 9999;
+            nMonth = 12;
+            nDay = 31;
+            nSecOfDay = 86399;
+        }
+
+        char* p = pBuff;
+
+        DecDigits::put2(p + 0, (unsigned int)nYear / 100);
+        DecDigits::put2(p + 2, (unsigned int)nYear % 100);
+        p[4] = '-';
+        DecDigits::put2(p + 5, (unsigned int)nMonth);
+        p[7] = '-';
+        DecDigits::put2(p + 8, (unsigned int)nDay);
+        p[10] = 'T';
+        DecDigits::put2(p + 11, nSecOfDay / 3600);
+        p[13] = ':';
+        DecDigits::put2(p + 14, (nSecOfDay / 60) % 60);
+        p[16] = ':';
+        DecDigits::put2(p + 17, nSecOfDay % 60);
+        p += 19;
+
+        if(nFracDigits == 3)
+        {
+            unsigned int nMs = nUsec / 1000;
+
+            p[0] = '.';
+            p[1] = (char)('0' + nMs / 100);
+            DecDigits::put2(p + 2, nMs % 100);
+            p += 4;
+        }
+        else if(nFracDigits == 6)
+        {
+            p[0] = '.';
+            DecDigits::put2(p + 1, nUsec / 10000);
+            DecDigits::put2(p + 3, (nUsec / 100) % 100);
+            DecDigits::put2(p + 5, nUsec % 100);
+            p += 7;
+        }
+
+        if(bUtc)
+        {
+            *p++ = 'Z';
+        }
+        else
+        {
+            uint32_t nAbs = nOffset >= 0 ? (uint32_t)nOffset : (uint32_t)-nOffset;
+
+            p[0] = nOffset >= 0 ? '+' : '-';
+            DecDigits::put2(p + 1, (nAbs / 3600) % 100);
+            p[3] = ':';
+            DecDigits::put2(p + 4, (nAbs / 60) % 60);
+            p += 6;
+        }
+
+        *p = 0;
+
+        return p - pBuff;
+    }
+
+
+    ///Write 'nVal' as 8 decimal digits (with leading 0's)
+    ///INFO: All digits are computed at once in a 64-bit register (SWAR), instead of dividing by 10 in a loop.
+    ///'nVal' = must be less than 100,000,000
+    static void _digits8(uint32_t nVal,
+                         char* pDest)
+    {
+        static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Digits are stored in the little-endian order");
+
+        assert(nVal < 100000000);
+
+        //Split into 4-digit halves: low 32 bits have the higher half
+        uint64_t v = nVal / 10000 | (uint64_t)(nVal % 10000) << 32;
+
+        //Split each half into 2-digit parts (x / 100 == x * 10486 >> 20 for x < 10000)
+        uint64_t nHi = (v * 10486 >> 20) & 0x0000007F0000007Full;
+        v = (v - nHi * 100) << 16 | nHi;
+
+        //Split each part into digits (x / 10 == x * 103 >> 10 for x < 100)
+        uint64_t nTens = (v * 103 >> 10) & 0x000F000F000F000Full;
+        v = (v - nTens * 10) << 8 | nTens;
+
+        v |= 0x3030303030303030ull;
+        memcpy(pDest, &v, 8);
+    }
+};
+
+
+
+
+#endif /* iso8601_h */
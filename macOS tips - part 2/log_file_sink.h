@@ -0,0 +1,648 @@
+//
+//  log_file_sink.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of a log file sink for 'AsyncLogger' that gathers lines into large blocks, writes
+//  them with a single writev() call, and rotates log files by size on its own thread
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef log_file_sink_h
+#define log_file_sink_h
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "types.h"
+#include "async_log.h"
+
+
+
+
+#define ASYNC_LOG_FILE_BLOCK_SIZE (64 * 1024)           //Size of a single block that lines are gathered into, in bytes
+#define ASYNC_LOG_FILE_FLUSH_SIZE (256 * 1024)          //Write blocks to the file when this many bytes were gathered ...
+#define ASYNC_LOG_FILE_FLUSH_MS 1000                    //... or when this many ms have passed
+#define ASYNC_LOG_FILE_MAX_QUEUED (16 * 1024 * 1024)    //Lines are dropped if this many bytes are waiting to be written (ex: if the disk is stuck)
+#define ASYNC_LOG_FILE_FREE_BLOCKS 8                    //Max number of blocks to keep for reuse
+#define ASYNC_LOG_FILE_MAX_IOV 64                       //Max number of blocks to write with a single writev() call
+
+#define ASYNC_LOG_FILE_MAX_SIZE (10 * 1024 * 1024)      //Default size of a log file to rotate it at, in bytes
+#define ASYNC_LOG_FILE_MAX_FILES 5                      //Default number of rotated log files to keep
+
+static_assert(ASYNC_LOG_FILE_MAX_IOV <= 1024, "ASYNC_LOG_FILE_MAX_IOV must not exceed IOV_MAX!");
+
+
+
+///Statistics for 'AsyncLogSink_File'
+struct ASYNC_LOG_FILE_STATS
+{
+    size_t szcLines = 0;                //Number of lines written to log files
+    size_t szcBytes = 0;                //Number of bytes written to log files
+    size_t szcWrites = 0;               //Number of writev() calls
+    size_t szcRotations = 0;            //Number of times log files were rotated
+    size_t szcDurableFlushes = 0;       //Number of times the log file was synced to disk
+    size_t szcDroppedBytes = 0;         //Number of bytes that were dropped because too much was waiting to be written
+    size_t szcErrors = 0;               //Number of failed writes, syncs, or opens of log files
+};
+
+
+
+///Sink for 'AsyncLogger' that writes into a log file
+///INFO: Lines are only copied into blocks in memory by write(). Blocks are written to the file by the
+///      background thread of this struct, when enough of them were gathered, or on a timer. The same
+///      thread rotates the file when it reaches its max size, thus neither the logger, nor the threads
+///      that log, ever wait for the disk (unless flush() is called).
+///      Rotated files are named with a numeric suffix: "name.log.1" is the newest, "name.log.N" is the oldest.
+struct AsyncLogSink_File : public AsyncLogSink
+{
+    AsyncLogSink_File()
+    {
+    }
+
+    virtual ~AsyncLogSink_File()
+    {
+        close();
+
+        for(BLOCK* pBlock : _arrFree)
+        {
+            delete pBlock;
+        }
+    }
+
+
+    ///Open log file and start writing into it
+    ///'pstrPath' = path to the log file - it's created if it doesn't exist, or appended to if it does
+    ///'szcMaxFileSize' = size of the file in bytes to rotate it at, or 0 not to rotate it
+    ///'nMaxFiles' = number of rotated files to keep (older ones are deleted), or 0 to keep none
+    ///RETURN:
+    ///     = true if success
+    ///     = false if error (check errno for details)
+    bool open(const char* pstrPath,
+              size_t szcMaxFileSize = ASYNC_LOG_FILE_MAX_SIZE,
+              int nMaxFiles = ASYNC_LOG_FILE_MAX_FILES)
+    {
+        if(!pstrPath ||
+           !pstrPath[0] ||
+           nMaxFiles < 0)
+        {
+            //Bad parameters
+            assert(false);
+            errno = EINVAL;
+            return false;
+        }
+
+        //Close the previous file, if any
+        close();
+
+        int fd = _openFile(pstrPath);
+        if(fd == -1)
+        {
+            //Failed
+            return false;
+        }
+
+        struct stat st = {};
+        if(fstat(fd, &st) != 0)
+        {
+            //Failed
+            int nErr = errno;
+            ::close(fd);
+            errno = nErr;
+            return false;
+        }
+
+        //Act from within a lock
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _fd = fd;
+        _strPath = pstrPath;
+        _szcMaxFileSize = szcMaxFileSize;
+        _nMaxFiles = nMaxFiles;
+        _szcFileSize = (size_t)st.st_size;
+
+        _bStop = false;
+        _thread = std::thread(&AsyncLogSink_File::_threadProc, this);
+
+        return true;
+    }
+
+
+    ///Write out everything that was gathered, sync it to disk, and close the log file
+    ///INFO: Lines that are passed into write() after this call are dropped.
+    void close()
+    {
+        std::thread thrd;
+
+        if(true)
+        {
+            //Act from within a lock
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            if(!_thread.joinable())
+            {
+                //Not open
+                return;
+            }
+
+            _bStop = true;
+            thrd.swap(_thread);
+        }
+
+        //The thread writes out the rest before it exits
+        _cv.notify_all();
+        thrd.join();
+
+        if(_fd != -1)
+        {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+
+    ///Gather lines to be written by the background thread
+    ///INFO: Called from the background thread of 'AsyncLogger'.
+    virtual void write(const char* pText, size_t szcLen) override
+    {
+        if(!szcLen)
+            return;
+
+        size_t szcLines = (size_t)std::count(pText, pText + szcLen, '\n');
+
+        bool bNotify = false;
+
+        if(true)
+        {
+            //Act from within a lock
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            if(!_thread.joinable() ||
+               _szcQueued + szcLen > ASYNC_LOG_FILE_MAX_QUEUED)
+            {
+                //Not open, or the disk can't keep up
+                _stats.szcDroppedBytes += szcLen;
+                return;
+            }
+
+            //INFO: Lines are not split between blocks, so that a rotated file always ends with a full line
+            BLOCK* pBlock = !_arrQueued.empty() ? _arrQueued.back() : nullptr;
+
+            if(!pBlock ||
+               pBlock->szcUsed + szcLen > pBlock->arrData.size())
+            {
+                pBlock = _getBlock(szcLen);
+                _arrQueued.push_back(pBlock);
+            }
+
+            memcpy(pBlock->arrData.data() + pBlock->szcUsed, pText, szcLen);
+            pBlock->szcUsed += szcLen;
+            pBlock->szcLines += szcLines;
+
+            _szcQueued += szcLen;
+
+            bNotify = _szcQueued >= ASYNC_LOG_FILE_FLUSH_SIZE;
+        }
+
+        if(bNotify)
+        {
+            _cv.notify_all();
+        }
+    }
+
+
+    ///Wait until everything that was gathered so far is written to the log file
+    ///'bDurable' = true to also make sure that it's on disk - use it before the system sleeps or shuts down
+    virtual void flush(bool bDurable) override
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if(!_thread.joinable())
+        {
+            //Not open
+            return;
+        }
+
+        uint64_t nReq = ++_nFlushRequested;
+        if(bDurable)
+            _nDurableRequested = nReq;
+
+        _cv.notify_all();
+
+        _cvFlushed.wait(lock, [this, nReq]()
+        {
+            return _nFlushCompleted >= nReq;
+        });
+    }
+
+
+    ///Get statistics
+    ///'pOutStats' = receives statistics since the struct was created
+    void getStats(ASYNC_LOG_FILE_STATS* pOutStats)
+    {
+        assert(pOutStats);
+
+        //Act from within a lock
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        *pOutStats = _stats;
+    }
+
+
+
+private:
+
+    struct BLOCK
+    {
+        std::vector<char> arrData;      //Buffer for lines (its size is the capacity of the block)
+        size_t szcUsed = 0;             //Number of bytes used in 'arrData'
+        size_t szcLines = 0;            //Number of lines in 'arrData'
+    };
+
+
+    ///IMPORTANT: Must be called from within '_mutex'!
+    ///RETURN:
+    ///     = Empty block that can fit at least 'szcMin' bytes
+    BLOCK* _getBlock(size_t szcMin)
+    {
+        if(szcMin <= ASYNC_LOG_FILE_BLOCK_SIZE &&
+           !_arrFree.empty())
+        {
+            BLOCK* pBlock = _arrFree.back();
+            _arrFree.pop_back();
+
+            return pBlock;
+        }
+
+        BLOCK* pBlock = new BLOCK();
+        pBlock->arrData.resize(std::max(szcMin, (size_t)ASYNC_LOG_FILE_BLOCK_SIZE));
+
+        return pBlock;
+    }
+
+
+    ///RETURN:
+    ///     = File descriptor of the opened log file, or
+    ///     = -1 if error (check errno for details)
+    static int _openFile(const char* pstrPath)
+    {
+        return ::open(pstrPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+
+
+    ///Write all of 'iov' into the log file
+    ///INFO: Called from the background thread only.
+    ///RETURN:
+    ///     = true if success
+    bool _writeAll(struct iovec* iov,
+                   int nCnt)
+    {
+        while(nCnt > 0)
+        {
+            ssize_t nWritten = writev(_fd, iov, nCnt);
+            _szcWritesLocal++;
+
+            if(nWritten < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+
+                //Failed
+                return false;
+            }
+
+            //Skip what was written (it's rare for a file, but it may do a partial write)
+            size_t szcLeft = (size_t)nWritten;
+
+            while(nCnt > 0 &&
+                  szcLeft >= iov->iov_len)
+            {
+                szcLeft -= iov->iov_len;
+                iov++;
+                nCnt--;
+            }
+
+            if(nCnt > 0)
+            {
+                iov->iov_base = (char*)iov->iov_base + szcLeft;
+                iov->iov_len -= szcLeft;
+            }
+        }
+
+        return true;
+    }
+
+
+    ///Rename the current log file to "name.1", shift older ones, and start a new one
+    ///INFO: Called from the background thread only.
+    ///RETURN:
+    ///     = true if success
+    bool _rotate()
+    {
+        if(_nMaxFiles > 0)
+        {
+            //INFO: The oldest one is overwritten by the rename
+            for(int i = _nMaxFiles - 1; i >= 1; i--)
+            {
+                std::string strFrom = _strPath + "." + std::to_string(i);
+                std::string strTo = _strPath + "." + std::to_string(i + 1);
+
+                if(rename(strFrom.c_str(), strTo.c_str()) != 0 &&
+                   errno != ENOENT)
+                {
+                    //Failed - keep going
+                    _szcErrorsLocal++;
+                }
+            }
+
+            std::string strTo = _strPath + ".1";
+            if(rename(_strPath.c_str(), strTo.c_str()) != 0 &&
+               errno != ENOENT)
+            {
+                //Failed
+                _szcErrorsLocal++;
+            }
+        }
+        else
+        {
+            //Don't keep any
+            if(unlink(_strPath.c_str()) != 0 &&
+               errno != ENOENT)
+            {
+                //Failed
+                _szcErrorsLocal++;
+            }
+        }
+
+        if(_fd != -1)
+        {
+            ::close(_fd);
+        }
+
+        _fd = _openFile(_strPath.c_str());
+        _szcFileSize = 0;
+
+        if(_fd == -1)
+        {
+            //Failed - we'll try again with the next write
+            _szcErrorsLocal++;
+            return false;
+        }
+
+        _szcRotationsLocal++;
+
+        return true;
+    }
+
+
+    ///Write blocks into the log file, and rotate it as needed
+    ///INFO: Called from the background thread only.
+    void _writeBlocks(const std::vector<BLOCK*>& arrBlocks)
+    {
+        struct iovec iov[ASYNC_LOG_FILE_MAX_IOV];
+
+        size_t i = 0;
+        while(i < arrBlocks.size())
+        {
+            //Rotate if the next block doesn't fit into the file
+            if(_fd == -1 ||
+               (_szcMaxFileSize &&
+                _szcFileSize &&
+                _szcFileSize + arrBlocks[i]->szcUsed > _szcMaxFileSize))
+            {
+                if(!_rotate())
+                {
+                    //Failed - lose these blocks
+                    for(; i < arrBlocks.size(); i++)
+                    {
+                        _szcDroppedLocal += arrBlocks[i]->szcUsed;
+                    }
+
+                    break;
+                }
+            }
+
+            //Take as many blocks as will fit into the file
+            int nCnt = 0;
+            size_t szcBytes = 0;
+            size_t szcLines = 0;
+
+            do
+            {
+                const BLOCK* pBlock = arrBlocks[i];
+
+                iov[nCnt].iov_base = (void*)pBlock->arrData.data();
+                iov[nCnt].iov_len = pBlock->szcUsed;
+                nCnt++;
+
+                szcBytes += pBlock->szcUsed;
+                szcLines += pBlock->szcLines;
+
+                i++;
+            }
+            while(i < arrBlocks.size() &&
+                  nCnt < ASYNC_LOG_FILE_MAX_IOV &&
+                  (!_szcMaxFileSize ||
+                   _szcFileSize + szcBytes + arrBlocks[i]->szcUsed <= _szcMaxFileSize));
+
+            if(_writeAll(iov, nCnt))
+            {
+                _szcFileSize += szcBytes;
+
+                _szcBytesLocal += szcBytes;
+                _szcLinesLocal += szcLines;
+            }
+            else
+            {
+                //Failed
+                _szcErrorsLocal++;
+                _szcDroppedLocal += szcBytes;
+            }
+        }
+    }
+
+
+    ///Make sure that what was written to the log file is on disk
+    ///INFO: Called from the background thread only.
+    void _sync()
+    {
+        if(_fd == -1)
+            return;
+
+#ifdef F_FULLFSYNC
+        //INFO: On macOS fsync() doesn't flush the drive's cache
+        if(fcntl(_fd, F_FULLFSYNC) == 0)
+        {
+            _szcDurableLocal++;
+            return;
+        }
+#endif
+
+        if(fsync(_fd) == 0)
+        {
+            _szcDurableLocal++;
+        }
+        else
+        {
+            //Failed
+            _szcErrorsLocal++;
+        }
+    }
+
+
+    void _threadProc()
+    {
+        std::vector<BLOCK*> arrWriting;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        for(;;)
+        {
+            _cv.wait_for(lock, std::chrono::milliseconds(ASYNC_LOG_FILE_FLUSH_MS), [this]()
+            {
+                return _bStop ||
+                       _nFlushRequested > _nFlushCompleted ||
+                       _szcQueued >= ASYNC_LOG_FILE_FLUSH_SIZE;
+            });
+
+            bool bStop = _bStop;
+            uint64_t nFlushReq = _nFlushRequested;
+            bool bDurable = bStop || _nDurableRequested > _nFlushCompleted;
+
+            //Take what was gathered so far, and let write() start new blocks
+            arrWriting.swap(_arrQueued);
+            _szcQueued = 0;
+
+            //Write it outside of the lock
+            lock.unlock();
+
+            _writeBlocks(arrWriting);
+
+            if(bDurable)
+            {
+                _sync();
+            }
+
+            lock.lock();
+
+            //Reuse blocks
+            for(BLOCK* pBlock : arrWriting)
+            {
+                if(_arrFree.size() < ASYNC_LOG_FILE_FREE_BLOCKS &&
+                   pBlock->arrData.size() == ASYNC_LOG_FILE_BLOCK_SIZE)
+                {
+                    pBlock->szcUsed = 0;
+                    pBlock->szcLines = 0;
+
+                    _arrFree.push_back(pBlock);
+                }
+                else
+                {
+                    delete pBlock;
+                }
+            }
+
+            arrWriting.clear();
+
+            _stats.szcLines += _szcLinesLocal;
+            _stats.szcBytes += _szcBytesLocal;
+            _stats.szcWrites += _szcWritesLocal;
+            _stats.szcRotations += _szcRotationsLocal;
+            _stats.szcDurableFlushes += _szcDurableLocal;
+            _stats.szcDroppedBytes += _szcDroppedLocal;
+            _stats.szcErrors += _szcErrorsLocal;
+
+            _szcLinesLocal = 0;
+            _szcBytesLocal = 0;
+            _szcWritesLocal = 0;
+            _szcRotationsLocal = 0;
+            _szcDurableLocal = 0;
+            _szcDroppedLocal = 0;
+            _szcErrorsLocal = 0;
+
+            if(nFlushReq > _nFlushCompleted)
+            {
+                _nFlushCompleted = nFlushReq;
+                _cvFlushed.notify_all();
+            }
+
+            if(bStop)
+            {
+                //Release anyone who is still waiting for a flush
+                _nFlushCompleted = _nFlushRequested;
+                _cvFlushed.notify_all();
+
+                break;
+            }
+        }
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    AsyncLogSink_File(const AsyncLogSink_File& s) = delete;
+    AsyncLogSink_File& operator = (const AsyncLogSink_File& s) = delete;
+
+private:
+
+    std::mutex _mutex;                                  //Lock for accessing this struct
+    std::condition_variable _cv;                        //Wakes up '_thread'
+    std::condition_variable _cvFlushed;                 //Signaled when a flush completes
+    std::thread _thread;                                //Thread that writes into the log file
+    bool _bStop = false;                                //true to stop '_thread'
+
+    std::vector<BLOCK*> _arrQueued;                     //Blocks waiting to be written (the last one is being filled)
+    std::vector<BLOCK*> _arrFree;                       //Blocks for reuse
+    size_t _szcQueued = 0;                              //Number of bytes in '_arrQueued'
+
+    uint64_t _nFlushRequested = 0;                      //Number of flush() calls
+    uint64_t _nDurableRequested = 0;                    //Last flush() call that asked for a durable flush
+    uint64_t _nFlushCompleted = 0;                      //Last flush() call that was completed
+
+    ASYNC_LOG_FILE_STATS _stats;                        //Statistics
+
+    //Used by '_thread' only (or when it's not running)
+    int _fd = -1;                                       //Log file
+    std::string _strPath;                               //Path to the log file
+    size_t _szcMaxFileSize = 0;                         //Size to rotate the log file at, or 0 not to rotate it
+    int _nMaxFiles = 0;                                 //Number of rotated files to keep
+    size_t _szcFileSize = 0;                            //Current size of the log file
+
+    size_t _szcLinesLocal = 0;                          //Statistics since the last time they were added to '_stats'
+    size_t _szcBytesLocal = 0;
+    size_t _szcWritesLocal = 0;
+    size_t _szcRotationsLocal = 0;
+    size_t _szcDurableLocal = 0;
+    size_t _szcDroppedLocal = 0;
+    size_t _szcErrorsLocal = 0;
+};
+
+
+
+
+#endif /* log_file_sink_h */
@@ -14,6 +14,7 @@
 
 #include <iostream>
 #include <string>
+#include <array>
 
 #include <assert.h>                     //Assertions
 #include <sys/time.h>
@@ -25,6 +26,17 @@
 #include "notif_reboot_shutdown.h"
 #include "notif_sleep_wake.h"
 #include "wake_timer.h"
+#include "wake_scheduler.h"
+#include "wake_timer_debounce.h"
+#include "wake_stats.h"
+#include "wake_attribution.h"
+#include "wake_broker.h"
+#include "timer_service.h"
+#include "time_stamp.h"
+#include "async_log.h"
+#include "log_file_sink.h"
+#include "pwr_evt_record.h"
+#include "pwr_msg_handlers.h"
 
 #include "synched_data.h"               //Synchronization template class from "macOS tips - part 1"
 #include "CFString_conv.h"
@@ -35,11 +47,13 @@
 void addSignalCallbacks(int sig);
 void signalCallback(int sig, siginfo_t *info, void *context);
 void callback_RebootShutdownLogout(mach_msg_header_t* pHeader,
-                                   const char* pPortName,
+                                   NAME_ID nPortNameID,
                                    const void* pParam1,
                                    const void* pParam2);
-CURRENT_REBOOT_SHUTDOWN_STATE get_CURRENT_REBOOT_SHUTDOWN_STATE_by_port_name(const char* pPortName);
+CURRENT_REBOOT_SHUTDOWN_STATE get_CURRENT_REBOOT_SHUTDOWN_STATE_by_port_name(NAME_ID nPortNameID);
 std::string current_time_as_string();
+void output_pwr_event(PWR_EVT_RECORD& rec);
+void callback_OutputWakeStats(CFRunLoopTimerRef timer, void* info);
 
 void callback_SleepWake(natural_t msgType,
                         void *msgArgument,
@@ -75,6 +89,13 @@ SYNCHED_DATA<REBOOT_SHUTDOWN_STATE> g_RebootShutdownState({});  //Current state
 
 Notif_SleepWake g_NtfSleepWake;                                 //Class to service: sleep/wake notifications
 WakeTimer g_WkTmr("com.dennisbabkin.wake01");                   //Timer for waking macOS from sleep
+WakeScheduler g_WkSched(g_WkTmr);                               //Logical wake timers that share 'g_WkTmr'
+WakeTimer g_WkTmr2("com.dennisbabkin.wake02");                  //Timer for waking macOS from sleep, that is rescheduled often
+WakeTimerDebounced g_WkTmrDbnc(g_WkTmr2);                       //Debounced access to 'g_WkTmr2'
+WakeStats g_WkStats;                                            //Wake lateness & resume duration for our wake timers
+WakeAttribution g_WkAttr;                                       //Which scheduled wake events (of all apps) woke up macOS
+TimerService g_TmrSvc;                                          //In-process timers that know about sleep
+AsyncLogSink_File g_LogFile;                                    //Log file (if it's used instead of the stdout)
 
 
 
@@ -84,14 +105,67 @@ WakeTimer g_WkTmr("com.dennisbabkin.wake01");                   //Timer for waki
 
 
 //Entry point for this executable
+//  Command line options:
+//      -log <path>     = write our log into a file, instead of the stdout, ex: -log /var/log/com.dennisbabkin.pwr_evts.log
+//      -stats          = output wake stats & attribution every minute
+//      -broker         = run as the wake-timer broker for other processes
+//      -timers         = add in-process timers, to see what happens to them across sleep
 //
 int main(int argc, const char * argv[])
 {
+    //Parse command line
+    const char* pstrLogPath = nullptr;
+    bool bOutputStats = false;
+    bool bRunBroker = false;
+    bool bAddTimers = false;
+    
+    for(int a = 1; a < argc; a++)
+    {
+        if(strcmp(argv[a], "-log") == 0 &&
+           a + 1 < argc)
+        {
+            pstrLogPath = argv[++a];
+        }
+        else if(strcmp(argv[a], "-stats") == 0)
+        {
+            bOutputStats = true;
+        }
+        else if(strcmp(argv[a], "-broker") == 0)
+        {
+            bRunBroker = true;
+        }
+        else if(strcmp(argv[a], "-timers") == 0)
+        {
+            bAddTimers = true;
+        }
+        else
+        {
+            printf("Unknown option: %s\n", argv[a]);
+            return 1;
+        }
+    }
+    
+    
     //Assuming that we're the launch-daemon/agent, we need to handle some signals
     addSignalCallbacks(SIGTERM);
     addSignalCallbacks(SIGINT);
     
     
+    //Write our log into a file, instead of the stdout
+    if(pstrLogPath)
+    {
+        if(g_LogFile.open(pstrLogPath))
+        {
+            AsyncLogger::get().setSink(&g_LogFile);
+        }
+        else
+        {
+            //Failed
+            assert(false);
+        }
+    }
+    
+    
     //Register to receive notifications of shutdown, reboot & user logout
     static_assert(SIZEOF(g_Ntfs) == SIZEOF(gkNotifNames), "Number of elements in each array must be the same!");
     
@@ -106,6 +180,22 @@ int main(int argc, const char * argv[])
     }
 
     
+    //Collect wake stats for our wake timers
+    if(!g_WkStats.watchTimer(&g_WkTmr) ||
+       !g_WkStats.watchTimer(&g_WkTmr2))
+    {
+        //Failed
+        assert(false);
+    }
+    
+    //Sleep/wake notifications are delivered on this thread (via the main run loop), so
+    //make its log ring now, instead of on the first notification
+    if(!AsyncLogger::get().prepareThread())
+    {
+        //Failed
+        assert(false);
+    }
+    
     //Register to receive sleep/wake notifications
     if(!g_NtfSleepWake.init_SleepWakeNotifications(callback_SleepWake))
     {
@@ -113,6 +203,67 @@ int main(int argc, const char * argv[])
         assert(false);
     }
     
+    //Output wake stats & attribution every minute (on the main run loop)
+    if(bOutputStats)
+    {
+        CFRunLoopTimerRef refTmr = CFRunLoopTimerCreate(kCFAllocatorDefault,
+                                                        CFAbsoluteTimeGetCurrent() + 60,
+                                                        60,
+                                                        0,
+                                                        0,
+                                                        callback_OutputWakeStats,
+                                                        nullptr);
+        if(refTmr)
+        {
+            CFRunLoopAddTimer(CFRunLoopGetMain(), refTmr, kCFRunLoopCommonModes);
+            
+            //The run loop keeps it
+            CFRelease(refTmr);
+        }
+        else
+        {
+            //Failed
+            assert(false);
+        }
+    }
+    
+    //Run as the wake-timer broker for other processes
+    if(bRunBroker)
+    {
+        //INFO: Logical timers of all clients are merged by 'g_WkSched' into a single OS wake event
+        static WakeBrokerServer s_broker(g_WkSched);
+        
+        //INFO: Clients find it at the same path, since only processes of the same user can connect
+        std::string strSockPath;
+        WakeBrokerServer::getDefaultSocketPath(strSockPath);
+        
+        if(!s_broker.start(strSockPath.c_str()))
+        {
+            //Failed
+            assert(false);
+        }
+    }
+    
+    //Add in-process timers, to see what happens to them across sleep
+    if(bAddTimers)
+    {
+        auto pfnCallback = [](uint64_t nTimerID, const void* pParam1, const void* pParam2)
+        {
+            printf("%s > In-process timer fired: %s\n",
+                   current_time_as_string().c_str(),
+                   (const char*)pParam1);
+        };
+        
+        //Every minute - fire once after a wake, if it was missed
+        g_TmrSvc.addTimer(60 * 1000, 60 * 1000, TSP_FIRE_ONCE_IF_MISSED, pfnCallback, "fire-once");
+        
+        //Every 5 minutes - don't fire for missed ones
+        g_TmrSvc.addTimer(5 * 60 * 1000, 5 * 60 * 1000, TSP_SKIP_MISSED, pfnCallback, "skip-missed");
+        
+        //In 10 minutes of awake time
+        g_TmrSvc.addTimer(10 * 60 * 1000, 0, TSP_SHIFT_BY_SLEEP, pfnCallback, "shift-by-sleep");
+    }
+    
 
     
     //Test wake timer
@@ -169,6 +320,10 @@ int main(int argc, const char * argv[])
         assert(false);
     }
     
+    //Write out the rest of our log (it goes into the stdout after this)
+    AsyncLogger::get().setSink(nullptr);
+    g_LogFile.close();
+    
     return 0;
 }
 
@@ -216,28 +371,9 @@ void addSignalCallbacks(int sig)
 ///Return string with the current date and time
 std::string current_time_as_string()
 {
-    //Get current time
-    timeval tv = {};
-    gettimeofday(&tv, nullptr);
-    
-    tm dtm = {};
-    localtime_r(&tv.tv_sec, &dtm);
-    
-    char buff[128];
-    buff[0] = 0;
-    
-    snprintf(buff, SIZEOF(buff),
-             "%04u-%02u-%02u %02u:%02u:%02u.%06u"
-                             ,
-             1900 + dtm.tm_year,
-             1 + dtm.tm_mon,
-             dtm.tm_mday,
-             dtm.tm_hour,
-             dtm.tm_min,
-             dtm.tm_sec,
-             tv.tv_usec);
-    
-    buff[SIZEOF(buff) - 1] = 0;
+    //INFO: Use TimeStamp::formatNow() directly to avoid the heap allocation
+    char buff[TIME_STAMP_BUFF_SIZE];
+    TimeStamp::formatNow(buff, SIZEOF(buff));
     
     return buff;
 }
@@ -247,7 +383,7 @@ std::string current_time_as_string()
 
 ///Callback that is invoked for the reboot, shutdown, or logout notifications
 void callback_RebootShutdownLogout(mach_msg_header_t* pHeader,
-                                   const char* pPortName,
+                                   NAME_ID nPortNameID,
                                    const void* pParam1,
                                    const void* pParam2)
 {
@@ -255,16 +391,19 @@ void callback_RebootShutdownLogout(mach_msg_header_t* pHeader,
     UNREFERENCED_PARAMETER(pParam1);
     UNREFERENCED_PARAMETER(pParam2);
     
-    //See what notification it is
-    printf("%s > Received notification: %s\n", current_time_as_string().c_str(), pPortName);
-    
-    
     //Convert port name to a state value
-    CURRENT_REBOOT_SHUTDOWN_STATE new_state = get_CURRENT_REBOOT_SHUTDOWN_STATE_by_port_name(pPortName);
+    CURRENT_REBOOT_SHUTDOWN_STATE new_state = get_CURRENT_REBOOT_SHUTDOWN_STATE_by_port_name(nPortNameID);
     
     //Keep previous state
     static CURRENT_REBOOT_SHUTDOWN_STATE prev_state = CRS_STATE_Unknown;
     
+    PWR_EVT_RECORD rec;
+    rec.stamp();
+    rec.source = PES_RebootShutdown;
+    rec.nMsgType = new_state;
+    rec.pstrMsgName = NameTable::get().getName(nPortNameID);
+    rec.nStateBefore = prev_state;
+    
     if(new_state == CRS_STATE_Cancelled)
     {
         //User canceled the UI
@@ -295,29 +434,49 @@ void callback_RebootShutdownLogout(mach_msg_header_t* pHeader,
         
         //Remember masOS state
         g_RebootShutdownState.set(&rss);
+        
+        //Make sure that our log is on disk before we're killed
+        AsyncLogger::get().flush(true);
 
         new_state = CRS_STATE_Unknown;
     }
     
     //Remember as previous state
     prev_state = new_state;
+    
+    //Output what notification it was
+    rec.nStateAfter = new_state;
+    output_pwr_event(rec);
 }
 
 
 
 
-///Convert 'pPortName' into CURRENT_REBOOT_SHUTDOWN_STATE enumeration
+///Convert 'nPortNameID' into CURRENT_REBOOT_SHUTDOWN_STATE enumeration
+///'nPortNameID' = ID of the port name in NameTable (names are case-insensitive)
 ///RETURN:
 ///     = Matching state value from CURRENT_REBOOT_SHUTDOWN_STATE enum, or
 ///     = CRS_STATE_Unknown if not matched
-CURRENT_REBOOT_SHUTDOWN_STATE get_CURRENT_REBOOT_SHUTDOWN_STATE_by_port_name(const char* pPortName)
+CURRENT_REBOOT_SHUTDOWN_STATE get_CURRENT_REBOOT_SHUTDOWN_STATE_by_port_name(NAME_ID nPortNameID)
 {
-    if(pPortName &&
-       pPortName[0])
+    //IDs of names in 'gkNotifNames' - so that we don't compare strings
+    static const std::array<NAME_ID, SIZEOF(gkNotifNames)> s_arrIDs = []()
     {
+        std::array<NAME_ID, SIZEOF(gkNotifNames)> arrIDs;
+        
         for(int i = 0; i < SIZEOF(gkNotifNames); i++)
         {
-            if(strcasecmp(gkNotifNames[i].pName, pPortName))
+            arrIDs[i] = NameTable::get().intern(gkNotifNames[i].pName);
+        }
+        
+        return arrIDs;
+    }();
+    
+    if(nPortNameID != NAME_ID_NONE)
+    {
+        for(int i = 0; i < SIZEOF(gkNotifNames); i++)
+        {
+            if(s_arrIDs[i] == nPortNameID)
             {
                 return gkNotifNames[i].state;
             }
@@ -331,6 +490,8 @@ CURRENT_REBOOT_SHUTDOWN_STATE get_CURRENT_REBOOT_SHUTDOWN_STATE_by_port_name(con
 
 
 ///Notification when macOS enters sleep, or wakes up from it
+///INFO: It doesn't allocate memory or format strings until the message is acknowledged - see 'gkPwrMsgs'
+///      in pwr_msg_handlers.h for how each message is handled.
 void callback_SleepWake(natural_t msgType,
                         void *msgArgument,
                         io_connect_t portSleepWake,
@@ -340,133 +501,131 @@ void callback_SleepWake(natural_t msgType,
     UNREFERENCED_PARAMETER(pParam1);
     UNREFERENCED_PARAMETER(pParam2);
     
-    IOReturn ioRet;
-    std::string strPwrEvent;
+    //Timestamp it for wake stats (before we do anything else)
+    g_WkStats.onSleepWakeEvent(msgType);
+    
+    //Keep the state of the system
+    static PWR_SLEEP_STATE s_sleepState = PSS_Awake;
+    
+    PWR_EVT_RECORD rec;
+    rec.stamp();
+    rec.source = PES_SleepWake;
+    rec.nMsgType = msgType;
+    rec.nStateBefore = s_sleepState;
     
     //Determine what type of notification did we receive
-    switch(msgType)
+    //INFO: Some unrecognized event is output only by its numeric type.
+    uint32_t nAfterAck = PMA_None;
+    
+    const PWR_MSG_DESC<PWR_MSG_CTX>* pDesc = gkPwrMsgs.find(msgType);
+    if(pDesc)
     {
-        case kIOMessageCanSystemSleep:
+        PWR_MSG_CTX ctx = {msgType, msgArgument, s_sleepState, true, PMA_None};
+        
+        if(pDesc->pfnHandler)
         {
-            //Indicates that the system is pondering an idle sleep, but gives apps
-            //the chance to veto that sleep attempt.
-            //
-            strPwrEvent = "CanSystemSleep";
-
-            //Decide if we need to prevent idle sleep ...
-            //INFO: We will allow it here.
-            bool bAllowIdleSleep = true;
-
-            if(bAllowIdleSleep)
+            pDesc->pfnHandler(ctx);
+        }
+        
+        if(pDesc->nTraits & PMT_AckRequired)
+        {
+            IOReturn ioRet;
+            
+            if(ctx.bAllow ||
+               !(pDesc->nTraits & PMT_Vetoable))
             {
-                //Allow sleep
+                //Allow power change
                 ioRet = IOAllowPowerChange(portSleepWake,
                                            (intptr_t)msgArgument);
             }
             else
             {
-                //Prevent sleep
+                //Prevent power change
                 ioRet = IOCancelPowerChange(portSleepWake,
                                             (intptr_t)msgArgument);
             }
-
-            assert(ioRet == KERN_SUCCESS);
-        }
-        break;
-
-        case kIOMessageSystemWillNotSleep:
-        {
-            //Is delivered when some app client has vetoed an idle sleep request.
-            //kIOMessageSystemWillNotSleep may follow a kIOMessageCanSystemSleep
-            //notification, but will not otherwise be sent
-            //
-            strPwrEvent = "SystemWillNotSleep";
-        }
-        break;
-
-        case kIOMessageSystemWillSleep:
-        {
-            //Is delivered at the point the system is initiating a non-abortable sleep.
-            //
-            strPwrEvent = "SystemWillSleep";
-
-            //We must acknowledge it though
-            ioRet =  IOAllowPowerChange(portSleepWake,
-                                        (intptr_t)msgArgument);
             
             assert(ioRet == KERN_SUCCESS);
         }
-        break;
+        
+        s_sleepState = ctx.state;
+        nAfterAck = ctx.nAfterAck;
+        
+        rec.pstrMsgName = pDesc->pstrName;
+    }
+    
+    
+    //Output it
+    rec.nStateAfter = s_sleepState;
+    output_pwr_event(rec);
+    
+    //Now that the OS is not waiting for us, do what could take longer
+    //See which wake events were due (or take a snapshot of them before sleep)
+    g_WkAttr.onSleepWakeEvent(msgType);
+    
+    if(nAfterAck & PMA_FlushLog)
+    {
+        //INFO: The logger thread does it, so that we don't block the run loop on the disk.
+        AsyncLogger::get().flushAsync(true);
+    }
+    
+    if(nAfterAck & PMA_FireDueTimers)
+    {
+        //Fire logical wake timers that are due, and set the next one
+        g_WkSched.fireDueTimers();
+    }
+    
+    if(nAfterAck & PMA_RecomputeTimers)
+    {
+        //Recompute in-process timers for the time we were asleep
+        g_TmrSvc.onSystemHasPoweredOn();
+    }
+}
 
-        case kIOMessageSystemWillPowerOn:
-        {
-            //Is delivered at early wakeup time, before most hardware has been
-            //powered on. Be aware that any attempts to access disk, network,
-            //the display, etc. may result in errors or blocking your process
-            //until those resources become available.
-            //
-            strPwrEvent = "SystemWillPowerOn";
-        }
-        break;
 
-        case kIOMessageSystemHasPoweredOn:
-        {
-            //Is delivered at wakeup completion time, after all device drivers
-            //and hardware have handled the wakeup event. Expect this event 1-5
-            //or more seconds after initiating system wakeup
-            //
-            strPwrEvent = "SystemHasPoweredOn";
-        }
-        break;
 
-        case kIOMessageCanDevicePowerOff:
-        {
-            //(As practice has shown) this event is not really delivered anymore...
-            strPwrEvent = "CanDevicePowerOff";
-        }
-        break;
 
-        case kIOMessageDeviceWillNotPowerOff:
-        {
-            //(As practice has shown) this event is not really delivered anymore...
-            strPwrEvent = "DeviceWillNotPowerOff";
-        }
-        break;
+///Run-loop timer callback that outputs wake stats & attribution
+void callback_OutputWakeStats(CFRunLoopTimerRef timer, void* info)
+{
+    UNREFERENCED_PARAMETER(timer);
+    UNREFERENCED_PARAMETER(info);
+    
+    std::string strJson;
+    g_WkStats.exportAsJson(&strJson);
+    
+    printf("%s > Wake stats: %s\n",
+           current_time_as_string().c_str(),
+           strJson.c_str());
+    
+    g_WkAttr.exportAsJson(&strJson);
+    
+    printf("%s > Wake attribution: %s\n",
+           current_time_as_string().c_str(),
+           strJson.c_str());
+}
 
-        case kIOMessageCanSystemPowerOff:
-        {
-            //(As practice has shown) this event is not really delivered anymore...
-            strPwrEvent = "CanSystemPowerOff";
-        }
-        break;
 
-        case kIOMessageDeviceWillPowerOn:
-        {
-            //(As practice has shown) this event is not really delivered anymore...
-            strPwrEvent = "DeviceWillPowerOn";
-        }
-        break;
 
-        case kIOMessageDeviceHasPoweredOff:
-        {
-            //(As practice has shown) this event is not really delivered anymore...
-            strPwrEvent = "DeviceHasPoweredOff";
-        }
-        break;
 
-        default:
-        {
-            //Some unrecognized event
-            char buff[64];
-            snprintf(buff, SIZEOF(buff), "SleepEvent=%d", msgType);
-            strPwrEvent = buff;
-        }
-        break;
-    }
-    
+///Output a power notification as a JSON line
+///INFO: Can be called from time-critical callbacks, as it doesn't block on the output, or allocate memory.
+///'rec' = notification to output
+void output_pwr_event(PWR_EVT_RECORD& rec)
+{
+    static_assert(PWR_EVT_JSON_MAX_LEN <= ASYNC_LOG_MAX_STR, "JSON line must fit into a single log argument!");
     
-    //Output it
-    printf("%s > Received notification: %s\n", current_time_as_string().c_str(), strPwrEvent.c_str());
+    char buff[PWR_EVT_JSON_MAX_LEN + 1];
+    if(PwrEvtRecordEncoder::toJsonLine(rec, buff, sizeof(buff)))
+    {
+        //INFO: Don't block this thread on the stdout
+        ASYNC_LOG_RAW("%s", buff);
+    }
+    else
+    {
+        //Failed
+        assert(false);
+    }
 }
 
 
@@ -0,0 +1,297 @@
+//
+//  name_table.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of interning names (such as port names and bundle IDs) into small integer IDs,
+//  so that they can be compared without touching their text
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef name_table_h
+#define name_table_h
+
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <string_view>
+#include <unordered_map>
+#include <atomic>
+
+#include "rdr_wrtr.h"       //Reader/writer lock classes from "macOS tips - part 1"
+
+
+
+
+typedef uint32_t NAME_ID;                       //ID of an interned name
+
+#define NAME_ID_NONE 0                          //ID for no name
+
+#define NAME_TABLE_PAGE_SIZE 256                //Number of names in each page of the table
+#define NAME_TABLE_MAX_PAGES 256                //Max number of pages, or max number of names is NAME_TABLE_PAGE_SIZE * NAME_TABLE_MAX_PAGES
+
+
+
+///Process-wide table of interned names
+///INFO: Names are case-insensitive (for ASCII chars, same as strcasecmp), thus names that differ only
+///      by case get the same ID. Names are never removed, so their text stays valid for the life of the process.
+///INFO: Reading the text of a name by its ID doesn't take any locks.
+struct NameTable
+{
+    ///RETURN:
+    ///     = The table for this process
+    ///INFO: It's never destroyed, so that names remain valid while the process exits.
+    static NameTable& get()
+    {
+        static NameTable* s_pTable = new NameTable();
+
+        return *s_pTable;
+    }
+
+
+    ///Get ID of a name, and add it if it's not in the table yet
+    ///'pstrName' = name to add, ex: "com.dennisbabkin.wake01"
+    ///RETURN:
+    ///     = ID of the name, or
+    ///     = NAME_ID_NONE if 'pstrName' is 0 or "", or if the table is full
+    NAME_ID intern(const char* pstrName)
+    {
+        if(!pstrName ||
+           !pstrName[0])
+        {
+            return NAME_ID_NONE;
+        }
+
+        std::string_view svName(pstrName);
+
+        if(true)
+        {
+            //Act from within a lock
+            READER_LOCK rdl(_lock);
+
+            auto it = _mapIDs.find(svName);
+            if(it != _mapIDs.end())
+            {
+                return it->second;
+            }
+        }
+
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        //Another thread may have added it already
+        auto it = _mapIDs.find(svName);
+        if(it != _mapIDs.end())
+        {
+            return it->second;
+        }
+
+        uint32_t nIdx = _nCount.load(std::memory_order_relaxed);
+        if(nIdx >= NAME_TABLE_PAGE_SIZE * NAME_TABLE_MAX_PAGES)
+        {
+            //Table is full
+            assert(false);
+            return NAME_ID_NONE;
+        }
+
+        NAME* pPage = _arrPages[nIdx / NAME_TABLE_PAGE_SIZE].load(std::memory_order_relaxed);
+        if(!pPage)
+        {
+            pPage = new NAME[NAME_TABLE_PAGE_SIZE]();
+            _arrPages[nIdx / NAME_TABLE_PAGE_SIZE].store(pPage, std::memory_order_release);
+        }
+
+        //Keep both the name and its folded version in one allocation
+        size_t szcLen = svName.size();
+        char* pMem = new char[(szcLen + 1) * 2];
+
+        memcpy(pMem, pstrName, szcLen + 1);
+
+        char* pFolded = pMem + szcLen + 1;
+        for(size_t i = 0; i <= szcLen; i++)
+        {
+            pFolded[i] = _foldChar(pstrName[i]);
+        }
+
+        NAME& name = pPage[nIdx % NAME_TABLE_PAGE_SIZE];
+        name.pstrName = pMem;
+        name.pstrFolded = pFolded;
+        name.szcLen = szcLen;
+
+        NAME_ID nID = nIdx + 1;
+        _mapIDs.emplace(std::string_view(pFolded, szcLen), nID);
+
+        //Make the new name visible to getName()
+        _nCount.store(nIdx + 1, std::memory_order_release);
+
+        return nID;
+    }
+
+
+    ///Get ID of a name without adding it
+    ///'pstrName' = name to look for (case-insensitive)
+    ///RETURN:
+    ///     = ID of the name, or
+    ///     = NAME_ID_NONE if it's not in the table
+    NAME_ID find(const char* pstrName)
+    {
+        if(!pstrName ||
+           !pstrName[0])
+        {
+            return NAME_ID_NONE;
+        }
+
+        //Act from within a lock
+        READER_LOCK rdl(_lock);
+
+        auto it = _mapIDs.find(std::string_view(pstrName));
+
+        return it != _mapIDs.end() ? it->second : NAME_ID_NONE;
+    }
+
+
+    ///RETURN:
+    ///     = Name for 'nID', as it was first passed to intern() - it's never freed, or
+    ///     = "" if 'nID' is NAME_ID_NONE or not known
+    const char* getName(NAME_ID nID)
+    {
+        const NAME* pName = _getName(nID);
+
+        return pName ? pName->pstrName : "";
+    }
+
+
+    ///RETURN:
+    ///     = Lower-case name for 'nID' - it's never freed, or
+    ///     = "" if 'nID' is NAME_ID_NONE or not known
+    const char* getFolded(NAME_ID nID)
+    {
+        const NAME* pName = _getName(nID);
+
+        return pName ? pName->pstrFolded : "";
+    }
+
+
+    ///RETURN:
+    ///     = Length of the name for 'nID' in chars, or 0 if 'nID' is NAME_ID_NONE or not known
+    size_t getLength(NAME_ID nID)
+    {
+        const NAME* pName = _getName(nID);
+
+        return pName ? pName->szcLen : 0;
+    }
+
+
+    ///RETURN:
+    ///     = Number of names in the table
+    size_t getCount()
+    {
+        return _nCount.load(std::memory_order_acquire);
+    }
+
+
+
+private:
+
+    NameTable()
+    {
+    }
+
+
+    struct NAME
+    {
+        const char* pstrName;           //Name as it was first interned
+        const char* pstrFolded;         //Lower-case name (it's the key in '_mapIDs')
+        size_t szcLen;                  //Length of both names, in chars
+    };
+
+
+    ///RETURN:
+    ///     = Name for 'nID', or 0 if it's not known
+    const NAME* _getName(NAME_ID nID)
+    {
+        if(nID == NAME_ID_NONE ||
+           nID > _nCount.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+
+        uint32_t nIdx = nID - 1;
+
+        const NAME* pPage = _arrPages[nIdx / NAME_TABLE_PAGE_SIZE].load(std::memory_order_acquire);
+        assert(pPage);
+
+        return &pPage[nIdx % NAME_TABLE_PAGE_SIZE];
+    }
+
+
+    static char _foldChar(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? (char)(c + ('a' - 'A')) : c;
+    }
+
+
+    ///Case-insensitive hash (FNV-1a), so that names can be looked up without folding them first
+    struct FOLD_HASH
+    {
+        size_t operator()(std::string_view sv) const
+        {
+            uint64_t nHash = 14695981039346656037ull;
+
+            for(char c : sv)
+            {
+                nHash ^= (unsigned char)_foldChar(c);
+                nHash *= 1099511628211ull;
+            }
+
+            return (size_t)nHash;
+        }
+    };
+
+    struct FOLD_EQUAL
+    {
+        bool operator()(std::string_view sv1, std::string_view sv2) const
+        {
+            if(sv1.size() != sv2.size())
+                return false;
+
+            for(size_t i = 0; i < sv1.size(); i++)
+            {
+                if(_foldChar(sv1[i]) != _foldChar(sv2[i]))
+                    return false;
+            }
+
+            return true;
+        }
+    };
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    NameTable(const NameTable& s) = delete;
+    NameTable& operator = (const NameTable& s) = delete;
+
+private:
+
+    RDR_WRTR _lock;                                                     //Lock for '_mapIDs' and for adding names
+
+    std::unordered_map<std::string_view, NAME_ID, FOLD_HASH, FOLD_EQUAL> _mapIDs;     //Folded name -> its ID
+
+    std::atomic<NAME*> _arrPages[NAME_TABLE_MAX_PAGES] = {};            //Pages of names, that are never moved or freed
+    std::atomic<uint32_t> _nCount{0};                                   //Number of names in '_arrPages'
+};
+
+
+
+
+#endif /* name_table_h */
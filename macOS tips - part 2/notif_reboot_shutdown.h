@@ -18,6 +18,7 @@
 
 
 #include "rdr_wrtr.h"       //Reader/writer lock classes from "macOS tips - part 1"
+#include "name_table.h"
 
 #include <CoreFoundation/CoreFoundation.h>
 #include <notify.h>
@@ -74,13 +75,14 @@ struct Notif_RebootShutdown
     ///           - "com.apple.system.loginwindow.logoutcancelled" previous shutdown, restart, logout was aborted
     ///           - "com.apple.system.loginwindow.logoutNoReturn" previous shutdown, restart, logout is proceeding, can't abort
     ///'pfn' = callback function that is called when event happens, or null not to call it
+    ///        INFO: It receives the ID of 'pPortName' in NameTable - use NameTable::getName() to get its text.
     ///'pParam1' = passed directly into 'pfn' when it's called
     ///'pParam2' = passed directly into 'pfn' when it's called
     ///RETURN:
     ///     - true if success
     bool init_Notifications(const char* pPortName,
                             void (*pfn)(mach_msg_header_t* pHeader,
-                                        const char* pPortName,
+                                        NAME_ID nPortNameID,
                                         const void* pParam1,
                                         const void* pParam2) = nullptr,
                             const void* pParam1 = nullptr,
@@ -114,7 +116,7 @@ struct Notif_RebootShutdown
                     CFMachPortContext ctx = {};
                     ctx.info = this;
                     
-                    _strPortName = pPortName;
+                    _nPortNameID = NameTable::get().intern(pPortName);
                     
                     Boolean bShouldFree = false;
                     
@@ -157,7 +159,7 @@ struct Notif_RebootShutdown
                     if(!bRes)
                     {
                         //Clear port name if we failed
-                        _strPortName.clear();
+                        _nPortNameID = NAME_ID_NONE;
                     }
                 }
                 else
@@ -194,14 +196,22 @@ struct Notif_RebootShutdown
     
     
     ///RETURN:
-    ///     = Port name that is currently used for this class,
+    ///     = Port name that is currently used for this class (it's interned, so it remains valid after this class is reset),
     ///     = "" if it was not initialized
     const char* getPortName()
+    {
+        return NameTable::get().getName(getPortNameID());
+    }
+    
+    ///RETURN:
+    ///     = ID of the port name in NameTable, that is currently used for this class,
+    ///     = NAME_ID_NONE if it was not initialized
+    NAME_ID getPortNameID()
     {
         //Act from within a lock
         READER_LOCK rdl(_lock);
         
-        return _strPortName.c_str();
+        return _nPortNameID;
     }
         
     ///Remove the callback that was set by init_Notifications()
@@ -261,7 +271,7 @@ struct Notif_RebootShutdown
             //Reset parameters
             _bCallbackSet = false;
             
-            _strPortName.clear();
+            _nPortNameID = NAME_ID_NONE;
             
             _shutDownMachPort = MACH_PORT_NULL;
             
@@ -293,7 +303,7 @@ private:
             mach_msg_header_t *header = (mach_msg_header_t *)msg;
             
             pThis->_pfnCallback(header,
-                                pThis->_strPortName.c_str(),
+                                pThis->_nPortNameID,
                                 pThis->_pParam1,
                                 pThis->_pParam2);
         }
@@ -312,7 +322,7 @@ private:
 
     bool _bCallbackSet = false;         //true if we set callback OK
 
-    std::string _strPortName;           //Port name for Mach port notifications
+    NAME_ID _nPortNameID = NAME_ID_NONE;    //Port name for Mach port notifications (interned in NameTable)
 
     int _nShutdownNtf = 0;
     mach_port_t _shutDownMachPort = MACH_PORT_NULL;
@@ -321,7 +331,7 @@ private:
 
     
     void (*_pfnCallback)(mach_msg_header_t* pHeader,
-                            const char* pPortName,
+                            NAME_ID nPortNameID,
                             const void* pParam1,
                             const void* pParam2) = nullptr;
     const void* _pParam1 = nullptr;
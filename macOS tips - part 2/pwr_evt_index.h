@@ -0,0 +1,1083 @@
+//
+//  pwr_evt_index.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of an in-process index of scheduled power events, that is reconciled
+//  with the system-wide list by a sorted merge
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms
+//        with the PwrEvtSource_Memory class as a stand-in for the OS.
+//
+
+
+#ifndef pwr_evt_index_h
+#define pwr_evt_index_h
+
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <strings.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <atomic>
+
+#include "rdr_wrtr.h"           //Reader/writer lock classes from "macOS tips - part 1"
+#include "bundle_pattern.h"
+
+
+
+
+#define PWR_EVT_TXN_MAX_PARALLEL 4          //Default max number of threads that make OS calls when a transaction is committed
+
+
+
+///Scheduled power event
+struct PWR_EVT
+{
+    std::string strBundleID;                //Bundle ID of the event, ex: "com.dennisbabkin.wake01"
+    std::string strEventType;               //Event type, ex: kIOPMAutoWake
+    double dtWhen = 0;                      //UTC date/time of the event (as CFAbsoluteTime)
+};
+
+
+enum PWR_EVT_RESULT
+{
+    PWR_EVT_OK,                             //Success
+    PWR_EVT_NOT_FOUND,                      //Event was not found
+    PWR_EVT_ERROR,                          //Some other error
+};
+
+
+
+///Set of schedule & cancel operations that are committed together by PwrEvtIndex::commitTransaction()
+struct PwrEvtTxn
+{
+    enum OP_TYPE
+    {
+        OP_Schedule,                        //Schedule new event
+        OP_Cancel,                          //Cancel matching events
+    };
+
+    struct OP
+    {
+        OP_TYPE type;
+        PWR_EVT evt;                        //For OP_Cancel: 'strBundleID' and 'strEventType' can be "" to match all, 'dtWhen' is not used
+
+        //Results - set by commitTransaction()
+        bool bResult = false;               //true if operation succeeded
+        size_t szcCanceled = 0;             //For OP_Cancel: number of events that were canceled
+        int nOSError = 0;                   //For OP_Schedule: OS specific error code, or 0 if success
+    };
+
+
+    PwrEvtTxn()
+    {
+    }
+
+    ///Queue scheduling of a new event
+    ///INFO: It does not cancel previous events for the same bundle ID - queue queueCancel() before it for that.
+    ///'pstrBundleID' = bundle ID for the event, ex: "com.dennisbabkin.wake01"
+    ///'pstrEventType' = event type, ex: kIOPMAutoWake
+    ///'dtWhen' = UTC date/time of the event (as CFAbsoluteTime)
+    ///RETURN:
+    ///     = Index of this operation in the transaction
+    size_t queueSchedule(const char* pstrBundleID,
+                         const char* pstrEventType,
+                         double dtWhen)
+    {
+        OP op;
+        op.type = OP_Schedule;
+        op.evt.strBundleID = pstrBundleID ? pstrBundleID : "";
+        op.evt.strEventType = pstrEventType ? pstrEventType : "";
+        op.evt.dtWhen = dtWhen;
+
+        _arrOps.push_back(op);
+
+        return _arrOps.size() - 1;
+    }
+
+    ///Queue cancellation of events
+    ///INFO: It also cancels events that were queued by queueSchedule() before it in this transaction.
+    ///'pstrBundleID' = bundle ID to cancel events for (case-insensitive for ASCII letters), or 0 or "" to cancel all events
+    ///'pstrEventType' = event type to cancel events for, or 0 or "" to cancel for all event types
+    ///RETURN:
+    ///     = Index of this operation in the transaction
+    size_t queueCancel(const char* pstrBundleID,
+                       const char* pstrEventType)
+    {
+        OP op;
+        op.type = OP_Cancel;
+        op.evt.strBundleID = pstrBundleID ? pstrBundleID : "";
+        op.evt.strEventType = pstrEventType ? pstrEventType : "";
+
+        _arrOps.push_back(op);
+
+        return _arrOps.size() - 1;
+    }
+
+    ///RETURN:
+    ///     = Number of queued operations
+    size_t getCount() const
+    {
+        return _arrOps.size();
+    }
+
+    ///RETURN:
+    ///     = Operation and its results (after commit) by its index
+    const OP& getOp(size_t i) const
+    {
+        assert(i < _arrOps.size());
+        return _arrOps[i];
+    }
+
+    ///Remove all queued operations
+    void clear()
+    {
+        _arrOps.clear();
+    }
+
+private:
+    friend struct PwrEvtIndex;
+
+    std::vector<OP> _arrOps;                //Queued operations, in order
+};
+
+
+
+///Source of scheduled power events, ex: the OS itself
+struct PwrEvtSource
+{
+    virtual ~PwrEvtSource()
+    {
+    }
+
+    ///Enumerate all scheduled power events
+    ///'arrOut' = receives all events, in no specific order
+    ///RETURN:
+    ///     = true if success
+    virtual bool enumEvents(std::vector<PWR_EVT>& arrOut) = 0;
+
+    ///Schedule new power event
+    ///'pnOutOSError' = if not 0, receives OS specific error code, or 0 if success
+    virtual PWR_EVT_RESULT scheduleEvent(const PWR_EVT& evt, int* pnOutOSError = nullptr) = 0;
+
+    ///Cancel a previously scheduled power event
+    ///'pnOutOSError' = if not 0, receives OS specific error code, or 0 if success
+    virtual PWR_EVT_RESULT cancelEvent(const PWR_EVT& evt, int* pnOutOSError = nullptr) = 0;
+};
+
+
+
+
+///In-memory stand-in for the OS list of scheduled power events
+struct PwrEvtSource_Memory : public PwrEvtSource
+{
+    PwrEvtSource_Memory()
+    {
+    }
+
+    virtual bool enumEvents(std::vector<PWR_EVT>& arrOut) override
+    {
+        WRITER_LOCK wrl(_lock);
+
+        arrOut = _arrEvents;
+        _szcEnumCalls++;
+
+        return true;
+    }
+
+    virtual PWR_EVT_RESULT scheduleEvent(const PWR_EVT& evt, int* pnOutOSError = nullptr) override
+    {
+        WRITER_LOCK wrl(_lock);
+
+        _arrEvents.push_back(evt);
+        _szcScheduleCalls++;
+
+        if(pnOutOSError)
+            *pnOutOSError = 0;
+
+        return PWR_EVT_OK;
+    }
+
+    virtual PWR_EVT_RESULT cancelEvent(const PWR_EVT& evt, int* pnOutOSError = nullptr) override
+    {
+        PWR_EVT_RESULT res = PWR_EVT_NOT_FOUND;
+
+        WRITER_LOCK wrl(_lock);
+
+        _szcCancelCalls++;
+
+        for(auto it = _arrEvents.begin(); it != _arrEvents.end(); ++it)
+        {
+            if(it->dtWhen == evt.dtWhen &&
+               it->strEventType == evt.strEventType &&
+               strcasecmp(it->strBundleID.c_str(), evt.strBundleID.c_str()) == 0)
+            {
+                //Order doesn't matter
+                *it = _arrEvents.back();
+                _arrEvents.pop_back();
+
+                res = PWR_EVT_OK;
+                break;
+            }
+        }
+
+        if(pnOutOSError)
+            *pnOutOSError = res == PWR_EVT_OK ? 0 : ENOENT;
+
+        return res;
+    }
+
+
+    ///Get the number of calls that were made into this source
+    ///'pszOutSchedule' = if not 0, receives the number of scheduleEvent() calls
+    ///'pszOutCancel' = if not 0, receives the number of cancelEvent() calls
+    ///RETURN:
+    ///     = Number of enumEvents() calls
+    size_t getCallCounts(size_t* pszOutSchedule = nullptr,
+                         size_t* pszOutCancel = nullptr)
+    {
+        READER_LOCK rdl(_lock);
+
+        if(pszOutSchedule)
+            *pszOutSchedule = _szcScheduleCalls;
+        if(pszOutCancel)
+            *pszOutCancel = _szcCancelCalls;
+
+        return _szcEnumCalls;
+    }
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    PwrEvtSource_Memory(const PwrEvtSource_Memory& s) = delete;
+    PwrEvtSource_Memory& operator = (const PwrEvtSource_Memory& s) = delete;
+
+private:
+    RDR_WRTR _lock;                         //Lock for accessing this struct
+
+    std::vector<PWR_EVT> _arrEvents;        //All "scheduled" events
+
+    size_t _szcEnumCalls = 0;
+    size_t _szcScheduleCalls = 0;
+    size_t _szcCancelCalls = 0;
+};
+
+
+
+
+///Index of scheduled power events, sorted by (bundle ID, event type, date/time)
+///INFO: Events may be changed by other processes, or removed by the OS after they fire, thus the index is
+///      reconciled with the OS list before each lookup or cancellation. Then matching events are found by
+///      a range lookup, and changes that are made through this index are applied to it directly.
+///      A transaction is reconciled once for all of its operations, and schedules don't need it.
+struct PwrEvtIndex
+{
+    ///'pSource' = source of scheduled power events - must remain valid for the lifetime of this object
+    PwrEvtIndex(PwrEvtSource* pSource)
+        : _pSource(pSource)
+    {
+        assert(pSource);
+    }
+
+
+    ///Find the earliest scheduled event
+    ///'pstrBundleID' = bundle ID to look for (case-insensitive for ASCII letters), ex: "com.dennisbabkin.wake01"
+    ///'pstrEventType' = event type to look for, ex: kIOPMAutoWake
+    ///'pdtOutWhen' = if not 0, receives UTC date/time of the event, or 0 if not found
+    ///RETURN:
+    ///     = true if found
+    bool findEvent(const char* pstrBundleID,
+                   const char* pstrEventType,
+                   double* pdtOutWhen = nullptr)
+    {
+        bool bRes = false;
+        double dtWhen = 0;
+
+        assert(_isAscii(pstrBundleID));
+
+        if(pstrBundleID &&
+           pstrBundleID[0] &&
+           pstrEventType &&
+           pstrEventType[0])
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            _reconcile();
+
+            auto it = _lowerBound(pstrBundleID, pstrEventType);
+            if(it != _setEvents.end() &&
+               it->strKey == _foldCase(pstrBundleID) &&
+               it->evt.strEventType == pstrEventType)
+            {
+                dtWhen = it->evt.dtWhen;
+                bRes = true;
+            }
+        }
+        else
+        {
+            //Bad parameters
+            assert(false);
+        }
+
+        if(pdtOutWhen)
+            *pdtOutWhen = dtWhen;
+
+        return bRes;
+    }
+
+
+    ///Schedule new power event and add it to the index
+    ///'pnOutOSError' = if not 0, receives OS specific error code, or 0 if success
+    ///RETURN:
+    ///     = true if success
+    bool scheduleEvent(const char* pstrBundleID,
+                       const char* pstrEventType,
+                       double dtWhen,
+                       int* pnOutOSError = nullptr)
+    {
+        bool bRes = false;
+
+        assert(_isAscii(pstrBundleID));
+
+        if(pstrBundleID &&
+           pstrBundleID[0] &&
+           pstrEventType &&
+           pstrEventType[0])
+        {
+            PWR_EVT evt;
+            evt.strBundleID = pstrBundleID;
+            evt.strEventType = pstrEventType;
+            evt.dtWhen = dtWhen;
+
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            if(_pSource->scheduleEvent(evt, pnOutOSError) == PWR_EVT_OK)
+            {
+                _setEvents.insert(_makeEntry(evt));
+                _bLastOSValid = false;
+
+                bRes = true;
+            }
+        }
+        else
+        {
+            //Bad parameters
+            assert(false);
+
+            if(pnOutOSError)
+                *pnOutOSError = EINVAL;
+        }
+
+        return bRes;
+    }
+
+
+    ///Cancel scheduled events
+    ///'pstrBundleID' = bundle ID to cancel events for (case-insensitive for ASCII letters), or 0 or "" to cancel all events
+    ///'pstrEventType' = event type to cancel events for, or 0 or "" to cancel for all event types
+    ///'szCntCanceled' = receives the number of events that were canceled
+    ///RETURN:
+    ///     = true if no errors
+    ///     = false if at least one error took place
+    bool cancelEvents(const char* pstrBundleID,
+                      const char* pstrEventType,
+                      size_t& szCntCanceled)
+    {
+        assert(_isAscii(pstrBundleID));
+
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        return _cancelMatching([&](std::vector<std::multiset<ENTRY>::iterator>& arrOut)
+        {
+            _findMatching(pstrBundleID, pstrEventType, arrOut);
+        },
+        szCntCanceled);
+    }
+
+
+    ///Cancel scheduled events with bundle IDs that match a pattern
+    ///INFO: Patterns with a literal prefix, ex: "com.dennisbabkin.*", are looked up by a range in this index.
+    ///      Other patterns are applied in a single pass over it.
+    ///'pattern' = compiled pattern for bundle IDs
+    ///'pstrEventType' = event type to cancel events for, or 0 or "" to cancel for all event types
+    ///'szCntCanceled' = receives the number of events that were canceled
+    ///RETURN:
+    ///     = true if no errors
+    ///     = false if at least one error took place
+    bool cancelEventsByPattern(const BundlePattern& pattern,
+                               const char* pstrEventType,
+                               size_t& szCntCanceled)
+    {
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        return _cancelMatching([&](std::vector<std::multiset<ENTRY>::iterator>& arrOut)
+        {
+            _findMatching(pattern, pstrEventType, arrOut);
+        },
+        szCntCanceled);
+    }
+
+
+    ///Commit all operations in 'txn' with a single lock hold and at most one enumeration of OS events
+    ///INFO: Operations are first resolved in the order they were queued, against this index.
+    ///      Then all resulting OS cancellations are made, followed by all OS schedule calls,
+    ///      each batch on up to 'szMaxParallel' threads. A schedule that is canceled later in the
+    ///      same transaction never reaches the OS.
+    ///'txn' = transaction to commit - receives per-operation results
+    ///'szMaxParallel' = max number of threads to make OS calls on (1 to make them on this thread)
+    ///RETURN:
+    ///     = true if all operations succeeded
+    bool commitTransaction(PwrEvtTxn& txn,
+                           size_t szMaxParallel = PWR_EVT_TXN_MAX_PARALLEL)
+    {
+        bool bResult = true;
+
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        //Cancellations must see what is in the OS now
+        if(std::any_of(txn._arrOps.begin(), txn._arrOps.end(),
+                       [](const PwrEvtTxn::OP& op)
+                       {
+                           return op.type == PwrEvtTxn::OP_Cancel;
+                       }))
+        {
+            _reconcile();
+        }
+
+        struct OS_CALL
+        {
+            PWR_EVT evt;
+            size_t nOp;                             //Index of the operation in 'txn'
+            PWR_EVT_RESULT res = PWR_EVT_ERROR;
+            int nOSError = 0;
+        };
+
+        std::vector<OS_CALL> arrCancels;
+        std::vector<OS_CALL> arrSchedules;
+
+        //Entries in this index that are already claimed by a cancel operation
+        std::set<const ENTRY*> setClaimed;
+
+        std::vector<std::multiset<ENTRY>::iterator> arrMatch;
+
+        for(size_t i = 0; i < txn._arrOps.size(); i++)
+        {
+            PwrEvtTxn::OP& op = txn._arrOps[i];
+
+            assert(_isAscii(op.evt.strBundleID.c_str()));
+
+            op.bResult = false;
+            op.szcCanceled = 0;
+            op.nOSError = 0;
+
+            if(op.type == PwrEvtTxn::OP_Schedule)
+            {
+                if(!op.evt.strBundleID.empty() &&
+                   !op.evt.strEventType.empty())
+                {
+                    OS_CALL oc;
+                    oc.evt = op.evt;
+                    oc.nOp = i;
+
+                    arrSchedules.push_back(oc);
+                }
+                else
+                {
+                    //Bad parameters
+                    op.nOSError = EINVAL;
+                    bResult = false;
+                }
+            }
+            else if(op.type == PwrEvtTxn::OP_Cancel)
+            {
+                op.bResult = true;
+
+                const char* pstrBundleID = op.evt.strBundleID.c_str();
+                const char* pstrEventType = op.evt.strEventType.c_str();
+
+                //Events that are already in the OS
+                _findMatching(pstrBundleID, pstrEventType, arrMatch);
+
+                for(auto& it : arrMatch)
+                {
+                    if(setClaimed.insert(&(*it)).second)
+                    {
+                        OS_CALL oc;
+                        oc.evt = it->evt;
+                        oc.nOp = i;
+
+                        arrCancels.push_back(oc);
+                    }
+                }
+
+                //Events that were scheduled earlier in this transaction
+                std::string strKey = _foldCase(pstrBundleID);
+
+                for(auto it = arrSchedules.begin(); it != arrSchedules.end(); )
+                {
+                    if((strKey.empty() || _foldCase(it->evt.strBundleID.c_str()) == strKey) &&
+                       (op.evt.strEventType.empty() || it->evt.strEventType == op.evt.strEventType))
+                    {
+                        //Never send it to the OS
+                        txn._arrOps[it->nOp].bResult = true;
+                        op.szcCanceled++;
+
+                        it = arrSchedules.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+            }
+            else
+            {
+                //Bad operation
+                assert(false);
+                bResult = false;
+            }
+        }
+
+        //Cancel first, so that we don't cancel what we schedule
+        _callOSParallel(arrCancels, false, szMaxParallel);
+        _callOSParallel(arrSchedules, true, szMaxParallel);
+
+        _bLastOSValid = false;
+
+        //Apply results
+        for(OS_CALL& oc : arrCancels)
+        {
+            PwrEvtTxn::OP& op = txn._arrOps[oc.nOp];
+
+            if(oc.res == PWR_EVT_OK)
+            {
+                op.szcCanceled++;
+                _eraseOne(oc.evt);
+            }
+            else if(oc.res == PWR_EVT_NOT_FOUND)
+            {
+                //Someone else removed it after we reconciled - not an error
+                _eraseOne(oc.evt);
+            }
+            else
+            {
+                //Error
+                op.bResult = false;
+            }
+        }
+
+        for(OS_CALL& oc : arrSchedules)
+        {
+            PwrEvtTxn::OP& op = txn._arrOps[oc.nOp];
+
+            op.nOSError = oc.nOSError;
+
+            if(oc.res == PWR_EVT_OK)
+            {
+                op.bResult = true;
+                _setEvents.insert(_makeEntry(oc.evt));
+            }
+        }
+
+        for(const PwrEvtTxn::OP& op : txn._arrOps)
+        {
+            if(!op.bResult)
+            {
+                bResult = false;
+                break;
+            }
+        }
+
+        return bResult;
+    }
+
+
+    ///Get a snapshot of all scheduled events
+    ///INFO: The index is reconciled with the OS first.
+    ///'arrOut' = receives events, sorted by bundle ID (case-insensitive for ASCII letters), event type and date/time
+    ///RETURN:
+    ///     = true if success
+    ///     = false if the index could not be reconciled with the OS - 'arrOut' receives what is in the index
+    bool getEvents(std::vector<PWR_EVT>& arrOut)
+    {
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        bool bRes = _reconcile();
+
+        arrOut.clear();
+        arrOut.reserve(_setEvents.size());
+
+        for(const ENTRY& e : _setEvents)
+        {
+            arrOut.push_back(e.evt);
+        }
+
+        return bRes;
+    }
+
+
+    ///Reconcile this index with the OS now
+    ///'pszOutAdded' = if not 0, receives the number of events that were added to the index
+    ///'pszOutRemoved' = if not 0, receives the number of events that were removed from the index
+    ///RETURN:
+    ///     = true if success
+    bool refresh(size_t* pszOutAdded = nullptr,
+                 size_t* pszOutRemoved = nullptr)
+    {
+        WRITER_LOCK wrl(_lock);
+
+        return _reconcile(pszOutAdded, pszOutRemoved);
+    }
+
+
+    ///RETURN:
+    ///     = Number of events currently in the index
+    size_t getCount()
+    {
+        READER_LOCK rdl(_lock);
+
+        return _setEvents.size();
+    }
+
+
+    ///RETURN:
+    ///     = Number of times this index was reconciled with the OS
+    size_t getRefreshCount()
+    {
+        READER_LOCK rdl(_lock);
+
+        return _szcRefreshes;
+    }
+
+
+
+private:
+
+    struct ENTRY
+    {
+        std::string strKey;                 //Case-folded bundle ID
+        PWR_EVT evt;
+
+        bool operator < (const ENTRY& e) const
+        {
+            int nCmp = strKey.compare(e.strKey);
+            if(nCmp != 0)
+                return nCmp < 0;
+
+            nCmp = evt.strEventType.compare(e.evt.strEventType);
+            if(nCmp != 0)
+                return nCmp < 0;
+
+            if(evt.dtWhen != e.evt.dtWhen)
+                return evt.dtWhen < e.evt.dtWhen;
+
+            return evt.strBundleID < e.evt.strBundleID;
+        }
+    };
+
+
+    ///RETURN:
+    ///     = 'pStr' with ASCII letters in lower case
+    ///INFO: Bundle IDs can have only ASCII letters, digits, hyphens and periods, so it doesn't need CFStringCompare().
+    ///      Our own IDs are asserted to be ASCII (see _isAscii). IDs that other apps put into the OS list are
+    ///      used as they are, so if they have other chars, those are compared case-sensitively.
+    ///      It doesn't use tolower(), so that the current locale doesn't fold bytes of UTF-8 sequences.
+    static std::string _foldCase(const char* pStr)
+    {
+        std::string str;
+
+        if(pStr)
+        {
+            str = pStr;
+
+            for(char& c : str)
+            {
+                if(c >= 'A' && c <= 'Z')
+                {
+                    c += 'a' - 'A';
+                }
+            }
+        }
+
+        return str;
+    }
+
+    ///RETURN:
+    ///     = true if 'pStr' is 0, or has only ASCII chars
+    static bool _isAscii(const char* pStr)
+    {
+        if(pStr)
+        {
+            for(; *pStr; pStr++)
+            {
+                if((unsigned char)*pStr >= 0x80)
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    static ENTRY _makeEntry(const PWR_EVT& evt)
+    {
+        ENTRY e;
+        e.strKey = _foldCase(evt.strBundleID.c_str());
+        e.evt = evt;
+
+        return e;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Remove one entry for 'evt' from this index
+    ///INFO: The OS cancels one event per call, thus if it has identical events, the others must remain.
+    void _eraseOne(const PWR_EVT& evt)
+    {
+        auto it = _setEvents.find(_makeEntry(evt));
+        if(it != _setEvents.end())
+        {
+            _setEvents.erase(it);
+        }
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///RETURN:
+    ///     = Iterator to the first entry for 'pstrBundleID' and 'pstrEventType' (that can be "")
+    std::multiset<ENTRY>::iterator _lowerBound(const char* pstrBundleID,
+                                          const char* pstrEventType)
+    {
+        ENTRY e;
+        e.strKey = _foldCase(pstrBundleID);
+        e.evt.strEventType = pstrEventType ? pstrEventType : "";
+        e.evt.dtWhen = -std::numeric_limits<double>::infinity();
+
+        return _setEvents.lower_bound(e);
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Collect entries with bundle IDs that match 'pattern' and with 'pstrEventType' (that can be 0 or "" to match all)
+    void _findMatching(const BundlePattern& pattern,
+                       const char* pstrEventType,
+                       std::vector<std::multiset<ENTRY>::iterator>& arrOut)
+    {
+        arrOut.clear();
+
+        bool bAnyType = !pstrEventType || !pstrEventType[0];
+
+        //Keys are already case-folded
+        const std::string& strPrefix = pattern.getPrefix();
+
+        auto it = strPrefix.empty() ? _setEvents.begin() : _lowerBound(strPrefix.c_str(), "");
+
+        for(; it != _setEvents.end(); ++it)
+        {
+            if(!strPrefix.empty() &&
+               it->strKey.compare(0, strPrefix.size(), strPrefix) != 0)
+            {
+                //Past the range for this prefix
+                break;
+            }
+
+            if((bAnyType || it->evt.strEventType == pstrEventType) &&
+               pattern.isMatch(it->strKey))
+            {
+                arrOut.push_back(it);
+            }
+        }
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Cancel entries that 'fnFind' collects
+    ///'fnFind' = called to collect matching entries (it may be called again after this index is reconciled with the OS)
+    ///'szCntCanceled' = receives the number of events that were canceled
+    ///RETURN:
+    ///     = true if no errors
+    template<typename FN_FIND>
+    bool _cancelMatching(FN_FIND fnFind,
+                         size_t& szCntCanceled)
+    {
+        bool bResult = true;
+
+        szCntCanceled = 0;
+
+        _reconcile();
+
+        bool bNotFound = false;
+
+        for(int nPass = 0; nPass < 2; nPass++)
+        {
+            //Collect matching events first
+            std::vector<std::multiset<ENTRY>::iterator> arrRem;
+            fnFind(arrRem);
+
+            if(!arrRem.empty())
+                _bLastOSValid = false;
+
+            bNotFound = false;
+
+            for(auto& it : arrRem)
+            {
+                PWR_EVT_RESULT res = _pSource->cancelEvent(it->evt);
+                if(res == PWR_EVT_OK)
+                {
+                    //Done
+                    szCntCanceled++;
+
+                    _setEvents.erase(it);
+                }
+                else if(res == PWR_EVT_NOT_FOUND)
+                {
+                    //Our index did not match the OS - don't treat it as an error
+                    bNotFound = true;
+
+                    _setEvents.erase(it);
+                }
+                else
+                {
+                    //Error
+                    assert(false);
+                    bResult = false;
+                }
+            }
+
+            if(!bNotFound)
+                break;
+
+            //Reconcile with the OS and try again, in case an event was moved
+            _reconcile();
+        }
+
+        return bResult;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Collect entries that match 'pstrBundleID' and 'pstrEventType' (each can be 0 or "" to match all)
+    void _findMatching(const char* pstrBundleID,
+                       const char* pstrEventType,
+                       std::vector<std::multiset<ENTRY>::iterator>& arrOut)
+    {
+        arrOut.clear();
+
+        bool bAnyType = !pstrEventType || !pstrEventType[0];
+
+        if(pstrBundleID &&
+           pstrBundleID[0])
+        {
+            //Range lookup - O(log n)
+            std::string strKey = _foldCase(pstrBundleID);
+
+            for(auto it = _lowerBound(pstrBundleID, bAnyType ? "" : pstrEventType);
+                it != _setEvents.end() && it->strKey == strKey;
+                ++it)
+            {
+                if(!bAnyType &&
+                   it->evt.strEventType != pstrEventType)
+                {
+                    break;
+                }
+
+                arrOut.push_back(it);
+            }
+        }
+        else
+        {
+            //All bundles
+            for(auto it = _setEvents.begin(); it != _setEvents.end(); ++it)
+            {
+                if(bAnyType ||
+                   it->evt.strEventType == pstrEventType)
+                {
+                    arrOut.push_back(it);
+                }
+            }
+        }
+    }
+
+
+    ///Make OS calls for all elements in 'arrCalls' on up to 'szMaxParallel' threads
+    ///'bSchedule' = true to schedule events, false to cancel them
+    template<typename T>
+    void _callOSParallel(std::vector<T>& arrCalls,
+                         bool bSchedule,
+                         size_t szMaxParallel)
+    {
+        std::atomic<size_t> nNext(0);
+
+        auto fnWorker = [&]()
+        {
+            for(;;)
+            {
+                size_t i = nNext.fetch_add(1);
+                if(i >= arrCalls.size())
+                    break;
+
+                T& oc = arrCalls[i];
+
+                oc.res = bSchedule ?
+                         _pSource->scheduleEvent(oc.evt, &oc.nOSError) :
+                         _pSource->cancelEvent(oc.evt, &oc.nOSError);
+            }
+        };
+
+        size_t szcThreads = std::min(szMaxParallel, arrCalls.size());
+        if(szcThreads > 1)
+        {
+            //This thread is one of the workers
+            std::vector<std::thread> arrThreads;
+            arrThreads.reserve(szcThreads - 1);
+
+            for(size_t t = 1; t < szcThreads; t++)
+            {
+                arrThreads.emplace_back(fnWorker);
+            }
+
+            fnWorker();
+
+            for(std::thread& thr : arrThreads)
+            {
+                thr.join();
+            }
+        }
+        else
+        {
+            fnWorker();
+        }
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Reconcile this index with the OS by a sorted merge
+    ///INFO: Entries that did not change are left in place. Identical events are matched one-to-one.
+    ///      If the OS list is the same as on the last call, and this index wasn't changed since, there's nothing to merge.
+    ///RETURN:
+    ///     = true if success
+    bool _reconcile(size_t* pszOutAdded = nullptr,
+                    size_t* pszOutRemoved = nullptr)
+    {
+        bool bRes = true;
+
+        size_t szcAdded = 0;
+        size_t szcRemoved = 0;
+
+        std::vector<PWR_EVT> arrOS;
+        if(!_pSource->enumEvents(arrOS))
+        {
+            //Failed - keep what we have
+            assert(false);
+            bRes = false;
+        }
+        else if(_bLastOSValid &&
+                std::equal(arrOS.begin(), arrOS.end(), _arrLastOS.begin(), _arrLastOS.end(),
+                           [](const PWR_EVT& e1, const PWR_EVT& e2)
+                           {
+                               return e1.dtWhen == e2.dtWhen &&
+                                      e1.strBundleID == e2.strBundleID &&
+                                      e1.strEventType == e2.strEventType;
+                           }))
+        {
+            //Nothing changed
+            _szcRefreshes++;
+        }
+        else
+        {
+            std::vector<ENTRY> arrNew;
+            arrNew.reserve(arrOS.size());
+
+            for(const PWR_EVT& evt : arrOS)
+            {
+                arrNew.push_back(_makeEntry(evt));
+            }
+
+            std::sort(arrNew.begin(), arrNew.end());
+
+            //Sorted merge of both lists
+            auto itOld = _setEvents.begin();
+            auto itNew = arrNew.begin();
+
+            while(itOld != _setEvents.end() ||
+                  itNew != arrNew.end())
+            {
+                if(itNew == arrNew.end() ||
+                   (itOld != _setEvents.end() && *itOld < *itNew))
+                {
+                    //Not in the OS anymore
+                    itOld = _setEvents.erase(itOld);
+                    szcRemoved++;
+                }
+                else if(itOld == _setEvents.end() ||
+                        *itNew < *itOld)
+                {
+                    //New in the OS
+                    _setEvents.insert(itOld, *itNew);
+                    ++itNew;
+                    szcAdded++;
+                }
+                else
+                {
+                    //Same in both
+                    ++itOld;
+                    ++itNew;
+                }
+            }
+
+            _arrLastOS.swap(arrOS);
+            _bLastOSValid = true;
+
+            _szcRefreshes++;
+        }
+
+        if(pszOutAdded)
+            *pszOutAdded = szcAdded;
+        if(pszOutRemoved)
+            *pszOutRemoved = szcRemoved;
+
+        return bRes;
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    PwrEvtIndex(const PwrEvtIndex& s) = delete;
+    PwrEvtIndex& operator = (const PwrEvtIndex& s) = delete;
+
+private:
+
+    RDR_WRTR _lock;                                         //Lock for accessing this struct
+
+    PwrEvtSource* _pSource;                                 //Where the events come from
+
+    std::multiset<ENTRY> _setEvents;                        //Sorted index of events (identical events are kept as many times as the OS has them)
+
+    std::vector<PWR_EVT> _arrLastOS;                        //OS list, as it was enumerated on the last merge into '_setEvents'
+    bool _bLastOSValid = false;                             //true if '_setEvents' wasn't changed since it was merged with '_arrLastOS'
+
+    size_t _szcRefreshes = 0;                               //Number of times we reconciled with the OS
+};
+
+
+
+
+#endif /* pwr_evt_index_h */
@@ -0,0 +1,349 @@
+//
+//  pwr_evt_record.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of a structured record for power notifications, that can be encoded as
+//  JSON Lines, or in a fixed binary layout, without any heap allocations
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef pwr_evt_record_h
+#define pwr_evt_record_h
+
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+
+#include <atomic>
+
+#include "types.h"
+#include "dec_digits.h"
+
+
+
+
+#define PWR_EVT_BIN_VERSION 1                   //Version of PWR_EVT_RECORD_BIN
+                                                //IMPORTANT: Bump it if PWR_EVT_RECORD_BIN changes!
+
+#define PWR_EVT_JSON_MAX_LEN 248                //Max length of a JSON line produced by PwrEvtRecordEncoder::toJsonLine() (with the newline),
+                                                //for message names up to PWR_EVT_MAX_NAME_LEN chars
+#define PWR_EVT_MAX_NAME_LEN 56                 //Max number of chars of the message name, that are included into a JSON line
+
+
+
+///Where a power notification came from
+enum PWR_EVT_SOURCE : uint8_t
+{
+    PES_None,
+
+    PES_SleepWake,              //Sleep/wake notification: 'nMsgType' = kIOMessage*, states are PWR_SLEEP_STATE
+    PES_RebootShutdown,         //Reboot, shutdown or logout notification: 'nMsgType' and states are CURRENT_REBOOT_SHUTDOWN_STATE
+};
+
+
+
+///Single power notification, as a structured record
+struct PWR_EVT_RECORD
+{
+    uint64_t nSeqNum = 0;                   //Sequence number in this process (starts from 1) - gaps mean that records were lost
+    int64_t nTimeUs = 0;                    //When it was received: UTC time, in microseconds since the Unix epoch
+    PWR_EVT_SOURCE source = PES_None;       //Where it came from
+    uint8_t nStateBefore = 0;               //State before the notification (its meaning depends on 'source')
+    uint8_t nStateAfter = 0;                //State after the notification (its meaning depends on 'source')
+    uint32_t nMsgType = 0;                  //Type of the notification (its meaning depends on 'source')
+    const char* pstrMsgName = nullptr;      //Name of 'nMsgType', or 0 if not known - must be a static string
+                                            //INFO: It is not a part of the binary format.
+
+
+    ///Set the current time and the next sequence number
+    void stamp()
+    {
+        static std::atomic<uint64_t> s_nLastSeqNum{0};
+
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        nTimeUs = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        nSeqNum = s_nLastSeqNum.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+};
+
+
+
+///Fixed binary layout of PWR_EVT_RECORD
+///INFO: It's written in the native byte order, which is little-endian on all Macs.
+#pragma pack(push, 1)
+struct PWR_EVT_RECORD_BIN
+{
+    uint8_t nVersion;           //Must be PWR_EVT_BIN_VERSION
+    uint8_t nSource;            //One of PWR_EVT_SOURCE
+    uint8_t nStateBefore;
+    uint8_t nStateAfter;
+    uint32_t nMsgType;
+    uint64_t nSeqNum;
+    int64_t nTimeUs;
+    uint64_t nReserved;         //Must be 0
+};
+#pragma pack(pop)
+
+static_assert(sizeof(PWR_EVT_RECORD_BIN) == 32, "Binary record size must not change!");
+
+
+
+
+///Encoders for PWR_EVT_RECORD
+///INFO: They write into the buffer provided by the caller, so they can be used from time-critical callbacks.
+struct PwrEvtRecordEncoder
+{
+    ///Encode 'rec' as a single JSON line, ex:
+    ///     {"seq":12,"t_us":1687000000123456,"src":"sleep_wake","type":3758097024,"msg":"SystemWillSleep","before":1,"after":3}\n
+    ///INFO: "msg" is omitted if the record has no name.
+    ///'pBuff' = buffer to write into (it's null-terminated)
+    ///'szcBuff' = size of 'pBuff' in chars, must be at least PWR_EVT_JSON_MAX_LEN + 1
+    ///RETURN:
+    ///     = Number of chars written, not counting the null, or 0 if 'pBuff' is too small
+    static size_t toJsonLine(const PWR_EVT_RECORD& rec,
+                             char* pBuff,
+                             size_t szcBuff)
+    {
+        if(!pBuff ||
+           szcBuff < PWR_EVT_JSON_MAX_LEN + 1)
+        {
+            //Buffer is too small
+            assert(false);
+            return 0;
+        }
+
+        char* p = pBuff;
+
+        p = _putLit(p, "{\"seq\":");
+        p = _putU64(p, rec.nSeqNum);
+
+        p = _putLit(p, ",\"t_us\":");
+        p = _putI64(p, rec.nTimeUs);
+
+        p = _putLit(p, ",\"src\":\"");
+        p = _putLit(p, getSourceName(rec.source));
+
+        p = _putLit(p, "\",\"type\":");
+        p = _putU64(p, rec.nMsgType);
+
+        if(rec.pstrMsgName)
+        {
+            p = _putLit(p, ",\"msg\":\"");
+            p = _putEscaped(p, rec.pstrMsgName, PWR_EVT_MAX_NAME_LEN);
+            *p++ = '"';
+        }
+
+        p = _putLit(p, ",\"before\":");
+        p = _putU64(p, rec.nStateBefore);
+
+        p = _putLit(p, ",\"after\":");
+        p = _putU64(p, rec.nStateAfter);
+
+        p = _putLit(p, "}\n");
+
+        *p = 0;
+
+        size_t szcLen = p - pBuff;
+        assert(szcLen <= PWR_EVT_JSON_MAX_LEN);
+
+        return szcLen;
+    }
+
+
+    ///Encode 'rec' in the PWR_EVT_RECORD_BIN layout
+    ///'pBuff' = buffer to write into
+    ///'szcBuff' = size of 'pBuff' in bytes, must be at least sizeof(PWR_EVT_RECORD_BIN)
+    ///RETURN:
+    ///     = Number of bytes written, or 0 if 'pBuff' is too small
+    static size_t toBinary(const PWR_EVT_RECORD& rec,
+                           void* pBuff,
+                           size_t szcBuff)
+    {
+        if(!pBuff ||
+           szcBuff < sizeof(PWR_EVT_RECORD_BIN))
+        {
+            //Buffer is too small
+            assert(false);
+            return 0;
+        }
+
+        PWR_EVT_RECORD_BIN bin;
+        bin.nVersion = PWR_EVT_BIN_VERSION;
+        bin.nSource = rec.source;
+        bin.nStateBefore = rec.nStateBefore;
+        bin.nStateAfter = rec.nStateAfter;
+        bin.nMsgType = rec.nMsgType;
+        bin.nSeqNum = rec.nSeqNum;
+        bin.nTimeUs = rec.nTimeUs;
+        bin.nReserved = 0;
+
+        memcpy(pBuff, &bin, sizeof(bin));
+
+        return sizeof(bin);
+    }
+
+
+    ///Decode a record that was encoded with toBinary()
+    ///'pData' = encoded record
+    ///'szcData' = size of 'pData' in bytes
+    ///'pOutRec' = receives decoded record (its 'pstrMsgName' is set to 0)
+    ///RETURN:
+    ///     = true if success
+    ///     = false if 'pData' is not a record of the supported version
+    static bool fromBinary(const void* pData,
+                           size_t szcData,
+                           PWR_EVT_RECORD* pOutRec)
+    {
+        assert(pOutRec);
+
+        if(!pData ||
+           szcData < sizeof(PWR_EVT_RECORD_BIN))
+        {
+            //Not enough data
+            return false;
+        }
+
+        PWR_EVT_RECORD_BIN bin;
+        memcpy(&bin, pData, sizeof(bin));
+
+        if(bin.nVersion != PWR_EVT_BIN_VERSION ||
+           bin.nReserved != 0)
+        {
+            //Unsupported version
+            return false;
+        }
+
+        pOutRec->nSeqNum = bin.nSeqNum;
+        pOutRec->nTimeUs = bin.nTimeUs;
+        pOutRec->source = (PWR_EVT_SOURCE)bin.nSource;
+        pOutRec->nStateBefore = bin.nStateBefore;
+        pOutRec->nStateAfter = bin.nStateAfter;
+        pOutRec->nMsgType = bin.nMsgType;
+        pOutRec->pstrMsgName = nullptr;
+
+        return true;
+    }
+
+
+    ///RETURN:
+    ///     = Name of 'source', as used in JSON
+    static const char* getSourceName(PWR_EVT_SOURCE source)
+    {
+        switch(source)
+        {
+            case PES_SleepWake:
+                return "sleep_wake";
+            case PES_RebootShutdown:
+                return "reboot_shutdown";
+            default:
+                return "none";
+        }
+    }
+
+
+
+private:
+
+    ///Copy null-terminated 'pStr' as-is
+    ///RETURN: position after it
+    static char* _putLit(char* pDest,
+                         const char* pStr)
+    {
+        size_t szcLen = strlen(pStr);
+        memcpy(pDest, pStr, szcLen);
+
+        return pDest + szcLen;
+    }
+
+
+    ///Write 'nVal' in decimal
+    ///RETURN: position after it
+    static char* _putU64(char* pDest,
+                         uint64_t nVal)
+    {
+        //Fill from the end, two digits at a time
+        char buff[20];
+        char* pEnd = buff + sizeof(buff);
+        char* p = pEnd;
+
+        while(nVal >= 100)
+        {
+            p -= 2;
+            DecDigits::put2(p, (unsigned int)(nVal % 100));
+            nVal /= 100;
+        }
+
+        if(nVal >= 10)
+        {
+            p -= 2;
+            DecDigits::put2(p, (unsigned int)nVal);
+        }
+        else
+        {
+            *--p = (char)('0' + nVal);
+        }
+
+        size_t szcLen = pEnd - p;
+        memcpy(pDest, p, szcLen);
+
+        return pDest + szcLen;
+    }
+
+
+    ///Write 'nVal' in decimal
+    ///RETURN: position after it
+    static char* _putI64(char* pDest,
+                         int64_t nVal)
+    {
+        if(nVal < 0)
+        {
+            *pDest++ = '-';
+            return _putU64(pDest, 0 - (uint64_t)nVal);
+        }
+
+        return _putU64(pDest, (uint64_t)nVal);
+    }
+
+
+    ///Write up to 'szcMax' chars from 'pStr', escaped for a JSON string
+    ///INFO: Control chars are dropped, as message names are not supposed to have them.
+    ///RETURN: position after it
+    static char* _putEscaped(char* pDest,
+                             const char* pStr,
+                             size_t szcMax)
+    {
+        for(size_t i = 0; i < szcMax && pStr[i]; i++)
+        {
+            char c = pStr[i];
+
+            if(c == '"' || c == '\\')
+            {
+                *pDest++ = '\\';
+                *pDest++ = c;
+            }
+            else if((unsigned char)c >= ' ')
+            {
+                *pDest++ = c;
+            }
+        }
+
+        return pDest;
+    }
+};
+
+
+
+
+#endif /* pwr_evt_record_h */
@@ -0,0 +1,156 @@
+//
+//  pwr_msg_handlers.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Handlers of sleep/wake messages, and the table that dispatches them
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//        The handlers don't call the OS, allocate memory or format strings - what takes longer is
+//        requested with PWR_MSG_AFTER_ACK flags, and is done by the caller after the acknowledgment.
+//
+
+
+#ifndef pwr_msg_handlers_h
+#define pwr_msg_handlers_h
+
+#include <stdint.h>
+
+#include "types.h"
+#include "pwr_msg_table.h"
+
+#if __has_include(<IOKit/IOMessage.h>)
+#include <IOKit/IOMessage.h>
+#else
+//Same values as in <IOKit/IOMessage.h>
+#define kIOMessageCanDevicePowerOff         0xE0000200
+#define kIOMessageDeviceWillPowerOn         0xE0000215
+#define kIOMessageDeviceWillNotPowerOff     0xE0000220
+#define kIOMessageDeviceHasPoweredOff       0xE0000225
+#define kIOMessageCanSystemPowerOff         0xE0000240
+#define kIOMessageCanSystemSleep            0xE0000270
+#define kIOMessageSystemWillSleep           0xE0000280
+#define kIOMessageSystemWillNotSleep        0xE0000290
+#define kIOMessageSystemHasPoweredOn        0xE0000300
+#define kIOMessageSystemWillPowerOn         0xE0000320
+#endif
+
+
+
+
+///What to do after a sleep/wake message is acknowledged (can be combined)
+enum PWR_MSG_AFTER_ACK : uint32_t
+{
+    PMA_None = 0,
+
+    PMA_FlushLog = 0x1,                 //Put our log on disk
+    PMA_FireDueTimers = 0x2,            //Fire logical wake timers that are due, and set the next one
+    PMA_RecomputeTimers = 0x4,          //Recompute in-process timers for the time the system was asleep
+};
+
+
+///Context for handlers of sleep/wake messages
+struct PWR_MSG_CTX
+{
+    uint32_t msgType;                   //Type of the message, ex: kIOMessageSystemWillSleep
+    void* msgArgument;                  //Argument of the message, used to acknowledge it
+    PWR_SLEEP_STATE state;              //State of the system - handler can change it
+    bool bAllow;                        //For PMT_Vetoable messages: handler can set it to false to refuse the power change
+    uint32_t nAfterAck;                 //PWR_MSG_AFTER_ACK flags - handler can set them for what must not delay the acknowledgment
+};
+
+
+
+inline void onPwrMsg_CanSystemSleep(PWR_MSG_CTX& ctx)
+{
+    //Indicates that the system is pondering an idle sleep, but gives apps
+    //the chance to veto that sleep attempt.
+    //
+
+    //Decide if we need to prevent idle sleep ...
+    //INFO: We will allow it here.
+    ctx.bAllow = true;
+
+    if(ctx.bAllow)
+    {
+        ctx.state = PSS_SleepRequested;
+    }
+}
+
+inline void onPwrMsg_SystemWillNotSleep(PWR_MSG_CTX& ctx)
+{
+    //Is delivered when some app client has vetoed an idle sleep request.
+    //kIOMessageSystemWillNotSleep may follow a kIOMessageCanSystemSleep
+    //notification, but will not otherwise be sent
+    //
+    ctx.state = PSS_Awake;
+}
+
+inline void onPwrMsg_SystemWillSleep(PWR_MSG_CTX& ctx)
+{
+    //Is delivered at the point the system is initiating a non-abortable sleep.
+    //
+    ctx.state = PSS_GoingToSleep;
+
+    //Put our log on disk, in case we don't wake up
+    //INFO: It is acknowledged after we return, and only then the log is flushed, so that we don't delay sleep.
+    //      Debounced wake times don't need to be set here, as their run-loop timers set them in the OS in time.
+    ctx.nAfterAck |= PMA_FlushLog;
+}
+
+inline void onPwrMsg_SystemWillPowerOn(PWR_MSG_CTX& ctx)
+{
+    //Is delivered at early wakeup time, before most hardware has been
+    //powered on. Be aware that any attempts to access disk, network,
+    //the display, etc. may result in errors or blocking your process
+    //until those resources become available.
+    //
+    ctx.state = PSS_PoweringOn;
+}
+
+inline void onPwrMsg_SystemHasPoweredOn(PWR_MSG_CTX& ctx)
+{
+    //Is delivered at wakeup completion time, after all device drivers
+    //and hardware have handled the wakeup event. Expect this event 1-5
+    //or more seconds after initiating system wakeup
+    //
+    ctx.state = PSS_Awake;
+
+    ctx.nAfterAck |= PMA_FireDueTimers | PMA_RecomputeTimers;
+}
+
+
+
+//Sleep/wake messages that we know of
+//INFO: Messages without a handler are only output.
+//      (As practice has shown) kIOMessage*Device* and kIOMessageCanSystemPowerOff are not really delivered anymore...
+static constexpr PWR_MSG_DESC<PWR_MSG_CTX> gkPwrMsgDescs[] =
+{
+    { kIOMessageCanSystemSleep,         "CanSystemSleep",           PMT_AckRequired | PMT_Vetoable,     onPwrMsg_CanSystemSleep, },
+    { kIOMessageSystemWillNotSleep,     "SystemWillNotSleep",       PMT_None,                           onPwrMsg_SystemWillNotSleep, },
+    { kIOMessageSystemWillSleep,        "SystemWillSleep",          PMT_AckRequired,                    onPwrMsg_SystemWillSleep, },
+    { kIOMessageSystemWillPowerOn,      "SystemWillPowerOn",        PMT_None,                           onPwrMsg_SystemWillPowerOn, },
+    { kIOMessageSystemHasPoweredOn,     "SystemHasPoweredOn",       PMT_None,                           onPwrMsg_SystemHasPoweredOn, },
+    { kIOMessageCanDevicePowerOff,      "CanDevicePowerOff",        PMT_None,                           nullptr, },
+    { kIOMessageDeviceWillNotPowerOff,  "DeviceWillNotPowerOff",    PMT_None,                           nullptr, },
+    { kIOMessageCanSystemPowerOff,      "CanSystemPowerOff",        PMT_None,                           nullptr, },
+    { kIOMessageDeviceWillPowerOn,      "DeviceWillPowerOn",        PMT_None,                           nullptr, },
+    { kIOMessageDeviceHasPoweredOff,    "DeviceHasPoweredOff",      PMT_None,                           nullptr, },
+};
+
+static constexpr PwrMsgTable gkPwrMsgs(gkPwrMsgDescs);
+
+static_assert(gkPwrMsgs.isUnique(), "Each message type must be in the table only once!");
+static_assert(gkPwrMsgs.isValid(), "Bad message traits!");
+static_assert(gkPwrMsgs.find(kIOMessageSystemWillSleep)->pfnHandler == onPwrMsg_SystemWillSleep, "Lookup is broken!");
+
+
+
+
+#endif /* pwr_msg_handlers_h */
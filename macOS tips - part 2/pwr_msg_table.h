@@ -0,0 +1,157 @@
+//
+//  pwr_msg_table.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of decoding power messages with a table that is built at compile time,
+//  so that no memory is allocated and no strings are formatted when a message arrives
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef pwr_msg_table_h
+#define pwr_msg_table_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+
+///How a power message must be handled (can be combined)
+enum PWR_MSG_TRAITS : uint8_t
+{
+    PMT_None = 0,
+
+    PMT_AckRequired = 0x1,          //Message must be acknowledged, or the system will wait for a timeout
+    PMT_Vetoable = 0x2,             //Acknowledgment can refuse the power change
+};
+
+
+
+///Description of a single power message
+///'CTX' = type of context that is passed to the handler
+template<typename CTX>
+struct PWR_MSG_DESC
+{
+    uint32_t nMsgType;                  //Type of the message, ex: kIOMessageSystemWillSleep
+    const char* pstrName;               //Name of the message, ex: "SystemWillSleep" - must be a static string
+    uint8_t nTraits;                    //PWR_MSG_TRAITS flags
+    void (*pfnHandler)(CTX& ctx);       //Called when this message is received, or 0 if there's nothing to do
+};
+
+
+
+///Table of power messages, that is sorted at compile time
+///INFO: Declare it as constexpr, ex:
+///         constexpr PWR_MSG_DESC<MY_CTX> gkDescs[] = { {kIOMessageSystemWillSleep, "SystemWillSleep", PMT_AckRequired, onWillSleep}, ... };
+///         constexpr PwrMsgTable gkMsgs(gkDescs);
+template<typename CTX, size_t N>
+struct PwrMsgTable
+{
+    constexpr PwrMsgTable(const PWR_MSG_DESC<CTX> (&arr)[N])
+        : _arr{}
+    {
+        //Insertion sort by message type
+        for(size_t i = 0; i < N; i++)
+        {
+            size_t j = i;
+
+            for(; j > 0 && _arr[j - 1].nMsgType > arr[i].nMsgType; j--)
+            {
+                _arr[j] = _arr[j - 1];
+            }
+
+            _arr[j] = arr[i];
+        }
+    }
+
+
+    ///Find description of a message
+    ///'nMsgType' = type of the message
+    ///RETURN:
+    ///     = Description of 'nMsgType', or
+    ///     = 0 if it's not in the table
+    constexpr const PWR_MSG_DESC<CTX>* find(uint32_t nMsgType) const
+    {
+        size_t szLo = 0;
+        size_t szHi = N;
+
+        while(szLo < szHi)
+        {
+            size_t szMid = szLo + (szHi - szLo) / 2;
+
+            if(_arr[szMid].nMsgType < nMsgType)
+                szLo = szMid + 1;
+            else
+                szHi = szMid;
+        }
+
+        return szLo < N && _arr[szLo].nMsgType == nMsgType ? &_arr[szLo] : nullptr;
+    }
+
+
+    ///RETURN:
+    ///     = true if each message type is in the table only once - check it with static_assert()
+    constexpr bool isUnique() const
+    {
+        for(size_t i = 1; i < N; i++)
+        {
+            if(_arr[i - 1].nMsgType == _arr[i].nMsgType)
+                return false;
+        }
+
+        return true;
+    }
+
+
+    ///RETURN:
+    ///     = true if the traits of all messages are valid - check it with static_assert()
+    constexpr bool isValid() const
+    {
+        for(size_t i = 0; i < N; i++)
+        {
+            if(!_arr[i].pstrName ||
+               !_arr[i].pstrName[0])
+            {
+                //Must have a name
+                return false;
+            }
+
+            if((_arr[i].nTraits & PMT_Vetoable) &&
+               !(_arr[i].nTraits & PMT_AckRequired))
+            {
+                //Can't refuse without acknowledging
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    ///RETURN:
+    ///     = Number of messages in the table
+    constexpr size_t size() const
+    {
+        return N;
+    }
+
+
+
+private:
+
+    PWR_MSG_DESC<CTX> _arr[N];          //Descriptions sorted by 'nMsgType'
+};
+
+
+
+
+#endif /* pwr_msg_table_h */
@@ -0,0 +1,563 @@
+//
+//  recur_schedule.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of recurring schedules in the cron format, that are compiled into bit masks,
+//  so that the next fire time can be found without stepping through every minute
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef recur_schedule_h
+#define recur_schedule_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include <string>
+
+#include "civil_time.h"
+
+
+
+
+#define RECUR_MAX_YEARS_AHEAD 50        //Max number of years to look ahead for the next fire time
+                                        //INFO: Schedules like "0 0 29 2 1" (Feb 29 that is Monday) fire once in many years.
+
+
+
+///Recurring schedule in the cron format: "minute hour day-of-month month day-of-week"
+///Each field may be: '*', a number, a range "1-5", a list "0,15,30", or a step "*/15" or "8-18/2".
+///Day of the week is [0-7] where both 0 and 7 are Sunday.
+///If both day-of-month and day-of-week are not '*', a day matches if either of them matches (as in cron).
+///Also supported: "@yearly", "@monthly", "@weekly", "@daily", "@hourly"
+///Ex: "0 3 * * *" = every day at 3:00 AM, "30 8 * * 1-5" = weekdays at 8:30 AM
+///INFO: All times are in the local time zone.
+struct RecurSchedule
+{
+    RecurSchedule()
+    {
+    }
+
+    ///'pstrCron' = schedule to compile - check isValid() for the result
+    RecurSchedule(const char* pstrCron)
+    {
+        compile(pstrCron);
+    }
+
+
+    ///Compile 'pstrCron' into bit masks
+    ///'pstrCron' = schedule in the cron format
+    ///RETURN:
+    ///     = true if success
+    ///     = false if 'pstrCron' has bad format
+    bool compile(const char* pstrCron)
+    {
+        _bValid = false;
+
+        if(!pstrCron)
+        {
+            //Bad parameter
+            assert(false);
+            return false;
+        }
+
+        //Skip leading spaces
+        while(isspace((unsigned char)*pstrCron))
+            pstrCron++;
+
+        _strSource = pstrCron;
+
+        static const struct
+        {
+            const char* pName;
+            const char* pCron;
+        }
+        kShortcuts[] = {
+            {"@yearly",     "0 0 1 1 *"},
+            {"@annually",   "0 0 1 1 *"},
+            {"@monthly",    "0 0 1 * *"},
+            {"@weekly",     "0 0 * * 0"},
+            {"@daily",      "0 0 * * *"},
+            {"@midnight",   "0 0 * * *"},
+            {"@hourly",     "0 * * * *"},
+        };
+
+        if(*pstrCron == '@')
+        {
+            for(size_t i = 0; i < sizeof(kShortcuts) / sizeof(kShortcuts[0]); i++)
+            {
+                if(strcasecmp(pstrCron, kShortcuts[i].pName) == 0)
+                {
+                    return compile(kShortcuts[i].pCron);
+                }
+            }
+
+            //Unknown shortcut
+            return false;
+        }
+
+        uint64_t nMinutes, nHours, nDays, nMonths, nWeekdays;
+        bool bDaysStar, bWeekdaysStar;
+
+        const char* p = pstrCron;
+
+        if(!_parseField(p, 0, 59, nMinutes, nullptr) ||
+           !_parseField(p, 0, 23, nHours, nullptr) ||
+           !_parseField(p, 1, 31, nDays, &bDaysStar) ||
+           !_parseField(p, 1, 12, nMonths, nullptr) ||
+           !_parseField(p, 0, 7, nWeekdays, &bWeekdaysStar))
+        {
+            //Bad format
+            return false;
+        }
+
+        while(isspace((unsigned char)*p))
+            p++;
+
+        if(*p)
+        {
+            //Extra characters
+            return false;
+        }
+
+        //Sunday can be 0 or 7
+        if(nWeekdays & (1 << 7))
+            nWeekdays = (nWeekdays | 1) & 0x7F;
+
+        _nMinutes = nMinutes;
+        _nHours = (uint32_t)nHours;
+        _nDays = (uint32_t)nDays;
+        _nMonths = (uint16_t)nMonths;
+
+        //Days of the month for each day of the week that the 1st falls on
+        //INFO: Bit 'd' is set if day 'd' of such month is one of the days of the week in the schedule
+        for(int w = 0; w < 7; w++)
+        {
+            uint32_t nMask = 0;
+
+            for(int d = 1; d <= 31; d++)
+            {
+                if(nWeekdays & (1 << ((w + d - 1) % 7)))
+                    nMask |= 1u << d;
+            }
+
+            _arrWeekdayDays[w] = nMask;
+        }
+
+        //Cron rule: if either field is '*', both must match, otherwise either one
+        _bDaysOr = !bDaysStar && !bWeekdaysStar;
+        _bDaysAll = bDaysStar && bWeekdaysStar;
+
+        _bValid = _nMinutes && _nHours && _nDays && _nMonths && nWeekdays;
+
+        return _bValid;
+    }
+
+
+    ///RETURN:
+    ///     = true if this schedule was compiled successfully
+    bool isValid() const
+    {
+        return _bValid;
+    }
+
+    ///RETURN:
+    ///     = Schedule in the cron format that was compiled last (shortcuts like "@daily" are expanded)
+    const std::string& getSource() const
+    {
+        return _strSource;
+    }
+
+
+    ///Find the next local time that matches this schedule
+    ///INFO: Each field is found with a single bit scan, so it takes constant time per month,
+    ///      and it only visits months that have a matching day.
+    ///'nLocalAfter' = local time, as the number of seconds since midnight of Jan 1, 1970 (as if it was in UTC)
+    ///'pOutLocal' = if not 0, receives the first local time after 'nLocalAfter' (in the same format)
+    ///RETURN:
+    ///     = true if found
+    ///     = false if none within RECUR_MAX_YEARS_AHEAD
+    bool getNextLocal(int64_t nLocalAfter,
+                      int64_t* pOutLocal) const
+    {
+        if(!_bValid)
+        {
+            //Not compiled
+            assert(false);
+            return false;
+        }
+
+        //Start from the next whole minute
+        int64_t nStart = nLocalAfter + 60;
+        nStart -= _mod(nStart, 60);
+
+        int64_t nDays = _floorDiv(nStart, 86400);
+        int nSecOfDay = (int)(nStart - nDays * 86400);
+
+        int nYear, nMonth, nDay;
+        LocalTimeConv::civilFromDays(nDays, &nYear, &nMonth, &nDay);
+
+        int nHour = nSecOfDay / 3600;
+        int nMinute = (nSecOfDay % 3600) / 60;
+
+        int nYearMax = nYear + RECUR_MAX_YEARS_AHEAD;
+
+        while(nYear <= nYearMax)
+        {
+            //Month
+            uint32_t nMonthsLeft = _nMonths & ~((1u << nMonth) - 1);
+            if(!nMonthsLeft)
+            {
+                //Next year
+                nYear++;
+                nMonth = 1;
+                nDay = 1;
+                nHour = 0;
+                nMinute = 0;
+
+                continue;
+            }
+
+            int nM = __builtin_ctz(nMonthsLeft);
+            if(nM != nMonth)
+            {
+                nMonth = nM;
+                nDay = 1;
+                nHour = 0;
+                nMinute = 0;
+            }
+
+            //Day
+            int64_t nDays1st = LocalTimeConv::daysFromCivil(nYear, nMonth, 1);
+            uint32_t nDaysLeft = _getDayMask(nYear, nMonth, nDays1st) & ~((1u << nDay) - 1);
+
+            if(nDaysLeft)
+            {
+                int nD = __builtin_ctz(nDaysLeft);
+                if(nD != nDay)
+                {
+                    nDay = nD;
+                    nHour = 0;
+                    nMinute = 0;
+                }
+
+                //Hour & minute
+                for(;;)
+                {
+                    uint32_t nHoursLeft = _nHours & ~((1u << nHour) - 1);
+                    if(!nHoursLeft)
+                        break;
+
+                    int nH = __builtin_ctz(nHoursLeft);
+                    if(nH != nHour)
+                    {
+                        nHour = nH;
+                        nMinute = 0;
+                    }
+
+                    uint64_t nMinutesLeft = _nMinutes & ~((1ull << nMinute) - 1);
+                    if(nMinutesLeft)
+                    {
+                        //Found it
+                        if(pOutLocal)
+                        {
+                            *pOutLocal = (nDays1st + nDay - 1) * 86400 +
+                                         nHour * 3600 +
+                                         __builtin_ctzll(nMinutesLeft) * 60;
+                        }
+
+                        return true;
+                    }
+
+                    //Next hour
+                    nHour++;
+                    nMinute = 0;
+
+                    if(nHour >= 24)
+                        break;
+                }
+
+                //Next day in this month
+                nDaysLeft &= (uint32_t)~((1ull << (nDay + 1)) - 1);
+                if(nDaysLeft)
+                {
+                    nDay = __builtin_ctz(nDaysLeft);
+                    nHour = 0;
+                    nMinute = 0;
+
+                    //Since it's a new day, the first hour & minute always match
+                    if(pOutLocal)
+                    {
+                        *pOutLocal = (nDays1st + nDay - 1) * 86400 +
+                                     __builtin_ctz(_nHours) * 3600 +
+                                     __builtin_ctzll(_nMinutes) * 60;
+                    }
+
+                    return true;
+                }
+            }
+
+            //Next month
+            nMonth++;
+            nDay = 1;
+            nHour = 0;
+            nMinute = 0;
+
+            if(nMonth > 12)
+            {
+                nYear++;
+                nMonth = 1;
+            }
+        }
+
+        //None
+        return false;
+    }
+
+
+    ///Find the next UTC time that matches this schedule
+    ///INFO: Local times that are skipped by a DST change fire at the same moment that mktime() maps them to.
+    ///      Local times that happen twice fire only once.
+    ///'conv' = converter of local times
+    ///'nUtcAfter' = number of seconds since midnight of Jan 1, 1970 in UTC
+    ///'pOutUtc' = if not 0, receives the first UTC time after 'nUtcAfter' (in the same format)
+    ///RETURN:
+    ///     = true if found
+    bool getNextUtc(LocalTimeConv& conv,
+                    int64_t nUtcAfter,
+                    int64_t* pOutUtc) const
+    {
+        int64_t nLocal;
+        if(!conv.toLocal(nUtcAfter, &nLocal))
+        {
+            //Error
+            assert(false);
+            return false;
+        }
+
+        //INFO: If a local time happened twice, the first match may already be in the past
+        for(int i = 0; i < 3; i++)
+        {
+            int64_t nNextLocal;
+            if(!getNextLocal(nLocal, &nNextLocal))
+            {
+                //None
+                return false;
+            }
+
+            int64_t nDays = _floorDiv(nNextLocal, 86400);
+            int nSecOfDay = (int)(nNextLocal - nDays * 86400);
+
+            int nYear, nMonth, nDay;
+            LocalTimeConv::civilFromDays(nDays, &nYear, &nMonth, &nDay);
+
+            int64_t nUtc;
+            if(!conv.toUtc(nYear, nMonth, nDay, nSecOfDay / 3600, (nSecOfDay % 3600) / 60, 0, &nUtc))
+            {
+                //Error
+                assert(false);
+                return false;
+            }
+
+            if(nUtc > nUtcAfter)
+            {
+                if(pOutUtc)
+                    *pOutUtc = nUtc;
+
+                return true;
+            }
+
+            nLocal = nNextLocal;
+        }
+
+        //Should not happen
+        assert(false);
+        return false;
+    }
+
+
+
+private:
+
+    ///Parse one field of the cron format at 'p' and move 'p' past it
+    ///'nMin' = min allowed value
+    ///'nMax' = max allowed value
+    ///'nOutMask' = receives bit mask with bits set for the values in this field
+    ///'pbOutStar' = if not 0, receives true if the field was '*'
+    ///RETURN:
+    ///     = true if success
+    static bool _parseField(const char*& p,
+                            int nMin,
+                            int nMax,
+                            uint64_t& nOutMask,
+                            bool* pbOutStar)
+    {
+        nOutMask = 0;
+
+        while(isspace((unsigned char)*p))
+            p++;
+
+        if(pbOutStar)
+            *pbOutStar = p[0] == '*' && (p[1] == 0 || isspace((unsigned char)p[1]));
+
+        //Comma-separated list
+        for(;;)
+        {
+            int nFrom, nTo;
+
+            if(*p == '*')
+            {
+                nFrom = nMin;
+                nTo = nMax;
+                p++;
+            }
+            else
+            {
+                if(!_parseNumber(p, nFrom))
+                    return false;
+
+                nTo = nFrom;
+
+                if(*p == '-')
+                {
+                    p++;
+
+                    if(!_parseNumber(p, nTo))
+                        return false;
+                }
+            }
+
+            int nStep = 1;
+
+            if(*p == '/')
+            {
+                p++;
+
+                if(!_parseNumber(p, nStep) ||
+                   nStep <= 0)
+                {
+                    return false;
+                }
+            }
+
+            if(nFrom < nMin ||
+               nTo > nMax ||
+               nFrom > nTo)
+            {
+                //Out of range
+                return false;
+            }
+
+            for(int v = nFrom; v <= nTo; v += nStep)
+            {
+                nOutMask |= 1ull << v;
+            }
+
+            if(*p != ',')
+                break;
+
+            p++;
+        }
+
+        //Must end with a space or the end of string
+        return *p == 0 || isspace((unsigned char)*p);
+    }
+
+
+    static bool _parseNumber(const char*& p,
+                             int& nOut)
+    {
+        if(!isdigit((unsigned char)*p))
+            return false;
+
+        nOut = 0;
+
+        while(isdigit((unsigned char)*p))
+        {
+            nOut = nOut * 10 + (*p - '0');
+            p++;
+
+            if(nOut > 1000)
+                return false;
+        }
+
+        return true;
+    }
+
+
+    ///RETURN:
+    ///     = Bit mask of days [1-31] in 'nMonth' of 'nYear' that match this schedule
+    uint32_t _getDayMask(int nYear,
+                         int nMonth,
+                         int64_t nDays1st) const
+    {
+        static const int kDaysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+        int nDim = kDaysInMonth[nMonth - 1];
+        if(nMonth == 2 &&
+           (nYear % 4 == 0 && (nYear % 100 != 0 || nYear % 400 == 0)))
+        {
+            nDim = 29;
+        }
+
+        uint32_t nValid = (uint32_t)(((1ull << (nDim + 1)) - 1) & ~1ull);
+
+        uint32_t nWeekdayDays = _arrWeekdayDays[LocalTimeConv::weekdayFromDays(nDays1st)];
+
+        uint32_t nMask;
+        if(_bDaysAll)
+            nMask = nValid;
+        else if(_bDaysOr)
+            nMask = _nDays | nWeekdayDays;
+        else
+            nMask = _nDays & nWeekdayDays;
+
+        return nMask & nValid;
+    }
+
+
+    static int64_t _floorDiv(int64_t a,
+                             int64_t b)
+    {
+        return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+
+    static int64_t _mod(int64_t a,
+                        int64_t b)
+    {
+        return a - _floorDiv(a, b) * b;
+    }
+
+
+
+private:
+
+    bool _bValid = false;                   //true if compiled successfully
+    std::string _strSource;                 //Schedule that was compiled
+
+    uint64_t _nMinutes = 0;                 //Bits [0-59] for minutes
+    uint32_t _nHours = 0;                   //Bits [0-23] for hours
+    uint32_t _nDays = 0;                    //Bits [1-31] for days of the month
+    uint16_t _nMonths = 0;                  //Bits [1-12] for months
+    uint32_t _arrWeekdayDays[7] = {};       //Bits [1-31] for days of the month that match days of the week, if the 1st is: [0-6] (0 = Sunday)
+
+    bool _bDaysOr = false;                  //true if a day matches by either day of the month or day of the week
+    bool _bDaysAll = false;                 //true if all days match
+};
+
+
+
+
+#endif /* recur_schedule_h */
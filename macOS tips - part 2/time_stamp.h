@@ -0,0 +1,156 @@
+//
+//  time_stamp.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of how to format the current local time for log lines without heap allocations,
+//  by caching the part of it that changes only once per second
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef time_stamp_h
+#define time_stamp_h
+
+#include <time.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "dec_digits.h"
+
+
+
+
+#define TIME_STAMP_LEN 26                       //Number of chars in "YYYY-MM-DD HH:MM:SS.uuuuuu"
+#define TIME_STAMP_PREFIX_LEN 19                //Number of chars in "YYYY-MM-DD HH:MM:SS"
+#define TIME_STAMP_BUFF_SIZE (TIME_STAMP_LEN + 1)   //Min size of the buffer for TimeStamp functions, in chars (with the null)
+
+
+
+///Formats local date & time as "YYYY-MM-DD HH:MM:SS.uuuuuu"
+///INFO: The "YYYY-MM-DD HH:MM:SS" part is cached for each thread, and is recomputed only
+///      when the second changes. Only the microseconds are formatted on each call.
+///INFO: A time zone change is picked up on the next second.
+struct TimeStamp
+{
+    ///Format the current local date & time into 'pBuff'
+    ///'pBuff' = buffer to write the time stamp into (it's null-terminated)
+    ///'szcBuff' = size of 'pBuff' in chars, must be at least TIME_STAMP_BUFF_SIZE
+    ///RETURN:
+    ///     = Number of chars written, not counting the null, or 0 if 'pBuff' is too small
+    static size_t formatNow(char* pBuff,
+                            size_t szcBuff)
+    {
+        timeval tv = {};
+        gettimeofday(&tv, nullptr);
+
+        return format(tv, pBuff, szcBuff);
+    }
+
+
+    ///Format 'tv' as local date & time into 'pBuff'
+    ///'tv' = UTC time, as returned by gettimeofday()
+    ///'pBuff' = buffer to write the time stamp into (it's null-terminated)
+    ///'szcBuff' = size of 'pBuff' in chars, must be at least TIME_STAMP_BUFF_SIZE
+    ///RETURN:
+    ///     = Number of chars written, not counting the null, or 0 if 'pBuff' is too small
+    static size_t format(const timeval& tv,
+                         char* pBuff,
+                         size_t szcBuff)
+    {
+        if(!pBuff ||
+           szcBuff < TIME_STAMP_BUFF_SIZE)
+        {
+            //Buffer is too small
+            assert(false);
+            return 0;
+        }
+
+        PREFIX_CACHE& cache = _getCache();
+
+        if(!cache.bValid ||
+           cache.nSec != tv.tv_sec)
+        {
+            _formatPrefix(tv.tv_sec, cache.szPrefix);
+
+            cache.nSec = tv.tv_sec;
+            cache.bValid = true;
+        }
+
+        memcpy(pBuff, cache.szPrefix, TIME_STAMP_PREFIX_LEN);
+
+        //Patch microseconds
+        unsigned int nUsec = (unsigned int)tv.tv_usec;
+        if(nUsec > 999999)
+            nUsec = 999999;
+
+        char* pUs = pBuff + TIME_STAMP_PREFIX_LEN;
+        pUs[0] = '.';
+        DecDigits::put2(pUs + 1, nUsec / 10000);
+        DecDigits::put2(pUs + 3, (nUsec / 100) % 100);
+        DecDigits::put2(pUs + 5, nUsec % 100);
+
+        pBuff[TIME_STAMP_LEN] = 0;
+
+        return TIME_STAMP_LEN;
+    }
+
+
+
+private:
+
+    struct PREFIX_CACHE
+    {
+        bool bValid = false;
+        time_t nSec = 0;                                    //Second that 'szPrefix' was formatted for
+        char szPrefix[TIME_STAMP_PREFIX_LEN + 1];           //"YYYY-MM-DD HH:MM:SS" for 'nSec'
+    };
+
+    static PREFIX_CACHE& _getCache()
+    {
+        static thread_local PREFIX_CACHE s_cache;
+
+        return s_cache;
+    }
+
+
+
+    ///Format "YYYY-MM-DD HH:MM:SS" for 'nSec' in the local time zone
+    ///'pDest' = receives TIME_STAMP_PREFIX_LEN chars and the null
+    static void _formatPrefix(time_t nSec,
+                              char* pDest)
+    {
+        tm dtm = {};
+        localtime_r(&nSec, &dtm);
+
+        unsigned int nYear = (unsigned int)(1900 + dtm.tm_year) % 10000;
+
+        DecDigits::put2(pDest + 0, nYear / 100);
+        DecDigits::put2(pDest + 2, nYear % 100);
+        pDest[4] = '-';
+        DecDigits::put2(pDest + 5, (unsigned int)(1 + dtm.tm_mon));
+        pDest[7] = '-';
+        DecDigits::put2(pDest + 8, (unsigned int)dtm.tm_mday);
+        pDest[10] = ' ';
+        DecDigits::put2(pDest + 11, (unsigned int)dtm.tm_hour);
+        pDest[13] = ':';
+        DecDigits::put2(pDest + 14, (unsigned int)dtm.tm_min);
+        pDest[16] = ':';
+        DecDigits::put2(pDest + 17, (unsigned int)dtm.tm_sec);
+        pDest[TIME_STAMP_PREFIX_LEN] = 0;
+    }
+};
+
+
+
+
+#endif /* time_stamp_h */
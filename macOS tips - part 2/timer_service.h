@@ -0,0 +1,584 @@
+//
+//  timer_service.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of in-process timers that behave predictably when the system sleeps
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef timer_service_h
+#define timer_service_h
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+
+
+#define TMR_SVC_TICK_MS 10                  //Resolution of the timing wheel, in ms
+#define TMR_SVC_SLOTS 512                   //Number of slots in the timing wheel (must be a power of 2)
+                                            //INFO: Timers that are further than TMR_SVC_SLOTS * TMR_SVC_TICK_MS away
+                                            //      go around the wheel, and are skipped until their round comes.
+#define TMR_SVC_SPREAD_MS 20                //Default interval in ms between timers that became overdue while the system was asleep
+#define TMR_SVC_SLEEP_MIN_MS 500            //Min difference between the two clocks, in ms, that is treated as the system sleep
+#define TMR_SVC_MAX_WAIT_MS 5000            //Max number of ms that the worker waits while there are timers
+                                            //INFO: The wait itself may not count the time while the system is asleep,
+                                            //      so this is how late we can notice a wake if onSystemHasPoweredOn() is not called.
+
+//Clocks that we measure time with
+#if defined(CLOCK_UPTIME_RAW)
+#define TMR_SVC_CLOCK_AWAKE CLOCK_UPTIME_RAW            //Does not count while the system is asleep (macOS)
+#define TMR_SVC_CLOCK_CONTINUOUS CLOCK_MONOTONIC_RAW    //Keeps counting while the system is asleep (macOS)
+                                                        //INFO: Both are raw, or NTP slewing of only one of them would add up as sleep.
+#else
+#define TMR_SVC_CLOCK_AWAKE CLOCK_MONOTONIC
+#define TMR_SVC_CLOCK_CONTINUOUS CLOCK_BOOTTIME
+#endif
+
+static_assert((TMR_SVC_SLOTS & (TMR_SVC_SLOTS - 1)) == 0, "TMR_SVC_SLOTS must be a power of 2!");
+
+
+
+///What to do with a timer if the system was asleep when it was due
+enum TMR_SVC_POLICY
+{
+    TSP_FIRE_ONCE_IF_MISSED,            //Fire it once after the wake (even if several periods were missed), then continue from there
+    TSP_SKIP_MISSED,                    //Don't fire it for the missed time - periodic timers continue with their next period, one-shot timers are dropped
+    TSP_SHIFT_BY_SLEEP,                 //Move its deadline by the time the system was asleep, as if the time stood still
+};
+
+
+
+///In-process timers on a timing wheel, that are serviced by a single background thread
+///INFO: Deadlines are kept on a clock that counts while the system is asleep, and the duration of each
+///      sleep is measured by comparing it with a clock that doesn't. After a wake, deadlines are
+///      recomputed according to each timer's policy, and timers that became overdue are fired
+///      one at a time, spread apart, instead of all at once.
+struct TimerService
+{
+    ///'msSpread' = interval in ms between firings of timers that became overdue while the system was asleep
+    TimerService(uint32_t msSpread = TMR_SVC_SPREAD_MS)
+        : _nSpreadNs((uint64_t)msSpread * 1000000)
+    {
+        _arrSlots.resize(TMR_SVC_SLOTS);
+
+        _nSleptNs = _getSleptNs();
+        _nCurTick = _getNowNs(TMR_SVC_CLOCK_CONTINUOUS) / _kTickNs;
+
+        _thread = std::thread(&TimerService::_threadProc, this);
+    }
+
+    ~TimerService()
+    {
+        if(true)
+        {
+            //Act from within a lock
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            _bStop = true;
+        }
+
+        _cv.notify_one();
+        _thread.join();
+    }
+
+
+    ///Callback that is invoked when a timer fires
+    ///INFO: It is called from the background thread, outside of any lock.
+    ///'nTimerID' = ID of the timer that was returned by addTimer()
+    ///'pParam1' = passed from addTimer()
+    ///'pParam2' = passed from addTimer()
+    typedef void (*PFN_TMR_SVC_CALLBACK)(uint64_t nTimerID,
+                                         const void* pParam1,
+                                         const void* pParam2);
+
+
+    ///Add a timer
+    ///'msDelay' = number of ms from "now" when to fire it first
+    ///'msPeriod' = number of ms between firings after that, or 0 for a one-shot timer
+    ///'policy' = what to do with it if the system was asleep when it was due
+    ///'pfn' = callback to invoke when the timer fires
+    ///'pParam1' = passed directly into 'pfn' when it's called
+    ///'pParam2' = passed directly into 'pfn' when it's called
+    ///RETURN:
+    ///     = Non-zero timer ID if success - one-shot timers are removed automatically after they fire
+    ///     = 0 if error
+    uint64_t addTimer(uint32_t msDelay,
+                      uint32_t msPeriod,
+                      TMR_SVC_POLICY policy,
+                      PFN_TMR_SVC_CALLBACK pfn,
+                      const void* pParam1 = nullptr,
+                      const void* pParam2 = nullptr)
+    {
+        if(!pfn)
+        {
+            //Nothing to call
+            assert(false);
+            return 0;
+        }
+
+        uint64_t nID;
+
+        if(true)
+        {
+            //Act from within a lock
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            nID = ++_nLastID;
+
+            TIMER& tmr = _mapTimers[nID];
+            tmr.nID = nID;
+            tmr.nDeadlineNs = _getNowNs(TMR_SVC_CLOCK_CONTINUOUS) + (uint64_t)msDelay * 1000000;
+            tmr.nPeriodNs = (uint64_t)msPeriod * 1000000;
+            tmr.policy = policy;
+            tmr.pfn = pfn;
+            tmr.pParam1 = pParam1;
+            tmr.pParam2 = pParam2;
+
+            _insert(tmr);
+        }
+
+        //The worker may need to wake up earlier now
+        _cv.notify_one();
+
+        return nID;
+    }
+
+
+    ///Cancel a timer that was added with addTimer()
+    ///INFO: The timer may still fire if its callback was already about to be called.
+    ///RETURN:
+    ///     = true if the timer was found and canceled
+    bool cancelTimer(uint64_t nTimerID)
+    {
+        //Act from within a lock
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        //INFO: Its slot entry is discarded lazily
+        return _mapTimers.erase(nTimerID) != 0;
+    }
+
+
+    ///Call it when the system wakes up, ex: on kIOMessageSystemHasPoweredOn notification
+    ///INFO: The wake is also noticed without it, but only within TMR_SVC_MAX_WAIT_MS.
+    void onSystemHasPoweredOn()
+    {
+        _cv.notify_one();
+    }
+
+
+    ///RETURN:
+    ///     = Number of timers that are currently scheduled
+    size_t getTimerCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        return _mapTimers.size();
+    }
+
+
+    ///Get statistics
+    ///'pszOutSkipped' = if not 0, receives the number of firings that were skipped because of the TSP_SKIP_MISSED policy
+    ///'pszOutShifted' = if not 0, receives the number of times a deadline was moved because of the TSP_SHIFT_BY_SLEEP policy
+    ///'pszOutSpread' = if not 0, receives the number of overdue timers that were spread apart after a wake
+    ///'pnOutSleptMs' = if not 0, receives the total number of ms that the system was asleep, as seen by this struct
+    ///RETURN:
+    ///     = Number of times timers fired
+    size_t getStats(size_t* pszOutSkipped = nullptr,
+                    size_t* pszOutShifted = nullptr,
+                    size_t* pszOutSpread = nullptr,
+                    uint64_t* pnOutSleptMs = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if(pszOutSkipped)
+            *pszOutSkipped = _szcSkipped;
+        if(pszOutShifted)
+            *pszOutShifted = _szcShifted;
+        if(pszOutSpread)
+            *pszOutSpread = _szcSpread;
+        if(pnOutSleptMs)
+            *pnOutSleptMs = _nTotalSleptNs / 1000000;
+
+        return _szcFired;
+    }
+
+
+
+private:
+
+    struct TIMER
+    {
+        uint64_t nID = 0;
+        uint64_t nDeadlineNs = 0;               //When to fire it next, on TMR_SVC_CLOCK_CONTINUOUS
+        uint64_t nPeriodNs = 0;                 //Period, or 0 for a one-shot timer
+        TMR_SVC_POLICY policy = TSP_FIRE_ONCE_IF_MISSED;
+
+        PFN_TMR_SVC_CALLBACK pfn = nullptr;
+        const void* pParam1 = nullptr;
+        const void* pParam2 = nullptr;
+    };
+
+    struct SLOT_ENTRY
+    {
+        uint64_t nID;                           //Timer ID
+        uint64_t nTick;                         //Tick when it's due - if it doesn't match the timer, this entry is stale
+    };
+
+    struct FIRE
+    {
+        PFN_TMR_SVC_CALLBACK pfn;
+        uint64_t nID;
+        const void* pParam1;
+        const void* pParam2;
+    };
+
+
+    static uint64_t _getNowNs(clockid_t clk)
+    {
+        timespec ts = {};
+        if(clock_gettime(clk, &ts) != 0)
+        {
+            //Failed
+            assert(false);
+        }
+
+        return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    }
+
+    ///RETURN:
+    ///     = Number of ns that the system spent asleep since some point in the past
+    ///     INFO: Only differences between the returned values make sense.
+    static uint64_t _getSleptNs()
+    {
+        return _getNowNs(TMR_SVC_CLOCK_CONTINUOUS) - _getNowNs(TMR_SVC_CLOCK_AWAKE);
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Put 'tmr' into the slot for its deadline
+    void _insert(const TIMER& tmr)
+    {
+        uint64_t nTick = (tmr.nDeadlineNs + _kTickNs - 1) / _kTickNs;
+
+        //It can't go into the past of the wheel
+        if(nTick <= _nCurTick)
+            nTick = _nCurTick + 1;
+
+        _arrSlots[nTick & (TMR_SVC_SLOTS - 1)].push_back({tmr.nID, nTick});
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///RETURN:
+    ///     = Tick of the entry in 'se' if it's still valid, or 0 if it's stale
+    uint64_t _getValidTick(const SLOT_ENTRY& se)
+    {
+        auto it = _mapTimers.find(se.nID);
+        if(it != _mapTimers.end())
+        {
+            uint64_t nTick = (it->second.nDeadlineNs + _kTickNs - 1) / _kTickNs;
+            if(nTick <= se.nTick)
+            {
+                return se.nTick;
+            }
+        }
+
+        return 0;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Recompute all deadlines after the system was asleep for 'nSleptNs'
+    void _onWake(uint64_t nSleptNs)
+    {
+        _nTotalSleptNs += nSleptNs;
+
+        uint64_t nNowNs = _getNowNs(TMR_SVC_CLOCK_CONTINUOUS);
+
+        //Take all timers off the wheel
+        for(std::vector<SLOT_ENTRY>& arrSlot : _arrSlots)
+        {
+            arrSlot.clear();
+        }
+
+        _nCurTick = nNowNs / _kTickNs;
+
+        std::vector<TIMER*> arrOverdue;
+
+        for(auto it = _mapTimers.begin(); it != _mapTimers.end(); )
+        {
+            TIMER& tmr = it->second;
+
+            if(tmr.policy == TSP_SHIFT_BY_SLEEP)
+            {
+                tmr.nDeadlineNs += nSleptNs;
+                _szcShifted++;
+            }
+            else if(tmr.nDeadlineNs <= nNowNs)
+            {
+                if(tmr.policy == TSP_SKIP_MISSED)
+                {
+                    if(!tmr.nPeriodNs)
+                    {
+                        //One-shot timer is gone
+                        _szcSkipped++;
+                        it = _mapTimers.erase(it);
+                        continue;
+                    }
+
+                    //Next period that is still ahead
+                    uint64_t nMissed = (nNowNs - tmr.nDeadlineNs) / tmr.nPeriodNs + 1;
+
+                    tmr.nDeadlineNs += nMissed * tmr.nPeriodNs;
+                    _szcSkipped += nMissed;
+                }
+                else
+                {
+                    arrOverdue.push_back(&tmr);
+                }
+            }
+
+            ++it;
+        }
+
+        //Spread overdue timers apart, in the order they were due
+        std::sort(arrOverdue.begin(), arrOverdue.end(),
+                  [](const TIMER* p1, const TIMER* p2)
+                  {
+                      return p1->nDeadlineNs < p2->nDeadlineNs;
+                  });
+
+        for(size_t i = 0; i < arrOverdue.size(); i++)
+        {
+            arrOverdue[i]->nDeadlineNs = nNowNs + i * _nSpreadNs;
+        }
+
+        _szcSpread += arrOverdue.size();
+
+        //And put all of them back
+        for(const auto& kv : _mapTimers)
+        {
+            _insert(kv.second);
+        }
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Advance the wheel up to 'nNowTick', re-arm periodic timers that are due, and collect callbacks for them
+    void _advance(uint64_t nNowTick,
+                  std::vector<FIRE>& arrFire)
+    {
+        //INFO: If we're behind by more than a full turn, each slot needs to be visited only once
+        uint64_t nFrom = _nCurTick + 1;
+        if(nNowTick >= TMR_SVC_SLOTS &&
+           nFrom < nNowTick - TMR_SVC_SLOTS + 1)
+        {
+            nFrom = nNowTick - TMR_SVC_SLOTS + 1;
+        }
+
+        std::vector<uint64_t> arrDue;
+
+        for(uint64_t t = nFrom; t <= nNowTick; t++)
+        {
+            std::vector<SLOT_ENTRY>& arrSlot = _arrSlots[t & (TMR_SVC_SLOTS - 1)];
+
+            for(size_t i = 0; i < arrSlot.size(); )
+            {
+                uint64_t nTick = _getValidTick(arrSlot[i]);
+                if(!nTick ||
+                   nTick <= nNowTick)
+                {
+                    if(nTick)
+                    {
+                        arrDue.push_back(arrSlot[i].nID);
+                    }
+
+                    //Remove it (order in the slot doesn't matter)
+                    arrSlot[i] = arrSlot.back();
+                    arrSlot.pop_back();
+                }
+                else
+                {
+                    //Its round hasn't come yet
+                    i++;
+                }
+            }
+        }
+
+        _nCurTick = nNowTick;
+
+        for(uint64_t nID : arrDue)
+        {
+            auto it = _mapTimers.find(nID);
+            assert(it != _mapTimers.end());
+
+            TIMER& tmr = it->second;
+
+            arrFire.push_back({tmr.pfn, tmr.nID, tmr.pParam1, tmr.pParam2});
+
+            if(tmr.nPeriodNs)
+            {
+                //Keep the phase, but don't try to catch up if we were late
+                tmr.nDeadlineNs += tmr.nPeriodNs;
+
+                if(tmr.nDeadlineNs <= nNowTick * _kTickNs)
+                    tmr.nDeadlineNs = (nNowTick + 1) * _kTickNs;
+
+                _insert(tmr);
+            }
+            else
+            {
+                _mapTimers.erase(it);
+            }
+        }
+
+        _szcFired += arrFire.size();
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///RETURN:
+    ///     = Earliest tick that has a timer, or 0 if there are no timers
+    uint64_t _getNextTick()
+    {
+        if(_mapTimers.empty())
+            return 0;
+
+        //Look for the first slot with a timer in this round of the wheel
+        uint64_t nMin = 0;
+
+        for(uint64_t t = _nCurTick + 1; t <= _nCurTick + TMR_SVC_SLOTS; t++)
+        {
+            for(const SLOT_ENTRY& se : _arrSlots[t & (TMR_SVC_SLOTS - 1)])
+            {
+                uint64_t nTick = _getValidTick(se);
+                if(nTick &&
+                   (!nMin || nTick < nMin))
+                {
+                    nMin = nTick;
+                }
+            }
+
+            if(nMin &&
+               nMin <= t)
+            {
+                //Nothing can come before it
+                break;
+            }
+        }
+
+        return nMin;
+    }
+
+
+    void _threadProc()
+    {
+        std::vector<FIRE> arrFire;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while(!_bStop)
+        {
+            //Did the system sleep since the last time we checked?
+            uint64_t nSleptNs = _getSleptNs();
+            //INFO: Two clocks are not read at once, so the difference may jitter slightly in either direction
+            if(nSleptNs > _nSleptNs &&
+               nSleptNs - _nSleptNs >= (uint64_t)TMR_SVC_SLEEP_MIN_MS * 1000000)
+            {
+                _onWake(nSleptNs - _nSleptNs);
+            }
+
+            //Always start from the last reading, so that jitter and drift between the clocks don't add up into a false wake
+            _nSleptNs = nSleptNs;
+
+            uint64_t nNowNs = _getNowNs(TMR_SVC_CLOCK_CONTINUOUS);
+
+            arrFire.clear();
+            _advance(nNowNs / _kTickNs, arrFire);
+
+            if(!arrFire.empty())
+            {
+                //Invoke callbacks outside of the lock (they may add or cancel timers)
+                lock.unlock();
+
+                for(const FIRE& f : arrFire)
+                {
+                    f.pfn(f.nID, f.pParam1, f.pParam2);
+                }
+
+                lock.lock();
+                continue;
+            }
+
+            uint64_t nNextTick = _getNextTick();
+            if(!nNextTick)
+            {
+                //Nothing to do until a timer is added
+                _cv.wait(lock);
+            }
+            else
+            {
+                uint64_t nWaitNs = nNextTick * _kTickNs > nNowNs ? nNextTick * _kTickNs - nNowNs : 0;
+                if(nWaitNs > (uint64_t)TMR_SVC_MAX_WAIT_MS * 1000000)
+                    nWaitNs = (uint64_t)TMR_SVC_MAX_WAIT_MS * 1000000;
+
+                _cv.wait_for(lock, std::chrono::nanoseconds(nWaitNs));
+            }
+        }
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    TimerService(const TimerService& s) = delete;
+    TimerService& operator = (const TimerService& s) = delete;
+
+private:
+
+    static constexpr uint64_t _kTickNs = (uint64_t)TMR_SVC_TICK_MS * 1000000;
+
+    std::mutex _mutex;                                      //Lock for accessing this struct
+    std::condition_variable _cv;                            //Wakes up '_thread'
+    std::thread _thread;                                    //Thread that fires timers
+    bool _bStop = false;                                    //true to stop '_thread'
+
+    uint64_t _nSpreadNs;                                    //Interval between firings of overdue timers after a wake
+
+    std::unordered_map<uint64_t, TIMER> _mapTimers;         //All timers, by their IDs
+    std::vector<std::vector<SLOT_ENTRY>> _arrSlots;         //Timing wheel
+    uint64_t _nCurTick = 0;                                 //Last tick that the wheel was advanced to
+    uint64_t _nLastID = 0;                                  //Last assigned timer ID
+
+    uint64_t _nSleptNs = 0;                                 //Result of _getSleptNs() when we last checked it
+
+    size_t _szcFired = 0;                                   //Number of times timers fired
+    size_t _szcSkipped = 0;                                 //Number of firings skipped because of TSP_SKIP_MISSED
+    size_t _szcShifted = 0;                                 //Number of deadlines moved because of TSP_SHIFT_BY_SLEEP
+    size_t _szcSpread = 0;                                  //Number of overdue timers that were spread apart
+    uint64_t _nTotalSleptNs = 0;                            //Total time the system was asleep
+};
+
+
+
+
+#endif /* timer_service_h */
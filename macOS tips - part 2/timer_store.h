@@ -0,0 +1,855 @@
+//
+//  timer_store.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of a crash-consistent store of wake timers in a memory-mapped file,
+//  that can be used right after a restart without parsing it
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef timer_store_h
+#define timer_store_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "rdr_wrtr.h"           //Reader/writer lock classes from "macOS tips - part 1"
+#include "async_log.h"
+
+
+
+
+#define TIMER_STORE_DEF_MAX_RECORDS 256         //Default max number of records in a new store file
+#define TIMER_STORE_MAX_RECORDS (64 * 1024)     //Max number of records in a store file
+
+#define TIMER_STORE_SYNC_TO_DISK 1              //1 to flush each change to disk before it becomes visible, so that it survives
+                                                //a power loss, or 0 to rely on the OS page cache (it survives a crash of this process only)
+
+#define TIMER_STORE_MAGIC 0x52544B57            //"WKTR"
+#define TIMER_STORE_VERSION 1
+
+#define TIMER_STORE_DAMAGED_SUFFIX ".damaged"    //Suffix for the name of a store file that couldn't be opened
+
+#define TIMER_STORE_SLOT_SIZE 4096              //Size of each header slot in the file, and the alignment of record banks
+                                                //INFO: It's a part of the file format, so it doesn't follow the page size of the OS.
+
+
+
+///Persisted wake timer
+///INFO: It has a fixed size, so that records can be used directly from the file.
+struct TIMER_REC
+{
+    char szOwner[64];               //Owner of this record, ex: bundle ID of the wake timer (null-terminated)
+    uint64_t nID;                   //ID of the timer (unique per owner), or 0 for the OS wake event of the owner itself
+    double dtEarliest;              //UTC date/time when it may fire at the earliest (as CFAbsoluteTime)
+    double dtLatest;                //UTC date/time when it must fire (as CFAbsoluteTime)
+    char szCron[64];                //Recurring schedule in the cron format, or "" for a one-shot timer (null-terminated)
+    uint64_t nReserved;             //Must be 0
+};
+
+static_assert(sizeof(TIMER_REC) == 160, "Record size is a part of the file format!");
+
+
+
+///Store of wake timers in a memory-mapped file
+///INFO: File layout is:
+///         [header slot 0] [header slot 1] [record bank 0] [record bank 1]
+///      Records are kept sorted by owner & ID in one bank. A change is written into the other bank,
+///      and then it becomes visible by writing a header with the next generation into the other slot.
+///      On open, the valid header with the highest generation is used, so a crash at any moment
+///      leaves either the old or the new set of records.
+struct TimerStore
+{
+    TimerStore()
+    {
+    }
+
+    ~TimerStore()
+    {
+        close();
+    }
+
+
+    ///Open or create the store file
+    ///INFO: Only one process can have it open at a time.
+    ///      If the file is damaged, or is of another version, it's renamed to 'pstrPath' + TIMER_STORE_DAMAGED_SUFFIX
+    ///      (and that is logged), and a new file is created instead.
+    ///'pstrPath' = path to the file
+    ///'szMaxRecords' = max number of records, if the file is created (existing files keep their size) - up to TIMER_STORE_MAX_RECORDS
+    ///RETURN:
+    ///     = true if success
+    ///     = false if error (check errno for details)
+    bool open(const char* pstrPath,
+              size_t szMaxRecords = TIMER_STORE_DEF_MAX_RECORDS)
+    {
+        WRITER_LOCK wrl(_lock);
+
+        _close();
+
+        if(!pstrPath ||
+           !pstrPath[0] ||
+           !szMaxRecords ||
+           szMaxRecords > TIMER_STORE_MAX_RECORDS)
+        {
+            //Bad parameters
+            assert(false);
+            errno = EINVAL;
+            return false;
+        }
+
+        int nOSError = 0;
+
+        int hFile = ::open(pstrPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if(hFile != -1)
+        {
+            //Don't let another instance of the daemon use it at the same time
+            if(flock(hFile, LOCK_EX | LOCK_NB) == 0)
+            {
+                struct stat st = {};
+                if(fstat(hFile, &st) == 0)
+                {
+                    //See if the file has a valid header
+                    HEADER hdr;
+                    size_t szcMapping = 0;
+
+                    if(_readBestHeader(hFile, (size_t)st.st_size, &hdr))
+                    {
+                        //Use its size
+                        szcMapping = _getFileSize(hdr.nMaxRecords);
+                    }
+                    else
+                    {
+                        if(!_isBlank(hFile, (size_t)st.st_size))
+                        {
+                            //Damaged, or of another version - don't overwrite it, but start a new file
+                            int hFileNew = _moveAside(pstrPath);
+                            int nErr = errno;
+
+                            ::close(hFile);
+                            hFile = hFileNew;
+
+                            if(hFile == -1)
+                            {
+                                //Error
+                                nOSError = nErr;
+                            }
+                        }
+
+                        //New file
+                        szcMapping = hFile != -1 ? _getFileSize((uint32_t)szMaxRecords) : 0;
+
+                        if(!szcMapping)
+                        {
+                            //Failed above
+                        }
+                        else if(ftruncate(hFile, 0) != 0 ||
+                                ftruncate(hFile, (off_t)szcMapping) != 0)
+                        {
+                            //Error
+                            nOSError = errno;
+                            szcMapping = 0;
+                        }
+                        else
+                        {
+                            memset(&hdr, 0, sizeof(hdr));
+                            hdr.nMagic = TIMER_STORE_MAGIC;
+                            hdr.nVersion = TIMER_STORE_VERSION;
+                            hdr.nRecSize = sizeof(TIMER_REC);
+                            hdr.nMaxRecords = (uint32_t)szMaxRecords;
+                            hdr.nGeneration = 0;
+                            hdr.nBank = 0;
+                            hdr.nCount = 0;
+                        }
+                    }
+
+                    if(szcMapping)
+                    {
+                        void* pMem = mmap(nullptr, szcMapping, PROT_READ | PROT_WRITE, MAP_SHARED, hFile, 0);
+                        if(pMem != MAP_FAILED)
+                        {
+                            _pMem = (uint8_t*)pMem;
+                            _szcMem = szcMapping;
+                            _hFile = hFile;
+                            hFile = -1;
+
+                            _hdr = hdr;
+
+                            if(_hdr.nGeneration == 0)
+                            {
+                                //Write the first header
+                                if(!_writeHeader(_hdr))
+                                {
+                                    nOSError = errno;
+                                    _close();
+                                }
+                            }
+                        }
+                        else
+                        {
+                            //Error
+                            nOSError = errno;
+                        }
+                    }
+                }
+                else
+                {
+                    //Error
+                    nOSError = errno;
+                }
+            }
+            else
+            {
+                //Already in use
+                nOSError = errno;
+            }
+
+            if(hFile != -1)
+            {
+                ::close(hFile);
+            }
+        }
+        else
+        {
+            //Error
+            nOSError = errno;
+        }
+
+        errno = nOSError;
+        return _pMem != nullptr;
+    }
+
+
+    ///Close the store file
+    ///INFO: All changes are already in it.
+    void close()
+    {
+        WRITER_LOCK wrl(_lock);
+
+        _close();
+    }
+
+
+    ///RETURN:
+    ///     = true if the store file is open
+    bool isOpen()
+    {
+        READER_LOCK rdl(_lock);
+
+        return _pMem != nullptr;
+    }
+
+
+    ///Find a record
+    ///'pstrOwner' = owner of the record
+    ///'nID' = ID of the record
+    ///'pOutRec' = if not 0, receives the record
+    ///RETURN:
+    ///     = true if found
+    bool find(const char* pstrOwner,
+              uint64_t nID,
+              TIMER_REC* pOutRec = nullptr)
+    {
+        READER_LOCK rdl(_lock);
+
+        if(!_pMem)
+            return false;
+
+        const TIMER_REC* pRecs = _getBank(_hdr.nBank);
+        const TIMER_REC* pEnd = pRecs + _hdr.nCount;
+
+        const TIMER_REC* pRec = std::lower_bound(pRecs, pEnd, KEY{pstrOwner, nID}, _cmpKey);
+        if(pRec != pEnd &&
+           _isKey(*pRec, pstrOwner, nID))
+        {
+            if(pOutRec)
+                *pOutRec = *pRec;
+
+            return true;
+        }
+
+        return false;
+    }
+
+
+    ///Get all records for an owner
+    ///'pstrOwner' = owner of the records
+    ///'arrOut' = receives records, sorted by ID
+    ///RETURN:
+    ///     = Number of records in 'arrOut'
+    size_t getRecords(const char* pstrOwner,
+                      std::vector<TIMER_REC>& arrOut)
+    {
+        arrOut.clear();
+
+        READER_LOCK rdl(_lock);
+
+        if(!_pMem)
+            return 0;
+
+        const TIMER_REC* pRecs = _getBank(_hdr.nBank);
+        const TIMER_REC* pEnd = pRecs + _hdr.nCount;
+
+        for(const TIMER_REC* pRec = std::lower_bound(pRecs, pEnd, KEY{pstrOwner, 0}, _cmpKey);
+            pRec != pEnd && strcmp(pRec->szOwner, pstrOwner) == 0;
+            ++pRec)
+        {
+            arrOut.push_back(*pRec);
+        }
+
+        return arrOut.size();
+    }
+
+
+    ///Add a record, or replace the one with the same owner & ID
+    ///'rec' = record to write
+    ///RETURN:
+    ///     = true if success
+    ///     = false if error, or if the store is full
+    bool put(const TIMER_REC& rec)
+    {
+        if(!rec.szOwner[0] ||
+           !memchr(rec.szOwner, 0, sizeof(rec.szOwner)) ||
+           !memchr(rec.szCron, 0, sizeof(rec.szCron)))
+        {
+            //Bad record
+            assert(false);
+            return false;
+        }
+
+        WRITER_LOCK wrl(_lock);
+
+        if(!_pMem)
+            return false;
+
+        const TIMER_REC* pRecs = _getBank(_hdr.nBank);
+        const TIMER_REC* pEnd = pRecs + _hdr.nCount;
+
+        const TIMER_REC* pRec = std::lower_bound(pRecs, pEnd, KEY{rec.szOwner, rec.nID}, _cmpKey);
+        bool bReplace = pRec != pEnd && _isKey(*pRec, rec.szOwner, rec.nID);
+
+        if(bReplace &&
+           memcmp(pRec, &rec, sizeof(rec)) == 0)
+        {
+            //No changes
+            return true;
+        }
+
+        if(!bReplace &&
+           _hdr.nCount >= _hdr.nMaxRecords)
+        {
+            //Full
+            return false;
+        }
+
+        size_t nPos = pRec - pRecs;
+
+        return _commit(nPos, bReplace ? 1 : 0, &rec);
+    }
+
+
+    ///Remove a record
+    ///'pstrOwner' = owner of the record
+    ///'nID' = ID of the record
+    ///RETURN:
+    ///     = true if success, or if there was no such record
+    bool remove(const char* pstrOwner,
+                uint64_t nID)
+    {
+        WRITER_LOCK wrl(_lock);
+
+        if(!_pMem)
+            return false;
+
+        const TIMER_REC* pRecs = _getBank(_hdr.nBank);
+        const TIMER_REC* pEnd = pRecs + _hdr.nCount;
+
+        const TIMER_REC* pRec = std::lower_bound(pRecs, pEnd, KEY{pstrOwner, nID}, _cmpKey);
+        if(pRec == pEnd ||
+           !_isKey(*pRec, pstrOwner, nID))
+        {
+            //Nothing to do
+            return true;
+        }
+
+        return _commit(pRec - pRecs, 1, nullptr);
+    }
+
+
+    ///Remove all records of an owner with IDs of at least 'nMinID'
+    ///RETURN:
+    ///     = true if success
+    bool removeAll(const char* pstrOwner,
+                   uint64_t nMinID = 0)
+    {
+        WRITER_LOCK wrl(_lock);
+
+        if(!_pMem)
+            return false;
+
+        const TIMER_REC* pRecs = _getBank(_hdr.nBank);
+        const TIMER_REC* pEnd = pRecs + _hdr.nCount;
+
+        const TIMER_REC* pFirst = std::lower_bound(pRecs, pEnd, KEY{pstrOwner, nMinID}, _cmpKey);
+        const TIMER_REC* pLast = pFirst;
+
+        while(pLast != pEnd &&
+              strcmp(pLast->szOwner, pstrOwner) == 0)
+        {
+            ++pLast;
+        }
+
+        if(pFirst == pLast)
+        {
+            //Nothing to do
+            return true;
+        }
+
+        return _commit(pFirst - pRecs, pLast - pFirst, nullptr);
+    }
+
+
+    ///RETURN:
+    ///     = Number of changes that were written to the file since it was created
+    uint64_t getGeneration()
+    {
+        READER_LOCK rdl(_lock);
+
+        return _pMem ? _hdr.nGeneration : 0;
+    }
+
+
+    ///Fill in a record
+    ///'pstrOwner' = owner of the record
+    ///'nID' = ID of the record
+    ///'dtEarliest' = UTC date/time when it may fire at the earliest
+    ///'dtLatest' = UTC date/time when it must fire
+    ///'pstrCron' = recurring schedule, or 0 or "" for a one-shot timer
+    ///RETURN:
+    ///     = true if success
+    ///     = false if strings are too long
+    static bool makeRecord(TIMER_REC& rec,
+                           const char* pstrOwner,
+                           uint64_t nID,
+                           double dtEarliest,
+                           double dtLatest,
+                           const char* pstrCron = nullptr)
+    {
+        memset(&rec, 0, sizeof(rec));
+
+        rec.nID = nID;
+        rec.dtEarliest = dtEarliest;
+        rec.dtLatest = dtLatest;
+
+        size_t szcOwner = pstrOwner ? strlen(pstrOwner) : 0;
+        size_t szcCron = pstrCron ? strlen(pstrCron) : 0;
+
+        if(szcOwner >= sizeof(rec.szOwner) ||
+           szcCron >= sizeof(rec.szCron))
+        {
+            //Too long
+            return false;
+        }
+
+        if(szcOwner)
+            memcpy(rec.szOwner, pstrOwner, szcOwner);
+        if(szcCron)
+            memcpy(rec.szCron, pstrCron, szcCron);
+
+        return true;
+    }
+
+
+
+private:
+
+    struct HEADER
+    {
+        uint32_t nMagic;                    //TIMER_STORE_MAGIC
+        uint32_t nVersion;                  //TIMER_STORE_VERSION
+        uint32_t nRecSize;                  //sizeof(TIMER_REC)
+        uint32_t nMaxRecords;               //Max number of records in each bank
+        uint64_t nGeneration;               //Incremented with each change - the valid header with the highest one is used
+        uint32_t nBank;                     //Bank with records [0-1]
+        uint32_t nCount;                    //Number of records in 'nBank'
+        uint64_t nChecksumRecs;             //Checksum of records in 'nBank'
+        uint64_t nChecksumHdr;              //Checksum of this header up to this member
+    };
+
+    struct KEY
+    {
+        const char* pstrOwner;
+        uint64_t nID;
+    };
+
+
+    static bool _cmpKey(const TIMER_REC& rec,
+                        const KEY& key)
+    {
+        int nCmp = strcmp(rec.szOwner, key.pstrOwner);
+
+        return nCmp < 0 || (nCmp == 0 && rec.nID < key.nID);
+    }
+
+    static bool _isKey(const TIMER_REC& rec,
+                       const char* pstrOwner,
+                       uint64_t nID)
+    {
+        return rec.nID == nID &&
+               strcmp(rec.szOwner, pstrOwner) == 0;
+    }
+
+
+    ///RETURN:
+    ///     = 64-bit FNV-1a checksum of 'szcSize' bytes at 'pData'
+    static uint64_t _checksum(const void* pData,
+                              size_t szcSize)
+    {
+        uint64_t nHash = 0xcbf29ce484222325ull;
+
+        const uint8_t* p = (const uint8_t*)pData;
+        for(size_t i = 0; i < szcSize; i++)
+        {
+            nHash ^= p[i];
+            nHash *= 0x100000001b3ull;
+        }
+
+        return nHash;
+    }
+
+    static uint64_t _checksumHeader(const HEADER& hdr)
+    {
+        return _checksum(&hdr, offsetof(HEADER, nChecksumHdr));
+    }
+
+
+    static size_t _getBankSize(uint32_t nMaxRecords)
+    {
+        size_t szcBank = (size_t)nMaxRecords * sizeof(TIMER_REC);
+
+        //Round up to a slot
+        return (szcBank + TIMER_STORE_SLOT_SIZE - 1) & ~(size_t)(TIMER_STORE_SLOT_SIZE - 1);
+    }
+
+    static size_t _getFileSize(uint32_t nMaxRecords)
+    {
+        return TIMER_STORE_SLOT_SIZE * 2 + _getBankSize(nMaxRecords) * 2;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    TIMER_REC* _getBank(uint32_t nBank)
+    {
+        assert(_pMem);
+        assert(nBank < 2);
+
+        return (TIMER_REC*)(_pMem + TIMER_STORE_SLOT_SIZE * 2 + _getBankSize(_hdr.nMaxRecords) * nBank);
+    }
+
+
+    ///Read both header slots from 'hFile' and pick the valid one with the highest generation
+    ///'szcFile' = size of the file in bytes
+    ///RETURN:
+    ///     = true if found
+    static bool _readBestHeader(int hFile,
+                                size_t szcFile,
+                                HEADER* pOutHdr)
+    {
+        bool bFound = false;
+
+        for(int s = 0; s < 2; s++)
+        {
+            HEADER hdr;
+            if(pread(hFile, &hdr, sizeof(hdr), (off_t)s * TIMER_STORE_SLOT_SIZE) != (ssize_t)sizeof(hdr))
+                continue;
+
+            if(hdr.nMagic != TIMER_STORE_MAGIC ||
+               hdr.nVersion != TIMER_STORE_VERSION ||
+               hdr.nRecSize != sizeof(TIMER_REC) ||
+               hdr.nChecksumHdr != _checksumHeader(hdr) ||
+               hdr.nBank > 1 ||
+               hdr.nMaxRecords == 0 ||
+               hdr.nMaxRecords > TIMER_STORE_MAX_RECORDS ||
+               hdr.nCount > hdr.nMaxRecords ||
+               szcFile < _getFileSize(hdr.nMaxRecords))
+            {
+                //Invalid or torn
+                continue;
+            }
+
+            //Records that it points to must be intact
+            size_t szcRecs = (size_t)hdr.nCount * sizeof(TIMER_REC);
+            std::vector<uint8_t> arrRecs(szcRecs);
+
+            off_t nOffs = (off_t)(TIMER_STORE_SLOT_SIZE * 2 + _getBankSize(hdr.nMaxRecords) * hdr.nBank);
+
+            if(szcRecs &&
+               pread(hFile, arrRecs.data(), szcRecs, nOffs) != (ssize_t)szcRecs)
+            {
+                continue;
+            }
+
+            if(_checksum(arrRecs.data(), szcRecs) != hdr.nChecksumRecs)
+            {
+                //Records were not fully written
+                continue;
+            }
+
+            if(!bFound ||
+               hdr.nGeneration > pOutHdr->nGeneration)
+            {
+                *pOutHdr = hdr;
+                bFound = true;
+            }
+        }
+
+        return bFound;
+    }
+
+
+    ///RETURN:
+    ///     = true if 'hFile' was just created - it's empty, or has nothing but zeros in its header slots
+    ///       INFO: The latter happens if we crashed before writing the first header into it.
+    static bool _isBlank(int hFile,
+                         size_t szcFile)
+    {
+        uint8_t buff[TIMER_STORE_SLOT_SIZE];
+
+        size_t szcHdrs = std::min(szcFile, (size_t)TIMER_STORE_SLOT_SIZE * 2);
+
+        for(size_t nOffs = 0; nOffs < szcHdrs; nOffs += sizeof(buff))
+        {
+            size_t szcRead = std::min(szcHdrs - nOffs, sizeof(buff));
+
+            if(pread(hFile, buff, szcRead, (off_t)nOffs) != (ssize_t)szcRead)
+                return false;
+
+            for(size_t i = 0; i < szcRead; i++)
+            {
+                if(buff[i])
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    ///Rename a store file that couldn't be used to 'pstrPath' + TIMER_STORE_DAMAGED_SUFFIX, and create a new one instead
+    ///INFO: An older damaged file is replaced.
+    ///RETURN:
+    ///     = Handle of the new file, that is locked for this process
+    ///     = -1 if error (check errno for details)
+    static int _moveAside(const char* pstrPath)
+    {
+        std::string strAside = pstrPath;
+        strAside += TIMER_STORE_DAMAGED_SUFFIX;
+
+        if(rename(pstrPath, strAside.c_str()) != 0)
+        {
+            //Error
+            int nErr = errno;
+            ASYNC_LOG("ERROR: (%d) Timer store \"%s\" is damaged, and it couldn't be renamed\n", nErr, pstrPath);
+
+            errno = nErr;
+            return -1;
+        }
+
+        ASYNC_LOG("ERROR: Timer store \"%s\" is damaged - it was renamed to \"%s\", and a new one was created\n",
+                  pstrPath,
+                  strAside);
+
+        int hFile = ::open(pstrPath, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if(hFile != -1)
+        {
+            if(flock(hFile, LOCK_EX | LOCK_NB) != 0)
+            {
+                //Another process got to it first
+                int nErr = errno;
+
+                ::close(hFile);
+                hFile = -1;
+
+                errno = nErr;
+            }
+        }
+
+        return hFile;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Write the current records with 'szcRemove' records at 'nPos' replaced by 'pInsert' (if not 0)
+    ///into the other bank, and then make it visible with a new header
+    ///RETURN:
+    ///     = true if success
+    bool _commit(size_t nPos,
+                 size_t szcRemove,
+                 const TIMER_REC* pInsert)
+    {
+        assert(nPos + szcRemove <= _hdr.nCount);
+
+        const TIMER_REC* pSrc = _getBank(_hdr.nBank);
+
+        uint32_t nBankNew = _hdr.nBank ^ 1;
+        TIMER_REC* pDst = _getBank(nBankNew);
+
+        //Records before, new one, and records after
+        memcpy(pDst, pSrc, nPos * sizeof(TIMER_REC));
+
+        size_t nDst = nPos;
+        if(pInsert)
+        {
+            pDst[nDst++] = *pInsert;
+        }
+
+        size_t szcAfter = _hdr.nCount - nPos - szcRemove;
+        memcpy(pDst + nDst, pSrc + nPos + szcRemove, szcAfter * sizeof(TIMER_REC));
+        nDst += szcAfter;
+
+        assert(nDst <= _hdr.nMaxRecords);
+
+#if TIMER_STORE_SYNC_TO_DISK
+        //Records must be on disk before the header that points to them
+        if(!_msync(pDst, nDst * sizeof(TIMER_REC)))
+        {
+            //Error
+            assert(false);
+            return false;
+        }
+#endif
+
+        HEADER hdr = _hdr;
+        hdr.nGeneration++;
+        hdr.nBank = nBankNew;
+        hdr.nCount = (uint32_t)nDst;
+        hdr.nChecksumRecs = _checksum(pDst, nDst * sizeof(TIMER_REC));
+
+        if(!_writeHeader(hdr))
+        {
+            //Error
+            assert(false);
+            return false;
+        }
+
+        _hdr = hdr;
+
+        return true;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Write 'hdr' into the slot for its generation (that is the one not used by the current header)
+    ///RETURN:
+    ///     = true if success
+    bool _writeHeader(HEADER& hdr)
+    {
+        hdr.nChecksumHdr = _checksumHeader(hdr);
+
+        uint8_t* pSlot = _pMem + (hdr.nGeneration & 1) * TIMER_STORE_SLOT_SIZE;
+
+        //Make sure that the compiler doesn't reorder it with writes of records
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        memcpy(pSlot, &hdr, sizeof(hdr));
+
+#if TIMER_STORE_SYNC_TO_DISK
+        if(!_msync(pSlot, sizeof(hdr)))
+        {
+            //Error
+            return false;
+        }
+#endif
+
+        return true;
+    }
+
+
+    ///Write 'szcSize' bytes at 'pAddr' in the mapped file to disk
+    ///INFO: msync() requires an address aligned to the page size of the OS, that can be larger than
+    ///      TIMER_STORE_SLOT_SIZE (ex: 16 KB on Apple silicon), so the range is extended to whole pages.
+    ///      It's safe, as the rest of those pages is not being changed at the time.
+    ///RETURN:
+    ///     = true if success
+    static bool _msync(const void* pAddr,
+                       size_t szcSize)
+    {
+        if(!szcSize)
+            return true;
+
+        static const uintptr_t s_nPageSize = (uintptr_t)getpagesize();
+        assert((s_nPageSize & (s_nPageSize - 1)) == 0);
+
+        uintptr_t nBegin = (uintptr_t)pAddr & ~(s_nPageSize - 1);
+        uintptr_t nEnd = ((uintptr_t)pAddr + szcSize + s_nPageSize - 1) & ~(s_nPageSize - 1);
+
+        return msync((void*)nBegin, nEnd - nBegin, MS_SYNC) == 0;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    void _close()
+    {
+        if(_pMem)
+        {
+            if(munmap(_pMem, _szcMem) != 0)
+            {
+                //Error
+                assert(false);
+            }
+
+            _pMem = nullptr;
+            _szcMem = 0;
+        }
+
+        if(_hFile != -1)
+        {
+            //This also releases the flock
+            ::close(_hFile);
+            _hFile = -1;
+        }
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    TimerStore(const TimerStore& s) = delete;
+    TimerStore& operator = (const TimerStore& s) = delete;
+
+private:
+
+    RDR_WRTR _lock;                 //Lock for accessing this struct
+
+    int _hFile = -1;                //Store file, or -1 if not open
+    uint8_t* _pMem = nullptr;       //Memory-mapped store file, or null if not open
+    size_t _szcMem = 0;             //Size of '_pMem' in bytes
+
+    HEADER _hdr = {};               //Copy of the current header
+};
+
+
+
+
+#endif /* timer_store_h */
@@ -49,6 +49,18 @@ enum CURRENT_REBOOT_SHUTDOWN_STATE
 
 
 
+enum PWR_SLEEP_STATE
+{
+    PSS_Unknown,
+    
+    PSS_Awake,                          //System is running
+    PSS_SleepRequested,                 //System asked if it can go to idle sleep, and we allowed it
+    PSS_GoingToSleep,                   //System is going to sleep (it can't be canceled)
+    PSS_PoweringOn,                     //System is waking up, but device drivers are not powered on yet
+};
+
+
+
 
 
 #endif /* types_h */
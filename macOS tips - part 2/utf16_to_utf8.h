@@ -0,0 +1,437 @@
+//
+//  utf16_to_utf8.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of a vectorized conversion of UTF-16 into UTF-8, that can be used
+//  on the characters of a CFString (from CFStringGetCharactersPtr)
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms.
+//
+
+
+#ifndef utf16_to_utf8_h
+#define utf16_to_utf8_h
+
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "types.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define UTF16_TO_UTF8_AVX2 1
+#endif
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define UTF16_TO_UTF8_SSSE3 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define UTF16_TO_UTF8_SSE2 1
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define UTF16_TO_UTF8_NEON 1
+#endif
+
+
+
+
+#define UTF16_TO_UTF8_MAX_BYTES_PER_UNIT 3      //Max number of UTF-8 bytes for a single UTF-16 unit (a surrogate pair makes 4 bytes from 2 units)
+
+
+
+enum UTF_CONV_RES
+{
+    UCR_OK,                     //Converted successfully
+    UCR_BAD_SURROGATE,          //Source has an unpaired surrogate
+    UCR_BUFF_TOO_SMALL,         //Output buffer is too small
+};
+
+
+
+///Converts UTF-16 into UTF-8 with validation
+///INFO: Blocks of 8 units (or 16 with AVX2) are converted with SIMD instructions, if they contain only
+///      ASCII characters, only 1 and 2-byte characters, or only 3-byte characters (the last two with SSSE3
+///      and NEON). The rest goes through the scalar path, that also validates surrogate pairs.
+///      SIMD instruction sets are picked at compile time.
+struct Utf16ToUtf8
+{
+    ///RETURN:
+    ///     = Size of the buffer in bytes, that is enough to convert 'szcUnits' of UTF-16 into UTF-8
+    static constexpr size_t getMaxSize(size_t szcUnits)
+    {
+        return szcUnits * UTF16_TO_UTF8_MAX_BYTES_PER_UNIT;
+    }
+
+
+    ///Convert UTF-16 into UTF-8
+    ///'pSrc' = UTF-16 units in the native byte order
+    ///'szcSrc' = number of units in 'pSrc'
+    ///'pDest' = buffer to write UTF-8 into (it is not null-terminated)
+    ///'szcDest' = size of 'pDest' in bytes - getMaxSize() is always enough
+    ///'pszcOut' = if not 0, receives the number of bytes written into 'pDest' (if error, up to where it happened)
+    ///'pnErrPos' = if not 0, receives the index in 'pSrc' where the conversion stopped, if error
+    ///RETURN:
+    ///     = Result of the conversion
+    static UTF_CONV_RES convert(const uint16_t* pSrc,
+                                size_t szcSrc,
+                                char* pDest,
+                                size_t szcDest,
+                                size_t* pszcOut = nullptr,
+                                size_t* pnErrPos = nullptr)
+    {
+        size_t i = 0;
+        size_t o = 0;
+        UTF_CONV_RES res = UCR_OK;
+
+        while(i < szcSrc)
+        {
+#if defined(UTF16_TO_UTF8_AVX2)
+            //Runs of ASCII, 16 units at a time
+            while(szcSrc - i >= 16 &&
+                  szcDest - o >= 16)
+            {
+                __m256i v = _mm256_loadu_si256((const __m256i*)(pSrc + i));
+                if(!_mm256_testz_si256(v, _mm256_set1_epi16((short)0xFF80)))
+                    break;
+
+                __m128i vPacked = _mm_packus_epi16(_mm256_castsi256_si128(v),
+                                                   _mm256_extracti128_si256(v, 1));
+                _mm_storeu_si128((__m128i*)(pDest + o), vPacked);
+
+                i += 16;
+                o += 16;
+            }
+#endif
+
+            if(szcSrc - i >= 8 &&
+               szcDest - o >= 24)
+            {
+                int nWritten = _convertBlock8(pSrc + i, pDest + o);
+                if(nWritten >= 0)
+                {
+                    i += 8;
+                    o += nWritten;
+
+                    continue;
+                }
+            }
+
+            //The rest of the block goes through the scalar path
+            size_t iEnd = i + 8;
+            if(iEnd > szcSrc)
+                iEnd = szcSrc;
+
+            res = _convertScalar(pSrc, szcSrc, i, iEnd, pDest, szcDest, o);
+            if(res != UCR_OK)
+            {
+                break;
+            }
+        }
+
+        if(pszcOut)
+            *pszcOut = o;
+        if(pnErrPos)
+            *pnErrPos = i;
+
+        return res;
+    }
+
+
+    ///Convert UTF-16 into UTF-8 without SIMD instructions
+    ///INFO: It's the reference for convert() - its parameters are the same.
+    static UTF_CONV_RES convertScalar(const uint16_t* pSrc,
+                                      size_t szcSrc,
+                                      char* pDest,
+                                      size_t szcDest,
+                                      size_t* pszcOut = nullptr,
+                                      size_t* pnErrPos = nullptr)
+    {
+        size_t i = 0;
+        size_t o = 0;
+
+        UTF_CONV_RES res = _convertScalar(pSrc, szcSrc, i, szcSrc, pDest, szcDest, o);
+
+        if(pszcOut)
+            *pszcOut = o;
+        if(pnErrPos)
+            *pnErrPos = i;
+
+        return res;
+    }
+
+
+
+private:
+
+    ///Convert units from 'i' up to 'iEnd' (or one more, if the last one starts a surrogate pair)
+    ///'i' = index of the next unit in 'pSrc', that is advanced
+    ///'o' = index of the next byte in 'pDest', that is advanced
+    ///RETURN:
+    ///     = Result of the conversion
+    static UTF_CONV_RES _convertScalar(const uint16_t* pSrc,
+                                       size_t szcSrc,
+                                       size_t& i,
+                                       size_t iEnd,
+                                       char* pDest,
+                                       size_t szcDest,
+                                       size_t& o)
+    {
+        while(i < iEnd)
+        {
+            uint32_t c = pSrc[i];
+
+            if(c < 0x80)
+            {
+                if(o + 1 > szcDest)
+                    return UCR_BUFF_TOO_SMALL;
+
+                pDest[o++] = (char)c;
+                i++;
+            }
+            else if(c < 0x800)
+            {
+                if(o + 2 > szcDest)
+                    return UCR_BUFF_TOO_SMALL;
+
+                pDest[o++] = (char)(0xC0 | (c >> 6));
+                pDest[o++] = (char)(0x80 | (c & 0x3F));
+                i++;
+            }
+            else if((c & 0xF800) != 0xD800)
+            {
+                if(o + 3 > szcDest)
+                    return UCR_BUFF_TOO_SMALL;
+
+                pDest[o++] = (char)(0xE0 | (c >> 12));
+                pDest[o++] = (char)(0x80 | ((c >> 6) & 0x3F));
+                pDest[o++] = (char)(0x80 | (c & 0x3F));
+                i++;
+            }
+            else
+            {
+                //Surrogate pair: high surrogate must be followed by a low one
+                if(c >= 0xDC00 ||
+                   i + 1 >= szcSrc ||
+                   (pSrc[i + 1] & 0xFC00) != 0xDC00)
+                {
+                    return UCR_BAD_SURROGATE;
+                }
+
+                if(o + 4 > szcDest)
+                    return UCR_BUFF_TOO_SMALL;
+
+                uint32_t cp = 0x10000 + ((c - 0xD800) << 10) + (pSrc[i + 1] - 0xDC00);
+
+                pDest[o++] = (char)(0xF0 | (cp >> 18));
+                pDest[o++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+                pDest[o++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                pDest[o++] = (char)(0x80 | (cp & 0x3F));
+                i += 2;
+            }
+        }
+
+        return UCR_OK;
+    }
+
+
+    struct SHUFFLE_TABLE
+    {
+        uint8_t arr[256][16];
+    };
+
+    ///RETURN:
+    ///     = Table of byte shuffles, by the mask of ASCII units in a block of 8 units, that drop the
+    ///       unused second byte of each ASCII unit from the 16 bytes of lead/trail pairs
+    static constexpr SHUFFLE_TABLE _makeShuffleTable()
+    {
+        SHUFFLE_TABLE tbl = {};
+
+        for(int m = 0; m < 256; m++)
+        {
+            int k = 0;
+
+            for(int u = 0; u < 8; u++)
+            {
+                tbl.arr[m][k++] = (uint8_t)(u * 2);
+
+                if(!(m & (1 << u)))
+                {
+                    tbl.arr[m][k++] = (uint8_t)(u * 2 + 1);
+                }
+            }
+
+            //Zero the rest
+            while(k < 16)
+            {
+                tbl.arr[m][k++] = 0x80;
+            }
+        }
+
+        return tbl;
+    }
+
+    static const uint8_t* _getShuffle(unsigned int nAsciiMask)
+    {
+        alignas(16) static constexpr SHUFFLE_TABLE kTbl = _makeShuffleTable();
+
+        return kTbl.arr[nAsciiMask];
+    }
+
+
+    ///Convert 8 units with SIMD instructions
+    ///IMPORTANT: 'pDest' must have room for 24 bytes!
+    ///RETURN:
+    ///     = Number of bytes written into 'pDest', or
+    ///     = -1 if this block must be converted by the scalar path
+    static int _convertBlock8(const uint16_t* pSrc,
+                              char* pDest)
+    {
+#if defined(UTF16_TO_UTF8_SSSE3) || defined(UTF16_TO_UTF8_SSE2)
+
+        __m128i v = _mm_loadu_si128((const __m128i*)pSrc);
+        __m128i vZero = _mm_setzero_si128();
+
+        //All ASCII?
+        __m128i vAscii = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xFF80)), vZero);
+        if(_mm_movemask_epi8(vAscii) == 0xFFFF)
+        {
+            _mm_storel_epi64((__m128i*)pDest, _mm_packus_epi16(v, v));
+            return 8;
+        }
+
+#if defined(UTF16_TO_UTF8_SSSE3)
+        //All 1 or 2-byte chars? (they can't be surrogates)
+        __m128i vBelow800 = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xF800)), vZero);
+        if(_mm_movemask_epi8(vBelow800) == 0xFFFF)
+        {
+            //Lead byte: the char itself for ASCII, or 110xxxxx
+            __m128i vLead = _mm_or_si128(_mm_srli_epi16(v, 6), _mm_set1_epi16(0xC0));
+            vLead = _mm_or_si128(_mm_and_si128(vAscii, v),
+                                 _mm_andnot_si128(vAscii, vLead));
+
+            //Trail byte: 10xxxxxx
+            __m128i vTrail = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi16(0x3F)),
+                                          _mm_set1_epi16(0x80));
+
+            __m128i vPairs = _mm_or_si128(vLead, _mm_slli_epi16(vTrail, 8));
+
+            unsigned int nAsciiMask = (unsigned int)_mm_movemask_epi8(_mm_packs_epi16(vAscii, vZero)) & 0xFF;
+
+            __m128i vShuffle = _mm_load_si128((const __m128i*)_getShuffle(nAsciiMask));
+            _mm_storeu_si128((__m128i*)pDest, _mm_shuffle_epi8(vPairs, vShuffle));
+
+            return 16 - __builtin_popcount(nAsciiMask);
+        }
+
+        //All 3-byte chars?
+        __m128i vSurrogate = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xF800)), _mm_set1_epi16((short)0xD800));
+        if(_mm_movemask_epi8(_mm_or_si128(vBelow800, vSurrogate)) == 0)
+        {
+            //1110xxxx 10xxxxxx 10xxxxxx
+            __m128i vMask3F = _mm_set1_epi16(0x3F);
+            __m128i vB0 = _mm_or_si128(_mm_srli_epi16(v, 12), _mm_set1_epi16(0xE0));
+            __m128i vB1 = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 6), vMask3F), _mm_set1_epi16(0x80));
+            __m128i vB2 = _mm_or_si128(_mm_and_si128(v, vMask3F), _mm_set1_epi16(0x80));
+
+            //First bytes of all chars followed by second bytes, and then third bytes
+            __m128i vB01 = _mm_packus_epi16(vB0, vB1);
+            __m128i vB2x = _mm_packus_epi16(vB2, vB2);
+
+            //Interleave them
+            const __m128i vShufLo01 = _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+            const __m128i vShufLo2 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+            const __m128i vShufHi01 = _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+            const __m128i vShufHi2 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+            _mm_storeu_si128((__m128i*)pDest,
+                             _mm_or_si128(_mm_shuffle_epi8(vB01, vShufLo01),
+                                          _mm_shuffle_epi8(vB2x, vShufLo2)));
+            _mm_storel_epi64((__m128i*)(pDest + 16),
+                             _mm_or_si128(_mm_shuffle_epi8(vB01, vShufHi01),
+                                          _mm_shuffle_epi8(vB2x, vShufHi2)));
+
+            return 24;
+        }
+#endif
+
+#elif defined(UTF16_TO_UTF8_NEON)
+
+        uint16x8_t v = vld1q_u16(pSrc);
+        uint16_t nMax = vmaxvq_u16(v);
+
+        //All ASCII?
+        if(nMax < 0x80)
+        {
+            vst1_u8((uint8_t*)pDest, vmovn_u16(v));
+            return 8;
+        }
+
+        //All 1 or 2-byte chars? (they can't be surrogates)
+        if(nMax < 0x800)
+        {
+            uint16x8_t vAscii = vcltq_u16(v, vdupq_n_u16(0x80));
+
+            //Lead byte: the char itself for ASCII, or 110xxxxx
+            uint16x8_t vLead = vorrq_u16(vshrq_n_u16(v, 6), vdupq_n_u16(0xC0));
+            vLead = vbslq_u16(vAscii, v, vLead);
+
+            //Trail byte: 10xxxxxx
+            uint16x8_t vTrail = vorrq_u16(vandq_u16(v, vdupq_n_u16(0x3F)),
+                                          vdupq_n_u16(0x80));
+
+            uint16x8_t vPairs = vorrq_u16(vLead, vshlq_n_u16(vTrail, 8));
+
+            static const uint16_t kBits[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+            unsigned int nAsciiMask = vaddvq_u16(vandq_u16(vAscii, vld1q_u16(kBits)));
+
+            uint8x16_t vRes = vqtbl1q_u8(vreinterpretq_u8_u16(vPairs),
+                                         vld1q_u8(_getShuffle(nAsciiMask)));
+            vst1q_u8((uint8_t*)pDest, vRes);
+
+            return 16 - __builtin_popcount(nAsciiMask);
+        }
+
+        //All 3-byte chars?
+        uint16x8_t vSurrogate = vceqq_u16(vandq_u16(v, vdupq_n_u16(0xF800)), vdupq_n_u16(0xD800));
+        if(vminvq_u16(v) >= 0x800 &&
+           vmaxvq_u16(vSurrogate) == 0)
+        {
+            //1110xxxx 10xxxxxx 10xxxxxx
+            uint16x8_t vMask3F = vdupq_n_u16(0x3F);
+
+            uint8x8x3_t vBytes;
+            vBytes.val[0] = vmovn_u16(vorrq_u16(vshrq_n_u16(v, 12), vdupq_n_u16(0xE0)));
+            vBytes.val[1] = vmovn_u16(vorrq_u16(vandq_u16(vshrq_n_u16(v, 6), vMask3F), vdupq_n_u16(0x80)));
+            vBytes.val[2] = vmovn_u16(vorrq_u16(vandq_u16(v, vMask3F), vdupq_n_u16(0x80)));
+
+            //It interleaves them
+            vst3_u8((uint8_t*)pDest, vBytes);
+
+            return 24;
+        }
+
+#else
+        UNREFERENCED_PARAMETER(pSrc);
+        UNREFERENCED_PARAMETER(pDest);
+#endif
+
+        //3-byte chars, or surrogates
+        return -1;
+    }
+};
+
+
+
+
+#endif /* utf16_to_utf8_h */
@@ -0,0 +1,374 @@
+//
+//  wake_attribution.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of how to tell which scheduled wake events (of any app) woke up macOS
+//
+
+
+#ifndef wake_attribution_h
+#define wake_attribution_h
+
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+
+#include "types.h"
+#include "rdr_wrtr.h"           //Reader/writer lock classes from "macOS tips - part 1"
+#include "pwr_evt_index.h"
+#include "wake_timer.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#include <IOKit/IOMessage.h>
+
+
+
+
+#define WAKE_ATTR_EARLY_SEC 30          //Events that are due up to this many seconds after the system woke up are considered to have caused it
+                                        //INFO: The OS may wake the system slightly earlier than requested.
+#define WAKE_ATTR_LATE_SEC 120          //Events that were due more than this many seconds before the system woke up are considered to be missed
+
+
+
+///Wake attribution counters for a single bundle ID
+struct WAKE_ATTR
+{
+    std::string strBundleID;            //Bundle ID of scheduled wake events, ex: "com.dennisbabkin.wake01"
+
+    size_t szcCaused = 0;               //Number of wakes that only events for this bundle ID were due for
+    size_t szcShared = 0;               //Number of wakes that events for this bundle ID were due for, along with events for other bundle IDs
+    size_t szcMissed = 0;               //Number of times an event for this bundle ID was due while the system was asleep, but it didn't wake up for it
+};
+
+
+
+///Attributes each wake of the system to scheduled wake events of all apps
+///INFO: It takes a snapshot of scheduled events when the system is about to sleep, because the OS
+///      removes events after they fire. When the system wakes up, events that were due around
+///      that time are credited for the wake.
+struct WakeAttribution
+{
+    ///'pEvtIndex' = index of scheduled power events to use, or 0 to use the one for the OS
+    ///                 INFO: Can be used to provide PwrEvtIndex with PwrEvtSource_Memory for testing.
+    WakeAttribution(PwrEvtIndex* pEvtIndex = nullptr)
+        : _pEvtIndex(pEvtIndex ? pEvtIndex : WakeTimer::getSystemEvtIndex())
+    {
+    }
+
+
+    ///Must be called from the callback for 'Notif_SleepWake' with each notification
+    ///IMPORTANT: Call it after the notification is acknowledged, as it enumerates scheduled events in the OS
+    ///           and allocates memory! The OS powers down drivers after all apps acknowledge
+    ///           kIOMessageSystemWillSleep, which leaves enough time for it before the system sleeps.
+    ///'msgType' = notification type, as was passed into the callback
+    void onSleepWakeEvent(natural_t msgType)
+    {
+        CFAbsoluteTime dtNow = CFAbsoluteTimeGetCurrent();
+
+        switch(msgType)
+        {
+            case kIOMessageSystemWillSleep:
+            {
+                _onWillSleep(dtNow);
+            }
+            break;
+
+            case kIOMessageSystemWillPowerOn:
+            case kIOMessageSystemHasPoweredOn:
+            {
+                //Whichever comes first
+                _onWake(dtNow);
+            }
+            break;
+
+            default:
+                break;
+        }
+    }
+
+
+    ///Get counters for a bundle ID
+    ///'pstrBundleID' = bundle ID, ex: "com.dennisbabkin.wake01"
+    ///'pOutAttr' = if not 0, receives counters for 'pstrBundleID'
+    ///RETURN:
+    ///     = true if 'pstrBundleID' had any wake events scheduled while the system was asleep
+    bool getAttribution(const char* pstrBundleID,
+                        WAKE_ATTR* pOutAttr = nullptr)
+    {
+        bool bRes = false;
+        WAKE_ATTR attr;
+
+        if(pstrBundleID)
+        {
+            //Act from within a lock
+            READER_LOCK rdl(_lock);
+
+            auto it = _mapAttr.find(pstrBundleID);
+            if(it != _mapAttr.end())
+            {
+                attr = it->second;
+                bRes = true;
+            }
+        }
+        else
+        {
+            //Bad parameter
+            assert(false);
+        }
+
+        if(pOutAttr)
+            *pOutAttr = attr;
+
+        return bRes;
+    }
+
+
+    ///Get counters for all bundle IDs
+    ///'arrOut' = receives counters, sorted by bundle ID
+    ///'pszOutWakes' = if not 0, receives the number of observed wakes
+    ///'pszOutWakesOther' = if not 0, receives the number of wakes that no scheduled events were due for
+    void getAllAttributions(std::vector<WAKE_ATTR>& arrOut,
+                            size_t* pszOutWakes = nullptr,
+                            size_t* pszOutWakesOther = nullptr)
+    {
+        //Act from within a lock
+        READER_LOCK rdl(_lock);
+
+        arrOut.clear();
+        arrOut.reserve(_mapAttr.size());
+
+        for(const auto& kv : _mapAttr)
+        {
+            arrOut.push_back(kv.second);
+        }
+
+        if(pszOutWakes)
+            *pszOutWakes = _szcWakes;
+        if(pszOutWakesOther)
+            *pszOutWakesOther = _szcWakesOther;
+    }
+
+
+    ///Get counters for all bundle IDs as a JSON object
+    ///'pstrOut' = receives the JSON, ex:
+    ///             {"wakes":5,"other":1,"bundles":[{"id":"com.dennisbabkin.wake01","caused":3,"shared":1,"missed":0},...]}
+    void exportAsJson(std::string* pstrOut)
+    {
+        assert(pstrOut);
+
+        std::vector<WAKE_ATTR> arrAttr;
+        size_t szcWakes, szcWakesOther;
+        getAllAttributions(arrAttr, &szcWakes, &szcWakesOther);
+
+        char buff[128];
+        snprintf(buff, sizeof(buff),
+                 "{\"wakes\":%zu,\"other\":%zu,\"bundles\":[",
+                 szcWakes,
+                 szcWakesOther);
+
+        pstrOut->assign(buff);
+
+        for(size_t i = 0; i < arrAttr.size(); i++)
+        {
+            const WAKE_ATTR& attr = arrAttr[i];
+
+            pstrOut->append(i ? ",{\"id\":\"" : "{\"id\":\"");
+
+            for(char c : attr.strBundleID)
+            {
+                //Bundle IDs are not supposed to have these, but just in case
+                if(c == '"' || c == '\\')
+                    pstrOut->push_back('\\');
+
+                if((unsigned char)c >= ' ')
+                    pstrOut->push_back(c);
+            }
+
+            snprintf(buff, sizeof(buff),
+                     "\",\"caused\":%zu,\"shared\":%zu,\"missed\":%zu}",
+                     attr.szcCaused,
+                     attr.szcShared,
+                     attr.szcMissed);
+
+            pstrOut->append(buff);
+        }
+
+        pstrOut->append("]}");
+    }
+
+
+    ///Remove all collected counters
+    void reset()
+    {
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        _mapAttr.clear();
+
+        _szcWakes = 0;
+        _szcWakesOther = 0;
+    }
+
+
+
+private:
+
+    ///Take a snapshot of scheduled wake events
+    ///'dtNow' = current UTC date/time
+    void _onWillSleep(CFAbsoluteTime dtNow)
+    {
+        //Get events that other processes have set too
+        //INFO: Do it outside of our lock, as it will call the OS.
+        std::vector<PWR_EVT> arrEvts;
+
+        if(!_pEvtIndex->getEvents(arrEvts))
+        {
+            //Failed - use what the index had
+            assert(false);
+        }
+
+        //Leave only wake events that are still ahead
+        arrEvts.erase(std::remove_if(arrEvts.begin(), arrEvts.end(),
+                                     [dtNow](const PWR_EVT& evt)
+                                     {
+                                         return evt.dtWhen <= dtNow ||
+                                                (evt.strEventType != kIOPMAutoWake &&
+                                                 evt.strEventType != kIOPMAutoWakeOrPowerOn);
+                                     }),
+                      arrEvts.end());
+
+        std::sort(arrEvts.begin(), arrEvts.end(),
+                  [](const PWR_EVT& e1, const PWR_EVT& e2)
+                  {
+                      return e1.dtWhen < e2.dtWhen;
+                  });
+
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        _arrSnapshot.swap(arrEvts);
+        _bAsleep = true;
+    }
+
+
+    ///Credit the wake to events from the snapshot
+    ///'dtNow' = current UTC date/time
+    void _onWake(CFAbsoluteTime dtNow)
+    {
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        if(!_bAsleep)
+        {
+            //We didn't see the system go to sleep, or already counted this wake
+            return;
+        }
+
+        _bAsleep = false;
+        _szcWakes++;
+
+        std::set<std::string> setDue;
+        std::set<std::string> setMissed;
+
+        //The snapshot is sorted by the date/time
+        for(const PWR_EVT& evt : _arrSnapshot)
+        {
+            if(evt.dtWhen > dtNow + WAKE_ATTR_EARLY_SEC)
+            {
+                //The rest are not due yet
+                break;
+            }
+
+            if(evt.dtWhen >= dtNow - WAKE_ATTR_LATE_SEC)
+            {
+                setDue.insert(evt.strBundleID);
+            }
+            else
+            {
+                setMissed.insert(evt.strBundleID);
+            }
+        }
+
+        if(setDue.empty())
+        {
+            //Something else woke the system
+            _szcWakesOther++;
+        }
+
+        for(const std::string& strID : setDue)
+        {
+            WAKE_ATTR& attr = _getAttr(strID);
+
+            if(setDue.size() == 1)
+                attr.szcCaused++;
+            else
+                attr.szcShared++;
+        }
+
+        for(const std::string& strID : setMissed)
+        {
+            //Don't count it as missed if its later event woke the system
+            if(setDue.find(strID) == setDue.end())
+            {
+                _getAttr(strID).szcMissed++;
+            }
+        }
+
+        _arrSnapshot.clear();
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///RETURN:
+    ///     = Counters for 'strBundleID', that are added if they don't exist
+    WAKE_ATTR& _getAttr(const std::string& strBundleID)
+    {
+        WAKE_ATTR& attr = _mapAttr[strBundleID];
+        if(attr.strBundleID.empty())
+        {
+            attr.strBundleID = strBundleID;
+        }
+
+        return attr;
+    }
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    WakeAttribution(const WakeAttribution& s) = delete;
+    WakeAttribution& operator = (const WakeAttribution& s) = delete;
+
+private:
+
+    RDR_WRTR _lock;                                 //Lock for accessing this struct
+
+    PwrEvtIndex* _pEvtIndex;                        //Index of scheduled power events
+
+    bool _bAsleep = false;                          //true if we saw the system go to sleep, but didn't see it wake up yet
+    std::vector<PWR_EVT> _arrSnapshot;              //Wake events that were scheduled when the system went to sleep, sorted by date/time
+
+    std::map<std::string, WAKE_ATTR> _mapAttr;      //Counters for each bundle ID
+    size_t _szcWakes = 0;                           //Number of observed wakes
+    size_t _szcWakesOther = 0;                      //Number of wakes that no scheduled events were due for
+};
+
+
+
+
+#endif /* wake_attribution_h */
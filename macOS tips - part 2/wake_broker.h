@@ -0,0 +1,1144 @@
+//
+//  wake_broker.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of how to share a single OS wake event between many processes, by letting one
+//  daemon (broker) own it, while client processes request logical wake timers over a UNIX-domain socket
+//
+
+
+#ifndef wake_broker_h
+#define wake_broker_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+
+#include "types.h"
+#include "rdr_wrtr.h"           //Reader/writer lock classes from "macOS tips - part 1"
+#include "async_log.h"
+#include "wake_timer.h"
+#include "wake_scheduler.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+
+
+
+
+#define WAKE_BROKER_PROTOCOL_VERSION 1          //Version of the protocol between the broker and its clients
+                                                //IMPORTANT: Bump it if WAKE_BROKER_MSG changes!
+
+#define WAKE_BROKER_MAX_REQUESTS 1024           //Max number of logical wake timers that a single client may have at once
+
+#define WAKE_BROKER_MAX_CLIENTS 4096            //Max number of clients that may be connected at once
+                                                //INFO: Connections past it are closed right away.
+
+#define WAKE_BROKER_DIR_NAME "com.dennisbabkin.wakebroker"     //Private directory for the broker socket, in the per-user temporary directory
+#define WAKE_BROKER_SOCKET_NAME "broker.sock"                   //Default name of the broker socket in WAKE_BROKER_DIR_NAME
+
+#define WAKE_BROKER_RECV_CHUNK 4096             //Number of bytes to read from a socket at once
+
+#define WAKE_BROKER_MAX_OUT_MSGS (WAKE_BROKER_MAX_REQUESTS * 2)     //Max number of messages that may wait to be sent to a single client
+                                                                    //INFO: Messages past it are dropped, so that a client that doesn't read
+                                                                    //      its socket can't make the broker use unbounded memory.
+
+
+
+enum WAKE_BROKER_MSG_TYPE : UInt8
+{
+    WBM_NONE,
+
+    //Client -> broker
+    WBM_SET,                    //Set (or replace) logical wake timer 'nID' for a window 'dtEarliest' - 'dtLatest'
+    WBM_CANCEL,                 //Cancel logical wake timer 'nID'
+    WBM_CANCEL_ALL,             //Cancel all logical wake timers of this client
+
+    //Broker -> client
+    WBM_FIRED,                  //Logical wake timer 'nID' fired, 'dtLatest' = when it was due at the latest
+    WBM_REJECTED,               //Request for 'nID' was rejected (bad window, or too many timers)
+};
+
+
+///Single message between the broker and its clients
+///INFO: Both sides run on the same machine, so the native byte order is used.
+#pragma pack(push, 1)
+struct WAKE_BROKER_MSG
+{
+    UInt8 nVersion;             //Must be WAKE_BROKER_PROTOCOL_VERSION
+    UInt8 nType;                //One of WAKE_BROKER_MSG_TYPE
+    UInt16 nReserved1;          //Must be 0
+    UInt32 nReserved2;          //Must be 0
+    UInt64 nID;                 //Client-assigned ID of the logical wake timer (unique within the connection)
+    double dtEarliest;          //UTC date/time (as CFAbsoluteTime)
+    double dtLatest;            //UTC date/time (as CFAbsoluteTime)
+};
+#pragma pack(pop)
+
+static_assert(sizeof(WAKE_BROKER_MSG) == 32, "Protocol message size must not change!");
+
+
+
+
+///Broker that owns a single OS wake event (through 'WakeScheduler') and serves logical wake timers of client processes
+///INFO: All sockets are serviced by a single background thread with poll(). Requests of all clients
+///      are merged by 'WakeScheduler', so the OS is called only when the earliest wake time changes.
+///      Timers of a client are removed when it disconnects.
+///      Only processes of the same user (or root) can connect: the socket is in a directory that only
+///      this user can access, the socket file itself is not accessible to others, and the UID of each
+///      client is checked when it connects.
+struct WakeBrokerServer
+{
+    ///'scheduler' = scheduler to add logical wake timers of clients to - must remain valid for the lifetime of this struct
+    ///             INFO: Call its fireDueTimers() when the system wakes up, as usual.
+    WakeBrokerServer(WakeScheduler& scheduler)
+        : _scheduler(scheduler)
+    {
+    }
+
+    ~WakeBrokerServer()
+    {
+        stop();
+    }
+
+
+    ///Get the default path to the broker socket, for the current user
+    ///INFO: It is in a private directory, in the per-user temporary directory. Use the same for clients.
+    ///'strOutPath' = receives the path, ex: "/var/folders/xx/yyyy/T/com.dennisbabkin.wakebroker/broker.sock"
+    ///'pstrName' = name of the socket file
+    static void getDefaultSocketPath(std::string& strOutPath,
+                                     const char* pstrName = WAKE_BROKER_SOCKET_NAME)
+    {
+        char buff[1024];
+        buff[0] = 0;
+
+#ifdef _CS_DARWIN_USER_TEMP_DIR
+        //Unlike /tmp, it's accessible only to the current user
+        size_t szcLen = confstr(_CS_DARWIN_USER_TEMP_DIR, buff, sizeof(buff));
+        if(szcLen == 0 ||
+           szcLen > sizeof(buff))
+        {
+            //Failed
+            assert(false);
+            buff[0] = 0;
+        }
+#endif
+
+        if(buff[0])
+        {
+            strOutPath = buff;
+        }
+        else
+        {
+            const char* pstrTmp = getenv("TMPDIR");
+            strOutPath = pstrTmp && pstrTmp[0] ? pstrTmp : "/tmp/";
+        }
+
+        if(strOutPath.back() != '/')
+            strOutPath += '/';
+
+        strOutPath += WAKE_BROKER_DIR_NAME "/";
+        strOutPath += pstrName ? pstrName : WAKE_BROKER_SOCKET_NAME;
+    }
+
+
+    ///Start listening for clients on a UNIX-domain socket
+    ///INFO: A stale socket file at 'pstrSocketPath' is removed first.
+    ///'pstrSocketPath' = path to the socket file - use getDefaultSocketPath() to get it
+    ///             IMPORTANT: Its directory is created if it doesn't exist. It must be owned by the current user
+    ///                        and must not be accessible to anyone else, or this function fails.
+    ///RETURN:
+    ///     = true if success
+    bool start(const char* pstrSocketPath)
+    {
+        bool bRes = false;
+
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        if(_fdListen != -1)
+        {
+            //Already started
+            assert(false);
+            return false;
+        }
+
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+
+        if(pstrSocketPath &&
+           pstrSocketPath[0] &&
+           strlen(pstrSocketPath) < sizeof(addr.sun_path))
+        {
+            strcpy(addr.sun_path, pstrSocketPath);
+
+            if(!_makePrivateDir(pstrSocketPath))
+            {
+                //Failed - don't let others reach our socket
+                return false;
+            }
+
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(fd != -1)
+            {
+                unlink(pstrSocketPath);
+
+                //INFO: Clients can't connect before listen(), so there's no need to change umask (for the whole process) for bind()
+                if(bind(fd, (const sockaddr*)&addr, sizeof(addr)) == 0 &&
+                   chmod(pstrSocketPath, S_IRUSR | S_IWUSR) == 0 &&
+                   listen(fd, SOMAXCONN) == 0 &&
+                   _setNonBlocking(fd) &&
+                   pipe(_arrPipe) == 0)
+                {
+                    if(_setNonBlocking(_arrPipe[0]) &&
+                       _setNonBlocking(_arrPipe[1]))
+                    {
+                        _fdListen = fd;
+                        fd = -1;
+
+                        _strPath = pstrSocketPath;
+                        _bStop = false;
+
+                        _thread = std::thread(&WakeBrokerServer::_threadProc, this);
+
+                        bRes = true;
+                    }
+                    else
+                    {
+                        //Failed
+                        assert(false);
+                        _closePipe();
+                    }
+                }
+                else
+                {
+                    //Failed
+                    int nErr = errno;
+                    ASYNC_LOG("ERROR: (%d) Failed to listen on the broker socket: %s\n", nErr, pstrSocketPath);
+                }
+
+                if(fd != -1)
+                {
+                    close(fd);
+                }
+            }
+            else
+            {
+                //Failed
+                assert(false);
+            }
+        }
+        else
+        {
+            //Bad path
+            assert(false);
+        }
+
+        return bRes;
+    }
+
+
+    ///Stop listening, disconnect all clients and remove their logical wake timers
+    void stop()
+    {
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            if(_fdListen == -1)
+            {
+                //Not started
+                return;
+            }
+
+            _bStop = true;
+            _poke();
+        }
+
+        _thread.join();
+
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        for(auto& kv : _mapClients)
+        {
+            _dropClientTimers(kv.second);
+
+            close(kv.second.fd);
+        }
+
+        _mapClients.clear();
+        _mapTimers.clear();
+
+        close(_fdListen);
+        _fdListen = -1;
+
+        _closePipe();
+
+        unlink(_strPath.c_str());
+    }
+
+
+    ///Get statistics
+    ///'pszOutRequests' = if not 0, receives the number of requests received from all clients
+    ///'pszOutFired' = if not 0, receives the number of WBM_FIRED notifications sent to clients
+    ///'pszOutTimers' = if not 0, receives the number of logical wake timers that clients currently have
+    ///'pszOutDropped' = if not 0, receives the number of messages for clients that were dropped because their queues were full
+    ///'pszOutRefused' = if not 0, receives the number of connections that were closed right away (other user, or too many clients)
+    ///RETURN:
+    ///     = Number of currently connected clients
+    size_t getStats(size_t* pszOutRequests = nullptr,
+                    size_t* pszOutFired = nullptr,
+                    size_t* pszOutTimers = nullptr,
+                    size_t* pszOutDropped = nullptr,
+                    size_t* pszOutRefused = nullptr)
+    {
+        READER_LOCK rdl(_lock);
+
+        if(pszOutRequests)
+            *pszOutRequests = _szcRequests;
+        if(pszOutFired)
+            *pszOutFired = _szcFired;
+        if(pszOutTimers)
+            *pszOutTimers = _mapTimers.size();
+        if(pszOutDropped)
+            *pszOutDropped = _szcDropped;
+        if(pszOutRefused)
+            *pszOutRefused = _szcRefused;
+
+        return _mapClients.size();
+    }
+
+
+
+private:
+
+    struct CLIENT
+    {
+        int fd = -1;                                            //Connected socket
+        UInt64 nConnID = 0;                                     //Unique ID of this connection (file descriptors are reused)
+
+        std::vector<UInt8> arrIn;                               //Received bytes that don't make a full message yet
+        std::vector<UInt8> arrOut;                              //Bytes that are waiting to be sent (up to WAKE_BROKER_MAX_OUT_MSGS messages)
+
+        std::unordered_map<UInt64, UInt64> mapReqToTimer;       //Client-assigned ID -> logical timer ID in '_scheduler'
+    };
+
+    struct TIMER_OWNER
+    {
+        UInt64 nConnID;                                         //Connection that requested the logical timer
+        UInt64 nReqID;                                          //Client-assigned ID of the logical timer
+    };
+
+
+    ///Create the directory of 'pstrPath' (if it doesn't exist), and make sure that only we can access it
+    ///RETURN:
+    ///     = true if the directory is private
+    static bool _makePrivateDir(const char* pstrPath)
+    {
+        std::string strDir = pstrPath;
+
+        size_t nSlash = strDir.rfind('/');
+        if(nSlash == std::string::npos ||
+           nSlash == 0)
+        {
+            //Must not be in the current or the root directory
+            ASYNC_LOG("ERROR: Broker socket must be in its own directory: %s\n", pstrPath);
+            return false;
+        }
+
+        strDir.resize(nSlash);
+
+        if(mkdir(strDir.c_str(), S_IRWXU) != 0 &&
+           errno != EEXIST)
+        {
+            //Failed
+            int nErr = errno;
+            ASYNC_LOG("ERROR: (%d) Failed to create directory for the broker socket: %s\n", nErr, strDir);
+            return false;
+        }
+
+        //It could've been made by someone else (lstat doesn't follow a symlink)
+        struct stat st;
+        if(lstat(strDir.c_str(), &st) != 0 ||
+           !S_ISDIR(st.st_mode) ||
+           st.st_uid != geteuid() ||
+           (st.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+        {
+            //Not private
+            ASYNC_LOG("ERROR: Directory for the broker socket is not private: %s\n", strDir);
+            return false;
+        }
+
+        return true;
+    }
+
+
+    static bool _setNonBlocking(int fd)
+    {
+        int nFlags = fcntl(fd, F_GETFL, 0);
+
+        return nFlags != -1 &&
+               fcntl(fd, F_SETFL, nFlags | O_NONBLOCK) != -1;
+    }
+
+
+    void _closePipe()
+    {
+        for(int& fd : _arrPipe)
+        {
+            if(fd != -1)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+
+    ///Wake up the background thread
+    void _poke()
+    {
+        UInt8 b = 0;
+        if(write(_arrPipe[1], &b, 1) == -1)
+        {
+            //The pipe is full, which means that the thread is about to wake up anyway
+            assert(errno == EAGAIN);
+        }
+    }
+
+
+    void _threadProc()
+    {
+        std::vector<pollfd> arrPoll;
+        std::vector<UInt64> arrConnIDs;         //Connection ID for each element of 'arrPoll', starting from index 2
+
+        for(;;)
+        {
+            arrPoll.clear();
+            arrConnIDs.clear();
+
+            if(true)
+            {
+                //Act from within a lock
+                READER_LOCK rdl(_lock);
+
+                if(_bStop)
+                    break;
+
+                arrPoll.push_back({_fdListen, POLLIN, 0});
+                arrPoll.push_back({_arrPipe[0], POLLIN, 0});
+
+                for(const auto& kv : _mapClients)
+                {
+                    arrPoll.push_back({kv.second.fd, (short)(kv.second.arrOut.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+                    arrConnIDs.push_back(kv.first);
+                }
+            }
+
+            int nRes = poll(arrPoll.data(), (nfds_t)arrPoll.size(), -1);
+            if(nRes < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+
+                //Failed
+                assert(false);
+                break;
+            }
+
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            if(arrPoll[1].revents)
+            {
+                //Drain the pipe - we only needed to wake up
+                UInt8 buff[256];
+                while(read(_arrPipe[0], buff, sizeof(buff)) > 0);
+            }
+
+            for(size_t i = 2; i < arrPoll.size(); i++)
+            {
+                if(!arrPoll[i].revents)
+                    continue;
+
+                auto it = _mapClients.find(arrConnIDs[i - 2]);
+                if(it == _mapClients.end())
+                    continue;
+
+                bool bKeep = true;
+
+                if(arrPoll[i].revents & (POLLIN | POLLHUP | POLLERR))
+                {
+                    bKeep = _receive(it->second);
+                }
+
+                if(bKeep &&
+                   !it->second.arrOut.empty())
+                {
+                    bKeep = _flush(it->second);
+                }
+
+                if(!bKeep)
+                {
+                    _dropClient(it);
+                }
+            }
+
+            if(arrPoll[0].revents)
+            {
+                _acceptClients();
+            }
+        }
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    void _acceptClients()
+    {
+        for(;;)
+        {
+            int fd = accept(_fdListen, nullptr, nullptr);
+            if(fd == -1)
+            {
+                //EAGAIN when there's nobody left to accept
+                assert(errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED || errno == EMFILE);
+                break;
+            }
+
+            //Only serve processes of our own user (or root)
+            uid_t uid = (uid_t)-1;
+            gid_t gid;
+            if(getpeereid(fd, &uid, &gid) != 0 ||
+               (uid != geteuid() && uid != 0))
+            {
+                _szcRefused++;
+
+                ASYNC_LOG("WARNING: Refused broker client with UID=%d\n", (int)uid);
+                close(fd);
+                continue;
+            }
+
+            if(_mapClients.size() >= WAKE_BROKER_MAX_CLIENTS)
+            {
+                //Too many clients
+                _szcRefused++;
+
+                close(fd);
+                continue;
+            }
+
+#ifdef SO_NOSIGPIPE
+            //Don't let a client that went away kill us with SIGPIPE
+            int nOn = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nOn, sizeof(nOn));
+#endif
+
+            if(!_setNonBlocking(fd))
+            {
+                //Failed
+                assert(false);
+                close(fd);
+                continue;
+            }
+
+            CLIENT& client = _mapClients[++_nLastConnID];
+            client.fd = fd;
+            client.nConnID = _nLastConnID;
+        }
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Read what's available from the client and process all full messages
+    ///RETURN:
+    ///     = false if the client must be disconnected
+    bool _receive(CLIENT& client)
+    {
+        for(;;)
+        {
+            size_t szcHave = client.arrIn.size();
+            client.arrIn.resize(szcHave + WAKE_BROKER_RECV_CHUNK);
+
+            ssize_t nRead = recv(client.fd, client.arrIn.data() + szcHave, WAKE_BROKER_RECV_CHUNK, 0);
+            if(nRead <= 0)
+            {
+                client.arrIn.resize(szcHave);
+
+                if(nRead < 0 &&
+                   (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                {
+                    //Nothing more to read
+                    break;
+                }
+
+                //Disconnected
+                return false;
+            }
+
+            client.arrIn.resize(szcHave + nRead);
+
+            //Process full messages
+            size_t szcMsgs = client.arrIn.size() / sizeof(WAKE_BROKER_MSG);
+            for(size_t m = 0; m < szcMsgs; m++)
+            {
+                WAKE_BROKER_MSG msg;
+                memcpy(&msg, client.arrIn.data() + m * sizeof(msg), sizeof(msg));
+
+                if(!_processMsg(client, msg))
+                {
+                    //Protocol error
+                    return false;
+                }
+            }
+
+            client.arrIn.erase(client.arrIn.begin(), client.arrIn.begin() + szcMsgs * sizeof(WAKE_BROKER_MSG));
+        }
+
+        return true;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///RETURN:
+    ///     = false if 'msg' is not valid and the client must be disconnected
+    bool _processMsg(CLIENT& client,
+                     const WAKE_BROKER_MSG& msg)
+    {
+        if(msg.nVersion != WAKE_BROKER_PROTOCOL_VERSION ||
+           msg.nReserved1 != 0 ||
+           msg.nReserved2 != 0)
+        {
+            //Not our protocol
+            return false;
+        }
+
+        _szcRequests++;
+
+        switch(msg.nType)
+        {
+            case WBM_SET:
+            {
+                //Replace the previous timer with the same ID
+                _cancelTimer(client, msg.nID);
+
+                if(!(msg.dtEarliest > 0) ||
+                   !(msg.dtLatest >= msg.dtEarliest) ||
+                   client.mapReqToTimer.size() >= WAKE_BROKER_MAX_REQUESTS)
+                {
+                    _queueMsg(client, WBM_REJECTED, msg.nID, 0);
+                    break;
+                }
+
+                //INFO: We're holding our lock, so if it fires right away, the callback will wait until we record it
+                UInt64 nTimerID = _scheduler.addTimerWindow(msg.dtEarliest,
+                                                            msg.dtLatest,
+                                                            _onTimerFired,
+                                                            this);
+                if(nTimerID)
+                {
+                    client.mapReqToTimer[msg.nID] = nTimerID;
+                    _mapTimers[nTimerID] = {client.nConnID, msg.nID};
+                }
+                else
+                {
+                    //Failed
+                    _queueMsg(client, WBM_REJECTED, msg.nID, 0);
+                }
+            }
+            break;
+
+            case WBM_CANCEL:
+            {
+                _cancelTimer(client, msg.nID);
+            }
+            break;
+
+            case WBM_CANCEL_ALL:
+            {
+                _dropClientTimers(client);
+            }
+            break;
+
+            default:
+            {
+                //Unknown message
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    void _cancelTimer(CLIENT& client,
+                      UInt64 nReqID)
+    {
+        auto it = client.mapReqToTimer.find(nReqID);
+        if(it != client.mapReqToTimer.end())
+        {
+            _scheduler.removeTimer(it->second);
+            _mapTimers.erase(it->second);
+
+            client.mapReqToTimer.erase(it);
+        }
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    void _dropClientTimers(CLIENT& client)
+    {
+        for(const auto& kv : client.mapReqToTimer)
+        {
+            _scheduler.removeTimer(kv.second);
+            _mapTimers.erase(kv.second);
+        }
+
+        client.mapReqToTimer.clear();
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    void _dropClient(std::unordered_map<UInt64, CLIENT>::iterator it)
+    {
+        _dropClientTimers(it->second);
+
+        close(it->second.fd);
+
+        _mapClients.erase(it);
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Append message to the outgoing buffer for the client
+    ///RETURN:
+    ///     = true if queued
+    ///     = false if the outgoing buffer is full - the message was dropped
+    bool _queueMsg(CLIENT& client,
+                   WAKE_BROKER_MSG_TYPE type,
+                   UInt64 nID,
+                   CFAbsoluteTime dtWhen)
+    {
+        if(client.arrOut.size() >= WAKE_BROKER_MAX_OUT_MSGS * sizeof(WAKE_BROKER_MSG))
+        {
+            //Client doesn't read what we send
+            _szcDropped++;
+
+            return false;
+        }
+
+        WAKE_BROKER_MSG msg = {};
+        msg.nVersion = WAKE_BROKER_PROTOCOL_VERSION;
+        msg.nType = type;
+        msg.nID = nID;
+        msg.dtLatest = dtWhen;
+
+        const UInt8* pMsg = (const UInt8*)&msg;
+        client.arrOut.insert(client.arrOut.end(), pMsg, pMsg + sizeof(msg));
+
+        return true;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Send as much of the outgoing buffer as the socket takes
+    ///RETURN:
+    ///     = false if the client must be disconnected
+    bool _flush(CLIENT& client)
+    {
+#ifdef MSG_NOSIGNAL
+        int nFlags = MSG_NOSIGNAL;
+#else
+        int nFlags = 0;
+#endif
+
+        size_t szcSent = 0;
+
+        while(szcSent < client.arrOut.size())
+        {
+            ssize_t nSent = send(client.fd, client.arrOut.data() + szcSent, client.arrOut.size() - szcSent, nFlags);
+            if(nSent < 0)
+            {
+                if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                {
+                    //Will send the rest when the socket is writable
+                    break;
+                }
+
+                //Disconnected
+                return false;
+            }
+
+            szcSent += nSent;
+        }
+
+        client.arrOut.erase(client.arrOut.begin(), client.arrOut.begin() + szcSent);
+
+        return true;
+    }
+
+
+    ///Called by '_scheduler' when a logical timer of a client fires
+    static void _onTimerFired(UInt64 nTimerID,
+                              CFAbsoluteTime dtWhen,
+                              const void* pParam1,
+                              const void* pParam2)
+    {
+        UNREFERENCED_PARAMETER(pParam2);
+
+        WakeBrokerServer* pThis = (WakeBrokerServer*)pParam1;
+        assert(pThis);
+
+        //Act from within a lock
+        WRITER_LOCK wrl(pThis->_lock);
+
+        auto itTmr = pThis->_mapTimers.find(nTimerID);
+        if(itTmr == pThis->_mapTimers.end())
+        {
+            //Client went away or canceled it
+            return;
+        }
+
+        TIMER_OWNER owner = itTmr->second;
+        pThis->_mapTimers.erase(itTmr);
+
+        auto itClient = pThis->_mapClients.find(owner.nConnID);
+        if(itClient != pThis->_mapClients.end())
+        {
+            itClient->second.mapReqToTimer.erase(owner.nReqID);
+
+            //Let the background thread send it
+            if(pThis->_queueMsg(itClient->second, WBM_FIRED, owner.nReqID, dtWhen))
+            {
+                pThis->_szcFired++;
+            }
+
+            pThis->_poke();
+        }
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    WakeBrokerServer(const WakeBrokerServer& s) = delete;
+    WakeBrokerServer& operator = (const WakeBrokerServer& s) = delete;
+
+private:
+
+    RDR_WRTR _lock;                                         //Lock for accessing this struct
+
+    WakeScheduler& _scheduler;                              //Scheduler that owns the OS wake event
+
+    int _fdListen = -1;                                     //Listening socket, or -1 if not started
+    int _arrPipe[2] = {-1, -1};                             //Pipe to wake up '_thread' with
+    std::string _strPath;                                   //Path to the socket file
+    std::thread _thread;                                    //Thread that services all sockets
+    bool _bStop = false;                                    //true to stop '_thread'
+
+    std::unordered_map<UInt64, CLIENT> _mapClients;         //Connected clients, by their connection IDs
+    std::unordered_map<UInt64, TIMER_OWNER> _mapTimers;     //Logical timer ID in '_scheduler' -> who requested it
+    UInt64 _nLastConnID = 0;                                //Last assigned connection ID
+
+    size_t _szcRequests = 0;                                //Number of requests received from all clients
+    size_t _szcFired = 0;                                   //Number of WBM_FIRED notifications queued for clients
+    size_t _szcDropped = 0;                                 //Number of messages for clients that were dropped because their queues were full
+    size_t _szcRefused = 0;                                 //Number of connections that were closed right away
+};
+
+
+
+
+///Client of 'WakeBrokerServer', that requests logical wake timers instead of setting its own OS wake event
+///INFO: It doesn't start any threads. Call dispatch() to receive notifications, either from your own thread,
+///      or when getSocket() becomes readable (ex: with a CFFileDescriptor on a run-loop).
+///IMPORTANT: It is not thread-safe!
+struct WakeBrokerClient
+{
+    WakeBrokerClient()
+    {
+    }
+
+    ~WakeBrokerClient()
+    {
+        disconnect();
+    }
+
+
+    ///Callback that is invoked for notifications from the broker
+    ///'type' = WBM_FIRED or WBM_REJECTED
+    ///'nID' = ID of the logical wake timer, as it was passed into setWakeWindow()
+    ///'dtWhen' = for WBM_FIRED, UTC date/time when the timer was due at the latest
+    ///'pParam1' = passed from dispatch()
+    ///'pParam2' = passed from dispatch()
+    typedef void (*PFN_WAKE_BROKER_CALLBACK)(WAKE_BROKER_MSG_TYPE type,
+                                             UInt64 nID,
+                                             CFAbsoluteTime dtWhen,
+                                             const void* pParam1,
+                                             const void* pParam2);
+
+
+    ///Connect to the broker
+    ///INFO: The broker accepts only processes of the same user (or root).
+    ///'pstrSocketPath' = path to the socket file that the broker listens on, ex: from WakeBrokerServer::getDefaultSocketPath()
+    ///RETURN:
+    ///     = true if connected
+    bool connect(const char* pstrSocketPath)
+    {
+        disconnect();
+
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+
+        if(!pstrSocketPath ||
+           !pstrSocketPath[0] ||
+           strlen(pstrSocketPath) >= sizeof(addr.sun_path))
+        {
+            //Bad path
+            assert(false);
+            return false;
+        }
+
+        strcpy(addr.sun_path, pstrSocketPath);
+
+        _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(_fd == -1)
+        {
+            //Failed
+            return false;
+        }
+
+#ifdef SO_NOSIGPIPE
+        int nOn = 1;
+        setsockopt(_fd, SOL_SOCKET, SO_NOSIGPIPE, &nOn, sizeof(nOn));
+#endif
+
+        if(::connect(_fd, (const sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            //Broker is not running
+            disconnect();
+            return false;
+        }
+
+        return true;
+    }
+
+
+    void disconnect()
+    {
+        if(_fd != -1)
+        {
+            close(_fd);
+            _fd = -1;
+        }
+
+        _arrIn.clear();
+    }
+
+
+    ///RETURN:
+    ///     = Connected socket, or -1 if not connected
+    int getSocket() const
+    {
+        return _fd;
+    }
+
+
+    ///Request a logical wake timer that may fire at any moment within a tolerance window
+    ///INFO: It replaces an earlier timer with the same 'nID'.
+    ///'nID' = ID of this timer, chosen by the caller
+    ///'dtEarliest' = UTC date/time when this timer may fire at the earliest
+    ///'dtLatest' = UTC date/time when this timer must fire at the latest. Must not be less than 'dtEarliest'
+    ///RETURN:
+    ///     = true if the request was sent (the broker replies with WBM_REJECTED if it can't take it)
+    bool setWakeWindow(UInt64 nID,
+                       CFAbsoluteTime dtEarliest,
+                       CFAbsoluteTime dtLatest)
+    {
+        return _send(WBM_SET, nID, dtEarliest, dtLatest);
+    }
+
+    ///Request a logical wake timer at the absolute time
+    bool setWakeAbsolute(UInt64 nID,
+                         CFAbsoluteTime dtWhen)
+    {
+        return _send(WBM_SET, nID, dtWhen, dtWhen);
+    }
+
+    ///Cancel a logical wake timer that was requested with 'nID'
+    bool cancel(UInt64 nID)
+    {
+        return _send(WBM_CANCEL, nID, 0, 0);
+    }
+
+    ///Cancel all logical wake timers of this client
+    bool cancelAll()
+    {
+        return _send(WBM_CANCEL_ALL, 0, 0, 0);
+    }
+
+
+    ///Receive notifications from the broker and invoke 'pfn' for each of them
+    ///'pfn' = callback to invoke
+    ///'pParam1' = passed directly into 'pfn' when it's called
+    ///'pParam2' = passed directly into 'pfn' when it's called
+    ///'msTimeout' = number of ms to wait for notifications, 0 not to wait, or -1 to wait indefinitely
+    ///RETURN:
+    ///     = Number of notifications processed
+    ///     = -1 if disconnected from the broker
+    int dispatch(PFN_WAKE_BROKER_CALLBACK pfn,
+                 const void* pParam1 = nullptr,
+                 const void* pParam2 = nullptr,
+                 int msTimeout = 0)
+    {
+        if(_fd == -1)
+            return -1;
+
+        pollfd pfd = {_fd, POLLIN, 0};
+        int nRes = poll(&pfd, 1, msTimeout);
+        if(nRes <= 0)
+        {
+            return nRes < 0 && errno != EINTR ? -1 : 0;
+        }
+
+        int nCnt = 0;
+
+        for(;;)
+        {
+            size_t szcHave = _arrIn.size();
+            _arrIn.resize(szcHave + WAKE_BROKER_RECV_CHUNK);
+
+            ssize_t nRead = recv(_fd, _arrIn.data() + szcHave, WAKE_BROKER_RECV_CHUNK, MSG_DONTWAIT);
+            if(nRead <= 0)
+            {
+                _arrIn.resize(szcHave);
+
+                if(nRead < 0 &&
+                   (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                {
+                    break;
+                }
+
+                //Broker went away
+                disconnect();
+                return -1;
+            }
+
+            _arrIn.resize(szcHave + nRead);
+
+            size_t szcMsgs = _arrIn.size() / sizeof(WAKE_BROKER_MSG);
+            for(size_t m = 0; m < szcMsgs; m++)
+            {
+                WAKE_BROKER_MSG msg;
+                memcpy(&msg, _arrIn.data() + m * sizeof(msg), sizeof(msg));
+
+                if(msg.nVersion == WAKE_BROKER_PROTOCOL_VERSION &&
+                   (msg.nType == WBM_FIRED || msg.nType == WBM_REJECTED))
+                {
+                    if(pfn)
+                    {
+                        pfn((WAKE_BROKER_MSG_TYPE)msg.nType, msg.nID, msg.dtLatest, pParam1, pParam2);
+                    }
+
+                    nCnt++;
+                }
+                else
+                {
+                    //Unknown message
+                    assert(false);
+                }
+            }
+
+            _arrIn.erase(_arrIn.begin(), _arrIn.begin() + szcMsgs * sizeof(WAKE_BROKER_MSG));
+        }
+
+        return nCnt;
+    }
+
+
+
+private:
+
+    bool _send(WAKE_BROKER_MSG_TYPE type,
+               UInt64 nID,
+               CFAbsoluteTime dtEarliest,
+               CFAbsoluteTime dtLatest)
+    {
+        if(_fd == -1)
+        {
+            //Not connected
+            return false;
+        }
+
+        WAKE_BROKER_MSG msg = {};
+        msg.nVersion = WAKE_BROKER_PROTOCOL_VERSION;
+        msg.nType = type;
+        msg.nID = nID;
+        msg.dtEarliest = dtEarliest;
+        msg.dtLatest = dtLatest;
+
+#ifdef MSG_NOSIGNAL
+        int nFlags = MSG_NOSIGNAL;
+#else
+        int nFlags = 0;
+#endif
+
+        //INFO: The socket is blocking, and the message is small, so it is sent in full
+        const UInt8* pMsg = (const UInt8*)&msg;
+        size_t szcSent = 0;
+
+        while(szcSent < sizeof(msg))
+        {
+            ssize_t nSent = send(_fd, pMsg + szcSent, sizeof(msg) - szcSent, nFlags);
+            if(nSent < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+
+                //Broker went away
+                return false;
+            }
+
+            szcSent += nSent;
+        }
+
+        return true;
+    }
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    WakeBrokerClient(const WakeBrokerClient& s) = delete;
+    WakeBrokerClient& operator = (const WakeBrokerClient& s) = delete;
+
+private:
+
+    int _fd = -1;                       //Socket connected to the broker, or -1 if not connected
+    std::vector<UInt8> _arrIn;          //Received bytes that don't make a full message yet
+};
+
+
+
+
+#endif /* wake_broker_h */
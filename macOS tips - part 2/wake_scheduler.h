@@ -0,0 +1,1009 @@
+//
+//  wake_scheduler.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of how to multiplex many logical wake timers over a single OS wake event
+//
+
+
+#ifndef wake_scheduler_h
+#define wake_scheduler_h
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <memory>
+
+#include "types.h"
+#include "rdr_wrtr.h"           //Reader/writer lock classes from "macOS tips - part 1"
+#include "wake_timer.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+
+
+
+
+#define WAKE_SCHED_DUE_SLACK_SEC 1.0        //Logical timers that are due within this many seconds from "now" are fired together
+                                            //INFO: The OS may wake us up slightly before the scheduled time.
+
+#define WAKE_SCHED_RETRY_SEC 5.0           //Number of seconds after a failure to set the OS wake event, when it's tried again
+
+#define WAKE_SCHED_RUNLOOP_INTERVAL 1.0e8   //Repeat interval for the run-loop timer, in sec
+                                            //INFO: We always move its fire date ourselves. It is repeating only
+                                            //      so that it's not invalidated by the run-loop after it fires.
+
+
+
+struct WakeScheduler
+{
+    ///'wakeTimer' = OS wake timer that this scheduler will program with the earliest logical timer
+    ///             IMPORTANT: Do not set or stop 'wakeTimer' directly while this scheduler is in use!
+    ///'pStore' = if not 0, persistent store to keep logical timers in (use the same one as for 'wakeTimer').
+    ///             It must remain valid for the life of this struct.
+    ///             INFO: Call restoreTimers() after a restart to get them back. Logical timers and
+    ///                   the OS wake event are left in place when this struct is destroyed.
+    WakeScheduler(WakeTimer& wakeTimer,
+                  TimerStore* pStore = nullptr)
+        : _wakeTimer(wakeTimer)
+        , _pStore(pStore)
+    {
+        //Records are kept under the bundle ID of the wake timer (with non-zero IDs)
+        _pstrOwner = NameTable::get().getName(_wakeTimer.getBundleID());
+    }
+
+    ~WakeScheduler()
+    {
+        if(!_pStore)
+        {
+            //Remove all logical timers & the OS wake event
+            removeAllTimers();
+        }
+        else
+        {
+            //Keep them for the next run
+            WRITER_LOCK wrl(_lock);
+
+            _setRunLoopTimer(0);
+        }
+    }
+
+
+
+    ///Callback that is invoked when a logical timer fires
+    ///'nTimerID' = ID of the timer that was returned by addTimer*()
+    ///'dtWhen' = UTC date/time when the timer was scheduled for (or its latest date/time, if it had a tolerance window)
+    ///'pParam1' = passed from addTimer*()
+    ///'pParam2' = passed from addTimer*()
+    typedef void (*PFN_WAKE_SCHED_CALLBACK)(UInt64 nTimerID,
+                                            CFAbsoluteTime dtWhen,
+                                            const void* pParam1,
+                                            const void* pParam2);
+
+
+    ///Add a logical wake timer as the relative time from the current moment
+    ///'msFromNow' = number of ms from "now" to fire this timer
+    ///'pfn' = callback to invoke when the timer fires (it is called outside of any lock), or 0 not to call it
+    ///'pParam1' = passed directly into 'pfn' when it's called
+    ///'pParam2' = passed directly into 'pfn' when it's called
+    ///'msLeeway' = number of ms after 'msFromNow' that this timer may also fire at, or 0 for an exact deadline
+    ///RETURN:
+    ///     = Non-zero timer ID if success - the timer is removed automatically after it fires
+    ///     = 0 if error
+    UInt64 addTimerRelative(UInt32 msFromNow,
+                            PFN_WAKE_SCHED_CALLBACK pfn,
+                            const void* pParam1 = nullptr,
+                            const void* pParam2 = nullptr,
+                            UInt32 msLeeway = 0)
+    {
+        CFAbsoluteTime dtWhen = CFAbsoluteTimeGetCurrent() + ((CFTimeInterval)msFromNow) / 1000.0;
+
+        return addTimerWindow(dtWhen,
+                              dtWhen + ((CFTimeInterval)msLeeway) / 1000.0,
+                              pfn, pParam1, pParam2);
+    }
+
+
+    ///Add a logical wake timer at the absolute time
+    ///'dtWhen' = UTC date/time when to fire this timer (use WakeTimer::Set_CFAbsoluteTime() function to create it)
+    ///'pfn' = callback to invoke when the timer fires (it is called outside of any lock), or 0 not to call it
+    ///'pParam1' = passed directly into 'pfn' when it's called
+    ///'pParam2' = passed directly into 'pfn' when it's called
+    ///RETURN:
+    ///     = Non-zero timer ID if success - the timer is removed automatically after it fires
+    ///     = 0 if error
+    UInt64 addTimerAbsolute(CFAbsoluteTime dtWhen,
+                            PFN_WAKE_SCHED_CALLBACK pfn,
+                            const void* pParam1 = nullptr,
+                            const void* pParam2 = nullptr)
+    {
+        return addTimerWindow(dtWhen, dtWhen, pfn, pParam1, pParam2);
+    }
+
+
+    ///Add a logical wake timer that may fire at any moment within a tolerance window
+    ///INFO: Overlapping windows are served by the same physical wake of the system.
+    ///'dtEarliest' = UTC date/time when this timer may fire at the earliest
+    ///'dtLatest' = UTC date/time when this timer must fire at the latest. Must not be less than 'dtEarliest'
+    ///'pfn' = callback to invoke when the timer fires (it is called outside of any lock), or 0 not to call it
+    ///'pParam1' = passed directly into 'pfn' when it's called
+    ///'pParam2' = passed directly into 'pfn' when it's called
+    ///RETURN:
+    ///     = Non-zero timer ID if success - the timer is removed automatically after it fires
+    ///     = 0 if error
+    UInt64 addTimerWindow(CFAbsoluteTime dtEarliest,
+                          CFAbsoluteTime dtLatest,
+                          PFN_WAKE_SCHED_CALLBACK pfn,
+                          const void* pParam1 = nullptr,
+                          const void* pParam2 = nullptr)
+    {
+        return _addTimer(dtEarliest, dtLatest, pfn, pParam1, pParam2, nullptr);
+    }
+
+
+    ///Add a logical wake timer that fires on a recurring schedule
+    ///INFO: After each firing it is re-armed for the next time in the schedule, with the same ID.
+    ///      Firings that were missed while the system was off are skipped.
+    ///'pstrCron' = schedule in the cron format, in the local time zone, ex: "0 3 * * *" for every day at 3:00 AM
+    ///             (check RecurSchedule for details)
+    ///'pfn' = callback to invoke when the timer fires (it is called outside of any lock), or 0 not to call it
+    ///'pParam1' = passed directly into 'pfn' when it's called
+    ///'pParam2' = passed directly into 'pfn' when it's called
+    ///'msLeeway' = number of ms after each scheduled time that this timer may also fire at, or 0 for an exact deadline
+    ///RETURN:
+    ///     = Non-zero timer ID if success - call removeTimer() to stop it
+    ///     = 0 if error
+    UInt64 addTimerRecurring(const char* pstrCron,
+                             PFN_WAKE_SCHED_CALLBACK pfn,
+                             const void* pParam1 = nullptr,
+                             const void* pParam2 = nullptr,
+                             UInt32 msLeeway = 0)
+    {
+        std::shared_ptr<RecurSchedule> pRecur = std::make_shared<RecurSchedule>();
+
+        if(!pRecur->compile(pstrCron))
+        {
+            //Bad schedule
+            assert(false);
+            return 0;
+        }
+
+        CFAbsoluteTime dtWhen;
+        if(!WakeTimer::Get_NextRecurringTime(*pRecur, CFAbsoluteTimeGetCurrent(), &dtWhen))
+        {
+            //It never fires
+            return 0;
+        }
+
+        return _addTimer(dtWhen,
+                         dtWhen + ((CFTimeInterval)msLeeway) / 1000.0,
+                         pfn, pParam1, pParam2,
+                         pRecur);
+    }
+
+
+    ///Restore logical timers from the persistent store, after a restart
+    ///INFO: Callbacks are not persisted, so all restored timers use the same callback - use timer IDs to tell them apart.
+    ///      Timers that became due while this process was not running fire on the next call to fireDueTimers().
+    ///'pfn' = callback to invoke when a restored timer fires (it is called outside of any lock), or 0 not to call it
+    ///'pParam1' = passed directly into 'pfn' when it's called
+    ///'pParam2' = passed directly into 'pfn' when it's called
+    ///RETURN:
+    ///     = Number of logical timers that were restored
+    size_t restoreTimers(PFN_WAKE_SCHED_CALLBACK pfn,
+                         const void* pParam1 = nullptr,
+                         const void* pParam2 = nullptr)
+    {
+        if(!_pStore)
+        {
+            //No store
+            assert(false);
+            return 0;
+        }
+
+        //Records are read directly from the mapped file
+        std::vector<TIMER_REC> arrRecs;
+        _pStore->getRecords(_pstrOwner, arrRecs);
+
+        size_t szcRestored = 0;
+        REARM rearm;
+
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            for(const TIMER_REC& rec : arrRecs)
+            {
+                if(rec.nID == 0 ||
+                   _mapTimers.find(rec.nID) != _mapTimers.end())
+                {
+                    //Not a logical timer, or already have it
+                    continue;
+                }
+
+                LOGICAL_TIMER lt;
+                lt.nID = rec.nID;
+                lt.dtEarliest = rec.dtEarliest;
+                lt.dtLatest = rec.dtLatest;
+                lt.pfnCallback = pfn;
+                lt.pParam1 = pParam1;
+                lt.pParam2 = pParam2;
+
+                if(rec.szCron[0])
+                {
+                    lt.pRecur = std::make_shared<RecurSchedule>();
+                    if(!lt.pRecur->compile(rec.szCron))
+                    {
+                        //Bad record
+                        assert(false);
+                        continue;
+                    }
+                }
+
+                _mapTimers[lt.nID] = lt;
+
+                _arrHeap.push_back({lt.dtLatest, lt.nID});
+                std::push_heap(_arrHeap.begin(), _arrHeap.end(), _heapCmp);
+
+                if(lt.nID > _nLastID)
+                    _nLastID = lt.nID;
+
+                szcRestored++;
+            }
+
+            //INFO: Timers that are already due are fired by the run-loop timer right away.
+            rearm = _planRearm();
+        }
+
+        //Talk to the OS outside of the lock
+        if(!_applyRearm(rearm))
+        {
+            //Failed - it will be retried
+            assert(false);
+        }
+
+        return szcRestored;
+    }
+
+
+    ///Remove logical timer that was added by addTimer*() functions
+    ///'nTimerID' = timer ID to remove
+    ///RETURN:
+    ///     = true if timer was found and removed
+    bool removeTimer(UInt64 nTimerID)
+    {
+        bool bRes = false;
+        REARM rearm;
+
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            if(_mapTimers.erase(nTimerID) != 0)
+            {
+                //INFO: Its heap entry is discarded lazily when it reaches the top
+                bRes = true;
+
+                _markStoreDirty(nTimerID);
+
+                rearm = _planRearm();
+            }
+        }
+
+        //Talk to the OS outside of the lock
+        if(!_applyRearm(rearm))
+        {
+            //Failed to update the OS event - it will be retried
+            assert(false);
+        }
+
+        //Write to disk outside of the lock
+        _flushStore();
+
+        return bRes;
+    }
+
+
+    ///Remove all logical timers and the OS wake event
+    ///RETURN:
+    ///     = true if no errors
+    bool removeAllTimers()
+    {
+        REARM rearm;
+
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            _mapTimers.clear();
+            _arrHeap.clear();
+
+            _bStoreRemoveAll = true;
+            _setStoreDirty.clear();
+
+            rearm = _planRearm();
+        }
+
+        //Talk to the OS outside of the lock
+        bool bRes = _applyRearm(rearm);
+
+        //Write to disk outside of the lock
+        _flushStore();
+
+        return bRes;
+    }
+
+
+    ///RETURN:
+    ///     = Number of logical timers that are currently scheduled
+    size_t getTimerCount()
+    {
+        READER_LOCK rdl(_lock);
+
+        return _mapTimers.size();
+    }
+
+
+    ///Get the time of the earliest logical timer, that is also programmed into the OS
+    ///'pdtOutWhen' = if not 0, receives UTC date/time of the OS wake event, or 0 if none
+    ///RETURN:
+    ///     = true if OS wake event is currently set
+    bool getNextWakeTime(CFAbsoluteTime* pdtOutWhen = nullptr)
+    {
+        bool bRes;
+        CFAbsoluteTime dtWhen;
+
+        if(true)
+        {
+            //Act from within a lock
+            READER_LOCK rdl(_lock);
+
+            bRes = _bArmed;
+            dtWhen = _bArmed ? _dtArmed : 0;
+        }
+
+        if(pdtOutWhen)
+            *pdtOutWhen = dtWhen;
+
+        return bRes;
+    }
+
+
+    ///Compute the minimal set of physical wakes that would serve all currently scheduled logical timers
+    ///INFO: Uses greedy interval stabbing - windows are sorted by their latest date/time, and each
+    ///      physical wake is placed at the latest date/time of the first window that is not served yet.
+    ///'pArrOutWakes' = if not 0, receives UTC date/times of physical wakes, sorted in ascending order
+    ///RETURN:
+    ///     = Number of physical wakes that are saved, compared to waking up for each logical timer separately
+    size_t getWakePlan(std::vector<CFAbsoluteTime>* pArrOutWakes = nullptr)
+    {
+        std::vector<std::pair<CFAbsoluteTime, CFAbsoluteTime>> arrWnds;        //[latest, earliest]
+
+        if(true)
+        {
+            //Act from within a lock
+            READER_LOCK rdl(_lock);
+
+            arrWnds.reserve(_mapTimers.size());
+
+            for(const auto& kv : _mapTimers)
+            {
+                arrWnds.push_back({kv.second.dtLatest, kv.second.dtEarliest});
+            }
+        }
+
+        std::sort(arrWnds.begin(), arrWnds.end());
+
+        if(pArrOutWakes)
+            pArrOutWakes->clear();
+
+        size_t szcWakes = 0;
+        CFAbsoluteTime dtStab = 0;
+
+        for(size_t i = 0; i < arrWnds.size(); i++)
+        {
+            if(szcWakes == 0 ||
+               arrWnds[i].second > dtStab)
+            {
+                //Not served by the previous wake - need a new one
+                dtStab = arrWnds[i].first;
+                szcWakes++;
+
+                if(pArrOutWakes)
+                    pArrOutWakes->push_back(dtStab);
+            }
+        }
+
+        return arrWnds.size() - szcWakes;
+    }
+
+
+    ///Get statistics of how logical timers were fired so far
+    ///'pszOutTimersFired' = if not 0, receives the number of logical timers that fired
+    ///'pszOutWakes' = if not 0, receives the number of times when at least one logical timer fired
+    ///RETURN:
+    ///     = Number of physical wakes that were saved by coalescing logical timers
+    size_t getFiredStats(size_t* pszOutTimersFired = nullptr,
+                         size_t* pszOutWakes = nullptr)
+    {
+        size_t szcFired, szcWakes;
+
+        if(true)
+        {
+            //Act from within a lock
+            READER_LOCK rdl(_lock);
+
+            szcFired = _szcTimersFired;
+            szcWakes = _szcWakes;
+        }
+
+        if(pszOutTimersFired)
+            *pszOutTimersFired = szcFired;
+        if(pszOutWakes)
+            *pszOutWakes = szcWakes;
+
+        return szcFired - szcWakes;
+    }
+
+
+    ///Fire all logical timers that are due and program the OS with the next earliest one
+    ///INFO: Call it when the system wakes up, ex: on kIOMessageSystemHasPoweredOn notification.
+    ///      It is also called internally from the run-loop timer, if the system was awake at the due time.
+    ///INFO: Timers with tolerance windows are fired as soon as their earliest date/time has passed,
+    ///      so that they can share this wake with other timers.
+    ///RETURN:
+    ///     = Number of logical timers that fired
+    size_t fireDueTimers()
+    {
+        std::vector<LOGICAL_TIMER> arrDue;
+        REARM rearm;
+
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            CFAbsoluteTime dtDue = CFAbsoluteTimeGetCurrent() + WAKE_SCHED_DUE_SLACK_SEC;
+
+            //INFO: This is O(n) but it happens only once per wake
+            for(auto it = _mapTimers.begin(); it != _mapTimers.end(); )
+            {
+                if(it->second.dtEarliest <= dtDue)
+                {
+                    //INFO: Its heap entry is discarded lazily when it reaches the top
+                    arrDue.push_back(it->second);
+                    it = _mapTimers.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            if(!arrDue.empty())
+            {
+                _szcTimersFired += arrDue.size();
+                _szcWakes++;
+            }
+
+            //Re-arm recurring timers for their next time (with the same ID), and forget the others
+            CFAbsoluteTime dtNow = CFAbsoluteTimeGetCurrent();
+
+            for(const LOGICAL_TIMER& lt : arrDue)
+            {
+                if(lt.pRecur)
+                {
+                    CFAbsoluteTime dtNext;
+                    if(WakeTimer::Get_NextRecurringTime(*lt.pRecur, std::max(dtNow, lt.dtEarliest), &dtNext))
+                    {
+                        LOGICAL_TIMER ltNext = lt;
+                        ltNext.dtEarliest = dtNext;
+                        ltNext.dtLatest = dtNext + (lt.dtLatest - lt.dtEarliest);
+
+                        _mapTimers[lt.nID] = ltNext;
+
+                        _arrHeap.push_back({ltNext.dtLatest, lt.nID});
+                        std::push_heap(_arrHeap.begin(), _arrHeap.end(), _heapCmp);
+
+                        _markStoreDirty(lt.nID);
+                        continue;
+                    }
+                }
+
+                _markStoreDirty(lt.nID);
+            }
+
+            //Decide how to program the next one
+            rearm = _planRearm();
+        }
+
+        //Talk to the OS outside of the lock
+        if(!_applyRearm(rearm))
+        {
+            //Failed - it will be retried
+            assert(false);
+        }
+
+        //Write to disk outside of the lock
+        _flushStore();
+
+        //Invoke callbacks outside of the lock (they may add new timers)
+        for(const LOGICAL_TIMER& lt : arrDue)
+        {
+            if(lt.pfnCallback)
+            {
+                lt.pfnCallback(lt.nID, lt.dtLatest, lt.pParam1, lt.pParam2);
+            }
+        }
+
+        return arrDue.size();
+    }
+
+
+
+private:
+
+    UInt64 _addTimer(CFAbsoluteTime dtEarliest,
+                     CFAbsoluteTime dtLatest,
+                     PFN_WAKE_SCHED_CALLBACK pfn,
+                     const void* pParam1,
+                     const void* pParam2,
+                     const std::shared_ptr<RecurSchedule>& pRecur)
+    {
+        UInt64 nID = 0;
+        REARM rearm;
+
+        if(dtLatest < dtEarliest)
+        {
+            //Bad window
+            assert(false);
+            return 0;
+        }
+
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            nID = ++_nLastID;
+
+            LOGICAL_TIMER lt;
+            lt.nID = nID;
+            lt.dtEarliest = dtEarliest;
+            lt.dtLatest = dtLatest;
+            lt.pfnCallback = pfn;
+            lt.pParam1 = pParam1;
+            lt.pParam2 = pParam2;
+            lt.pRecur = pRecur;
+
+            _mapTimers[nID] = lt;
+
+            _arrHeap.push_back({dtLatest, nID});
+            std::push_heap(_arrHeap.begin(), _arrHeap.end(), _heapCmp);
+
+            _markStoreDirty(nID);
+
+            //Only touches the OS if this became the earliest deadline
+            rearm = _planRearm();
+        }
+
+        //Talk to the OS outside of the lock
+        //INFO: If it fails, the timer is kept - it's tried again later, and the run-loop timer fires it
+        //      if the system is awake. A timer that is already due is fired on the next fireDueTimers().
+        if(!_applyRearm(rearm))
+        {
+            //Failed - it will be retried
+            assert(false);
+        }
+
+        //Write to disk outside of the lock
+        _flushStore();
+
+        return nID;
+    }
+
+
+    ///What _planRearm() decided to do with the OS wake event
+    struct REARM
+    {
+        UInt64 nVer = 0;                        //Version of this request, or 0 if the OS wake event doesn't need to change
+        bool bSet = false;                      //true to set the OS wake event for 'dtWhen', false to stop it
+        CFAbsoluteTime dtWhen = 0;              //UTC date/time for the OS wake event
+    };
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Discard removed timers from the top of the heap, set the run-loop timer for the earliest deadline
+    ///of all logical timers, and decide if the OS wake event needs to change for it.
+    ///INFO: It does not talk to the OS - pass the result into _applyRearm() after releasing '_lock'.
+    ///      The OS event is not changed if the earliest time did not change, or if it is already due.
+    ///RETURN:
+    ///     = What to do with the OS wake event
+    REARM _planRearm()
+    {
+        REARM rearm;
+
+        //Drop stale entries from the top
+        //INFO: Entry is also stale if its recurring timer was re-armed for another time.
+        while(!_arrHeap.empty())
+        {
+            auto it = _mapTimers.find(_arrHeap.front().nID);
+            if(it != _mapTimers.end() &&
+               it->second.dtLatest == _arrHeap.front().dtLatest)
+            {
+                break;
+            }
+
+            std::pop_heap(_arrHeap.begin(), _arrHeap.end(), _heapCmp);
+            _arrHeap.pop_back();
+        }
+
+        //And compact the heap if too many stale entries accumulated
+        if(_arrHeap.size() > 64 &&
+           _arrHeap.size() > _mapTimers.size() * 2)
+        {
+            _arrHeap.clear();
+            _arrHeap.reserve(_mapTimers.size());
+
+            for(const auto& kv : _mapTimers)
+            {
+                _arrHeap.push_back({kv.second.dtLatest, kv.first});
+            }
+
+            std::make_heap(_arrHeap.begin(), _arrHeap.end(), _heapCmp);
+        }
+
+        if(!_arrHeap.empty())
+        {
+            CFAbsoluteTime dtNext = _arrHeap.front().dtLatest;
+
+            if(!_bArmRequested ||
+               dtNext != _dtArmRequested)
+            {
+                _setRunLoopTimer(dtNext);
+
+                //The OS can't wake us up in the past - the run-loop timer fires it right away instead
+                if(dtNext > CFAbsoluteTimeGetCurrent())
+                {
+                    //Program the single OS wake event
+                    _bArmRequested = true;
+                    _dtArmRequested = dtNext;
+
+                    rearm.nVer = ++_nVerArmRequested;
+                    rearm.bSet = true;
+                    rearm.dtWhen = dtNext;
+                }
+            }
+        }
+        else if(_bArmRequested ||
+                !_bArmRequestValid)
+        {
+            //Nothing left to wait for
+            _setRunLoopTimer(0);
+
+            _bArmRequested = false;
+            _dtArmRequested = 0;
+
+            rearm.nVer = ++_nVerArmRequested;
+            rearm.bSet = false;
+        }
+
+        if(rearm.nVer)
+        {
+            _bArmRequestValid = true;
+        }
+
+        return rearm;
+    }
+
+
+    ///IMPORTANT: Must be called without holding '_lock'!
+    ///Set or stop the OS wake event as _planRearm() decided, and commit the result
+    ///INFO: If a newer request reached the OS already, this one is skipped. If it fails, it is tried again
+    ///      in WAKE_SCHED_RETRY_SEC, or sooner if the logical timers change.
+    ///'rearm' = what _planRearm() returned
+    ///RETURN:
+    ///     = true if success
+    bool _applyRearm(const REARM& rearm)
+    {
+        if(!rearm.nVer)
+        {
+            //Nothing to do
+            return true;
+        }
+
+        bool bRes = true;
+        bool bApplied = false;
+
+        if(true)
+        {
+            WRITER_LOCK wrl(_lockIPC);
+
+            if(rearm.nVer > _nVerArmApplied)
+            {
+                bRes = rearm.bSet ? _wakeTimer.setWakeEventAbsolute(rearm.dtWhen) :
+                                    _wakeTimer.stopWakeEvent();
+
+                _nVerArmApplied = rearm.nVer;
+                bApplied = true;
+            }
+        }
+
+        if(bApplied)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            if(rearm.nVer > _nVerArmCommitted)
+            {
+                _nVerArmCommitted = rearm.nVer;
+
+                _bArmed = bRes && rearm.bSet;
+                _dtArmed = _bArmed ? rearm.dtWhen : 0;
+            }
+
+            if(!bRes &&
+               rearm.nVer == _nVerArmRequested)
+            {
+                //Failed - make the next _planRearm() call the OS again,
+                //and call it from the run-loop timer (it fires the due timers too)
+                _bArmRequestValid = false;
+                _bArmRequested = false;
+                _dtArmRequested = 0;
+
+                CFAbsoluteTime dtRetry = CFAbsoluteTimeGetCurrent() + WAKE_SCHED_RETRY_SEC;
+
+                if(!_arrHeap.empty() &&
+                   _arrHeap.front().dtLatest < dtRetry)
+                {
+                    dtRetry = _arrHeap.front().dtLatest;
+                }
+
+                _setRunLoopTimer(dtRetry);
+            }
+        }
+
+        return bRes;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Set run-loop timer to fire at 'dtWhen' - in case the system is awake at that moment
+    ///'dtWhen' = UTC date/time, or 0 to remove the run-loop timer
+    void _setRunLoopTimer(CFAbsoluteTime dtWhen)
+    {
+        if(dtWhen)
+        {
+            if(!_refRunLoopTmr)
+            {
+                CFRunLoopTimerContext ctx = {};
+                ctx.info = this;
+
+                _refRunLoopTmr = CFRunLoopTimerCreate(kCFAllocatorDefault,
+                                                      dtWhen,
+                                                      WAKE_SCHED_RUNLOOP_INTERVAL,
+                                                      0,
+                                                      0,
+                                                      _onRunLoopTimer,
+                                                      &ctx);
+                if(_refRunLoopTmr)
+                {
+                    CFRunLoopAddTimer(CFRunLoopGetMain(),
+                                      _refRunLoopTmr,
+                                      kCFRunLoopCommonModes);
+                }
+                else
+                {
+                    //Failed
+                    assert(false);
+                }
+            }
+            else
+            {
+                CFRunLoopTimerSetNextFireDate(_refRunLoopTmr, dtWhen);
+            }
+        }
+        else if(_refRunLoopTmr)
+        {
+            CFRunLoopTimerInvalidate(_refRunLoopTmr);
+            CFRelease(_refRunLoopTmr);
+            _refRunLoopTmr = nullptr;
+        }
+    }
+
+
+    static void _onRunLoopTimer(CFRunLoopTimerRef timer,
+                                void* info)
+    {
+        UNREFERENCED_PARAMETER(timer);
+
+        WakeScheduler* pThis = (WakeScheduler*)info;
+        assert(pThis);
+
+        pThis->fireDueTimers();
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    WakeScheduler(const WakeScheduler& s) = delete;
+    WakeScheduler& operator = (const WakeScheduler& s) = delete;
+
+
+    struct LOGICAL_TIMER
+    {
+        UInt64 nID;
+        CFAbsoluteTime dtEarliest;              //UTC date/time when it may fire at the earliest
+        CFAbsoluteTime dtLatest;                //UTC date/time when it must fire (same as 'dtEarliest' for exact timers)
+
+        PFN_WAKE_SCHED_CALLBACK pfnCallback;
+        const void* pParam1;
+        const void* pParam2;
+
+        std::shared_ptr<RecurSchedule> pRecur;  //Schedule for recurring timers, or null for one-shot timers
+    };
+
+    struct HEAP_ENTRY
+    {
+        CFAbsoluteTime dtLatest;
+        UInt64 nID;
+    };
+
+    ///Comparator that makes a min-heap out of std::*_heap functions
+    static bool _heapCmp(const HEAP_ENTRY& a, const HEAP_ENTRY& b)
+    {
+        return a.dtLatest > b.dtLatest;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Remember that logical timer with 'nID' was added, changed or removed, so that _flushStore() writes it
+    void _markStoreDirty(UInt64 nID)
+    {
+        if(_pStore)
+        {
+            _setStoreDirty.insert(nID);
+        }
+    }
+
+
+    ///IMPORTANT: Must be called without holding '_lock'!
+    ///Write logical timers that were marked by _markStoreDirty() into the persistent store, if it's used
+    ///INFO: The store flushes to disk, so it's not done from within '_lock'. Instead, the latest state of
+    ///      changed timers is collected from within '_lock', and written from within '_lockStore'.
+    ///      Thus, if two threads flush at the same time, the one that writes last also has the latest state.
+    void _flushStore()
+    {
+        if(!_pStore)
+            return;
+
+        WRITER_LOCK wrlStore(_lockStore);
+
+        bool bRemoveAll;
+        std::vector<TIMER_REC> arrPut;
+        std::vector<UInt64> arrRemove;
+
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            bRemoveAll = _bStoreRemoveAll;
+            _bStoreRemoveAll = false;
+
+            for(UInt64 nID : _setStoreDirty)
+            {
+                auto it = _mapTimers.find(nID);
+                if(it != _mapTimers.end())
+                {
+                    const LOGICAL_TIMER& lt = it->second;
+
+                    TIMER_REC rec;
+                    if(TimerStore::makeRecord(rec,
+                                              _pstrOwner,
+                                              lt.nID,
+                                              lt.dtEarliest,
+                                              lt.dtLatest,
+                                              lt.pRecur ? lt.pRecur->getSource().c_str() : nullptr))
+                    {
+                        arrPut.push_back(rec);
+                    }
+                    else
+                    {
+                        //Failed - it will still fire, but it won't survive a restart
+                        assert(false);
+                    }
+                }
+                else
+                {
+                    arrRemove.push_back(nID);
+                }
+            }
+
+            _setStoreDirty.clear();
+        }
+
+        if(bRemoveAll)
+        {
+            //Only logical timers - ID 0 is used by the wake timer itself
+            if(!_pStore->removeAll(_pstrOwner, 1))
+            {
+                //Failed
+                assert(false);
+            }
+        }
+
+        for(const TIMER_REC& rec : arrPut)
+        {
+            if(!_pStore->put(rec))
+            {
+                //Failed - it will still fire, but it won't survive a restart
+                assert(false);
+            }
+        }
+
+        for(UInt64 nID : arrRemove)
+        {
+            if(!_pStore->remove(_pstrOwner, nID))
+            {
+                //Failed
+                assert(false);
+            }
+        }
+    }
+
+private:
+
+    RDR_WRTR _lock;                                     //Lock for accessing this struct
+    RDR_WRTR _lockStore;                                //Lock that serializes writes to '_pStore' (always used as a writer)
+                                                        //IMPORTANT: Never hold '_lock' while acquiring this lock!
+    RDR_WRTR _lockIPC;                                  //Lock that serializes calls into '_wakeTimer' (always used as a writer)
+                                                        //IMPORTANT: Never acquire '_lock' while holding this lock!
+
+    WakeTimer& _wakeTimer;                              //The only OS wake event that we use
+
+    TimerStore* _pStore;                                //Persistent store for logical timers, or null if not used
+    const char* _pstrOwner;                             //Owner of our records in '_pStore' (interned bundle ID of '_wakeTimer')
+    std::unordered_set<UInt64> _setStoreDirty;          //IDs of logical timers that must be written into '_pStore' (accessed within '_lock')
+    bool _bStoreRemoveAll = false;                      //true if all logical timers must be removed from '_pStore' first (accessed within '_lock')
+
+    std::vector<HEAP_ENTRY> _arrHeap;                   //Min-heap by latest date/time (may contain removed timers)
+    std::unordered_map<UInt64, LOGICAL_TIMER> _mapTimers;   //Currently scheduled logical timers by ID
+
+    UInt64 _nLastID = 0;                                //Last issued timer ID
+
+    bool _bArmed = false;                               //true if OS wake event is set for '_dtArmed'
+    CFAbsoluteTime _dtArmed = 0;                        //UTC date/time that OS wake event was set for
+
+    bool _bArmRequested = false;                        //true if the last request to the OS was to set the wake event for '_dtArmRequested'
+    CFAbsoluteTime _dtArmRequested = 0;                 //UTC date/time of the last request to set the OS wake event
+    bool _bArmRequestValid = false;                     //false if the last request to the OS failed, or there was none yet
+
+    UInt64 _nVerArmRequested = 0;                       //Version of the last request to change the OS wake event (accessed within '_lock')
+    UInt64 _nVerArmCommitted = 0;                       //Version of the request that '_bArmed' and '_dtArmed' reflect (accessed within '_lock')
+    UInt64 _nVerArmApplied = 0;                         //Version of the last request that reached the OS (accessed within '_lockIPC')
+
+    CFRunLoopTimerRef _refRunLoopTmr = nullptr;         //Run-loop timer for when the system is awake at the due time
+
+    size_t _szcTimersFired = 0;                         //Number of logical timers that fired so far
+    size_t _szcWakes = 0;                               //Number of times that at least one logical timer fired
+};
+
+
+
+
+#endif /* wake_scheduler_h */
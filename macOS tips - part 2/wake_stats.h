@@ -0,0 +1,562 @@
+//
+//  wake_stats.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of how to measure how late macOS wakes up, compared to when our wake timers were set for,
+//  and how long it takes for the system to resume after that
+//
+
+
+#ifndef wake_stats_h
+#define wake_stats_h
+
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include "types.h"
+#include "rdr_wrtr.h"           //Reader/writer lock classes from "macOS tips - part 1"
+#include "wake_timer.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <IOKit/IOMessage.h>
+
+
+
+
+#define WAKE_STATS_MAX_EARLY_MS 30000           //If the system wakes up earlier than this many ms before our wake time,
+                                                //we assume that it was woken up by something else (user, another app, etc.)
+
+#define WAKE_STATS_MAX_TIMERS 16                //Max number of wake timers that 'WakeStats' can watch
+
+#define LATENCY_HIST_SUB_BITS 3                 //Number of bits for sub-buckets in each power-of-2 range of 'LatencyHistogram'
+#define LATENCY_HIST_SUB_CNT (1 << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_BUCKETS ((64 - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB_CNT)
+
+
+
+///Streaming histogram of non-negative values (ex: in ms) with a fixed memory footprint
+///INFO: Each power-of-2 range is split into LATENCY_HIST_SUB_CNT linear sub-buckets, so that any
+///      percentile that it returns is within 1/LATENCY_HIST_SUB_CNT of the actual value.
+///      Count, min, max and sum are exact.
+///IMPORTANT: It is not thread-safe!
+struct LatencyHistogram
+{
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        memset(_arrCounts, 0, sizeof(_arrCounts));
+
+        _nCount = 0;
+        _nMin = 0;
+        _nMax = 0;
+        _nSum = 0;
+    }
+
+
+    ///Add 'nValue' to this histogram
+    void record(UInt64 nValue)
+    {
+        _arrCounts[getBucketIndex(nValue)]++;
+
+        if(!_nCount ||
+           nValue < _nMin)
+        {
+            _nMin = nValue;
+        }
+
+        if(nValue > _nMax)
+            _nMax = nValue;
+
+        _nSum += nValue;
+        _nCount++;
+    }
+
+    UInt64 getCount() const
+    {
+        return _nCount;
+    }
+
+    UInt64 getMin() const
+    {
+        return _nMin;
+    }
+
+    UInt64 getMax() const
+    {
+        return _nMax;
+    }
+
+    ///RETURN:
+    ///     = Average of all recorded values, or 0 if none were recorded
+    double getMean() const
+    {
+        return _nCount ? (double)_nSum / (double)_nCount : 0;
+    }
+
+
+    ///Estimate a percentile of recorded values
+    ///'fPercentile' = percentile to get, from 0 to 100, ex: 99.9
+    ///RETURN:
+    ///     = Estimated value, or 0 if none were recorded
+    UInt64 getPercentile(double fPercentile) const
+    {
+        if(!_nCount)
+            return 0;
+
+        if(fPercentile <= 0)
+            return _nMin;
+        if(fPercentile >= 100)
+            return _nMax;
+
+        //Rank of the value that we need (1-based)
+        UInt64 nRank = (UInt64)((fPercentile / 100.0) * (double)_nCount + 0.5);
+        if(nRank < 1)
+            nRank = 1;
+
+        UInt64 nSeen = 0;
+        for(size_t i = 0; i < LATENCY_HIST_BUCKETS; i++)
+        {
+            nSeen += _arrCounts[i];
+            if(nSeen >= nRank)
+            {
+                //Report the middle of the bucket, but don't go outside of what we've seen
+                UInt64 nLow = getBucketLowest(i);
+                UInt64 nVal = nLow + (getBucketHighest(i) - nLow) / 2;
+
+                if(nVal < _nMin)
+                    nVal = _nMin;
+                if(nVal > _nMax)
+                    nVal = _nMax;
+
+                return nVal;
+            }
+        }
+
+        //Can't be here
+        assert(false);
+        return _nMax;
+    }
+
+
+    ///Merge counts from 'other' histogram into this one
+    void merge(const LatencyHistogram& other)
+    {
+        if(!other._nCount)
+            return;
+
+        for(size_t i = 0; i < LATENCY_HIST_BUCKETS; i++)
+        {
+            _arrCounts[i] += other._arrCounts[i];
+        }
+
+        if(!_nCount ||
+           other._nMin < _nMin)
+        {
+            _nMin = other._nMin;
+        }
+
+        if(other._nMax > _nMax)
+            _nMax = other._nMax;
+
+        _nSum += other._nSum;
+        _nCount += other._nCount;
+    }
+
+
+    ///Append this histogram as a JSON object to 'pstrOut'
+    ///INFO: Only non-empty buckets are exported, as an array of [lowest, highest, count]
+    void appendAsJson(std::string* pstrOut) const
+    {
+        assert(pstrOut);
+
+        char buff[256];
+        snprintf(buff, sizeof(buff),
+                 "{\"count\":%llu,\"min\":%llu,\"max\":%llu,\"mean\":%.3f,"
+                 "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"buckets\":[",
+                 (unsigned long long)_nCount,
+                 (unsigned long long)_nMin,
+                 (unsigned long long)_nMax,
+                 getMean(),
+                 (unsigned long long)getPercentile(50),
+                 (unsigned long long)getPercentile(90),
+                 (unsigned long long)getPercentile(99),
+                 (unsigned long long)getPercentile(99.9));
+
+        pstrOut->append(buff);
+
+        bool bFirst = true;
+        for(size_t i = 0; i < LATENCY_HIST_BUCKETS; i++)
+        {
+            if(_arrCounts[i])
+            {
+                snprintf(buff, sizeof(buff),
+                         "%s[%llu,%llu,%llu]",
+                         bFirst ? "" : ",",
+                         (unsigned long long)getBucketLowest(i),
+                         (unsigned long long)getBucketHighest(i),
+                         (unsigned long long)_arrCounts[i]);
+
+                pstrOut->append(buff);
+                bFirst = false;
+            }
+        }
+
+        pstrOut->append("]}");
+    }
+
+
+
+    ///RETURN:
+    ///     = Index of the bucket for 'nValue'
+    static constexpr size_t getBucketIndex(UInt64 nValue)
+    {
+        if(nValue < LATENCY_HIST_SUB_CNT)
+        {
+            //Small values have a bucket each
+            return (size_t)nValue;
+        }
+
+        int nMsb = 63 - __builtin_clzll(nValue);
+        size_t nSub = (size_t)(nValue >> (nMsb - LATENCY_HIST_SUB_BITS)) & (LATENCY_HIST_SUB_CNT - 1);
+
+        return (size_t)(nMsb - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB_CNT + nSub;
+    }
+
+    ///RETURN:
+    ///     = Lowest value that goes into the bucket with 'nIndex'
+    static constexpr UInt64 getBucketLowest(size_t nIndex)
+    {
+        if(nIndex < LATENCY_HIST_SUB_CNT)
+            return nIndex;
+
+        int nMsb = (int)(nIndex / LATENCY_HIST_SUB_CNT) + LATENCY_HIST_SUB_BITS - 1;
+        UInt64 nSub = nIndex % LATENCY_HIST_SUB_CNT;
+
+        return (LATENCY_HIST_SUB_CNT + nSub) << (nMsb - LATENCY_HIST_SUB_BITS);
+    }
+
+    ///RETURN:
+    ///     = Highest value that goes into the bucket with 'nIndex'
+    static constexpr UInt64 getBucketHighest(size_t nIndex)
+    {
+        return nIndex + 1 < LATENCY_HIST_BUCKETS ? getBucketLowest(nIndex + 1) - 1 : ~0ull;
+    }
+
+
+private:
+
+    UInt64 _arrCounts[LATENCY_HIST_BUCKETS];        //Number of values in each bucket
+
+    UInt64 _nCount;                                 //Number of recorded values
+    UInt64 _nMin;                                   //Smallest recorded value
+    UInt64 _nMax;                                   //Largest recorded value
+    UInt64 _nSum;                                   //Sum of all recorded values
+};
+
+
+static_assert(LatencyHistogram::getBucketIndex(LATENCY_HIST_SUB_CNT - 1) == LATENCY_HIST_SUB_CNT - 1, "Bad bucket index!");
+static_assert(LatencyHistogram::getBucketIndex(LATENCY_HIST_SUB_CNT) == LATENCY_HIST_SUB_CNT, "Bad bucket index!");
+static_assert(LatencyHistogram::getBucketIndex(~0ull) == LATENCY_HIST_BUCKETS - 1, "Bad bucket index!");
+static_assert(LatencyHistogram::getBucketLowest(LatencyHistogram::getBucketIndex(1000)) <= 1000 &&
+              LatencyHistogram::getBucketHighest(LatencyHistogram::getBucketIndex(1000)) >= 1000, "Bad bucket range!");
+
+
+
+
+///Snapshot of the data collected by 'WakeStats'
+struct WAKE_STATS_SNAPSHOT
+{
+    LatencyHistogram histLateness;      //How late (in ms) the system woke up after the earliest wake time of our timers
+                                        //INFO: Wakes that were early (within WAKE_STATS_MAX_EARLY_MS) are recorded as 0.
+    LatencyHistogram histResume;        //How long it took (in ms) from kIOMessageSystemWillPowerOn to kIOMessageSystemHasPoweredOn
+
+    size_t szcSleeps = 0;               //Number of times the system went to sleep (kIOMessageSystemWillSleep)
+    size_t szcWakes = 0;                //Number of times the system woke up
+    size_t szcWakesScheduled = 0;       //Number of wakes that we attributed to our wake timers
+    size_t szcWakesEarly = 0;           //Number of wakes from 'szcWakesScheduled' that happened before our wake time
+    size_t szcWakesUnscheduled = 0;     //Number of wakes when none of our timers were set, or the system woke up too early for them
+};
+
+
+
+///Correlates wake times of our 'WakeTimer's with sleep/wake notifications
+///and keeps streaming histograms of the wake lateness and resume duration
+struct WakeStats
+{
+    WakeStats()
+    {
+    }
+
+
+    ///Add a wake timer to take wake times from
+    ///IMPORTANT: 'pWakeTimer' must remain valid for the lifetime of this struct!
+    ///RETURN:
+    ///     = true if success
+    ///     = false if there are already WAKE_STATS_MAX_TIMERS timers
+    bool watchTimer(WakeTimer* pWakeTimer)
+    {
+        assert(pWakeTimer);
+
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        if(_szcTimers >= WAKE_STATS_MAX_TIMERS)
+        {
+            //Too many
+            assert(false);
+            return false;
+        }
+
+        _arrTimers[_szcTimers++] = pWakeTimer;
+
+        return true;
+    }
+
+
+    ///Must be called from the callback for 'Notif_SleepWake' with each notification
+    ///INFO: It is very quick and doesn't allocate memory, and thus it can be called before the notification is acknowledged.
+    ///'msgType' = notification type, as was passed into the callback
+    void onSleepWakeEvent(natural_t msgType)
+    {
+        //Take timestamps as early as possible
+        CFAbsoluteTime dtNow = CFAbsoluteTimeGetCurrent();
+        std::chrono::steady_clock::time_point tmNow = std::chrono::steady_clock::now();
+
+        switch(msgType)
+        {
+            case kIOMessageSystemWillSleep:
+            {
+                //Pick the earliest wake time from our timers
+                //INFO: Do it outside of our lock, as it will need to lock each timer.
+                WakeTimer* arrTimers[WAKE_STATS_MAX_TIMERS];
+                size_t szcTimers;
+
+                if(true)
+                {
+                    //Act from within a lock
+                    READER_LOCK rdl(_lock);
+
+                    szcTimers = _szcTimers;
+                    std::copy(_arrTimers, _arrTimers + szcTimers, arrTimers);
+                }
+
+                CFAbsoluteTime dtEarliest = 0;
+
+                for(size_t t = 0; t < szcTimers; t++)
+                {
+                    WakeTimer* pTimer = arrTimers[t];
+
+                    CFAbsoluteTime dtWake;
+                    if(pTimer->getWakeEventInfo(&dtWake) &&
+                       dtWake > dtNow)
+                    {
+                        if(!dtEarliest ||
+                           dtWake < dtEarliest)
+                        {
+                            dtEarliest = dtWake;
+                        }
+                    }
+                }
+
+                //Act from within a lock
+                WRITER_LOCK wrl(_lock);
+
+                _data.szcSleeps++;
+
+                _bAsleep = true;
+                _dtScheduled = dtEarliest;
+                _bResuming = false;
+            }
+            break;
+
+            case kIOMessageSystemWillPowerOn:
+            {
+                //Act from within a lock
+                WRITER_LOCK wrl(_lock);
+
+                _onWake(dtNow);
+
+                _bResuming = true;
+                _tmWillPowerOn = tmNow;
+            }
+            break;
+
+            case kIOMessageSystemHasPoweredOn:
+            {
+                //Act from within a lock
+                WRITER_LOCK wrl(_lock);
+
+                if(_bResuming)
+                {
+                    std::chrono::steady_clock::duration dur = tmNow - _tmWillPowerOn;
+                    SInt64 nMs = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
+
+                    _data.histResume.record(nMs > 0 ? (UInt64)nMs : 0);
+
+                    _bResuming = false;
+                }
+                else
+                {
+                    //We didn't get kIOMessageSystemWillPowerOn, so use this one for the wake time
+                    //INFO: We can't tell the resume duration in this case.
+                    _onWake(dtNow);
+                }
+            }
+            break;
+
+            default:
+                break;
+        }
+    }
+
+
+    ///Get collected data
+    ///'pOutData' = receives collected data
+    void getSnapshot(WAKE_STATS_SNAPSHOT* pOutData)
+    {
+        assert(pOutData);
+
+        //Act from within a lock
+        READER_LOCK rdl(_lock);
+
+        *pOutData = _data;
+    }
+
+
+    ///Get collected data as a JSON object
+    ///'pstrOut' = receives the JSON, ex:
+    ///             {"sleeps":3,"wakes":3,"scheduled":2,"early":0,"unscheduled":1,
+    ///              "lateness_ms":{"count":2,"min":850,"max":1900,...},"resume_ms":{...}}
+    void exportAsJson(std::string* pstrOut)
+    {
+        assert(pstrOut);
+
+        WAKE_STATS_SNAPSHOT data;
+        getSnapshot(&data);
+
+        char buff[256];
+        snprintf(buff, sizeof(buff),
+                 "{\"sleeps\":%zu,\"wakes\":%zu,\"scheduled\":%zu,\"early\":%zu,\"unscheduled\":%zu,\"lateness_ms\":",
+                 data.szcSleeps,
+                 data.szcWakes,
+                 data.szcWakesScheduled,
+                 data.szcWakesEarly,
+                 data.szcWakesUnscheduled);
+
+        pstrOut->assign(buff);
+
+        data.histLateness.appendAsJson(pstrOut);
+
+        pstrOut->append(",\"resume_ms\":");
+
+        data.histResume.appendAsJson(pstrOut);
+
+        pstrOut->append("}");
+    }
+
+
+    ///Remove all collected data
+    ///INFO: It does not remove watched timers.
+    void reset()
+    {
+        //Act from within a lock
+        WRITER_LOCK wrl(_lock);
+
+        _data.histLateness.reset();
+        _data.histResume.reset();
+
+        _data.szcSleeps = 0;
+        _data.szcWakes = 0;
+        _data.szcWakesScheduled = 0;
+        _data.szcWakesEarly = 0;
+        _data.szcWakesUnscheduled = 0;
+    }
+
+
+
+private:
+
+    ///Must be called within the '_lock' when the system wakes up
+    ///'dtNow' = current UTC date/time
+    void _onWake(CFAbsoluteTime dtNow)
+    {
+        if(!_bAsleep)
+        {
+            //We didn't see this system go to sleep
+            return;
+        }
+
+        _bAsleep = false;
+        _data.szcWakes++;
+
+        if(!_dtScheduled)
+        {
+            //None of our timers were set
+            _data.szcWakesUnscheduled++;
+            return;
+        }
+
+        CFTimeInterval fLateMs = (dtNow - _dtScheduled) * 1000.0;
+        if(fLateMs < -WAKE_STATS_MAX_EARLY_MS)
+        {
+            //Too early to be our wake event
+            _data.szcWakesUnscheduled++;
+            return;
+        }
+
+        _data.szcWakesScheduled++;
+
+        if(fLateMs < 0)
+        {
+            //The system could've woken up slightly early
+            _data.szcWakesEarly++;
+            fLateMs = 0;
+        }
+
+        _data.histLateness.record((UInt64)(fLateMs + 0.5));
+    }
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    WakeStats(const WakeStats& s) = delete;
+    WakeStats& operator = (const WakeStats& s) = delete;
+
+private:
+
+    RDR_WRTR _lock;                                         //Lock for accessing this struct
+
+    WakeTimer* _arrTimers[WAKE_STATS_MAX_TIMERS] = {};      //Wake timers to take wake times from
+    size_t _szcTimers = 0;                                  //Number of timers in '_arrTimers'
+
+    bool _bAsleep = false;                                  //true if we saw the system go to sleep, but didn't see it wake up yet
+    CFAbsoluteTime _dtScheduled = 0;                        //Earliest UTC date/time when our timers were set to wake the system, or 0 if none
+
+    bool _bResuming = false;                                //true if we received kIOMessageSystemWillPowerOn, but not kIOMessageSystemHasPoweredOn yet
+    std::chrono::steady_clock::time_point _tmWillPowerOn;   //When we received kIOMessageSystemWillPowerOn
+
+    WAKE_STATS_SNAPSHOT _data;                              //Collected data
+};
+
+
+
+
+#endif /* wake_stats_h */
@@ -18,13 +18,208 @@
 
 #include <stdio.h>
 #include <assert.h>
+#include <math.h>
 
 #include <string>
 #include <vector>
+#include <thread>
+#include <atomic>
 
 #include "rdr_wrtr.h"           //Reader/writer lock classes from "macOS tips - part 1"
+#include "pwr_evt_index.h"
+#include "civil_time.h"
+#include "recur_schedule.h"
+#include "timer_store.h"
+#include "name_table.h"
+#include "CFString_conv.h"
 
 #include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/pwr_mgt/IOPMLib.h>
+
+
+
+
+
+
+
+///Source of scheduled power events that talks to the OS power management
+struct PwrEvtSource_IOPM : public PwrEvtSource
+{
+    PwrEvtSource_IOPM()
+    {
+    }
+    
+    virtual bool enumEvents(std::vector<PWR_EVT>& arrOut) override
+    {
+        bool bResult = true;
+        
+        arrOut.clear();
+        
+        CFTypeRef resVal;
+        PWR_EVT evt;
+        
+        //Enumerate all wake events in the system
+        CFArrayRef refArr = IOPMCopyScheduledPowerEvents();
+        if(refArr)
+        {
+            CFIndex nCnt = CFArrayGetCount(refArr);
+            
+            arrOut.reserve(nCnt);
+            
+            for(CFIndex i = 0; i < nCnt; i++)
+            {
+                CFDictionaryRef refDic = (CFDictionaryRef)CFArrayGetValueAtIndex(refArr, i);
+                if(refDic &&
+                   CFGetTypeID(refDic) == CFDictionaryGetTypeID())
+                {
+                    //Get the ID, event type and date/time
+                    if(CFDictionaryGetValueIfPresent(refDic,
+                                                     CFSTR(kIOPMPowerEventAppNameKey),
+                                                     &resVal) &&
+                       CFGetTypeID(resVal) == CFStringGetTypeID() &&
+                       AssignString_From_CFStringRef((CFStringRef)resVal, evt.strBundleID))
+                    {
+                        if(CFDictionaryGetValueIfPresent(refDic,
+                                                         CFSTR(kIOPMPowerEventTypeKey),
+                                                         &resVal) &&
+                           CFGetTypeID(resVal) == CFStringGetTypeID() &&
+                           AssignString_From_CFStringRef((CFStringRef)resVal, evt.strEventType))
+                        {
+                            if(CFDictionaryGetValueIfPresent(refDic,
+                                                             CFSTR(kIOPMPowerEventTimeKey),
+                                                             &resVal) &&
+                               CFGetTypeID(resVal) == CFDateGetTypeID())
+                            {
+                                evt.dtWhen = CFDateGetAbsoluteTime((CFDateRef)resVal);
+                                
+                                arrOut.push_back(evt);
+                            }
+                            else
+                            {
+                                //Bad date
+                                assert(false);
+                                bResult = false;
+                            }
+                        }
+                        else
+                        {
+                            //Bad event type
+                            assert(false);
+                            bResult = false;
+                        }
+                    }
+                    else
+                    {
+                        //Bad ID
+                        assert(false);
+                        bResult = false;
+                    }
+                }
+                else
+                {
+                    //Error
+                    assert(false);
+                    bResult = false;
+                }
+            }
+            
+            //Free mem
+            CFRelease(refArr);
+            refArr = nullptr;
+        }
+        else
+        {
+            //There are no scheduled events
+        }
+        
+        return bResult;
+    }
+    
+    virtual PWR_EVT_RESULT scheduleEvent(const PWR_EVT& evt, int* pnOutOSError = nullptr) override
+    {
+        return _callOS(IOPMSchedulePowerEvent, evt, pnOutOSError);
+    }
+    
+    virtual PWR_EVT_RESULT cancelEvent(const PWR_EVT& evt, int* pnOutOSError = nullptr) override
+    {
+        return _callOS(IOPMCancelScheduledPowerEvent, evt, pnOutOSError);
+    }
+    
+    
+private:
+    
+    ///Call 'pfn' with CF objects created from 'evt'
+    static PWR_EVT_RESULT _callOS(IOReturn (*pfn)(CFDateRef, CFStringRef, CFStringRef),
+                                  const PWR_EVT& evt,
+                                  int* pnOutOSError)
+    {
+        PWR_EVT_RESULT res = PWR_EVT_ERROR;
+        IOReturn ioRes = kIOReturnNoMemory;
+        
+        CFDateRef refDtm = CFDateCreate(kCFAllocatorDefault, evt.dtWhen);
+        if(refDtm)
+        {
+            CFStringRef refEventType = CFStringCreateWithCString(kCFAllocatorDefault,
+                                                                 evt.strEventType.c_str(),
+                                                                 kCFStringEncodingUTF8);
+            if(refEventType)
+            {
+                CFStringRef refID = CFStringCreateWithCString(kCFAllocatorDefault,
+                                                              evt.strBundleID.c_str(),
+                                                              kCFStringEncodingUTF8);
+                if(refID)
+                {
+                    ioRes = pfn(refDtm, refID, refEventType);
+                    
+                    if(ioRes == kIOReturnSuccess)
+                    {
+                        //Done
+                        res = PWR_EVT_OK;
+                    }
+                    else if(ioRes == kIOReturnNotFound)
+                    {
+                        //This may happen if someone else canceled it already
+                        res = PWR_EVT_NOT_FOUND;
+                    }
+                    
+                    CFRelease(refID);
+                    refID = NULL;
+                }
+                else
+                {
+                    //Error
+                    assert(false);
+                }
+                
+                CFRelease(refEventType);
+                refEventType = NULL;
+            }
+            else
+            {
+                //Error
+                assert(false);
+            }
+            
+            //Free
+            CFRelease(refDtm);
+        }
+        else
+        {
+            //Error
+            assert(false);
+        }
+        
+        if(pnOutOSError)
+            *pnOutOSError = ioRes;
+        
+        return res;
+    }
+    
+private:
+    ///Copy constructor and assignments are NOT available!
+    PwrEvtSource_IOPM(const PwrEvtSource_IOPM& s) = delete;
+    PwrEvtSource_IOPM& operator = (const PwrEvtSource_IOPM& s) = delete;
+};
 
 
 
@@ -37,21 +232,51 @@ struct WakeTimer
     ///'pstrTimerBundleID' = string with unique bundle identifier for this timer. ex: "com.dennisbabkin.wake01"
     ///                 INFO: This ID must remain the same between different instances of this app,
     ///                 as it will be saved in the global scope on disk by the macOS
-    WakeTimer(const char* pstrTimerBundleID)
+    ///'pEvtIndex' = index of scheduled power events to use, or 0 to use the one for the OS
+    ///                 INFO: Can be used to provide PwrEvtIndex with PwrEvtSource_Memory for testing.
+    ///'pStore' = if not 0, persistent store to keep the state of this timer in. It must remain valid for the life of this struct.
+    ///                 INFO: The last known wake event is restored from it right away, and is then reconciled
+    ///                       with the OS on a background thread. The wake event is also left in the OS
+    ///                       when this struct is destroyed, so that it survives a restart of this process.
+    WakeTimer(const char* pstrTimerBundleID,
+              PwrEvtIndex* pEvtIndex = nullptr,
+              TimerStore* pStore = nullptr)
+        : _pEvtIndex(pEvtIndex ? pEvtIndex : _getSystemEvtIndex())
+        , _pStore(pStore)
     {
         assert(pstrTimerBundleID && pstrTimerBundleID[0]);       //Must be provided
         
-        if(pstrTimerBundleID)
+        //Bundle ID is interned, so that it's never copied or freed
+        _nTmrBundleID = NameTable::get().intern(pstrTimerBundleID);
+        _pstrTmrBundleID = NameTable::get().getName(_nTmrBundleID);
+        
+        if(_pStore)
         {
-            _strTmrBundleID = pstrTimerBundleID;
+            //Restore the last known state without talking to the OS
+            TIMER_REC rec;
+            if(_pStore->find(_pstrTmrBundleID, 0, &rec))
+            {
+                _bWakeEvtSet = true;
+                _dtmWake = rec.dtLatest;
+            }
+            
+            //And check it with the OS later
+            _thrReconcile = std::thread(&WakeTimer::_reconcile, this);
         }
-        
     }
     
     ~WakeTimer()
     {
-        //Stop wake event
-        stopWakeEvent();
+        if(_thrReconcile.joinable())
+        {
+            _thrReconcile.join();
+        }
+        
+        if(!_pStore)
+        {
+            //Stop wake event
+            stopWakeEvent();
+        }
     }
     
     
@@ -64,25 +289,16 @@ struct WakeTimer
     ///'pdtOutWhen' = if not 0, receives UTC date/time when the wake event was set for. Or receives 0 if didn't set it.
     ///RETURN:
     ///     = true if set OK
+    ///     = false if error, or if a newer call to change this timer was made on another thread
     bool setWakeEventRelative(UInt32 msFromNow,
                               CFAbsoluteTime* pdtOutWhen = nullptr)
     {
-        bool bRes = false;
-        
         //Time when to fire the wake event
         CFAbsoluteTime dtWhen = CFAbsoluteTimeGetCurrent() + ((CFTimeInterval)msFromNow) / 1000.0;
         
-        if(true)
-        {
-            //Act from within a lock
-            WRITER_LOCK wrl(_lock);
-         
-            bRes = _setWakeEvent(dtWhen,
-                                 WAKE_TIMER_EVENT_TYPE,
-                                 pdtOutWhen);
-        }
-        
-        return bRes;
+        return _setWakeEventTwoPhase(dtWhen,
+                                     WAKE_TIMER_EVENT_TYPE,
+                                     pdtOutWhen);
     }
  
     
@@ -92,22 +308,13 @@ struct WakeTimer
     ///'pdtOutWhen' = if not 0, receives UTC date/time when the wake event was set for. Or receives 0 if didn't set it.
     ///RETURN:
     ///     = true if set OK
+    ///     = false if error, or if a newer call to change this timer was made on another thread
     bool setWakeEventAbsolute(CFAbsoluteTime dtWake,
                               CFAbsoluteTime* pdtOutWhen = nullptr)
     {
-        bool bRes = false;
-        
-        if(true)
-        {
-            //Act from within a lock
-            WRITER_LOCK wrl(_lock);
-         
-            bRes = _setWakeEvent(dtWake,
-                                 WAKE_TIMER_EVENT_TYPE,
-                                 pdtOutWhen);
-        }
-        
-        return bRes;
+        return _setWakeEventTwoPhase(dtWake,
+                                     WAKE_TIMER_EVENT_TYPE,
+                                     pdtOutWhen);
     }
     
     
@@ -119,23 +326,42 @@ struct WakeTimer
     {
         bool bRes = true;
         
+        //Phase 1: Get the version of this request
+        UInt64 nVer;
         if(true)
         {
             //Act from within a lock
             WRITER_LOCK wrl(_lock);
             
-            //Cancel all events
-            size_t szCnt;
-            if(!_cancelEvents(_strTmrBundleID.c_str(), NULL, szCnt))
+            nVer = ++_nVerRequested;
+        }
+        
+        //Phase 2: Talk to the OS without holding '_lock'
+        bool bApplied = false;
+        if(true)
+        {
+            WRITER_LOCK wrl(_lockIPC);
+            
+            if(nVer > _nVerApplied)
             {
-                //Failed
-                bRes = false;
+                //Cancel all events
+                size_t szCnt;
+                if(!_cancelEvents(_pstrTmrBundleID, NULL, szCnt))
+                {
+                    //Failed
+                    bRes = false;
+                }
+                
+                _nVerApplied = nVer;
+                bApplied = true;
             }
-            
+        }
+        
+        //Phase 3: Commit
+        if(bApplied)
+        {
             //Reset parameters
-            _dtmWake = 0;
-            
-            _bWakeEvtSet = false;
+            _commitState(nVer, false, 0);
         }
         
         return bRes;
@@ -143,6 +369,8 @@ struct WakeTimer
     
     
     ///Get this wake event info
+    ///INFO: It is not blocked by power-management calls that other threads make for this timer.
+    ///      It doesn't allocate memory, unless 'pstrOutBundleID' is used.
     ///'pdtOutWhenWake' = if not 0, receives cached UTC date/time when the wake event was supposed to be set for.
     ///'pstrOutBundleID' = if not 0, receives the bundle ID for this wake event - is always returned, even if return is false
     ///RETURN:
@@ -154,7 +382,7 @@ struct WakeTimer
         bool bResult = false;
         
         CFAbsoluteTime dtmWake = 0;
-        std::string strBundle;
+        const char* pstrBundle;
 
         if(true)
         {
@@ -162,7 +390,7 @@ struct WakeTimer
             READER_LOCK rdl(_lock);
             
             dtmWake = _dtmWake;
-            strBundle = _strTmrBundleID;
+            pstrBundle = _pstrTmrBundleID;
          
             bResult = _bWakeEvtSet;
         }
@@ -170,14 +398,25 @@ struct WakeTimer
         if(pdtOutWhenWake)
             *pdtOutWhenWake = dtmWake;
         if(pstrOutBundleID)
-            *pstrOutBundleID = strBundle;
+            *pstrOutBundleID = pstrBundle ? pstrBundle : "";
         
         return bResult;
     }
     
     
     
+    ///RETURN:
+    ///     = ID of the bundle ID of this timer in NameTable - compare it instead of the bundle ID strings
+    ///INFO: Use NameTable::getName() to get its text. It never changes for this timer.
+    NAME_ID getBundleID()
+    {
+        return _nTmrBundleID;
+    }
+    
+    
+    
     ///Cancel specific (wake) event(s)
+    ///INFO: This timer's own wake event info is updated if its events were canceled.
     ///'pstrBundleID' = bundle ID to cancel events for, ex: "com.dennisbabkin.wake01", or 0 or "" to cancel all events
     ///'pstrEventType' = event type to cancel events for, or 0 or  "" to cancel for all event types.
     ///             Ex. kIOPMAutoWake, kIOPMAutoPowerOn,  or kIOPMAutoWakeOrPowerOn
@@ -192,20 +431,128 @@ struct WakeTimer
         bool bRes;
         size_t szCnt;
         
+        //Phase 1: Talk to the OS without holding '_lock'
+        UInt64 nVer;
+        bool bSet;
+        CFAbsoluteTime dtWake;
         if(true)
         {
-            //Act from within a lock
-            WRITER_LOCK wrl(_lock);
+            WRITER_LOCK wrl(_lockIPC);
+            
+            //Get the version of this request here, so that versions are in the same order as the OS calls
+            //INFO: Otherwise an older request could reach the OS after a newer one took its snapshot below.
+            nVer = ++_nVerRequested;
             
             bRes = _cancelEvents(pstrBundleID, pstrEventType, szCnt);
+            
+            //See what is left for us (it doesn't require enumeration)
+            bSet = _getWakeEventTime(&dtWake);
+            
+            assert(nVer > _nVerApplied);
+            _nVerApplied = nVer;
         }
         
+        //Phase 2: Commit
+        _commitState(nVer, bSet, dtWake);
+        
         if(pszOutCountCanceled)
             *pszOutCountCanceled = szCnt;
-        
+
+        return bRes;
+    }
+
+
+    ///Cancel (wake) event(s) for all bundle IDs that match a pattern
+    ///INFO: This timer's own wake event info is updated if its events were canceled.
+    ///'pstrPattern' = case-insensitive pattern for bundle IDs, that may contain '*' and '?' wildcards,
+    ///                ex: "com.dennisbabkin.*", or 0 or "" to cancel all events
+    ///'pstrEventType' = event type to cancel events for, or 0 or  "" to cancel for all event types.
+    ///             Ex. kIOPMAutoWake, kIOPMAutoPowerOn,  or kIOPMAutoWakeOrPowerOn
+    ///'pszOutCountCanceled' = if not 0, receives the number of events that were canceled
+    ///RETURN:
+    ///     = true if no errors
+    ///     =false if at least one error took place
+    bool cancelEventsByPattern(const char* pstrPattern,
+                               const char* pstrEventType,
+                               size_t* pszOutCountCanceled = nullptr)
+    {
+        bool bRes;
+        size_t szCnt;
+
+        //Compile it once for all bundle IDs
+        BundlePattern pattern(pstrPattern);
+
+        //Phase 1: Talk to the OS without holding '_lock'
+        UInt64 nVer;
+        bool bSet;
+        CFAbsoluteTime dtWake;
+        if(true)
+        {
+            WRITER_LOCK wrl(_lockIPC);
+
+            //Get the version of this request in the order of OS calls (see cancelEvents())
+            nVer = ++_nVerRequested;
+
+            bRes = _pEvtIndex->cancelEventsByPattern(pattern, pstrEventType, szCnt);
+
+            //See what is left for us (it doesn't require enumeration)
+            bSet = _getWakeEventTime(&dtWake);
+
+            assert(nVer > _nVerApplied);
+            _nVerApplied = nVer;
+        }
+
+        //Phase 2: Commit
+        _commitState(nVer, bSet, dtWake);
+
+        if(pszOutCountCanceled)
+            *pszOutCountCanceled = szCnt;
+
         return bRes;
     }
 
+
+
+    ///Commit a transaction of many schedule & cancel operations, with a single lock hold
+    ///and at most one enumeration of all system events
+    ///INFO: Use it to reschedule many events in one go.
+    ///      This timer's own wake event info is updated if the transaction touched its bundle ID.
+    ///'txn' = transaction to commit, use this timer's bundle ID in it to change this timer.
+    ///        Receives per-operation results.
+    ///'szMaxParallel' = max number of threads to make power-management calls on
+    ///RETURN:
+    ///     = true if all operations succeeded
+    bool commitTransaction(PwrEvtTxn& txn,
+                           size_t szMaxParallel = PWR_EVT_TXN_MAX_PARALLEL)
+    {
+        bool bRes;
+        
+        //Phase 1: Talk to the OS without holding '_lock'
+        UInt64 nVer;
+        bool bSet;
+        CFAbsoluteTime dtWake;
+        if(true)
+        {
+            WRITER_LOCK wrl(_lockIPC);
+            
+            //Get the version of this request in the order of OS calls (see cancelEvents())
+            nVer = ++_nVerRequested;
+            
+            bRes = _pEvtIndex->commitTransaction(txn, szMaxParallel);
+            
+            //Update our own state from the index (it doesn't require enumeration)
+            bSet = _getWakeEventTime(&dtWake);
+            
+            assert(nVer > _nVerApplied);
+            _nVerApplied = nVer;
+        }
+        
+        //Phase 2: Commit
+        _commitState(nVer, bSet, dtWake);
+        
+        return bRes;
+    }
+    
     
     
     
@@ -246,11 +593,20 @@ struct WakeTimer
     }
     
     
+    ///RETURN:
+    ///     = Index of scheduled power events in the OS, that is shared by all wake timers in this process
+    static PwrEvtIndex* getSystemEvtIndex()
+    {
+        return _getSystemEvtIndex();
+    }
+    
+    
     
 #define DIFF_UNIX_EPOCH_AND_MAC_TIME_SEC 978307200      //Difference in seconds between Mac time and Unix Epoch
 
     
     ///Set 'pOutDtm' from an absolute date & time (for the local time zone)
+    ///INFO: It gives the same result as mktime(), but mostly without calling it.
     ///RETURN:
     ///     = true if success
     static bool Set_CFAbsoluteTime(CFAbsoluteTime* pOutDtm,
@@ -267,28 +623,11 @@ struct WakeTimer
         
         CFAbsoluteTime dtm = 0;
         
-        struct tm t = {};
-        t.tm_year = nYear - 1900;       //years since 1900
-        t.tm_mon = nMonth - 1;          //months since January [0-11]
-        t.tm_mday = nDay;               //day of the month [1-31]
-        t.tm_hour = nHour;              //hours since midnight [0-23]
-        t.tm_min = nMinute;             //minutes after the hour [0-59]
-        t.tm_sec = nSecond;             //seconds after the minute [0-60]
-        
-        t.tm_isdst = -1;
-
         //Convert to number of seconds since midnight Jan 1, 1970
-        time_t time = mktime(&t);
-        if(time != -1)
+        int64_t time;
+        if(_getLocalTimeConv()->toUtc(nYear, nMonth, nDay, nHour, nMinute, nSecond, &time))
         {
-            //CFAbsoluteTime: Time in fractional seconds since midnight of Jan 1, 2001
-            dtm = time;
-            
-            //Adjust from Jan 1, 1970 to Jan 1, 2001
-            dtm -= DIFF_UNIX_EPOCH_AND_MAC_TIME_SEC;
-            
-            //And apply milliseconds
-            dtm += (double)nMillisecond / 1000.0;
+            dtm = _toCFAbsoluteTime(time, nMillisecond);
             
             bRes = true;
         }
@@ -298,382 +637,340 @@ struct WakeTimer
         
         return bRes;
     }
-
-
     
-private:
     
-    ///IMPORTANT: Must be called from within a lock!
-    ///'dtWhen' = date/time in UTC
-    ///'pstrEventType' = event type, eg: kIOPMAutoWake, kIOPMAutoPowerOn, or kIOPMAutoWakeOrPowerOn
-    ///'pdtOutWhen' = if not 0, receives when wake timer was set, or 0 if error
+    ///Find the next time that a recurring schedule fires at
+    ///'sched' = compiled schedule
+    ///'dtAfter' = UTC date/time to look after
+    ///'pOutDtm' = if not 0, receives UTC date/time of the first firing after 'dtAfter', or 0 if none
     ///RETURN:
-    ///     = true if success
-    bool _setWakeEvent(CFAbsoluteTime dtWhen,
-                       const char* pstrEventType,
-                       CFAbsoluteTime* pdtOutWhen = nullptr)
+    ///     = true if found
+    static bool Get_NextRecurringTime(const RecurSchedule& sched,
+                                      CFAbsoluteTime dtAfter,
+                                      CFAbsoluteTime* pOutDtm)
     {
         bool bRes = false;
         
-        CFDateRef refDtm = CFDateCreate(kCFAllocatorDefault, dtWhen);
-        if(refDtm)
-        {
-            CFStringRef refEventType = CFStringCreateWithCString(kCFAllocatorDefault,
-                                                                 pstrEventType,
-                                                                 kCFStringEncodingUTF8);
-
-            if(refEventType)
-            {
-                CFStringRef refID = CFStringCreateWithCString(kCFAllocatorDefault,
-                                                              _strTmrBundleID.c_str(),
-                                                              kCFStringEncodingUTF8);
-                
-                if(refID)
-                {
-                    //Cancel previous wake event (if it was set)
-                    size_t szCnt;
-                    if(!_cancelEvents(_strTmrBundleID.c_str(),
-                                      pstrEventType,
-                                      szCnt))
-                    {
-                        //Failed
-                        assert(false);
-                    }
-                    
-                    
-                    //Create new wake event
-                    IOReturn ioRes = IOPMSchedulePowerEvent(refDtm,
-                                                            refID,
-                                                            refEventType);
-                    
-                    if(ioRes == kIOReturnSuccess)
-                    {
-                        //Done
-                        bRes = true;
-                        
-                        _bWakeEvtSet = true;
-                    }
-                    else
-                    {
-                        //Error
-                        //eg: kIOReturnNotPrivileged = 0xE00002C1 = -536870207
-                        assert(false);
-                        
-                        //Reset parameters
-                        _dtmWake = 0;
-                        
-                        _bWakeEvtSet = false;
-                    }
-                 
-                    CFRelease(refID);
-                    refID = NULL;
-                }
-                else
-                {
-                    //Error
-                    assert(false);
-               }
-             
-                CFRelease(refEventType);
-                refEventType = NULL;
-            }
-            else
-            {
-                //Error
-                assert(false);
-            }
-
-            //Free
-            CFRelease(refDtm);
-        }
-        else
-        {
-            //Error
-            assert(false);
-        }
+        CFAbsoluteTime dtm = 0;
         
+        //Convert to number of seconds since midnight Jan 1, 1970
+        int64_t time = (int64_t)floor(dtAfter) + DIFF_UNIX_EPOCH_AND_MAC_TIME_SEC;
         
-        //Set time when we set it?
-        if(pdtOutWhen)
+        int64_t timeNext;
+        if(sched.getNextUtc(*_getLocalTimeConv(), time, &timeNext))
         {
-            //Retrieve when the wake timer was set from the OS itself
-            if(!_getWakeEventTime(pdtOutWhen))
-            {
-                //Error
-                assert(false);
-            }
+            dtm = _toCFAbsoluteTime(timeNext, 0);
+            
+            bRes = true;
         }
         
+        if(pOutDtm)
+            *pOutDtm = dtm;
+        
         return bRes;
     }
     
     
+    ///Set 'pOutDtms' from an array of absolute dates & times (for the local time zone)
+    ///INFO: It is faster than calling Set_CFAbsoluteTime() for each element.
+    ///'pArr' = local dates & times to convert
+    ///'szCnt' = number of elements in 'pArr'
+    ///'pOutDtms' = receives 'szCnt' elements, or 0 for the ones that could not be converted
+    ///RETURN:
+    ///     = Number of elements that were converted successfully
+    static size_t Set_CFAbsoluteTimes(const CIVIL_TIME* pArr,
+                                      size_t szCnt,
+                                      CFAbsoluteTime* pOutDtms)
+    {
+        std::vector<int64_t> arrTimes(szCnt);
+        
+        size_t szcOK = _getLocalTimeConv()->toUtcBatch(pArr, szCnt, arrTimes.data());
+        
+        for(size_t i = 0; i < szCnt; i++)
+        {
+            pOutDtms[i] = arrTimes[i] != -1 ? _toCFAbsoluteTime(arrTimes[i], pArr[i].nMillisecond) : 0;
+        }
+        
+        return szcOK;
+    }
+
+
     
+private:
     
-    ///IMPORTANT: Must be called from within a lock!
-    ///'pstrBundleID' = bundle ID to cancel events for, ex: "com.dennisbabkin.wake01", or 0 or "" to cancel all events
-    ///'pstrEventType' = event type to cancel events for, or 0 or  "" to cancel for all event types.
-    ///             Ex. kIOPMAutoWake, kIOPMAutoPowerOn,  or kIOPMAutoWakeOrPowerOn
-    ///'szCntCanceled' = receives the number of events that were canceled
+    ///Set wake event in three phases, so that '_lock' is not held while talking to the OS:
+    ///  1. Decide what to do from within '_lock'
+    ///  2. Make power-management calls from within '_lockIPC' only
+    ///  3. Commit the result from within '_lock', unless a newer request was committed already,
+    ///     and then write it into the store outside of '_lock'
+    ///'dtWhen' = date/time in UTC
+    ///'pstrEventType' = event type, eg: kIOPMAutoWake, kIOPMAutoPowerOn, or kIOPMAutoWakeOrPowerOn
+    ///'pdtOutWhen' = if not 0, receives when wake timer was set, or 0 if error
     ///RETURN:
-    ///     = true if no errors
-    ///     =false if at least one error took place
-    bool _cancelEvents(const char* pstrBundleID,
-                       const char* pstrEventType,
-                       size_t& szCntCanceled)
+    ///     = true if success
+    bool _setWakeEventTwoPhase(CFAbsoluteTime dtWhen,
+                               const char* pstrEventType,
+                               CFAbsoluteTime* pdtOutWhen)
     {
-        bool bResult = true;
+        bool bRes = false;
+        CFAbsoluteTime dtSet = 0;
         
-        szCntCanceled = 0;
+        //Phase 1
+        UInt64 nVer;
+        bool bSameAsSet;
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+            
+            //Did we set it for this time already? (It still has to be checked with the OS, since
+            //the event is removed from it after it fires, or it could've been canceled by another process)
+            bSameAsSet = _bWakeEvtSet &&
+                         _dtmWake == dtWhen &&
+                         _nVerCommitted == _nVerRequested &&
+                         dtWhen > CFAbsoluteTimeGetCurrent();
+            
+            nVer = ++_nVerRequested;
+        }
         
-        CFStringRef refID = NULL;
-        if(pstrBundleID &&
-           pstrBundleID[0])
+        //Phase 2
+        bool bApplied = false;
+        if(true)
         {
-            refID = CFStringCreateWithCString(kCFAllocatorDefault,
-                                              pstrBundleID,
-                                              kCFStringEncodingUTF8);
-            if(!refID)
+            WRITER_LOCK wrl(_lockIPC);
+            
+            //Skip it if a newer request already reached the OS
+            if(nVer > _nVerApplied)
             {
-                //Error
-                assert(false);
-                bResult = false;
+                //Is the OS still set as we left it?
+                //INFO: A lookup costs one enumeration of OS events, instead of a cancellation and a schedule too.
+                if(bSameAsSet &&
+                   _nVerApplied + 1 == nVer &&
+                   _getWakeEventTime(&dtSet) &&
+                   dtSet == dtWhen)
+                {
+                    //Nothing to do
+                    bRes = true;
+                }
+                else
+                {
+                    bRes = _setWakeEvent(dtWhen,
+                                         pstrEventType,
+                                         &dtSet);
+                }
+                
+                _nVerApplied = nVer;
+                bApplied = true;
             }
         }
         
-        CFStringRef refEvtType = NULL;
-        if(pstrEventType &&
-           pstrEventType[0])
+        //Phase 3
+        if(bApplied)
         {
-            refEvtType = CFStringCreateWithCString(kCFAllocatorDefault,
-                                                   pstrEventType,
-                                                   kCFStringEncodingUTF8);
-            if(!refEvtType)
-            {
-                //Error
-                assert(false);
-                bResult = false;
-            }
+            _commitState(nVer, bRes, bRes ? dtWhen : 0);
         }
         
-        CFArrayRef refArr = NULL;
+        if(pdtOutWhen)
+            *pdtOutWhen = bRes ? dtSet : 0;
         
+        return bRes;
+    }
+    
+    
+    ///Commit the state of this timer after talking to the OS
+    ///'nVer' = version of the request that this state is for - it is ignored if a newer version was committed
+    ///'bSet' = true if wake event is set
+    ///'dtWake' = UTC date/time of the wake event, if 'bSet' is true
+    void _commitState(UInt64 nVer,
+                      bool bSet,
+                      CFAbsoluteTime dtWake)
+    {
+        bool bCommitted = false;
         
-        struct REM_EVT_INFO
+        if(true)
         {
-            CFDateRef refDate;
-            CFStringRef refID;
-            CFStringRef refType;
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
             
-            void clearIt()
+            if(nVer > _nVerCommitted)
             {
-                refDate = NULL;
-                refID = NULL;
-                refType = NULL;
+                _nVerCommitted = nVer;
+                
+                _bWakeEvtSet = bSet;
+                _dtmWake = bSet ? dtWake : 0;
+                
+                bCommitted = true;
             }
-        };
+        }
         
+        if(bCommitted)
+        {
+            //Keep the store in sync with our state (it flushes to disk, so don't block readers of '_lock')
+            _flushStore();
+        }
+    }
+    
+    
+    ///IMPORTANT: Must be called without holding '_lock' or '_lockIPC'!
+    ///Write the latest committed state of this timer into '_pStore', if it's used
+    ///INFO: The state is read from within '_lockStore', thus if two threads flush at the same time,
+    ///      an older state can never overwrite a newer one.
+    void _flushStore()
+    {
+        if(!_pStore)
+            return;
         
-        CFTypeRef resVal;
-        REM_EVT_INFO rei;
+        WRITER_LOCK wrlStore(_lockStore);
         
-        std::vector<REM_EVT_INFO> arrRem;
+        UInt64 nVer;
+        bool bSet;
+        CFAbsoluteTime dtWake;
         
+        if(true)
+        {
+            //Act from within a lock
+            READER_LOCK rdl(_lock);
+            
+            nVer = _nVerCommitted;
+            bSet = _bWakeEvtSet;
+            dtWake = _dtmWake;
+        }
         
-        if(bResult)
+        if(nVer > _nVerStored)
         {
-            //Enumerate all wake events in the system
-            refArr = IOPMCopyScheduledPowerEvents();
-            if(refArr)
+            TIMER_REC rec;
+            bool bRes = bSet ? TimerStore::makeRecord(rec, _pstrTmrBundleID, 0, dtWake, dtWake) &&
+                               _pStore->put(rec) :
+                               _pStore->remove(_pstrTmrBundleID, 0);
+            if(!bRes)
             {
-                CFIndex nCnt = CFArrayGetCount(refArr);
-                
-                for(CFIndex i = 0; i < nCnt; i++)
-                {
-                    CFDictionaryRef refDic = (CFDictionaryRef)CFArrayGetValueAtIndex(refArr, i);
-                    if(refDic)
-                    {
-                        CFTypeID type = CFGetTypeID(refDic);
-                        if(type == CFDictionaryGetTypeID())
-                        {
-                            //See if we need to remove this entry
-                            rei.clearIt();
-                            
-                            //Get the ID
-                            if(CFDictionaryGetValueIfPresent(refDic,
-                                                             CFSTR(kIOPMPowerEventAppNameKey),
-                                                             &resVal))
-                            {
-                                type = CFGetTypeID(resVal);
-                                if(type == CFStringGetTypeID())
-                                {
-                                    //See if it's our ID
-                                    if(refID == NULL ||
-                                       CFStringCompare(refID,
-                                                       (CFStringRef)resVal,
-                                                       kCFCompareCaseInsensitive) == kCFCompareEqualTo)
-                                    {
-                                        //Remove it
-                                        rei.refID = (CFStringRef)resVal;
-                                    }
-                                }
-                                else
-                                {
-                                    //Bad type
-                                    assert(false);
-                                    bResult = false;
-                                }
-                            }
-                            else
-                            {
-                                //No such key
-                                assert(false);
-                                bResult = false;
-                            }
-                            
-                            
-                            if(rei.refID)
-                            {
-                                //See if we need to match the type
-                                
-                                //Get the event type
-                                if(CFDictionaryGetValueIfPresent(refDic,
-                                                                 CFSTR(kIOPMPowerEventTypeKey),
-                                                                 &resVal))
-                                {
-                                    type = CFGetTypeID(resVal);
-                                    if(type == CFStringGetTypeID())
-                                    {
-                                        //See if it's our ID
-                                        if(refEvtType == NULL ||
-                                           CFStringCompare(refEvtType,
-                                                           (CFStringRef)resVal,
-                                                           0) == kCFCompareEqualTo)
-                                        {
-                                            //Remove it
-                                            rei.refType = (CFStringRef)resVal;
-                                        }
-                                    }
-                                    else
-                                    {
-                                        //Bad type
-                                        assert(false);
-                                        bResult = false;
-                                    }
-                                }
-                                else
-                                {
-                                    //Error
-                                    assert(false);
-                                    bResult = false;
-                                }
-                                
-                                
-                                if(rei.refType)
-                                {
-                                    //Get the date from this event
-                                    if(CFDictionaryGetValueIfPresent(refDic,
-                                                                     CFSTR(kIOPMPowerEventTimeKey),
-                                                                     &resVal))
-                                    {
-                                        type = CFGetTypeID(resVal);
-                                        if(type == CFDateGetTypeID())
-                                        {
-                                            rei.refDate = (CFDateRef)resVal;
-                                            
-                                            //Add it to our list (we'll delete it later)
-                                            arrRem.push_back(rei);
-                                        }
-                                        else
-                                        {
-                                            //Bad type
-                                            assert(false);
-                                            bResult = false;
-                                        }
-                                    }
-                                    else
-                                    {
-                                        //Error
-                                        assert(false);
-                                        bResult = false;
-                                    }
-                                }
-                            }
-                        }
-                        else
-                        {
-                            //Error
-                            assert(false);
-                            bResult = false;
-                        }
-                    }
-                    else
-                    {
-                        //Error
-                        assert(false);
-                        bResult = false;
-                    }
-                }
-            }
-            else
-            {
-                //There are no scheduled events
+                //Failed
+                assert(false);
             }
             
+            _nVerStored = nVer;
+        }
+    }
+    
+    
+    ///Reconcile the state that was restored from the store with the OS
+    ///INFO: It is called on a background thread, since it may need to enumerate all power events.
+    void _reconcile()
+    {
+        //Phase 1: Get the version of this request
+        UInt64 nVer;
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+            
+            nVer = ++_nVerRequested;
+        }
+        
+        //Phase 2: Talk to the OS without holding '_lock'
+        bool bSet;
+        CFAbsoluteTime dtWake;
+        bool bApplied = false;
+        if(true)
+        {
+            WRITER_LOCK wrl(_lockIPC);
             
-            size_t szCntRem = arrRem.size();
-            if(szCntRem > 0)
+            //Skip it if a newer request already reached the OS
+            if(nVer > _nVerApplied)
             {
-                const REM_EVT_INFO* pREI = arrRem.data();
-                for(size_t i = 0; i < szCntRem; i++, pREI++)
-                {
-                    assert(pREI->refID);
-                    assert(pREI->refDate);
-                    assert(pREI->refType);
-                    
-                    IOReturn ioRes = IOPMCancelScheduledPowerEvent(pREI->refDate,
-                                                                   pREI->refID,
-                                                                   pREI->refType);
-                    
-                    if(ioRes == kIOReturnSuccess)
-                    {
-                        //Done
-                        szCntCanceled++;
-                    }
-                    else
-                    {
-                        //Failed - don't report some errors
-                        if(ioRes != kIOReturnNotFound)      //This may happen because of a delay of us finding it and then canceling it later
-                        {
-                            assert(false);
-                            bResult = false;
-                        }
-                    }
-                }
+                bSet = _getWakeEventTime(&dtWake);
                 
+                _nVerApplied = nVer;
+                bApplied = true;
             }
         }
         
-        //Free mem
-        if(refID)
+        //Phase 3: Commit
+        if(bApplied)
         {
-            CFRelease(refID);
-            refID = nullptr;
+            _commitState(nVer, bSet, bSet ? dtWake : 0);
         }
+    }
+    
+    
+    ///IMPORTANT: Must be called from within '_lockIPC'!
+    ///INFO: It does not change the state of this struct - use _commitState() for that.
+    ///'dtWhen' = date/time in UTC
+    ///'pstrEventType' = event type, eg: kIOPMAutoWake, kIOPMAutoPowerOn, or kIOPMAutoWakeOrPowerOn
+    ///'pdtOutWhen' = if not 0, receives when wake timer was set, or 0 if error
+    ///RETURN:
+    ///     = true if success
+    bool _setWakeEvent(CFAbsoluteTime dtWhen,
+                       const char* pstrEventType,
+                       CFAbsoluteTime* pdtOutWhen = nullptr)
+    {
+        bool bRes = false;
         
-        if(refEvtType)
+        //Cancel previous wake event (if it was set)
+        size_t szCnt;
+        if(!_cancelEvents(_pstrTmrBundleID,
+                          pstrEventType,
+                          szCnt))
         {
-            CFRelease(refEvtType);
-            refEvtType = nullptr;
+            //Failed
+            assert(false);
         }
         
-        if(refArr)
+        
+        //Create new wake event
+        int nOSErr;
+        if(_pEvtIndex->scheduleEvent(_pstrTmrBundleID,
+                                     pstrEventType,
+                                     dtWhen,
+                                     &nOSErr))
         {
-            CFRelease(refArr);
-            refArr = nullptr;
+            //Done
+            bRes = true;
+        }
+        else
+        {
+            //Error
+            //eg: kIOReturnNotPrivileged = 0xE00002C1 = -536870207
+            assert(false);
         }
         
-        return bResult;
+        
+        //Set time when we set it?
+        if(pdtOutWhen)
+        {
+            *pdtOutWhen = 0;
+            
+            //Retrieve when the wake timer was set from our index of OS events
+            if(bRes &&
+               !_getWakeEventTime(pdtOutWhen))
+            {
+                //Error
+                assert(false);
+            }
+        }
+        
+        return bRes;
+    }
+    
+    
+    
+    
+    ///IMPORTANT: Must be called from within '_lockIPC'!
+    ///'pstrBundleID' = bundle ID to cancel events for, ex: "com.dennisbabkin.wake01", or 0 or "" to cancel all events
+    ///'pstrEventType' = event type to cancel events for, or 0 or  "" to cancel for all event types.
+    ///             Ex. kIOPMAutoWake, kIOPMAutoPowerOn,  or kIOPMAutoWakeOrPowerOn
+    ///'szCntCanceled' = receives the number of events that were canceled
+    ///RETURN:
+    ///     = true if no errors
+    ///     =false if at least one error took place
+    bool _cancelEvents(const char* pstrBundleID,
+                       const char* pstrEventType,
+                       size_t& szCntCanceled)
+    {
+        //INFO: The index enumerates system events once, and then finds ours by a range lookup
+        return _pEvtIndex->cancelEvents(pstrBundleID,
+                                        pstrEventType,
+                                        szCntCanceled);
     }
     
     
@@ -683,95 +980,47 @@ private:
     ///     = true if retrieved OK
     bool _getWakeEventTime(CFAbsoluteTime* pdtOut)
     {
-        bool bRes = false;
-
-        CFAbsoluteTime dtWake = 0;
+        return _pEvtIndex->findEvent(_pstrTmrBundleID,
+                                     WAKE_TIMER_EVENT_TYPE,
+                                     pdtOut);
+    }
+    
+    
+    ///RETURN:
+    ///     = CFAbsoluteTime for 'time' in seconds since midnight Jan 1, 1970 and 'nMillisecond'
+    static CFAbsoluteTime _toCFAbsoluteTime(int64_t time,
+                                            int nMillisecond)
+    {
+        //CFAbsoluteTime: Time in fractional seconds since midnight of Jan 1, 2001
+        CFAbsoluteTime dtm = (CFAbsoluteTime)time;
         
-        CFStringRef refID = CFStringCreateWithCString(kCFAllocatorDefault,
-                                                      _strTmrBundleID.c_str(),
-                                                      kCFStringEncodingUTF8);
-        if(refID)
-        {
-            CFTypeRef resVal;
-            
-            //Enumerate all global wake events
-            CFArrayRef refArr = IOPMCopyScheduledPowerEvents();
-            if(refArr)
-            {
-                CFIndex nCnt = CFArrayGetCount(refArr);
-                
-                for(CFIndex i = 0; i < nCnt; i++)
-                {
-                    CFDictionaryRef refDic = (CFDictionaryRef)CFArrayGetValueAtIndex(refArr, i);
-                    if(refDic &&
-                       CFGetTypeID(refDic) == CFDictionaryGetTypeID())
-                    {
-                        //Find our bundle ID
-                        if(CFDictionaryGetValueIfPresent(refDic,
-                                                         CFSTR(kIOPMPowerEventAppNameKey),
-                                                         &resVal) &&
-                           CFGetTypeID(resVal) == CFStringGetTypeID() &&
-                           CFStringCompare(refID,
-                                           (CFStringRef)resVal,
-                                           kCFCompareCaseInsensitive) == kCFCompareEqualTo)
-                        {
-                            //See if this is the right event type
-                            if(CFDictionaryGetValueIfPresent(refDic,
-                                                             CFSTR(kIOPMPowerEventTypeKey),
-                                                             &resVal) &&
-                               CFGetTypeID(resVal) == CFStringGetTypeID() &&
-                               CFStringCompare(CFSTR(WAKE_TIMER_EVENT_TYPE),
-                                               (CFStringRef)resVal,
-                                               0) == kCFCompareEqualTo)
-                            {
-                                //Get date/time
-                                if(CFDictionaryGetValueIfPresent(refDic,
-                                                                 CFSTR(kIOPMPowerEventTimeKey),
-                                                                 &resVal) &&
-                                   CFGetTypeID(resVal) == CFDateGetTypeID())
-                                {
-                                    //Got it
-                                    dtWake = CFDateGetAbsoluteTime((CFDateRef)resVal);
-                                    
-                                    bRes = true;
-                                }
-                                else
-                                {
-                                    assert(false);
-                                }
-                             
-                                break;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        assert(false);
-                    }
-                }
-                
-                //Free mem
-                CFRelease(refArr);
-            }
-            else
-            {
-                assert(false);
-            }
-            
-         
-            //Free
-            CFRelease(refID);
-            refID = NULL;
-        }
-        else
-        {
-            assert(false);
-        }
+        //Adjust from Jan 1, 1970 to Jan 1, 2001
+        dtm -= DIFF_UNIX_EPOCH_AND_MAC_TIME_SEC;
         
-        if(pdtOut)
-            *pdtOut = dtWake;
+        //And apply milliseconds
+        dtm += (double)nMillisecond / 1000.0;
         
-        return bRes;
+        return dtm;
+    }
+    
+    
+    ///RETURN:
+    ///     = Converter of local time to UTC, that is shared with date/time formatting in this process
+    static LocalTimeConv* _getLocalTimeConv()
+    {
+        //INFO: It's invalidated when the time zone changes
+        return DateFormatterCache::getLocalTimeConv();
+    }
+    
+    
+    ///RETURN:
+    ///     = Index of scheduled power events in the OS, that is shared by all instances of this struct
+    static PwrEvtIndex* _getSystemEvtIndex()
+    {
+        static PwrEvtSource_IOPM s_src;
+        static PwrEvtIndex s_idx(&s_src);
+        
+        return &s_idx;
     }
     
 
@@ -783,12 +1032,27 @@ private:
 private:
     
     RDR_WRTR _lock;                     //Lock for accessing this struct
+    RDR_WRTR _lockIPC;                  //Lock that serializes power-management calls for this struct (always used as a writer)
+                                        //IMPORTANT: Never acquire '_lock' while holding this lock!
+    RDR_WRTR _lockStore;                //Lock that serializes writes to '_pStore' (always used as a writer)
+                                        //IMPORTANT: Never hold '_lock' or '_lockIPC' while acquiring this lock!
 
-    std::string _strTmrBundleID;        //Bundle ID for this timer
+    NAME_ID _nTmrBundleID = NAME_ID_NONE;   //Bundle ID for this timer, interned in NameTable (it doesn't change after construction, so it's read without a lock)
+    const char* _pstrTmrBundleID = "";      //Text of '_nTmrBundleID' (it's never freed)
+    
+    PwrEvtIndex* _pEvtIndex;            //Index of scheduled power events
+    
+    TimerStore* _pStore;                //Persistent store for the state of this timer, or null if not used
+    std::thread _thrReconcile;          //Thread that reconciles the state from '_pStore' with the OS
     
     bool _bWakeEvtSet = false;          //true if we set the wake event
     
     CFAbsoluteTime _dtmWake = 0;        //UTC date/time when wake event was scheduled
+    
+    std::atomic<UInt64> _nVerRequested{0};  //Version of the last request to change this timer (incremented within '_lock' or '_lockIPC')
+    UInt64 _nVerCommitted = 0;          //Version of the request that '_bWakeEvtSet' and '_dtmWake' reflect (accessed within '_lock')
+    UInt64 _nVerApplied = 0;            //Version of the last request that reached the OS (accessed within '_lockIPC')
+    UInt64 _nVerStored = 0;             //Version of the state that was written into '_pStore' (accessed within '_lockStore')
 };
 
 
@@ -0,0 +1,449 @@
+//
+//  wake_timer_async.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of how to set wake timers asynchronously from a single background worker
+//
+
+
+#ifndef wake_timer_async_h
+#define wake_timer_async_h
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <memory>
+
+#include "wake_timer.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+
+
+
+
+enum WAKE_ASYNC_RES
+{
+    WAR_OK,                         //Request was completed successfully
+    WAR_FAILED,                     //Request failed
+    WAR_SUPERSEDED,                 //Request never reached the OS because a newer request for the same timer replaced it
+    WAR_ABORTED,                    //Request was not processed because the worker was stopped
+};
+
+
+struct WAKE_ASYNC_RESULT
+{
+    WAKE_ASYNC_RES res = WAR_ABORTED;
+    CFAbsoluteTime dtWhen = 0;      //UTC date/time when the wake event was set for, or 0 if it wasn't set
+};
+
+
+
+
+struct WakeTimerAsync
+{
+    WakeTimerAsync()
+    {
+    }
+
+    ~WakeTimerAsync()
+    {
+        //Process what's left and stop the worker
+        stop(true);
+    }
+
+
+    ///Callback that is invoked when an asynchronous request completes
+    ///INFO: It is called from the worker thread.
+    ///'result' = result of the request
+    ///'pParam1' = passed from the *Async() function
+    ///'pParam2' = passed from the *Async() function
+    typedef void (*PFN_WAKE_ASYNC_CALLBACK)(const WAKE_ASYNC_RESULT& result,
+                                            const void* pParam1,
+                                            const void* pParam2);
+
+
+    ///Set wake event for 'tmr' as the relative time from the current moment, without blocking
+    ///INFO: The time is calculated when this function is called, not when the request is processed.
+    ///'tmr' = wake timer to set - must remain valid until the request completes
+    ///'msFromNow' = number of ms from "now" to wake the system
+    ///RETURN:
+    ///     = Future that receives the result of this request
+    std::future<WAKE_ASYNC_RESULT> setWakeEventRelativeAsync(WakeTimer& tmr,
+                                                             UInt32 msFromNow)
+    {
+        CFAbsoluteTime dtWhen = CFAbsoluteTimeGetCurrent() + ((CFTimeInterval)msFromNow) / 1000.0;
+
+        return setWakeEventAbsoluteAsync(tmr, dtWhen);
+    }
+
+    ///Set wake event for 'tmr' as the absolute time, without blocking
+    ///'tmr' = wake timer to set - must remain valid until the request completes
+    ///'dtWake' = UTC date/time when to set this wake event
+    ///RETURN:
+    ///     = Future that receives the result of this request
+    std::future<WAKE_ASYNC_RESULT> setWakeEventAbsoluteAsync(WakeTimer& tmr,
+                                                             CFAbsoluteTime dtWake)
+    {
+        COMPLETION cmpl;
+        cmpl.pPromise = std::make_shared<std::promise<WAKE_ASYNC_RESULT>>();
+
+        std::future<WAKE_ASYNC_RESULT> ftr = cmpl.pPromise->get_future();
+
+        _submit(tmr, true, dtWake, cmpl);
+
+        return ftr;
+    }
+
+    ///Set wake event for 'tmr' as the absolute time, without blocking
+    ///'tmr' = wake timer to set - must remain valid until the request completes
+    ///'dtWake' = UTC date/time when to set this wake event
+    ///'pfn' = callback to invoke when the request completes, or 0 not to call it
+    ///'pParam1' = passed directly into 'pfn' when it's called
+    ///'pParam2' = passed directly into 'pfn' when it's called
+    void setWakeEventAbsoluteAsync(WakeTimer& tmr,
+                                   CFAbsoluteTime dtWake,
+                                   PFN_WAKE_ASYNC_CALLBACK pfn,
+                                   const void* pParam1 = nullptr,
+                                   const void* pParam2 = nullptr)
+    {
+        COMPLETION cmpl;
+        cmpl.pfnCallback = pfn;
+        cmpl.pParam1 = pParam1;
+        cmpl.pParam2 = pParam2;
+
+        _submit(tmr, true, dtWake, cmpl);
+    }
+
+    ///Stop wake event for 'tmr', without blocking
+    ///'tmr' = wake timer to stop - must remain valid until the request completes
+    ///RETURN:
+    ///     = Future that receives the result of this request
+    std::future<WAKE_ASYNC_RESULT> stopWakeEventAsync(WakeTimer& tmr)
+    {
+        COMPLETION cmpl;
+        cmpl.pPromise = std::make_shared<std::promise<WAKE_ASYNC_RESULT>>();
+
+        std::future<WAKE_ASYNC_RESULT> ftr = cmpl.pPromise->get_future();
+
+        _submit(tmr, false, 0, cmpl);
+
+        return ftr;
+    }
+
+    ///Stop wake event for 'tmr', without blocking
+    ///'tmr' = wake timer to stop - must remain valid until the request completes
+    ///'pfn' = callback to invoke when the request completes, or 0 not to call it
+    ///'pParam1' = passed directly into 'pfn' when it's called
+    ///'pParam2' = passed directly into 'pfn' when it's called
+    void stopWakeEventAsync(WakeTimer& tmr,
+                            PFN_WAKE_ASYNC_CALLBACK pfn,
+                            const void* pParam1 = nullptr,
+                            const void* pParam2 = nullptr)
+    {
+        COMPLETION cmpl;
+        cmpl.pfnCallback = pfn;
+        cmpl.pParam1 = pParam1;
+        cmpl.pParam2 = pParam2;
+
+        _submit(tmr, false, 0, cmpl);
+    }
+
+
+    ///Wait until all requests that were submitted so far are processed
+    void flush()
+    {
+        std::unique_lock<std::mutex> lck(_mtx);
+
+        _cvIdle.wait(lck, [this]()
+        {
+            return _dqOrder.empty() && !_bBusy;
+        });
+    }
+
+
+    ///Stop the worker thread
+    ///INFO: New requests will restart it. Requests that are submitted while it is stopping are completed with WAR_ABORTED.
+    ///IMPORTANT: Don't call it from a completion callback!
+    ///'bProcessPending' = true to process pending requests first, false to abort them with WAR_ABORTED
+    void stop(bool bProcessPending)
+    {
+        std::vector<COMPLETION> arrAborted;
+        std::thread thread;
+
+        if(true)
+        {
+            std::unique_lock<std::mutex> lck(_mtx);
+
+            //Wait if another thread is stopping it
+            _cvIdle.wait(lck, [this]()
+            {
+                return !_bStop;
+            });
+
+            if(!bProcessPending)
+            {
+                for(auto& kv : _mapPending)
+                {
+                    for(COMPLETION& c : kv.second.arrCompletions)
+                    {
+                        arrAborted.push_back(std::move(c));
+                    }
+                }
+
+                _mapPending.clear();
+                _dqOrder.clear();
+            }
+
+            _bStop = true;
+
+            //Join it outside of the lock
+            thread = std::move(_thread);
+        }
+
+        _cv.notify_all();
+
+        if(thread.joinable())
+        {
+            assert(thread.get_id() != std::this_thread::get_id());
+            thread.join();
+        }
+
+        if(true)
+        {
+            std::unique_lock<std::mutex> lck(_mtx);
+            _bStop = false;
+        }
+
+        _cvIdle.notify_all();
+
+        WAKE_ASYNC_RESULT result;
+        result.res = WAR_ABORTED;
+
+        for(COMPLETION& c : arrAborted)
+        {
+            _complete(c, result);
+        }
+    }
+
+
+    ///Get statistics of this worker
+    ///'pszOutSubmitted' = if not 0, receives the number of requests that were submitted
+    ///'pszOutSuperseded' = if not 0, receives the number of requests that were merged into newer ones
+    ///RETURN:
+    ///     = Number of requests that were sent to the OS
+    size_t getStats(size_t* pszOutSubmitted = nullptr,
+                    size_t* pszOutSuperseded = nullptr)
+    {
+        std::unique_lock<std::mutex> lck(_mtx);
+
+        if(pszOutSubmitted)
+            *pszOutSubmitted = _szcSubmitted;
+        if(pszOutSuperseded)
+            *pszOutSuperseded = _szcSuperseded;
+
+        return _szcExecuted;
+    }
+
+
+
+private:
+
+    struct COMPLETION
+    {
+        std::shared_ptr<std::promise<WAKE_ASYNC_RESULT>> pPromise;     //Used if not null
+
+        PFN_WAKE_ASYNC_CALLBACK pfnCallback = nullptr;                  //Used if not null
+        const void* pParam1 = nullptr;
+        const void* pParam2 = nullptr;
+    };
+
+    struct REQUEST
+    {
+        bool bSet = false;                          //true to set wake event, false to stop it
+        CFAbsoluteTime dtWhen = 0;                  //UTC date/time when to set it
+
+        std::vector<COMPLETION> arrCompletions;     //Last one is for this request, others are for the ones it superseded
+    };
+
+
+    void _submit(WakeTimer& tmr,
+                 bool bSet,
+                 CFAbsoluteTime dtWhen,
+                 COMPLETION& cmpl)
+    {
+        if(true)
+        {
+            std::unique_lock<std::mutex> lck(_mtx);
+
+            _szcSubmitted++;
+
+            if(_bStop)
+            {
+                //Stopping - the worker may be gone already, and it can't be restarted until stop() returns
+                lck.unlock();
+
+                WAKE_ASYNC_RESULT result;
+                result.res = WAR_ABORTED;
+
+                _complete(cmpl, result);
+                return;
+            }
+
+            auto it = _mapPending.find(&tmr);
+            if(it != _mapPending.end())
+            {
+                //Replace the request that didn't reach the OS yet
+                _szcSuperseded++;
+            }
+            else
+            {
+                //New request - keep the order of timers
+                it = _mapPending.emplace(&tmr, REQUEST()).first;
+                _dqOrder.push_back(&tmr);
+            }
+
+            it->second.bSet = bSet;
+            it->second.dtWhen = dtWhen;
+            it->second.arrCompletions.push_back(std::move(cmpl));
+
+            if(!_thread.joinable())
+            {
+                //Start the worker
+                _thread = std::thread(&WakeTimerAsync::_worker, this);
+            }
+        }
+
+        _cv.notify_one();
+    }
+
+
+    void _worker()
+    {
+        std::unique_lock<std::mutex> lck(_mtx);
+
+        for(;;)
+        {
+            _cv.wait(lck, [this]()
+            {
+                return _bStop || !_dqOrder.empty();
+            });
+
+            if(_dqOrder.empty())
+            {
+                //Must be a stop
+                break;
+            }
+
+            WakeTimer* pTmr = _dqOrder.front();
+            _dqOrder.pop_front();
+
+            auto it = _mapPending.find(pTmr);
+            assert(it != _mapPending.end());
+
+            REQUEST req = std::move(it->second);
+            _mapPending.erase(it);
+
+            _szcExecuted++;
+            _bBusy = true;
+
+            //Talk to the OS without our lock
+            lck.unlock();
+
+            WAKE_ASYNC_RESULT result;
+            bool bRes;
+
+            if(req.bSet)
+            {
+                bRes = pTmr->setWakeEventAbsolute(req.dtWhen, &result.dtWhen);
+            }
+            else
+            {
+                bRes = pTmr->stopWakeEvent();
+            }
+
+            result.res = bRes ? WAR_OK : WAR_FAILED;
+
+            //Complete all requests that were merged into this one
+            size_t szcCmpl = req.arrCompletions.size();
+            assert(szcCmpl > 0);
+
+            WAKE_ASYNC_RESULT resSuperseded;
+            resSuperseded.res = WAR_SUPERSEDED;
+
+            for(size_t i = 0; i < szcCmpl; i++)
+            {
+                _complete(req.arrCompletions[i],
+                          i + 1 == szcCmpl ? result : resSuperseded);
+            }
+
+            lck.lock();
+
+            _bBusy = false;
+
+            if(_dqOrder.empty())
+            {
+                _cvIdle.notify_all();
+            }
+        }
+
+        _cvIdle.notify_all();
+    }
+
+
+    static void _complete(COMPLETION& cmpl,
+                          const WAKE_ASYNC_RESULT& result)
+    {
+        if(cmpl.pPromise)
+        {
+            cmpl.pPromise->set_value(result);
+        }
+
+        if(cmpl.pfnCallback)
+        {
+            cmpl.pfnCallback(result, cmpl.pParam1, cmpl.pParam2);
+        }
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    WakeTimerAsync(const WakeTimerAsync& s) = delete;
+    WakeTimerAsync& operator = (const WakeTimerAsync& s) = delete;
+
+private:
+
+    std::mutex _mtx;                                        //Lock for accessing this struct
+    std::condition_variable _cv;                            //Signaled when there's new work, or when we need to stop
+    std::condition_variable _cvIdle;                        //Signaled when the worker has nothing to do
+
+    std::thread _thread;                                    //The only thread that makes OS calls for us (accessed within '_mtx')
+    bool _bStop = false;                                    //true while stop() is stopping '_thread' - new requests are aborted
+    bool _bBusy = false;                                    //true while '_thread' is processing a request
+
+    std::deque<WakeTimer*> _dqOrder;                        //Timers with pending requests, in the order they were submitted
+    std::unordered_map<WakeTimer*, REQUEST> _mapPending;    //Latest pending request for each timer
+
+    size_t _szcSubmitted = 0;                               //Number of requests that were submitted
+    size_t _szcSuperseded = 0;                              //Number of requests that were replaced by newer ones
+    size_t _szcExecuted = 0;                                //Number of requests that were sent to the OS
+};
+
+
+
+
+#endif /* wake_timer_async_h */
@@ -0,0 +1,476 @@
+//
+//  wake_timer_debounce.h
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Demonstration of how to avoid excessive power-management calls when a wake timer is rescheduled often
+//
+
+
+#ifndef wake_timer_debounce_h
+#define wake_timer_debounce_h
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <atomic>
+#include <algorithm>
+
+#include "types.h"
+#include "rdr_wrtr.h"           //Reader/writer lock classes from "macOS tips - part 1"
+#include "wake_timer.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+
+
+
+
+#define WAKE_DEBOUNCE_DEFAULT_MS 2000           //Default number of ms that the wake time must remain the same before it's set in the OS
+#define WAKE_DEBOUNCE_MAX_LATENCY_MS 10000      //Default max number of ms that a requested wake time may wait before it's set in the OS
+                                                //INFO: So that a wake time that keeps changing is still set in time.
+#define WAKE_DEBOUNCE_RETRY_SEC 5.0             //Number of seconds after a failure to set the OS wake event, when it's tried again
+
+#define WAKE_DEBOUNCE_RUNLOOP_INTERVAL 1.0e8    //Repeat interval for the run-loop timer, in sec
+                                                //INFO: We always move its fire date ourselves. It is repeating only
+                                                //      so that it's not invalidated by the run-loop after it fires.
+
+
+
+struct WakeTimerDebounced
+{
+    ///'wakeTimer' = wake timer that this struct will set in the OS
+    ///             IMPORTANT: Do not set or stop 'wakeTimer' directly while this struct is in use!
+    ///'msDebounce' = number of ms that the wake time must remain the same before it's set in the OS
+    ///'msMaxLatency' = max number of ms since the first change that was not set in the OS yet, before it's set
+    ///                 there anyway (even if the wake time keeps changing)
+    WakeTimerDebounced(WakeTimer& wakeTimer,
+                       UInt32 msDebounce = WAKE_DEBOUNCE_DEFAULT_MS,
+                       UInt32 msMaxLatency = WAKE_DEBOUNCE_MAX_LATENCY_MS)
+        : _wakeTimer(wakeTimer)
+        , _fDebounceSec(((CFTimeInterval)msDebounce) / 1000.0)
+        , _fMaxLatencySec(((CFTimeInterval)std::max(msDebounce, msMaxLatency)) / 1000.0)
+    {
+        //Shared with the run-loop timer, so that it can outlive this struct
+        _pRunLoopCtx = new RUNLOOP_CTX;
+        _pRunLoopCtx->pThis = this;
+    }
+
+    ~WakeTimerDebounced()
+    {
+        //Wait for the run-loop timer callback, if it's running on another thread, and don't let it call us anymore
+        //INFO: Its callout may have already started, so the context that it gets is not freed until the timer is.
+        if(true)
+        {
+            WRITER_LOCK wrl(_pRunLoopCtx->lock);
+
+            _pRunLoopCtx->pThis = nullptr;
+        }
+
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            _setRunLoopTimer(0);
+        }
+
+        _releaseRunLoopCtx(_pRunLoopCtx);
+        _pRunLoopCtx = nullptr;
+    }
+
+
+    ///Set wake event as the relative time from the current moment
+    ///INFO: It only remembers the time. It will be set in the OS after it didn't change for the debounce interval,
+    ///      or when flush() is called.
+    ///'msFromNow' = number of ms from "now" to wake the system
+    void setWakeEventRelative(UInt32 msFromNow)
+    {
+        CFAbsoluteTime dtWhen = CFAbsoluteTimeGetCurrent() + ((CFTimeInterval)msFromNow) / 1000.0;
+
+        _setDesired(true, dtWhen);
+    }
+
+    ///Set wake event as the absolute time
+    ///INFO: It only remembers the time. It will be set in the OS after it didn't change for the debounce interval,
+    ///      or when flush() is called.
+    ///'dtWake' = UTC date/time when to set this wake event
+    void setWakeEventAbsolute(CFAbsoluteTime dtWake)
+    {
+        _setDesired(true, dtWake);
+    }
+
+    ///Stop wake event
+    ///INFO: It only remembers it. The OS event will be removed after the debounce interval, or when flush() is called.
+    void stopWakeEvent()
+    {
+        _setDesired(false, 0);
+    }
+
+
+    ///Set the last requested wake time in the OS right away, if it wasn't set yet
+    ///INFO: There's no need to call it on kIOMessageSystemWillSleep, as the run-loop timer sets it within
+    ///      the debounce interval (or the max latency). Don't call it before acknowledging that notification, as it calls the OS.
+    ///RETURN:
+    ///     = true if no errors
+    bool flush()
+    {
+        FLUSH fl;
+
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            fl = _planFlush();
+        }
+
+        //Talk to the OS outside of the lock
+        return _applyFlush(fl);
+    }
+
+
+    ///Get the last requested wake time (that may not be set in the OS yet)
+    ///'pdtOutWhen' = if not 0, receives UTC date/time of the requested wake event, or 0 if it was stopped
+    ///RETURN:
+    ///     = true if the wake event was requested
+    bool getDesiredWakeTime(CFAbsoluteTime* pdtOutWhen = nullptr)
+    {
+        bool bSet;
+        CFAbsoluteTime dtWhen;
+
+        if(true)
+        {
+            //Act from within a lock
+            READER_LOCK rdl(_lock);
+
+            bSet = _bDesiredSet;
+            dtWhen = _dtDesired;
+        }
+
+        if(pdtOutWhen)
+            *pdtOutWhen = bSet ? dtWhen : 0;
+
+        return bSet;
+    }
+
+
+    ///Get statistics
+    ///'pszOutRequests' = if not 0, receives the number of set/stop requests made through this struct
+    ///'pszOutOSCalls' = if not 0, receives the number of times the OS was called for them
+    ///RETURN:
+    ///     = Number of OS calls that were saved
+    size_t getStats(size_t* pszOutRequests = nullptr,
+                    size_t* pszOutOSCalls = nullptr)
+    {
+        READER_LOCK rdl(_lock);
+
+        if(pszOutRequests)
+            *pszOutRequests = _szcRequests;
+        if(pszOutOSCalls)
+            *pszOutOSCalls = _szcOSCalls;
+
+        return _szcRequests - _szcOSCalls;
+    }
+
+
+
+private:
+
+    ///What _planFlush() decided to set in the OS
+    struct FLUSH
+    {
+        UInt64 nVer = 0;                        //Version of this request, or 0 if the OS doesn't need to be called
+        bool bSet = false;                      //true to set the OS wake event for 'dtWhen', false to stop it
+        CFAbsoluteTime dtWhen = 0;              //UTC date/time for the OS wake event
+    };
+
+
+    void _setDesired(bool bSet,
+                     CFAbsoluteTime dtWhen)
+    {
+        FLUSH fl;
+
+        if(true)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            _szcRequests++;
+
+            CFAbsoluteTime dtNow = CFAbsoluteTimeGetCurrent();
+
+            _bDesiredSet = bSet;
+            _dtDesired = bSet ? dtWhen : 0;
+
+            if(!_bDirty)
+            {
+                _bDirty = true;
+                _dtDirtySince = dtNow;
+            }
+
+            //Restart the debounce interval, but don't go past the max latency
+            CFAbsoluteTime dtFlush = std::min(dtNow + _fDebounceSec,
+                                              _dtDirtySince + _fMaxLatencySec);
+
+            if((bSet && dtWhen - dtNow <= _fDebounceSec) ||
+               dtFlush <= dtNow)
+            {
+                //It's too close to wait for it to settle
+                fl = _planFlush();
+            }
+            else
+            {
+                _setRunLoopTimer(dtFlush);
+            }
+        }
+
+        //Talk to the OS outside of the lock
+        if(!_applyFlush(fl))
+        {
+            //Failed - it will be retried
+            assert(false);
+        }
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Decide if the last requested wake time needs to be set in the OS
+    ///INFO: It does not talk to the OS - pass the result into _applyFlush() after releasing '_lock'.
+    ///RETURN:
+    ///     = What to set in the OS
+    FLUSH _planFlush()
+    {
+        FLUSH fl;
+
+        if(_bDirty)
+        {
+            if(_bDesiredSet != _bOSSet ||
+               (_bDesiredSet && _dtDesired != _dtOS))
+            {
+                _szcOSCalls++;
+
+                fl.nVer = ++_nVerRequested;
+                fl.bSet = _bDesiredSet;
+                fl.dtWhen = _dtDesired;
+            }
+            else
+            {
+                //Already in the OS
+                _bDirty = false;
+                _dtDirtySince = 0;
+            }
+        }
+
+        _setRunLoopTimer(0);
+
+        return fl;
+    }
+
+
+    ///IMPORTANT: Must be called without holding '_lock'!
+    ///Set the OS wake event as _planFlush() decided, and commit the result
+    ///INFO: If a newer request reached the OS already, this one is skipped. If it fails,
+    ///      it is tried again from the run-loop timer in WAKE_DEBOUNCE_RETRY_SEC.
+    ///'fl' = what _planFlush() returned
+    ///RETURN:
+    ///     = true if no errors
+    bool _applyFlush(const FLUSH& fl)
+    {
+        if(!fl.nVer)
+        {
+            //Nothing to do
+            return true;
+        }
+
+        bool bRes = true;
+        bool bApplied = false;
+
+        if(true)
+        {
+            WRITER_LOCK wrl(_lockIPC);
+
+            if(fl.nVer > _nVerApplied)
+            {
+                bRes = fl.bSet ? _wakeTimer.setWakeEventAbsolute(fl.dtWhen) :
+                                 _wakeTimer.stopWakeEvent();
+
+                _nVerApplied = fl.nVer;
+                bApplied = true;
+            }
+        }
+
+        if(bApplied)
+        {
+            //Act from within a lock
+            WRITER_LOCK wrl(_lock);
+
+            if(bRes)
+            {
+                if(fl.nVer > _nVerCommitted)
+                {
+                    _nVerCommitted = fl.nVer;
+
+                    _bOSSet = fl.bSet;
+                    _dtOS = fl.dtWhen;
+                }
+
+                if(_bDesiredSet == fl.bSet &&
+                   _dtDesired == fl.dtWhen)
+                {
+                    //Nothing new was requested meanwhile
+                    _bDirty = false;
+                    _dtDirtySince = 0;
+                }
+            }
+            else if(fl.nVer == _nVerRequested)
+            {
+                //Failed - try again later (it stays dirty)
+                _setRunLoopTimer(CFAbsoluteTimeGetCurrent() + WAKE_DEBOUNCE_RETRY_SEC);
+            }
+        }
+
+        return bRes;
+    }
+
+
+    ///IMPORTANT: Must be called from within a lock!
+    ///Set run-loop timer to fire at 'dtWhen'
+    ///'dtWhen' = UTC date/time, or 0 to stop the run-loop timer
+    void _setRunLoopTimer(CFAbsoluteTime dtWhen)
+    {
+        if(dtWhen)
+        {
+            if(!_refRunLoopTmr)
+            {
+                CFRunLoopTimerContext ctx = {};
+                ctx.info = _pRunLoopCtx;
+                ctx.retain = _retainRunLoopCtx;
+                ctx.release = _releaseRunLoopCtx;
+
+                _refRunLoopTmr = CFRunLoopTimerCreate(kCFAllocatorDefault,
+                                                      dtWhen,
+                                                      WAKE_DEBOUNCE_RUNLOOP_INTERVAL,
+                                                      0,
+                                                      0,
+                                                      _onRunLoopTimer,
+                                                      &ctx);
+                if(_refRunLoopTmr)
+                {
+                    CFRunLoopAddTimer(CFRunLoopGetMain(),
+                                      _refRunLoopTmr,
+                                      kCFRunLoopCommonModes);
+                }
+                else
+                {
+                    //Failed
+                    assert(false);
+                }
+            }
+            else
+            {
+                CFRunLoopTimerSetNextFireDate(_refRunLoopTmr, dtWhen);
+            }
+        }
+        else if(_refRunLoopTmr)
+        {
+            CFRunLoopTimerInvalidate(_refRunLoopTmr);
+            CFRelease(_refRunLoopTmr);
+            _refRunLoopTmr = nullptr;
+        }
+    }
+
+
+    static void _onRunLoopTimer(CFRunLoopTimerRef timer,
+                                void* info)
+    {
+        UNREFERENCED_PARAMETER(timer);
+
+        RUNLOOP_CTX* pCtx = (RUNLOOP_CTX*)info;
+        assert(pCtx);
+
+        //Our destructor waits for this lock
+        WRITER_LOCK wrl(pCtx->lock);
+
+        if(pCtx->pThis)
+        {
+            //Debounce interval passed without changes
+            if(!pCtx->pThis->flush())
+            {
+                //Failed - it will be retried
+                assert(false);
+            }
+        }
+    }
+
+
+    ///Context of the run-loop timer, that is reference-counted by it
+    struct RUNLOOP_CTX
+    {
+        RDR_WRTR lock;                              //Held while the run-loop timer callback runs, and when 'pThis' is reset
+        WakeTimerDebounced* pThis = nullptr;        //Owner of the run-loop timer, or 0 after it was destroyed
+        std::atomic<int> nRefs{1};                  //Number of references (the owner holds one)
+    };
+
+    static const void* _retainRunLoopCtx(const void* info)
+    {
+        RUNLOOP_CTX* pCtx = (RUNLOOP_CTX*)info;
+        pCtx->nRefs++;
+
+        return info;
+    }
+
+    static void _releaseRunLoopCtx(const void* info)
+    {
+        RUNLOOP_CTX* pCtx = (RUNLOOP_CTX*)info;
+        if(--pCtx->nRefs == 0)
+        {
+            delete pCtx;
+        }
+    }
+
+
+
+private:
+    ///Copy constructor and assignments are NOT available!
+    WakeTimerDebounced(const WakeTimerDebounced& s) = delete;
+    WakeTimerDebounced& operator = (const WakeTimerDebounced& s) = delete;
+
+private:
+
+    RDR_WRTR _lock;                                 //Lock for accessing this struct
+    RDR_WRTR _lockIPC;                              //Lock that serializes calls into '_wakeTimer' (always used as a writer)
+                                                    //IMPORTANT: Never acquire '_lock' while holding this lock!
+
+    WakeTimer& _wakeTimer;                          //Wake timer that we set in the OS
+    CFTimeInterval _fDebounceSec;                   //Debounce interval in sec
+    CFTimeInterval _fMaxLatencySec;                 //Max time in sec that a request may wait before it's set in the OS
+
+    bool _bDesiredSet = false;                      //true if wake event was requested for '_dtDesired'
+    CFAbsoluteTime _dtDesired = 0;                  //UTC date/time of the last requested wake event
+    bool _bDirty = false;                           //true if the last request was not pushed to the OS yet
+    CFAbsoluteTime _dtDirtySince = 0;               //UTC date/time when '_bDirty' was set
+
+    bool _bOSSet = false;                           //true if wake event is set in the OS for '_dtOS'
+    CFAbsoluteTime _dtOS = 0;                       //UTC date/time of the wake event in the OS
+
+    UInt64 _nVerRequested = 0;                      //Version of the last request to the OS (accessed within '_lock')
+    UInt64 _nVerCommitted = 0;                      //Version of the request that '_bOSSet' and '_dtOS' reflect (accessed within '_lock')
+    UInt64 _nVerApplied = 0;                        //Version of the last request that reached the OS (accessed within '_lockIPC')
+
+    CFRunLoopTimerRef _refRunLoopTmr = nullptr;     //Run-loop timer for the end of the debounce interval
+    RUNLOOP_CTX* _pRunLoopCtx = nullptr;            //Context for '_refRunLoopTmr' (it may outlive this struct)
+
+    size_t _szcRequests = 0;                        //Number of set/stop requests
+    size_t _szcOSCalls = 0;                         //Number of times we called the OS
+};
+
+
+
+
+#endif /* wake_timer_debounce_h */
@@ -0,0 +1,321 @@
+//
+//  pwr_evt_index_test.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Test of PwrEvtIndex against PwrEvtSource_Memory, with events that are changed behind its back,
+//  followed by a benchmark of lookups
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms. Build it with:
+//          c++ -std=c++20 -O2 -I"../macOS tips - part 2" pwr_evt_index_test.cpp -o pwr_evt_index_test
+//
+
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "pwr_evt_index.h"
+
+
+
+static size_t gszcTests = 0;
+static size_t gszcFailed = 0;
+
+
+///Count the result of one check, and output it if it failed
+static void check(bool bOK,
+                  const char* pstrWhat)
+{
+    gszcTests++;
+
+    if(!bOK)
+    {
+        printf("FAILED: %s\n", pstrWhat);
+        gszcFailed++;
+    }
+}
+
+
+///Schedule an event in 'src' as if another process did it
+static void scheduleExternal(PwrEvtSource_Memory& src,
+                             const char* pstrBundleID,
+                             const char* pstrEventType,
+                             double dtWhen)
+{
+    PWR_EVT evt;
+    evt.strBundleID = pstrBundleID;
+    evt.strEventType = pstrEventType;
+    evt.dtWhen = dtWhen;
+
+    src.scheduleEvent(evt);
+}
+
+
+///Cancel an event in 'src' as if the OS removed it after it fired
+static void removeExternal(PwrEvtSource_Memory& src,
+                           const char* pstrBundleID,
+                           const char* pstrEventType,
+                           double dtWhen)
+{
+    PWR_EVT evt;
+    evt.strBundleID = pstrBundleID;
+    evt.strEventType = pstrEventType;
+    evt.dtWhen = dtWhen;
+
+    src.cancelEvent(evt);
+}
+
+
+
+static void testIdentical()
+{
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+
+    //Identical events must be counted (and kept) as many times as the OS has them
+    scheduleExternal(src, "com.other.app", "wake", 1000.0);
+    scheduleExternal(src, "com.other.app", "wake", 1000.0);
+    scheduleExternal(src, "com.other.app", "wake", 999.0);
+
+    size_t szcAdded = 0;
+    size_t szcRemoved = 0;
+    idx.refresh(&szcAdded, &szcRemoved);
+
+    check(szcAdded == 3 && szcRemoved == 0, "identical: refresh adds all events");
+    check(idx.getCount() == 3, "identical: count");
+
+    double dtWhen = 0;
+    check(idx.findEvent("com.other.app", "wake", &dtWhen) && dtWhen == 999.0, "identical: earliest event is found");
+
+    //Removing one of the identical events must leave the other one
+    removeExternal(src, "com.other.app", "wake", 1000.0);
+
+    idx.refresh(&szcAdded, &szcRemoved);
+    check(szcAdded == 0 && szcRemoved == 1, "identical: refresh removes one event");
+    check(idx.getCount() == 2, "identical: count after removal");
+
+    size_t szcCanceled = 0;
+    check(idx.cancelEvents("com.other.app", "wake", szcCanceled) && szcCanceled == 2, "identical: cancel the rest");
+    check(idx.getCount() == 0, "identical: index is empty");
+}
+
+
+static void testCase()
+{
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+
+    check(idx.scheduleEvent("com.dennisbabkin.Wake01", "wake", 100.0), "case: schedule");
+
+    check(idx.findEvent("COM.DENNISBABKIN.WAKE01", "wake"), "case: ASCII letters are found in any case");
+    check(!idx.findEvent("com.dennisbabkin.wake01", "WAKE"), "case: event type is case-sensitive");
+    check(!idx.findEvent("com.dennisbabkin.wake0", "wake"), "case: prefix is not a match");
+
+    //Non-ASCII IDs from other processes are compared as they are
+    scheduleExternal(src, "com.other.\xC3\x84pp", "wake", 200.0);
+
+    std::vector<PWR_EVT> arrEvts;
+    check(idx.getEvents(arrEvts) && arrEvts.size() == 2, "case: non-ASCII event is in the index");
+    check(arrEvts.size() == 2 && arrEvts[0].strBundleID == "com.dennisbabkin.Wake01", "case: events are sorted");
+}
+
+
+static void testExternalChanges()
+{
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+
+    check(idx.scheduleEvent("com.dennisbabkin.wake01", "wake", 100.0), "external: schedule");
+    check(idx.findEvent("com.dennisbabkin.wake01", "wake"), "external: find");
+
+    //Event fired and the OS removed it - lookup must not return it
+    removeExternal(src, "com.dennisbabkin.wake01", "wake", 100.0);
+    check(!idx.findEvent("com.dennisbabkin.wake01", "wake"), "external: fired event is not found");
+
+    //Another process scheduled it - lookup must see it right away
+    scheduleExternal(src, "com.dennisbabkin.wake01", "wake", 300.0);
+
+    double dtWhen = 0;
+    check(idx.findEvent("com.dennisbabkin.wake01", "wake", &dtWhen) && dtWhen == 300.0, "external: new event is found");
+
+    //Another process moved it - cancel must remove the new one, and not fail on the old one
+    removeExternal(src, "com.dennisbabkin.wake01", "wake", 300.0);
+    scheduleExternal(src, "com.dennisbabkin.wake01", "wake", 400.0);
+
+    size_t szcCanceled = 0;
+    check(idx.cancelEvents("com.dennisbabkin.wake01", "wake", szcCanceled) && szcCanceled == 1, "external: moved event is canceled");
+
+    std::vector<PWR_EVT> arrEvts;
+    src.enumEvents(arrEvts);
+    check(arrEvts.empty(), "external: OS list is empty");
+
+    //Nothing to cancel is not an error
+    check(idx.cancelEvents("com.dennisbabkin.wake01", "wake", szcCanceled) && szcCanceled == 0, "external: cancel of nothing");
+}
+
+
+static void testTransaction()
+{
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+
+    scheduleExternal(src, "com.other.app", "wake", 10.0);
+    scheduleExternal(src, "com.other.app", "wake", 20.0);
+    scheduleExternal(src, "com.other.app", "poweron", 30.0);
+    scheduleExternal(src, "com.third.app", "wake", 40.0);
+
+    //Cancel one bundle and schedule it again in one transaction,
+    //and a schedule that is canceled later must never reach the OS
+    PwrEvtTxn txn;
+    size_t nCancel = txn.queueCancel("COM.OTHER.APP", "wake");
+    size_t nSched = txn.queueSchedule("com.other.app", "wake", 50.0);
+    size_t nSchedGone = txn.queueSchedule("com.temp.app", "wake", 60.0);
+    size_t nCancelTemp = txn.queueCancel("com.temp.app", "");
+
+    size_t szcSchedBefore = 0;
+    size_t szcEnumBefore = src.getCallCounts(&szcSchedBefore);
+
+    check(idx.commitTransaction(txn), "txn: commit");
+
+    size_t szcSched = 0;
+    size_t szcEnum = src.getCallCounts(&szcSched);
+
+    check(txn.getOp(nCancel).bResult && txn.getOp(nCancel).szcCanceled == 2, "txn: cancel result");
+    check(txn.getOp(nSched).bResult, "txn: schedule result");
+    check(txn.getOp(nSchedGone).bResult && txn.getOp(nCancelTemp).szcCanceled == 1, "txn: schedule that was canceled");
+    check(szcSched - szcSchedBefore == 1, "txn: only one schedule reached the OS");
+    check(szcEnum - szcEnumBefore == 1, "txn: one enumeration for the transaction");
+
+    //The index must still match the OS
+    size_t szcAdded = 0;
+    size_t szcRemoved = 0;
+    idx.refresh(&szcAdded, &szcRemoved);
+    check(szcAdded == 0 && szcRemoved == 0, "txn: index matches the OS");
+    check(idx.getCount() == 3, "txn: count");
+
+    double dtWhen = 0;
+    check(idx.findEvent("com.other.app", "wake", &dtWhen) && dtWhen == 50.0, "txn: rescheduled event");
+    check(idx.findEvent("com.other.app", "poweron"), "txn: other event type is kept");
+
+    //Transaction without cancellations doesn't need to enumerate
+    PwrEvtTxn txn2;
+    txn2.queueSchedule("com.third.app", "wake", 70.0);
+
+    szcEnumBefore = src.getCallCounts();
+    check(idx.commitTransaction(txn2, 1), "txn: commit schedules");
+    check(src.getCallCounts() == szcEnumBefore, "txn: schedules don't enumerate");
+}
+
+
+static void testPattern()
+{
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+
+    scheduleExternal(src, "com.dennisbabkin.wake01", "wake", 1.0);
+    scheduleExternal(src, "com.dennisbabkin.wake02", "wake", 2.0);
+    scheduleExternal(src, "com.dennisbabkin2.wake", "wake", 3.0);
+    scheduleExternal(src, "com.other.wake01", "wake", 4.0);
+
+    size_t szcCanceled = 0;
+    check(idx.cancelEventsByPattern(BundlePattern("com.dennisbabkin.*"), "", szcCanceled) && szcCanceled == 2, "pattern: prefix");
+    check(idx.cancelEventsByPattern(BundlePattern("*.wake01"), "wake", szcCanceled) && szcCanceled == 1, "pattern: suffix");
+    check(idx.getCount() == 1 && idx.findEvent("com.dennisbabkin2.wake", "wake"), "pattern: what is left");
+}
+
+
+static void benchmark()
+{
+    const size_t szcBundles = 200;
+    const size_t szcEvtsPerBundle = 5;
+    const size_t szcLookups = 2000;
+
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+
+    //Events that other processes scheduled, including identical ones
+    for(size_t b = 0; b < szcBundles; b++)
+    {
+        char buff[64];
+        snprintf(buff, sizeof(buff), "com.other.app%03zu", b);
+
+        for(size_t e = 0; e < szcEvtsPerBundle; e++)
+        {
+            //Last one is the same as the first one
+            scheduleExternal(src, buff, "wake", 1000.0 + (double)(e % 4));
+        }
+    }
+
+    idx.refresh();
+
+    auto fnLookups = [&](bool bChange)
+    {
+        size_t szcFound = 0;
+
+        auto tmStart = std::chrono::steady_clock::now();
+
+        for(size_t i = 0; i < szcLookups; i++)
+        {
+            char buff[64];
+            snprintf(buff, sizeof(buff), "com.other.app%03zu", i % szcBundles);
+
+            if(bChange)
+            {
+                //Another process changes the OS list between lookups
+                scheduleExternal(src, "com.changing.app", "wake", (double)i);
+            }
+
+            if(idx.findEvent(buff, "wake"))
+            {
+                szcFound++;
+            }
+        }
+
+        auto tmEnd = std::chrono::steady_clock::now();
+
+        check(szcFound == szcLookups, "benchmark: all events are found");
+
+        return std::chrono::duration<double, std::nano>(tmEnd - tmStart).count() / szcLookups;
+    };
+
+    size_t szcEnumBefore = src.getCallCounts();
+
+    double fNsSame = fnLookups(false);
+    double fNsChanged = fnLookups(true);
+
+    //Each lookup is reconciled with the OS
+    check(src.getCallCounts() == szcEnumBefore + szcLookups * 2, "benchmark: one enumeration per lookup");
+
+    printf("PwrEvtIndex: %zu events, findEvent=%.1f ns per call (OS list unchanged), %.1f ns per call (OS list changed)\n",
+           szcBundles * szcEvtsPerBundle,
+           fNsSame,
+           fNsChanged);
+}
+
+
+
+
+int main()
+{
+    testIdentical();
+    testCase();
+    testExternalChanges();
+    testTransaction();
+    testPattern();
+
+    printf("Tests: %zu, failed: %zu\n", gszcTests, gszcFailed);
+
+    benchmark();
+
+    return gszcFailed == 0 ? 0 : 1;
+}
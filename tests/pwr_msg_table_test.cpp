@@ -0,0 +1,167 @@
+//
+//  pwr_msg_table_test.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Test that dispatching sleep/wake messages through the table and handlers of the app (gkPwrMsgs),
+//  and encoding them with PwrEvtRecordEncoder, doesn't allocate any memory
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms. Build it with:
+//          c++ -std=c++20 -O2 -I"../macOS tips - part 2" pwr_msg_table_test.cpp -o pwr_msg_table_test
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <new>
+#include <atomic>
+
+#include "pwr_msg_handlers.h"
+#include "pwr_evt_record.h"
+
+
+
+
+//Count all allocations in this process
+static std::atomic<size_t> gnAllocs{0};
+
+void* operator new(size_t sz)
+{
+    gnAllocs++;
+
+    void* p = malloc(sz ? sz : 1);
+    if(!p)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void* operator new[](size_t sz)
+{
+    return operator new(sz);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+
+
+int main()
+{
+    const int nCntPasses = 100000;
+
+    //Messages in the order that the system sends them, with some that we don't handle
+    const uint32_t arrMsgTypes[] = {
+        kIOMessageCanSystemSleep,
+        kIOMessageSystemWillNotSleep,
+        kIOMessageCanSystemSleep,
+        kIOMessageSystemWillSleep,
+        kIOMessageSystemWillPowerOn,
+        kIOMessageSystemHasPoweredOn,
+        kIOMessageDeviceHasPoweredOff,
+        kIOMessageCanDevicePowerOff,
+        0x12345,                            //Unknown messages
+        0xE0000999,
+    };
+
+    size_t szcAcks = 0;
+    size_t szcVetoes = 0;
+    size_t szcAfterAck = 0;
+    size_t szcChars = 0;
+
+    PWR_SLEEP_STATE sleepState = PSS_Awake;
+
+    size_t szcAllocsBefore = gnAllocs;
+
+    for(int p = 0; p < nCntPasses; p++)
+    {
+        for(uint32_t nMsgType : arrMsgTypes)
+        {
+            //Same as callback_SleepWake() does
+            PWR_EVT_RECORD rec;
+            rec.stamp();
+            rec.source = PES_SleepWake;
+            rec.nMsgType = nMsgType;
+            rec.nStateBefore = sleepState;
+
+            const PWR_MSG_DESC<PWR_MSG_CTX>* pDesc = gkPwrMsgs.find(nMsgType);
+            if(pDesc)
+            {
+                PWR_MSG_CTX ctx = {nMsgType, nullptr, sleepState, true, PMA_None};
+
+                if(pDesc->pfnHandler)
+                {
+                    pDesc->pfnHandler(ctx);
+                }
+
+                if(pDesc->nTraits & PMT_AckRequired)
+                {
+                    if(ctx.bAllow ||
+                       !(pDesc->nTraits & PMT_Vetoable))
+                    {
+                        szcAcks++;
+                    }
+                    else
+                    {
+                        szcVetoes++;
+                    }
+                }
+
+                sleepState = ctx.state;
+
+                if(ctx.nAfterAck)
+                {
+                    szcAfterAck++;
+                }
+
+                rec.pstrMsgName = pDesc->pstrName;
+            }
+
+            rec.nStateAfter = sleepState;
+
+            char buff[PWR_EVT_JSON_MAX_LEN + 1];
+            szcChars += PwrEvtRecordEncoder::toJsonLine(rec, buff, sizeof(buff));
+        }
+
+        assert(sleepState == PSS_Awake);
+    }
+
+    size_t szcAllocs = gnAllocs - szcAllocsBefore;
+
+    //Sleep is always allowed, and flushing the log and firing timers is left until after the ack
+    assert(szcAcks == (size_t)nCntPasses * 3);
+    assert(szcVetoes == 0);
+    assert(szcAfterAck == (size_t)nCntPasses * 2);
+
+    printf("Dispatched %zu messages (%zu chars of JSON): %zu allocations\n",
+           (size_t)nCntPasses * (sizeof(arrMsgTypes) / sizeof(arrMsgTypes[0])),
+           szcChars,
+           szcAllocs);
+
+    return szcAllocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+//
+//  utf16_to_utf8_test.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Test of Utf16ToUtf8 against iconv, with random strings, followed by a benchmark of both
+//
+//  INFO: This file does not depend on CoreFoundation, so it can be built on other platforms. Build it with:
+//          c++ -std=c++20 -O2 -I"../macOS tips - part 2" utf16_to_utf8_test.cpp -o utf16_to_utf8_test
+//        (add -liconv on macOS, and -mavx2 or -mssse3 on x86-64 to test the SIMD paths)
+//
+
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <iconv.h>
+
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "utf16_to_utf8.h"
+
+
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TEST_UTF16_NATIVE "UTF-16LE"
+#else
+#define TEST_UTF16_NATIVE "UTF-16BE"
+#endif
+
+
+enum TEST_CHARS
+{
+    TC_Ascii,               //Only ASCII
+    TC_TwoBytes,            //Mostly ASCII with 2-byte chars
+    TC_ThreeBytes,          //Only 3-byte chars, ex: CJK
+    TC_Pairs,               //Only surrogate pairs, ex: emoji
+    TC_Mix,                 //All of the above
+
+    TC_Count
+};
+
+
+
+///Convert UTF-16 into UTF-8 with iconv
+///RETURN:
+///     = true if success
+///     = false if 'arrSrc' is not valid UTF-16
+static bool convertWithIconv(const std::vector<uint16_t>& arrSrc,
+                             std::string& strOut)
+{
+    bool bRes = false;
+
+    iconv_t hConv = iconv_open("UTF-8", TEST_UTF16_NATIVE);
+    if(hConv != (iconv_t)-1)
+    {
+        strOut.assign(Utf16ToUtf8::getMaxSize(arrSrc.size()) + 4, 0);
+
+        char* pIn = (char*)arrSrc.data();
+        size_t szcIn = arrSrc.size() * sizeof(uint16_t);
+        char* pOut = &strOut[0];
+        size_t szcOut = strOut.size();
+
+        if(iconv(hConv, &pIn, &szcIn, &pOut, &szcOut) != (size_t)-1)
+        {
+            strOut.resize(strOut.size() - szcOut);
+            bRes = true;
+        }
+
+        iconv_close(hConv);
+    }
+    else
+    {
+        //Failed
+        assert(false);
+    }
+
+    return bRes;
+}
+
+
+///Make a random UTF-16 string
+///'chars' = kind of chars to put into it
+///'szcLen' = length of the string in units
+static std::vector<uint16_t> makeString(std::mt19937& rng,
+                                        TEST_CHARS chars,
+                                        size_t szcLen)
+{
+    std::vector<uint16_t> arr(szcLen);
+
+    for(size_t i = 0; i < szcLen; i++)
+    {
+        TEST_CHARS c = chars == TC_Mix ? (TEST_CHARS)(rng() % TC_Mix) : chars;
+
+        switch(c)
+        {
+            case TC_Ascii:
+                arr[i] = rng() % 0x80;
+                break;
+
+            case TC_TwoBytes:
+                arr[i] = (rng() % 3) ? rng() % 0x80 : 0x80 + rng() % (0x800 - 0x80);
+                break;
+
+            case TC_ThreeBytes:
+                arr[i] = 0x800 + rng() % (0xD800 - 0x800);
+                break;
+
+            case TC_Pairs:
+                if(i + 1 < szcLen)
+                {
+                    arr[i] = 0xD800 + rng() % 0x400;
+                    arr[++i] = 0xDC00 + rng() % 0x400;
+                }
+                else
+                {
+                    arr[i] = 'x';
+                }
+                break;
+
+            default:
+                assert(false);
+                break;
+        }
+    }
+
+    return arr;
+}
+
+
+
+
+int main()
+{
+    std::mt19937 rng(1);
+
+    size_t szcTests = 0;
+    size_t szcFailed = 0;
+
+    //Compare with iconv
+    for(int t = 0; t < 20000; t++)
+    {
+        size_t szcLen = rng() % 100;
+        std::vector<uint16_t> arrSrc = makeString(rng, (TEST_CHARS)(t % TC_Count), szcLen);
+
+        if(t % 7 == 0 &&
+           szcLen)
+        {
+            //Possibly an unpaired surrogate
+            arrSrc[rng() % szcLen] = 0xD800 + rng() % 0x800;
+        }
+
+        std::string strRef;
+        bool bValid = convertWithIconv(arrSrc, strRef);
+
+        std::vector<char> arrOut(Utf16ToUtf8::getMaxSize(szcLen) + 1);
+        size_t szcOut = 0;
+
+        UTF_CONV_RES res = Utf16ToUtf8::convert(arrSrc.data(), szcLen, arrOut.data(), arrOut.size() - 1, &szcOut);
+        UTF_CONV_RES resScalar = Utf16ToUtf8::convertScalar(arrSrc.data(), szcLen, arrOut.data(), arrOut.size() - 1);
+
+        bool bOK;
+
+        if(bValid)
+        {
+            bOK = res == UCR_OK &&
+                  resScalar == UCR_OK &&
+                  strRef.compare(0, std::string::npos, arrOut.data(), szcOut) == 0;
+
+            if(bOK)
+            {
+                //Buffer of the exact size must be enough, and one less must not be
+                std::vector<char> arrExact(strRef.size());
+
+                if(Utf16ToUtf8::convert(arrSrc.data(), szcLen, arrExact.data(), arrExact.size(), &szcOut) != UCR_OK ||
+                   szcOut != strRef.size() ||
+                   (!strRef.empty() &&
+                    memcmp(arrExact.data(), strRef.data(), strRef.size()) != 0))
+                {
+                    bOK = false;
+                }
+
+                if(!strRef.empty() &&
+                   Utf16ToUtf8::convert(arrSrc.data(), szcLen, arrExact.data(), arrExact.size() - 1) != UCR_BUFF_TOO_SMALL)
+                {
+                    bOK = false;
+                }
+            }
+        }
+        else
+        {
+            bOK = res == UCR_BAD_SURROGATE &&
+                  resScalar == UCR_BAD_SURROGATE;
+        }
+
+        szcTests++;
+
+        if(!bOK)
+        {
+            if(szcFailed < 5)
+            {
+                printf("FAILED: test=%d, len=%zu, iconv=%d, result=%d\n", t, szcLen, bValid, res);
+            }
+
+            szcFailed++;
+        }
+    }
+
+    printf("Tests: %zu, failed: %zu\n", szcTests, szcFailed);
+
+    //Benchmark
+    static const char* pstrNames[TC_Count] = {
+        "ascii",
+        "2-byte mix",
+        "3-byte",
+        "surrogate pairs",
+        "random mix",
+    };
+
+    for(int c = 0; c < TC_Count; c++)
+    {
+        std::vector<uint16_t> arrSrc = makeString(rng, (TEST_CHARS)c, 1 << 20);
+        std::vector<char> arrOut(Utf16ToUtf8::getMaxSize(arrSrc.size()));
+
+        auto fnSec = [](std::chrono::steady_clock::duration dur)
+        {
+            return std::chrono::duration<double>(dur).count();
+        };
+
+        double fBestScalar = 1e9;
+        double fBest = 1e9;
+        double fBestIconv = 1e9;
+
+        for(int r = 0; r < 5; r++)
+        {
+            std::string strRef;
+
+            auto tm0 = std::chrono::steady_clock::now();
+            Utf16ToUtf8::convertScalar(arrSrc.data(), arrSrc.size(), arrOut.data(), arrOut.size());
+
+            auto tm1 = std::chrono::steady_clock::now();
+            Utf16ToUtf8::convert(arrSrc.data(), arrSrc.size(), arrOut.data(), arrOut.size());
+
+            auto tm2 = std::chrono::steady_clock::now();
+            convertWithIconv(arrSrc, strRef);
+
+            auto tm3 = std::chrono::steady_clock::now();
+
+            fBestScalar = std::min(fBestScalar, fnSec(tm1 - tm0));
+            fBest = std::min(fBest, fnSec(tm2 - tm1));
+            fBestIconv = std::min(fBestIconv, fnSec(tm3 - tm2));
+        }
+
+        double fGB = (double)(arrSrc.size() * sizeof(uint16_t)) / 1e9;
+
+        printf("%-16s scalar=%.2f GB/s, convert=%.2f GB/s, iconv=%.2f GB/s\n",
+               pstrNames[c],
+               fGB / fBestScalar,
+               fGB / fBest,
+               fGB / fBestIconv);
+    }
+
+    return szcFailed == 0 ? 0 : 1;
+}
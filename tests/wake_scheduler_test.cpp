@@ -0,0 +1,134 @@
+//
+//  wake_scheduler_test.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Test that logical timers of WakeScheduler with tolerance windows share physical wakes,
+//  and that only the earliest one of them is set in the OS
+//
+//  INFO: It doesn't touch the OS wake events - they are kept in memory with PwrEvtSource_Memory. Build it with:
+//          c++ -std=c++20 -O2 -I"../macOS tips - part 2" wake_scheduler_test.cpp -o wake_scheduler_test -framework CoreFoundation -framework IOKit
+//
+
+
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+#include <vector>
+
+#include "types.h"
+#include "wake_scheduler.h"
+
+
+
+static size_t gszcTests = 0;
+static size_t gszcFailed = 0;
+
+
+///Count the result of one check, and output it if it failed
+static void check(bool bOK,
+                  const char* pstrWhat)
+{
+    gszcTests++;
+
+    if(!bOK)
+    {
+        printf("FAILED: %s\n", pstrWhat);
+        gszcFailed++;
+    }
+}
+
+
+///Check that 'dt' is 'fSec' seconds from 'dtNow' (give or take the time it took to get here)
+static bool isAbout(CFAbsoluteTime dt,
+                    CFAbsoluteTime dtNow,
+                    double fSec)
+{
+    return fabs(dt - dtNow - fSec) < 1.0;
+}
+
+
+
+
+int main()
+{
+    //Don't touch the OS - use events in memory
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+    WakeTimer wkTmr("com.dennisbabkin.wake-test", &idx);
+
+    static size_t s_szcFired = 0;
+
+    if(true)
+    {
+        WakeScheduler wkSched(wkTmr);
+
+        CFAbsoluteTime dtNow = CFAbsoluteTimeGetCurrent();
+
+        //Add several logical timers - only the earliest one is set in the OS
+        //INFO: Each timer may fire up to 60 seconds late, so that they can share physical wakes
+        static const UInt32 kDelaysSec[] = { 30, 45, 60, 120, 300 };
+
+        for(int i = 0; i < SIZEOF(kDelaysSec); i++)
+        {
+            check(wkSched.addTimerRelative(kDelaysSec[i] * 1000,
+                                           [](UInt64 nTimerID, CFAbsoluteTime dtWhen, const void* pParam1, const void* pParam2)
+                                           {
+                                               s_szcFired++;
+                                           },
+                                           nullptr,
+                                           nullptr,
+                                           60 * 1000) != 0, "add timer");
+        }
+
+        check(wkSched.getTimerCount() == SIZEOF(kDelaysSec), "timer count");
+
+        //Windows [30-90], [45-105], [60-120] are served by one wake, and [120-180], [300-360] by their own
+        std::vector<CFAbsoluteTime> arrWakes;
+        size_t szcSaved = wkSched.getWakePlan(&arrWakes);
+
+        check(szcSaved == 2, "wakes saved");
+        check(arrWakes.size() == 3 &&
+              isAbout(arrWakes[0], dtNow, 90) &&
+              isAbout(arrWakes[1], dtNow, 180) &&
+              isAbout(arrWakes[2], dtNow, 360), "wake plan");
+
+        //Only the earliest deadline is set in the OS
+        CFAbsoluteTime dtWhen = 0;
+        check(wkSched.getNextWakeTime(&dtWhen) && isAbout(dtWhen, dtNow, 90), "next wake time");
+
+        std::vector<PWR_EVT> arrEvts;
+        src.enumEvents(arrEvts);
+        check(arrEvts.size() == 1 && isAbout(arrEvts[0].dtWhen, dtNow, 90), "one OS wake event");
+
+        //Nothing is due yet
+        check(wkSched.fireDueTimers() == 0 && s_szcFired == 0, "nothing fires early");
+
+        //Timer that is already due fires and leaves the rest in place
+        check(wkSched.addTimerWindow(dtNow - 10, dtNow + 10, nullptr) != 0, "add due timer");
+        check(wkSched.fireDueTimers() == 1, "due timer fires");
+        check(wkSched.getTimerCount() == SIZEOF(kDelaysSec), "timer count after firing");
+        check(wkSched.getNextWakeTime(&dtWhen) && isAbout(dtWhen, dtNow, 90), "next wake time after firing");
+
+        printf("Scheduled %zu logical timers in %zu wakes (%zu saved)\n",
+               wkSched.getTimerCount(),
+               arrWakes.size(),
+               szcSaved);
+    }
+
+    //Scheduler without a store removes the OS wake event when it's destroyed
+    std::vector<PWR_EVT> arrEvts;
+    src.enumEvents(arrEvts);
+    check(arrEvts.empty(), "OS wake event is removed");
+
+    printf("Tests: %zu, failed: %zu\n", gszcTests, gszcFailed);
+
+    return gszcFailed == 0 ? 0 : 1;
+}
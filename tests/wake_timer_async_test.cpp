@@ -0,0 +1,105 @@
+//
+//  wake_timer_async_test.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Test that a wake timer that is rescheduled many times with WakeTimerAsync ends up
+//  with the last request in the OS, and that the requests before it may be merged into it
+//
+//  INFO: It doesn't touch the OS wake events - they are kept in memory with PwrEvtSource_Memory. Build it with:
+//          c++ -std=c++20 -O2 -I"../macOS tips - part 2" wake_timer_async_test.cpp -o wake_timer_async_test -framework CoreFoundation -framework IOKit
+//
+
+
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+#include <vector>
+#include <future>
+
+#include "types.h"
+#include "wake_timer_async.h"
+
+
+
+static size_t gszcTests = 0;
+static size_t gszcFailed = 0;
+
+
+///Count the result of one check, and output it if it failed
+static void check(bool bOK,
+                  const char* pstrWhat)
+{
+    gszcTests++;
+
+    if(!bOK)
+    {
+        printf("FAILED: %s\n", pstrWhat);
+        gszcFailed++;
+    }
+}
+
+
+
+
+int main()
+{
+    //Don't touch the OS - use events in memory
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+    WakeTimer wkTmr("com.dennisbabkin.wake-test", &idx);
+
+    WakeTimerAsync wta;
+
+    CFAbsoluteTime dtNow = CFAbsoluteTimeGetCurrent();
+
+    //Reschedule it several times - only the last request must stay in the OS
+    std::vector<std::future<WAKE_ASYNC_RESULT>> arrFtrs;
+    for(int i = 1; i <= 10; i++)
+    {
+        arrFtrs.push_back(wta.setWakeEventRelativeAsync(wkTmr, i * 60 * 1000));
+    }
+
+    WAKE_ASYNC_RESULT war = arrFtrs.back().get();
+    wta.flush();
+
+    check(war.res == WAR_OK && fabs(war.dtWhen - dtNow - 600) < 1.0, "last request is set");
+
+    for(size_t i = 0; i + 1 < arrFtrs.size(); i++)
+    {
+        WAKE_ASYNC_RES res = arrFtrs[i].get().res;
+        check(res == WAR_OK || res == WAR_SUPERSEDED, "earlier request is set or superseded");
+    }
+
+    size_t szcSubmitted, szcSuperseded;
+    size_t szcExecuted = wta.getStats(&szcSubmitted, &szcSuperseded);
+
+    check(szcSubmitted == 10 && szcExecuted + szcSuperseded == szcSubmitted, "stats");
+
+    std::vector<PWR_EVT> arrEvts;
+    src.enumEvents(arrEvts);
+    check(arrEvts.size() == 1 && arrEvts[0].dtWhen == war.dtWhen, "one OS wake event");
+
+    //New requests restart the worker after it was stopped
+    wta.stop(true);
+    check(wta.stopWakeEventAsync(wkTmr).get().res == WAR_OK, "stop after restart");
+
+    src.enumEvents(arrEvts);
+    check(arrEvts.empty(), "OS wake event is removed");
+
+    printf("Async wake timer: submitted=%zu, superseded=%zu, sent to OS=%zu\n",
+           szcSubmitted,
+           szcSuperseded,
+           szcExecuted);
+
+    printf("Tests: %zu, failed: %zu\n", gszcTests, gszcFailed);
+
+    return gszcFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+//
+//  wake_timer_store_test.cpp
+//  macOS tips - part 2
+//
+//  Created by dennisbabkin.com on 6/17/23.
+//
+//  This project is a part of the blog post.
+//  For more details, check:
+//
+//      https://dennisbabkin.com/blog/?i=AAA11500
+//
+//  Test that logical wake timers that are kept in a TimerStore are restored by the next run,
+//  without setting the OS wake event again
+//
+//  INFO: It doesn't touch the OS wake events - they are kept in memory with PwrEvtSource_Memory. Build it with:
+//          c++ -std=c++20 -O2 -I"../macOS tips - part 2" wake_timer_store_test.cpp -o wake_timer_store_test -framework CoreFoundation -framework IOKit
+//
+
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "wake_scheduler.h"
+
+
+
+static size_t gszcTests = 0;
+static size_t gszcFailed = 0;
+
+
+///Count the result of one check, and output it if it failed
+static void check(bool bOK,
+                  const char* pstrWhat)
+{
+    gszcTests++;
+
+    if(!bOK)
+    {
+        printf("FAILED: %s\n", pstrWhat);
+        gszcFailed++;
+    }
+}
+
+
+
+
+int main()
+{
+    const char* pstrPath = "/tmp/com.dennisbabkin.wake-test.timers";
+    const char* pstrBundleID = "com.dennisbabkin.wake-test";
+
+    unlink(pstrPath);
+    unlink((std::string(pstrPath) + TIMER_STORE_DAMAGED_SUFFIX).c_str());
+
+    //Don't touch the OS - use events in memory (that outlive both runs, as in the OS)
+    PwrEvtSource_Memory src;
+    PwrEvtIndex idx(&src);
+
+    auto pfnCallback = [](UInt64 nTimerID, CFAbsoluteTime dtWhen, const void* pParam1, const void* pParam2)
+    {
+    };
+
+    CFAbsoluteTime dtWakeFirst = 0;
+
+    if(true)
+    {
+        //First run
+        TimerStore store;
+        check(store.open(pstrPath), "first run: open store");
+
+        WakeTimer wkTmr(pstrBundleID, &idx, &store);
+        WakeScheduler wkSched(wkTmr, &store);
+
+        check(wkSched.restoreTimers(pfnCallback) == 0, "first run: nothing to restore");
+
+        check(wkSched.addTimerRelative(10 * 60 * 1000, pfnCallback) != 0, "first run: add timer");
+        check(wkSched.addTimerRecurring("0 4 * * *", pfnCallback) != 0, "first run: add recurring timer");
+
+        check(wkTmr.getWakeEventInfo(&dtWakeFirst) && dtWakeFirst != 0, "first run: wake event is set");
+    }
+
+    //Logical timers and the OS wake event must be left in place
+    std::vector<PWR_EVT> arrEvts;
+    src.enumEvents(arrEvts);
+    check(arrEvts.size() == 1 && arrEvts[0].dtWhen == dtWakeFirst, "OS wake event is kept");
+
+    if(true)
+    {
+        //Second run
+        TimerStore store;
+        check(store.open(pstrPath), "second run: open store");
+
+        size_t szcSchedBefore = 0;
+        size_t szcCancelBefore = 0;
+        src.getCallCounts(&szcSchedBefore, &szcCancelBefore);
+
+        WakeTimer wkTmr(pstrBundleID, &idx, &store);
+        WakeScheduler wkSched(wkTmr, &store);
+
+        //Wake event is known before the OS is asked about it
+        CFAbsoluteTime dtWake = 0;
+        check(wkTmr.getWakeEventInfo(&dtWake) && dtWake == dtWakeFirst, "second run: wake event is restored");
+
+        check(wkSched.restoreTimers(pfnCallback) == 2, "second run: timers are restored");
+        check(wkSched.getTimerCount() == 2, "second run: timer count");
+
+        size_t szcSched = 0;
+        size_t szcCancel = 0;
+        src.getCallCounts(&szcSched, &szcCancel);
+        check(szcSched == szcSchedBefore && szcCancel == szcCancelBefore, "second run: OS wake event is not set again");
+
+        //Clean up after the test
+        check(wkSched.removeAllTimers(), "second run: remove all timers");
+    }
+
+    src.enumEvents(arrEvts);
+    check(arrEvts.empty(), "OS wake event is removed");
+
+    unlink(pstrPath);
+
+    printf("Tests: %zu, failed: %zu\n", gszcTests, gszcFailed);
+
+    return gszcFailed == 0 ? 0 : 1;
+}